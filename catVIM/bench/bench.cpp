@@ -0,0 +1,361 @@
+// catVIM micro-benchmarks (make bench)
+//
+// Times the pieces of a frame: Renderer::flush for full repaints, scrolls
+// and single-cell changes at several terminal sizes, set_string, set_line
+// over ASCII and mixed-script text, InputParser::parse over recorded key
+// and mouse streams, and (through bench/bench.lua) syntax highlighting and
+// State:render in the real Lua code. Each result is the mean over enough
+// runs to fill --time ms:
+//
+//   ns/op       wall time per operation
+//   bytes/op    terminal output per operation (frames only)
+//   allocs/op   C++ heap allocations per operation
+//   lua_kb/op   Lua heap growth per operation, with the collector stopped
+//
+// Usage: bench [--json] [--time ms] [filter]
+// --json prints one JSON object per line, for comparing builds.
+#include "lua_bindings.hpp"
+#include "input.hpp"
+#include "renderer.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <new>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace catvim;
+
+// Every operator new in the process goes through here
+static std::atomic<size_t> g_allocs{0};
+
+void* operator new(size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+struct Options {
+    bool json = false;
+    double time_ms = 200;
+    std::string filter;
+};
+
+Options g_options;
+FILE* g_out = stdout;  // Results; fd 1 itself is taken over by frame output
+int g_frames_fd = -1;  // Where catvim.render.flush() writes during Lua benchmarks
+
+struct Sample {
+    double ns;
+    double bytes;
+    double allocs;
+    double lua_kb;
+};
+
+static void report(const std::string& name, const Sample& s) {
+    if (g_options.json) {
+        fprintf(g_out, "{\"name\":\"%s\",\"ns_per_op\":%.1f,\"bytes_per_op\":%.1f,"
+                       "\"allocs_per_op\":%.2f,\"lua_kb_per_op\":%.3f}\n",
+                name.c_str(), s.ns, s.bytes, s.allocs, s.lua_kb);
+    } else {
+        fprintf(g_out, "%-32s %12.1f %12.1f %10.2f %10.3f\n", name.c_str(), s.ns, s.bytes, s.allocs, s.lua_kb);
+    }
+    fflush(g_out);
+}
+
+static bool selected(const std::string& name) {
+    return g_options.filter.empty() || name.find(g_options.filter) != std::string::npos;
+}
+
+// Runs op() in growing batches until a batch takes --time ms, and returns
+// the per-op averages of that batch. op() returns the bytes it emitted.
+static Sample measure(const std::function<size_t()>& op) {
+    using clock = std::chrono::steady_clock;
+    for (int i = 0; i < 3; i++) op();  // Warm up caches and reused buffers
+
+    for (size_t n = 1;; n *= 2) {
+        size_t bytes = 0;
+        size_t allocs = g_allocs.load(std::memory_order_relaxed);
+        auto start = clock::now();
+        for (size_t i = 0; i < n; i++) bytes += op();
+        double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+        allocs = g_allocs.load(std::memory_order_relaxed) - allocs;
+        if (ns >= g_options.time_ms * 1e6 || n >= (size_t(1) << 30)) {
+            return {ns / n, double(bytes) / n, double(allocs) / n, 0};
+        }
+    }
+}
+
+static void run(const std::string& name, const std::function<size_t()>& op) {
+    if (selected(name)) report(name, measure(op));
+}
+
+// Renderer
+
+const int SIZES[][2] = {{80, 24}, {200, 60}, {400, 120}};
+
+static std::string size_name(int w, int h) {
+    return std::to_string(w) + "x" + std::to_string(h);
+}
+
+// Source-like text for row `n`: indentation, words and punctuation
+static std::string sample_line(int n, int width) {
+    static const char* words[] = {"static", "int", "render_row", "(", "y", ",", "editor_x", ")",
+                                  "return", "cursor", "->", "line", ";", "if", "{", "}", "0x1f"};
+    std::string line(static_cast<size_t>(n % 4) * 4, ' ');
+    for (int i = 0; static_cast<int>(line.size()) < width - 12; i++) {
+        line += words[(n * 7 + i * 3) % 17];
+        line += ' ';
+    }
+    return line;
+}
+
+// Paints row y of a screen showing document line `n`: a gutter, the text
+// and a couple of styled spans, the way the editor draws a buffer row
+static void paint_row(Renderer& r, int y, int n, const std::vector<std::string>& doc, const StyleId* styles) {
+    int w = r.width();
+    char gutter[16];
+    snprintf(gutter, sizeof(gutter), "%3d ", n % 1000);
+    r.set_string(0, y, gutter, styles[0]);
+    r.set_line(4, y, doc[n % doc.size()], w - 4);
+    r.style_span(4 + (n % 4) * 4, y, 6, styles[1]);
+    r.style_span(20, y, 10 + n % 5, styles[2]);
+}
+
+static void renderer_benchmarks() {
+    for (const auto& size : SIZES) {
+        int w = size[0], h = size[1];
+        std::string dims = size_name(w, h);
+        Renderer r;
+        r.resize(w, h);
+        std::vector<std::string> doc;
+        for (int n = 0; n < 2048; n++) doc.push_back(sample_line(n, w - 4));
+        StyleId styles[3] = {
+            r.intern_style({Color::RGB(90, 90, 110), Color::Default(), Attr::NONE}),
+            r.intern_style({Color::RGB(200, 120, 250), Color::Default(), Attr::BOLD}),
+            r.intern_style({Color::RGB(120, 220, 120), Color::Default(), Attr::NONE}),
+        };
+
+        // Every cell changes: alternate between two unrelated screens
+        int frame = 0;
+        run("flush/full/" + dims, [&]() {
+            frame++;
+            for (int y = 0; y < h; y++) paint_row(r, y, y + (frame & 1) * 1000, doc, styles);
+            return r.flush().size();
+        });
+
+        // The document moves up one line per frame
+        int top = 0;
+        run("flush/scroll/" + dims, [&]() {
+            top++;
+            for (int y = 0; y < h; y++) paint_row(r, y, top + y, doc, styles);
+            return r.flush().size();
+        });
+
+        // One cell toggles; nothing else is touched
+        int tick = 0;
+        run("flush/cell/" + dims, [&]() {
+            tick++;
+            r.set_cell(w / 2, h / 2, (tick & 1) ? U'x' : U'o', styles[tick & 1]);
+            return r.flush().size();
+        });
+
+        // A whole row of text
+        std::string row = sample_line(7, w);
+        row.resize(w, ' ');
+        int y = 0;
+        run("set_string/" + dims, [&]() {
+            r.set_string(0, y, row, styles[1]);
+            y = (y + 1) % h;
+            return size_t(0);
+        });
+        run("set_line/ascii/" + dims, [&]() {
+            r.set_line(0, y, row, w);
+            y = (y + 1) % h;
+            return size_t(0);
+        });
+
+        // A log line mixing accents, CJK and emoji into ASCII runs
+        std::string mixed;
+        while (static_cast<int>(mixed.size()) < w * 2) mixed += "12:04:55 naïve café — 日本語のログ 🎉 ok ";
+        run("set_line/mixed/" + dims, [&]() {
+            r.set_line(0, y, mixed, w);
+            y = (y + 1) % h;
+            return size_t(0);
+        });
+        r.flush();
+    }
+}
+
+// Input
+
+// One op parses the next event of the stream, starting over at its end
+static void parse_benchmark(const std::string& name, const std::string& stream) {
+    InputParser parser;
+    std::string_view rest;
+    Event ev;
+    size_t consumed;
+    run(name, [&]() {
+        if (rest.empty()) rest = stream;
+        while (!rest.empty()) {
+            bool got = parser.parse(rest, ev, consumed);
+            rest.remove_prefix(consumed ? consumed : 1);
+            if (got) break;
+        }
+        return size_t(0);
+    });
+}
+
+static void input_benchmarks() {
+    // Typing in insert mode, with cursor keys, Escape, Ctrl keys and
+    // function keys mixed in
+    std::string keys;
+    const char* text = "local function render_row(y, x) return x + y end";
+    for (int i = 0; i < 50; i++) {
+        keys += text;
+        keys += "\x1b[A\x1b[B\x1b[C\x1b[D";
+        keys += "\x1b[1;5C\x1b[3~\x1b[5~\x1bOP\x17\x15\r";
+        keys += "\x1b" "d";  // Alt+d
+    }
+    parse_benchmark("parse/keys", keys);
+
+    // SGR mouse reports: a drag across the screen, scrolling and clicks
+    std::string mouse;
+    for (int i = 0; i < 500; i++) {
+        int x = 1 + i % 200, y = 1 + i % 60;
+        mouse += "\x1b[<32;" + std::to_string(x) + ";" + std::to_string(y) + "M";
+        if (i % 5 == 0) mouse += "\x1b[<65;" + std::to_string(x) + ";" + std::to_string(y) + "M";
+        if (i % 25 == 0) {
+            mouse += "\x1b[<0;" + std::to_string(x) + ";" + std::to_string(y) + "M";
+            mouse += "\x1b[<0;" + std::to_string(x) + ";" + std::to_string(y) + "m";
+        }
+    }
+    parse_benchmark("parse/mouse", mouse);
+}
+
+// Lua
+
+// Current size of the frame output file; reset when it grows large
+static size_t frames_written() {
+    off_t pos = lseek(g_frames_fd, 0, SEEK_CUR);
+    return pos > 0 ? static_cast<size_t>(pos) : 0;
+}
+
+// bench.run(name, fn): times fn() like the C++ benchmarks; bytes/op is
+// what it wrote to the terminal. The collector runs as usual while timing;
+// Lua heap use is measured afterwards in a separate pass with it stopped.
+static int lua_bench_run(lua_State* L) {
+    std::string name = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    if (!selected(name)) return 0;
+    lua_pushvalue(L, 2);
+    int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    bool failed = false;
+    auto op = [&]() {
+        if (failed) return size_t(0);
+        size_t before = frames_written();
+        lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+        if (lua_pcall(L, 0, 0, 0) != 0) {
+            fprintf(stderr, "%s: %s\n", name.c_str(), lua_tostring(L, -1));
+            lua_pop(L, 1);
+            failed = true;
+        }
+        size_t after = frames_written();
+        if (after > (64u << 20)) {
+            (void)ftruncate(g_frames_fd, 0);
+            lseek(g_frames_fd, 0, SEEK_SET);
+        }
+        return after - before;
+    };
+    Sample sample = measure(op);
+
+    const int KB_RUNS = 100;
+    auto heap_kb = [L]() { return lua_gc(L, LUA_GCCOUNT, 0) + lua_gc(L, LUA_GCCOUNTB, 0) / 1024.0; };
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    lua_gc(L, LUA_GCSTOP, 0);
+    double kb = heap_kb();
+    for (int i = 0; i < KB_RUNS; i++) op();
+    sample.lua_kb = (heap_kb() - kb) / KB_RUNS;
+    lua_gc(L, LUA_GCRESTART, 0);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+
+    luaL_unref(L, LUA_REGISTRYINDEX, ref);
+    if (!failed) report(name, sample);
+    return 0;
+}
+
+static bool lua_benchmarks() {
+    // The editor draws to fd 1 and configures the terminal on fd 0: give
+    // it a scratch file and /dev/null instead
+    int out = dup(STDOUT_FILENO);
+    char path[] = "/tmp/catvim-bench-XXXXXX";
+    g_frames_fd = mkstemp(path);
+    if (out < 0 || g_frames_fd < 0) {
+        perror("bench");
+        return false;
+    }
+    unlink(path);
+    fflush(stdout);
+    g_out = fdopen(out, "w");
+    dup2(g_frames_fd, STDOUT_FILENO);
+    int null = open("/dev/null", O_RDONLY);
+    dup2(null, STDIN_FILENO);
+    close(null);
+
+    LuaBindings app;
+    if (!app.init()) {
+        fprintf(stderr, "bench: failed to initialize Lua\n");
+        return false;
+    }
+    lua_State* L = app.state();
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "path");
+    std::string lua_path = lua_tostring(L, -1);
+    lua_path += ";./src/lua/?.lua;./src/lua/?/init.lua";
+    lua_pushstring(L, lua_path.c_str());
+    lua_setfield(L, -3, "path");
+    lua_pop(L, 2);
+
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_bench_run); lua_setfield(L, -2, "run");
+    lua_pushstring(L, g_options.filter.c_str()); lua_setfield(L, -2, "filter");
+    lua_setglobal(L, "bench");
+    return app.load_file("bench/bench.lua");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            g_options.json = true;
+        } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            g_options.time_ms = atof(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [--json] [--time ms] [filter]\n", argv[0]);
+            return 2;
+        } else {
+            g_options.filter = argv[i];
+        }
+    }
+
+    if (!g_options.json) {
+        printf("%-32s %12s %12s %10s %10s\n", "benchmark", "ns/op", "bytes/op", "allocs/op", "lua_kb/op");
+    }
+    renderer_benchmarks();
+    input_benchmarks();
+    return lua_benchmarks() ? 0 : 1;
+}
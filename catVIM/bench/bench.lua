@@ -0,0 +1,69 @@
+-- catVIM Lua benchmarks, run by the bench binary (make bench)
+--
+-- bench.run(name, fn) times fn() the same way as the C++ benchmarks in
+-- bench.cpp. Everything here drives the editor's own modules.
+local Syntax = require("editor.syntax")
+
+local function read_lines(path)
+    local lines = {}
+    for line in io.lines(path) do
+        lines[#lines + 1] = line
+    end
+    return lines
+end
+
+-- Highlighting: one op is one line, with the lexer state carried from the
+-- line above as the highlighter does
+for _, sample in ipairs({ { "src/core/renderer.cpp", "cpp" }, { "src/lua/init.lua", "lua" } }) do
+    local path, filetype = sample[1], sample[2]
+    local lines = read_lines(path)
+    local i, state = 0, false
+    bench.run("lua/highlight_line/" .. filetype, function()
+        i = i % #lines + 1
+        if i == 1 then state = false end
+        local _, next_state = Syntax.highlight_line(lines[i], filetype, state)
+        state = next_state
+    end)
+end
+
+-- Frames: the editor with a C++ file open, drawn through State:render as
+-- the frame scheduler does. The terminal is 80x24 (bench.cpp points
+-- stdout at a file).
+arg = { "src/core/renderer.cpp" }
+local State = dofile("src/lua/init.lua")
+init()
+local frame = State.frame
+local line_count = State.buffer:line_count()
+local _, _, _, editor_h = State:editor_bounds()
+
+local function draw()
+    State:track_changes()
+    frame:present(0)
+end
+
+-- Everything repainted (what a resize or :e does)
+bench.run("lua/frame/full", function()
+    frame:damage_all()
+    draw()
+end)
+
+-- The cursor walks down past the bottom row: one line of scroll per frame
+State.cursor:move_to(editor_h, 1)
+draw()
+bench.run("lua/frame/scroll", function()
+    local line = State.cursor.line + 1
+    if line > line_count then line = editor_h end
+    State.cursor:move_to(line, 1)
+    draw()
+end)
+
+-- The cursor moves along a line: one row repainted per frame
+local row = 1
+while #State.buffer:get_line(row) < 20 do row = row + 1 end
+local width = #State.buffer:get_line(row)
+State.cursor:move_to(row, 1)
+draw()
+bench.run("lua/frame/cursor", function()
+    State.cursor:move_to(row, State.cursor.col % width + 1)
+    draw()
+end)
@@ -0,0 +1,292 @@
+#include "dir_tree.hpp"
+#include "worker_thread.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace catvim {
+
+static const uint32_t WATCH_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+static void drain(int fd) {
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0) {}
+}
+
+DirTree::DirTree(std::string root) : root_(std::move(root)) {
+    while (root_.size() > 1 && root_.back() == '/') root_.pop_back();
+}
+
+DirTree::~DirTree() {
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        (void)::write(wake_[1], "", 1);
+        thread_.join();
+    }
+    for (int fd : {notify_[0], notify_[1], wake_[0], wake_[1], inotify_}) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+bool DirTree::start(std::string& error) {
+    struct stat st;
+    if (stat(root_.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        error = "Not a directory: " + root_;
+        return false;
+    }
+    if (pipe(notify_) != 0 || pipe(wake_) != 0) {
+        error = std::string("pipe: ") + std::strerror(errno);
+        return false;
+    }
+    for (int fd : {notify_[0], notify_[1], wake_[0], wake_[1]}) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    // Without inotify the tree still works, it just doesn't follow changes
+    inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    set_expanded(root_, true);
+    thread_ = start_worker([this]() { run(); });
+    return true;
+}
+
+std::string DirTree::join(const std::string& dir, const std::string& name) {
+    return dir.back() == '/' ? dir + name : dir + "/" + name;
+}
+
+std::string DirTree::parent(const std::string& path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) return "";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// UI thread
+
+void DirTree::request(const std::string& path) {
+    dirs_[path].requested = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requests_.push_back(path);
+    }
+    (void)::write(wake_[1], "", 1);
+}
+
+void DirTree::set_expanded(const std::string& path, bool expanded) {
+    if (expanded) {
+        if (!expanded_.insert(path).second) return;
+        Dir& dir = dirs_[path];
+        if (!dir.loaded && !dir.requested) request(path);
+    } else if (path == root_ || !expanded_.erase(path)) {
+        return;
+    }
+    if (visible(parent(path)) || path == root_) flatten();
+}
+
+// Whether the entries of directory `path` are shown
+bool DirTree::visible(const std::string& path) const {
+    if (path == root_) return true;
+    if (path.size() <= root_.size() || !expanded_.count(path)) return false;
+    return visible(parent(path));
+}
+
+// Drops a directory that went away, and everything cached below it
+void DirTree::forget(const std::string& path) {
+    std::string prefix = join(path, "");
+    auto below = [&](const std::string& p) { return p == path || p.compare(0, prefix.size(), prefix) == 0; };
+    for (auto it = dirs_.begin(); it != dirs_.end();) {
+        it = below(it->first) ? dirs_.erase(it) : std::next(it);
+    }
+    for (auto it = expanded_.begin(); it != expanded_.end();) {
+        it = below(*it) ? expanded_.erase(it) : std::next(it);
+    }
+}
+
+bool DirTree::update() {
+    std::vector<Listing> listings;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listings.swap(finished_);
+        notified_ = false;
+        drain(notify_[0]);
+    }
+
+    bool changed = false;
+    for (Listing& listing : listings) {
+        auto it = dirs_.find(listing.path);
+        // Forgotten while it was being read
+        if (it == dirs_.end()) continue;
+        Dir& dir = it->second;
+        if (dir.loaded && dir.entries == listing.entries) continue;
+
+        for (const Entry& old : dir.entries) {
+            if (!old.isdir) continue;
+            auto same = [&](const Entry& e) { return e.isdir && e.name == old.name; };
+            if (std::none_of(listing.entries.begin(), listing.entries.end(), same)) {
+                forget(join(listing.path, old.name));
+            }
+        }
+        dir.entries = std::move(listing.entries);
+        dir.loaded = true;
+        if (visible(listing.path)) changed = true;
+    }
+    if (changed) flatten();
+    return changed;
+}
+
+void DirTree::flatten() {
+    rows_.clear();
+    add_rows(root_, 0);
+}
+
+void DirTree::add_rows(const std::string& path, int depth) {
+    auto it = dirs_.find(path);
+    if (it == dirs_.end()) return;
+    for (const Entry& entry : it->second.entries) {
+        Row row;
+        row.path = join(path, entry.name);
+        row.name = row.path.size() - entry.name.size();
+        row.depth = depth;
+        row.isdir = entry.isdir;
+        row.expanded = entry.isdir && expanded_.count(row.path) > 0;
+        row.loading = false;
+        if (row.expanded) {
+            auto sub = dirs_.find(row.path);
+            row.loading = sub == dirs_.end() || !sub->second.loaded;
+        }
+        rows_.push_back(std::move(row));
+        if (rows_.back().expanded) add_rows(std::string(rows_.back().path), depth + 1);
+    }
+}
+
+size_t DirTree::find(const std::string& path) const {
+    for (size_t i = 0; i < rows_.size(); i++) {
+        if (rows_[i].path == path) return i;
+    }
+    return rows_.size();
+}
+
+// Reader thread
+
+void DirTree::run() {
+    std::vector<std::string> requests;
+    std::unordered_set<std::string> changed;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopping_) return;
+            requests.swap(requests_);
+        }
+        for (const std::string& path : requests) read_dir(path);
+        requests.clear();
+
+        struct pollfd fds[2] = {{wake_[0], POLLIN, 0}, {inotify_, POLLIN, 0}};
+        int nfds = inotify_ >= 0 ? 2 : 1;
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        if (fds[0].revents & POLLIN) drain(wake_[0]);
+        if (nfds < 2 || !(fds[1].revents & POLLIN)) continue;
+
+        // Let a burst of changes (a checkout, a build) settle so each
+        // directory is read once for it
+        read_events(changed);
+        for (int i = 0; i < MAX_SETTLE; i++) {
+            fds[0].revents = fds[1].revents = 0;
+            if (poll(fds, 2, SETTLE_MS) <= 0 || (fds[0].revents & POLLIN)) break;
+            read_events(changed);
+        }
+        for (const std::string& path : changed) read_dir(path);
+        changed.clear();
+    }
+}
+
+// Collects the watched directories whose entries changed
+void DirTree::read_events(std::unordered_set<std::string>& changed) {
+    alignas(struct inotify_event) char buf[16384];
+    ssize_t n;
+    while ((n = read(inotify_, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + n;) {
+            const auto* ev = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // Events were lost: read everything again
+                for (const auto& w : watches_) changed.insert(w.second);
+                continue;
+            }
+            auto it = watches_.find(ev->wd);
+            if (it == watches_.end()) continue;
+            if (ev->mask & IN_IGNORED) {
+                // The directory itself is gone; its parent hears about it
+                watches_.erase(it);
+                continue;
+            }
+            changed.insert(it->second);
+        }
+    }
+}
+
+// Lists `path` and hands the result to the UI thread. The watch goes on
+// first so that no change after the listing is missed.
+void DirTree::read_dir(const std::string& path) {
+    if (inotify_ >= 0) {
+        int wd = inotify_add_watch(inotify_, path.c_str(), WATCH_EVENTS);
+        if (wd >= 0) watches_[wd] = path;
+    }
+    Listing listing;
+    listing.path = path;
+    list(path, listing.entries);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_.push_back(std::move(listing));
+    if (!notified_) {
+        notified_ = true;
+        (void)::write(notify_[1], "", 1);
+    }
+}
+
+// The entries of a directory, directories first, then by name. An
+// unreadable directory is listed as empty.
+void DirTree::list(const std::string& path, std::vector<Entry>& out) {
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    // getdents64 fills a large buffer per call where readdir() goes
+    // through glibc's small one
+    alignas(struct dirent64) char buf[65536];
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (long off = 0; off < n;) {
+            const auto* d = reinterpret_cast<const struct dirent64*>(buf + off);
+            off += d->d_reclen;
+            const char* name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+            bool isdir = d->d_type == DT_DIR;
+            if (d->d_type == DT_UNKNOWN) {
+                // Some file systems don't fill in d_type
+                struct stat st;
+                isdir = fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+            out.push_back({name, isdir});
+        }
+    }
+    close(fd);
+
+    std::sort(out.begin(), out.end(), [](const Entry& a, const Entry& b) {
+        if (a.isdir != b.isdir) return a.isdir;
+        return a.name < b.name;
+    });
+}
+
+}  // namespace catvim
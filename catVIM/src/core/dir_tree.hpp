@@ -0,0 +1,105 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace catvim {
+
+// A cached directory tree for the file explorer. Directories are read on a
+// background thread (getdents64) and sorted there, directories first; the
+// UI thread never touches the file system. Every directory read so far is
+// watched with inotify and re-read when its entries change, so collapsing
+// and expanding again costs nothing and the cache stays current.
+//
+// notify_fd() becomes readable when a read finishes; update() then applies
+// it. The visible rows (the expanded part of the tree, flattened) are kept
+// as a vector so a view can fetch just the window it shows.
+class DirTree {
+public:
+    struct Row {
+        std::string path;   // The root joined with the path from it
+        size_t name;        // Offset of the entry's own name in `path`
+        int depth;
+        bool isdir;
+        bool expanded;
+        bool loading;       // Expanded, but not read yet
+    };
+
+    explicit DirTree(std::string root);
+    ~DirTree();
+    DirTree(const DirTree&) = delete;
+    DirTree& operator=(const DirTree&) = delete;
+
+    bool start(std::string& error);
+
+    int notify_fd() const { return notify_[0]; }
+    // Applies the reads finished since the last call; true if the visible
+    // rows changed
+    bool update();
+
+    void set_expanded(const std::string& path, bool expanded);
+    size_t row_count() const { return rows_.size(); }
+    const Row& row(size_t i) const { return rows_[i]; }
+    // Index of the row showing `path`, or row_count() if none does
+    size_t find(const std::string& path) const;
+
+private:
+    static const int SETTLE_MS = 50;     // Quiet time before re-reading changed directories
+    static const int MAX_SETTLE = 10;    // ... but don't wait on a busy directory forever
+
+    struct Entry {
+        std::string name;
+        bool isdir;
+        bool operator==(const Entry& o) const { return isdir == o.isdir && name == o.name; }
+    };
+    struct Listing {
+        std::string path;
+        std::vector<Entry> entries;
+    };
+    struct Dir {
+        std::vector<Entry> entries;
+        bool loaded = false;
+        bool requested = false;
+    };
+
+    std::string root_;
+    int notify_[2] = {-1, -1};
+    int wake_[2] = {-1, -1};
+    int inotify_ = -1;
+    std::thread thread_;
+
+    // Shared with the reader thread
+    std::mutex mutex_;
+    std::vector<std::string> requests_;
+    std::vector<Listing> finished_;
+    bool notified_ = false;
+    bool stopping_ = false;
+
+    // Reader thread only
+    std::unordered_map<int, std::string> watches_;  // inotify wd -> path
+
+    // UI thread only
+    std::unordered_map<std::string, Dir> dirs_;
+    std::unordered_set<std::string> expanded_;
+    std::vector<Row> rows_;
+
+    void request(const std::string& path);
+    bool visible(const std::string& path) const;
+    void forget(const std::string& path);
+    void flatten();
+    void add_rows(const std::string& path, int depth);
+
+    void run();
+    void read_events(std::unordered_set<std::string>& changed);
+    void read_dir(const std::string& path);
+    static void list(const std::string& path, std::vector<Entry>& out);
+
+    static std::string join(const std::string& dir, const std::string& name);
+    static std::string parent(const std::string& path);
+};
+
+}  // namespace catvim
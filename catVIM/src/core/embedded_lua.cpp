@@ -0,0 +1,15 @@
+#include "embedded_lua.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace catvim {
+
+const EmbeddedLua* find_embedded_lua(const char* name) {
+    const EmbeddedLua* end = EMBEDDED_LUA + EMBEDDED_LUA_COUNT;
+    const EmbeddedLua* it = std::lower_bound(EMBEDDED_LUA, end, name, [](const EmbeddedLua& m, const char* n) {
+        return strcmp(m.name, n) < 0;
+    });
+    return it != end && strcmp(it->name, name) == 0 ? it : nullptr;
+}
+
+}  // namespace catvim
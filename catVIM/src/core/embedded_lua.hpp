@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+namespace catvim {
+
+// A module from src/lua linked into the binary. The build compiles each
+// one to bytecode with the compiler of the Lua it links against (luajit
+// -b or luac), or embeds the source when there is none; the table itself
+// is generated by tools/embed_lua.cpp, sorted by name.
+struct EmbeddedLua {
+    const char* name;  // As passed to require()
+    const char* path;  // Below src/lua, for error messages
+    const unsigned char* data;
+    size_t size;
+};
+
+extern const EmbeddedLua EMBEDDED_LUA[];
+extern const size_t EMBEDDED_LUA_COUNT;
+
+// nullptr if no module of that name was embedded
+const EmbeddedLua* find_embedded_lua(const char* name);
+
+}  // namespace catvim
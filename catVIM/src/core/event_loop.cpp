@@ -0,0 +1,304 @@
+#include "event_loop.hpp"
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#else
+#include <poll.h>
+#endif
+
+namespace catvim {
+
+int64_t EventLoop::now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+#ifndef __linux__
+// Write end of the self-pipe; the handler only forwards the signal number
+static int g_signal_pipe = -1;
+
+static void signal_to_pipe(int signo) {
+    int saved = errno;
+    unsigned char byte = static_cast<unsigned char>(signo);
+    (void)::write(g_signal_pipe, &byte, 1);
+    errno = saved;
+}
+#endif
+
+EventLoop::~EventLoop() {
+    if (poll_fd_ >= 0) close(poll_fd_);
+    if (signal_fd_ >= 0) close(signal_fd_);
+    if (timer_fd_ >= 0) close(timer_fd_);
+#ifndef __linux__
+    if (g_signal_pipe >= 0) close(g_signal_pipe);
+    g_signal_pipe = -1;
+#endif
+}
+
+bool EventLoop::init(std::string& error) {
+#ifdef __linux__
+    poll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (poll_fd_ < 0) {
+        error = std::string("epoll_create1: ") + std::strerror(errno);
+        return false;
+    }
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0) {
+        error = std::string("timerfd_create: ") + std::strerror(errno);
+        return false;
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = timer_fd_;
+    epoll_ctl(poll_fd_, EPOLL_CTL_ADD, timer_fd_, &ev);
+#else
+    int fds[2];
+    if (pipe(fds) != 0) {
+        error = std::string("pipe: ") + std::strerror(errno);
+        return false;
+    }
+    for (int fd : fds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    signal_fd_ = fds[0];
+    g_signal_pipe = fds[1];
+#endif
+    return true;
+}
+
+bool EventLoop::watch(int fd, uint32_t events, FdCallback callback) {
+#ifdef __linux__
+    struct epoll_event ev = {};
+    if (events & READABLE) ev.events |= EPOLLIN;
+    if (events & WRITABLE) ev.events |= EPOLLOUT;
+    ev.data.fd = fd;
+    int op = watches_.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(poll_fd_, op, fd, &ev) != 0) return false;
+#endif
+    watches_[fd] = {events, std::move(callback)};
+    return true;
+}
+
+void EventLoop::unwatch(int fd) {
+    auto it = watches_.find(fd);
+    if (it == watches_.end()) return;
+#ifdef __linux__
+    epoll_ctl(poll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+    watches_.erase(it);
+}
+
+bool EventLoop::on_signal(int signo, Callback callback) {
+    sigset_t one;
+    sigemptyset(&one);
+    sigaddset(&one, signo);
+#ifdef __linux__
+    if (pthread_sigmask(SIG_BLOCK, &one, nullptr) != 0) return false;
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, signo);
+    for (const auto& entry : signals_) sigaddset(&mask, entry.first);
+
+    bool created = signal_fd_ < 0;
+    int fd = signalfd(signal_fd_, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) return false;
+    signal_fd_ = fd;
+    if (created) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = signal_fd_;
+        epoll_ctl(poll_fd_, EPOLL_CTL_ADD, signal_fd_, &ev);
+    }
+#else
+    struct sigaction sa = {};
+    sa.sa_handler = signal_to_pipe;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(signo, &sa, nullptr) != 0) return false;
+#endif
+    signals_[signo] = std::move(callback);
+    return true;
+}
+
+int EventLoop::add_timer(int delay_ms, int repeat_ms, Callback callback) {
+    int id = next_timer_id_++;
+    timers_[id] = {now_ms() + (delay_ms > 0 ? delay_ms : 0), repeat_ms, std::move(callback)};
+    arm_timer();
+    return id;
+}
+
+void EventLoop::cancel_timer(int id) {
+    if (timers_.erase(id)) arm_timer();
+}
+
+int64_t EventLoop::next_deadline() const {
+    int64_t deadline = -1;
+    for (const auto& entry : timers_) {
+        if (deadline < 0 || entry.second.deadline < deadline) {
+            deadline = entry.second.deadline;
+        }
+    }
+    return deadline;
+}
+
+// Points the timerfd at the earliest deadline (or disarms it)
+void EventLoop::arm_timer() {
+#ifdef __linux__
+    struct itimerspec spec = {};
+    int64_t deadline = next_deadline();
+    if (deadline >= 0) {
+        // An all-zero value would disarm the timer instead of firing now
+        if (deadline == 0) deadline = 1;
+        spec.it_value.tv_sec = deadline / 1000;
+        spec.it_value.tv_nsec = (deadline % 1000) * 1000000;
+    }
+    timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+#endif
+}
+
+int EventLoop::run_timers() {
+    int64_t now = now_ms();
+    std::vector<int> due;
+    for (const auto& entry : timers_) {
+        if (entry.second.deadline <= now) due.push_back(entry.first);
+    }
+
+    int ran = 0;
+    for (int id : due) {
+        // An earlier callback may have cancelled this one
+        auto it = timers_.find(id);
+        if (it == timers_.end()) continue;
+        Callback callback = it->second.callback;
+        if (it->second.repeat_ms > 0) {
+            // Skip ticks that were missed instead of firing them in a burst
+            int64_t& deadline = it->second.deadline;
+            deadline += it->second.repeat_ms;
+            if (deadline <= now) deadline = now + it->second.repeat_ms;
+        } else {
+            timers_.erase(it);
+        }
+        callback();
+        ran++;
+    }
+    arm_timer();
+    return ran;
+}
+
+int EventLoop::run_signals() {
+    std::vector<int> pending;
+#ifdef __linux__
+    struct signalfd_siginfo info[8];
+    ssize_t n;
+    while ((n = read(signal_fd_, info, sizeof(info))) > 0) {
+        for (size_t i = 0; i < n / sizeof(info[0]); i++) {
+            pending.push_back(static_cast<int>(info[i].ssi_signo));
+        }
+    }
+#else
+    unsigned char bytes[64];
+    ssize_t n;
+    while ((n = read(signal_fd_, bytes, sizeof(bytes))) > 0) {
+        for (ssize_t i = 0; i < n; i++) pending.push_back(bytes[i]);
+    }
+#endif
+
+    // Several deliveries of one signal only need one callback
+    int ran = 0;
+    for (size_t i = 0; i < pending.size(); i++) {
+        bool seen = false;
+        for (size_t j = 0; j < i; j++) seen = seen || pending[j] == pending[i];
+        auto it = signals_.find(pending[i]);
+        if (seen || it == signals_.end()) continue;
+        Callback callback = it->second;
+        callback();
+        ran++;
+    }
+    return ran;
+}
+
+int EventLoop::run_once(int timeout_ms) {
+    struct Ready {
+        int fd;
+        uint32_t events;
+    };
+    std::vector<Ready> ready;
+    bool timers_due = false;
+    bool signals_due = false;
+
+#ifdef __linux__
+    struct epoll_event events[32];
+    int n = epoll_wait(poll_fd_, events, 32, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == timer_fd_) {
+            uint64_t expirations;
+            (void)read(timer_fd_, &expirations, sizeof(expirations));
+            timers_due = true;
+        } else if (fd == signal_fd_) {
+            signals_due = true;
+        } else {
+            uint32_t flags = 0;
+            if (events[i].events & EPOLLIN) flags |= READABLE;
+            if (events[i].events & EPOLLOUT) flags |= WRITABLE;
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) flags |= HANGUP;
+            ready.push_back({fd, flags});
+        }
+    }
+#else
+    // Sleep no longer than the next timer
+    int64_t deadline = next_deadline();
+    if (deadline >= 0) {
+        int64_t wait = deadline - now_ms();
+        if (wait < 0) wait = 0;
+        if (timeout_ms < 0 || wait < timeout_ms) timeout_ms = static_cast<int>(wait);
+    }
+
+    std::vector<struct pollfd> fds;
+    fds.push_back({signal_fd_, POLLIN, 0});
+    for (const auto& entry : watches_) {
+        short want = 0;
+        if (entry.second.events & READABLE) want |= POLLIN;
+        if (entry.second.events & WRITABLE) want |= POLLOUT;
+        fds.push_back({entry.first, want, 0});
+    }
+    if (poll(fds.data(), fds.size(), timeout_ms) > 0) {
+        signals_due = fds[0].revents != 0;
+        for (size_t i = 1; i < fds.size(); i++) {
+            short got = fds[i].revents;
+            if (!got) continue;
+            uint32_t flags = 0;
+            if (got & POLLIN) flags |= READABLE;
+            if (got & POLLOUT) flags |= WRITABLE;
+            if (got & (POLLHUP | POLLERR | POLLNVAL)) flags |= HANGUP;
+            ready.push_back({fds[i].fd, flags});
+        }
+    }
+    timers_due = true;
+#endif
+
+    int ran = 0;
+    if (signals_due) ran += run_signals();
+    for (const Ready& r : ready) {
+        // A previous callback may have removed this watch
+        auto it = watches_.find(r.fd);
+        if (it == watches_.end()) continue;
+        FdCallback callback = it->second.callback;
+        callback(r.events);
+        ran++;
+    }
+    if (timers_due) ran += run_timers();
+    return ran;
+}
+
+}  // namespace catvim
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+namespace catvim {
+
+// Waits on file descriptors, signals and timers and runs their callbacks.
+// Nothing is polled: with no timer armed, run_once() sleeps in the kernel
+// until a watched fd or signal wakes it. On Linux this is epoll with a
+// signalfd and a timerfd; elsewhere poll() with a self-pipe for signals.
+//
+// Callbacks may add or remove watches and timers, including their own.
+class EventLoop {
+public:
+    enum : uint32_t { READABLE = 1, WRITABLE = 2, HANGUP = 4 };
+
+    using FdCallback = std::function<void(uint32_t events)>;
+    using Callback = std::function<void()>;
+
+    EventLoop() = default;
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool init(std::string& error);
+
+    bool watch(int fd, uint32_t events, FdCallback callback);
+    void unwatch(int fd);
+
+    // The signal is blocked for normal delivery and reported here instead.
+    // Only the calling thread's mask changes (threads created afterwards
+    // inherit it), so every thread that already exists must block the
+    // signal too, or the kernel may hand it to one of them and it is lost.
+    // Register signals before starting any threads.
+    bool on_signal(int signo, Callback callback);
+
+    // Runs callback after delay_ms, then every repeat_ms if that is > 0.
+    // Returns an id for cancel_timer() (never 0).
+    int add_timer(int delay_ms, int repeat_ms, Callback callback);
+    void cancel_timer(int id);
+
+    // Waits up to timeout_ms (-1 = no limit) for something to happen and
+    // runs the callbacks that are ready. Returns how many ran.
+    int run_once(int timeout_ms = -1);
+
+    static int64_t now_ms();
+
+private:
+    struct Watch {
+        uint32_t events;
+        FdCallback callback;
+    };
+    struct Timer {
+        int64_t deadline;
+        int repeat_ms;
+        Callback callback;
+    };
+
+    int poll_fd_ = -1;    // epoll instance (Linux)
+    int signal_fd_ = -1;  // signalfd, or the read end of the self-pipe
+    int timer_fd_ = -1;   // timerfd (Linux)
+    std::map<int, Watch> watches_;
+    std::map<int, Callback> signals_;
+    std::map<int, Timer> timers_;
+    int next_timer_id_ = 1;
+
+    void arm_timer();
+    int64_t next_deadline() const;
+    int run_timers();
+    int run_signals();
+};
+
+}  // namespace catvim
@@ -0,0 +1,231 @@
+#include "file_io.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace catvim {
+
+static std::string errno_message(const char* what) {
+    return std::string(what) + ": " + std::strerror(errno);
+}
+
+static FileStamp to_stamp(const struct stat& st) {
+    FileStamp stamp;
+    stamp.dev = st.st_dev;
+    stamp.ino = st.st_ino;
+    stamp.size = st.st_size;
+#ifdef __APPLE__
+    const struct timespec& mtime = st.st_mtimespec;
+#else
+    const struct timespec& mtime = st.st_mtim;
+#endif
+    stamp.mtime_ns = static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+    return stamp;
+}
+
+bool stat_file(const char* path, FileStamp& out) {
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+    out = to_stamp(st);
+    return true;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+void MappedFile::close() {
+    if (map_) munmap(map_, size_);
+    map_ = nullptr;
+    data_ = "";
+    size_ = 0;
+    fallback_.clear();
+    stamp_ = FileStamp();
+}
+
+bool MappedFile::open(const char* path, std::string& error) {
+    close();
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = errno_message("Failed to open file");
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        error = errno_message("Failed to open file");
+        ::close(fd);
+        return false;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        error = "Failed to open file: is a directory";
+        ::close(fd);
+        return false;
+    }
+    stamp_ = to_stamp(st);
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            ::close(fd);
+            map_ = addr;
+            data_ = static_cast<const char*>(addr);
+            size_ = st.st_size;
+            return true;
+        }
+    }
+
+    // Not mappable: read it the old-fashioned way
+    char buf[65536];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            error = errno_message("Failed to read file");
+            ::close(fd);
+            fallback_.clear();
+            return false;
+        }
+        if (n == 0) break;
+        fallback_.append(buf, n);
+    }
+    ::close(fd);
+    data_ = fallback_.data();
+    size_ = fallback_.size();
+    return true;
+}
+
+void MappedFile::advise_sequential(bool sequential) {
+    if (map_) madvise(map_, size_, sequential ? MADV_SEQUENTIAL : MADV_NORMAL);
+}
+
+AtomicWriter::~AtomicWriter() {
+    abort();
+}
+
+bool AtomicWriter::open(const char* path, std::string& error) {
+    abort();
+    // Write through symlinks rather than replacing the link itself
+    path_ = path;
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISLNK(st.st_mode)) {
+        char* real = realpath(path, nullptr);
+        if (real) {
+            path_ = real;
+            free(real);
+        }
+    }
+
+    tmp_path_ = path_ + ".catvim-XXXXXX";
+    fd_ = mkostemp(&tmp_path_[0], O_CLOEXEC);
+    if (fd_ < 0) {
+        error = errno_message("Failed to create temporary file");
+        return false;
+    }
+
+    // mkstemp creates the file 0600; give it the target's mode and owner,
+    // or the usual default for a new file
+    if (stat(path_.c_str(), &st) == 0) {
+        fchmod(fd_, st.st_mode & 07777);
+        if (fchown(fd_, st.st_uid, st.st_gid) != 0) {
+            // Not permitted to give it away; the file stays ours
+        }
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(fd_, 0666 & ~mask);
+    }
+
+    iov_count_ = 0;
+    errno_ = 0;
+    return true;
+}
+
+bool AtomicWriter::write(const char* data, size_t len) {
+    if (fd_ < 0 || errno_) return false;
+    if (len == 0) return true;
+    if (iov_count_ == MAX_IOV && !flush()) return false;
+    iov_[iov_count_].iov_base = const_cast<char*>(data);
+    iov_[iov_count_].iov_len = len;
+    iov_count_++;
+    return true;
+}
+
+bool AtomicWriter::flush() {
+    struct iovec* iov = iov_;
+    int count = iov_count_;
+    iov_count_ = 0;
+    while (count > 0) {
+        ssize_t n = writev(fd_, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            errno_ = errno;
+            return false;
+        }
+        // Skip what was written; a short write can end mid-chunk
+        while (count > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+bool AtomicWriter::commit(std::string& error) {
+    if (fd_ < 0) {
+        error = "Failed to write file: not open";
+        return false;
+    }
+    if (!flush() || fsync(fd_) != 0) {
+        if (!errno_) errno_ = errno;
+    }
+    if (errno_) {
+        errno = errno_;
+        error = errno_message("Failed to write file");
+        abort();
+        return false;
+    }
+
+    int fd = fd_;
+    fd_ = -1;
+    if (::close(fd) != 0 || rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+        error = errno_message("Failed to write file");
+        unlink(tmp_path_.c_str());
+        return false;
+    }
+
+    // Make the rename itself durable
+    std::string dir = path_.substr(0, path_.find_last_of('/') + 1);
+    int dir_fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        ::close(dir_fd);
+    }
+    return true;
+}
+
+void AtomicWriter::abort() {
+    if (fd_ < 0) return;
+    ::close(fd_);
+    unlink(tmp_path_.c_str());
+    fd_ = -1;
+    iov_count_ = 0;
+}
+
+bool replace_file(const char* path, const char* data, size_t len, std::string& error) {
+    AtomicWriter writer;
+    if (!writer.open(path, error)) return false;
+    writer.write(data, len);
+    return writer.commit(error);
+}
+
+}  // namespace catvim
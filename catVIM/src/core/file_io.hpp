@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <sys/uio.h>
+
+namespace catvim {
+
+// Identifies one version of a file: a rewrite (even an atomic replace)
+// changes the inode or modification time
+struct FileStamp {
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+
+    bool operator==(const FileStamp& o) const {
+        return dev == o.dev && ino == o.ino && size == o.size && mtime_ns == o.mtime_ns;
+    }
+    bool operator!=(const FileStamp& o) const { return !(*this == o); }
+};
+
+// False if path can't be stat()ed
+bool stat_file(const char* path, FileStamp& out);
+
+// Read-only view of a file's contents. Regular files are mmap()ed, so pages
+// are only read from disk when touched and nothing is copied onto the heap;
+// anything that can't be mapped (pipes, /proc files) is read into memory.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* path, std::string& error);
+    void close();
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    // Of the file as it was opened
+    const FileStamp& stamp() const { return stamp_; }
+
+    // Access pattern hint for the kernel's readahead (no-op when not mapped)
+    void advise_sequential(bool sequential);
+
+private:
+    const char* data_ = "";
+    size_t size_ = 0;
+    void* map_ = nullptr;
+    std::string fallback_;
+    FileStamp stamp_;
+};
+
+// Replaces a file atomically: data is written to a temporary file in the
+// same directory, synced, and renamed over the target, so a crash leaves
+// either the old or the new contents. The target's permissions are kept.
+// Chunks passed to write() are gathered with writev() without copying, so
+// they must stay valid until the next flush (commit() or a full batch).
+class AtomicWriter {
+public:
+    AtomicWriter() = default;
+    ~AtomicWriter();
+    AtomicWriter(const AtomicWriter&) = delete;
+    AtomicWriter& operator=(const AtomicWriter&) = delete;
+
+    bool open(const char* path, std::string& error);
+    bool write(const char* data, size_t len);
+    bool commit(std::string& error);
+    void abort();
+
+private:
+    static const int MAX_IOV = 256;
+
+    std::string path_;
+    std::string tmp_path_;
+    int fd_ = -1;
+    int errno_ = 0;  // First write error, reported by commit()
+    struct iovec iov_[MAX_IOV];
+    int iov_count_ = 0;
+
+    bool flush();
+};
+
+bool replace_file(const char* path, const char* data, size_t len, std::string& error);
+
+}  // namespace catvim
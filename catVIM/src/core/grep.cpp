@@ -0,0 +1,270 @@
+#include "grep.hpp"
+#include "file_io.hpp"
+#include "worker_thread.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace catvim {
+
+// .gitignore rules
+
+static void parse_gitignore(const std::string& text, std::vector<IgnoreRules::Rule>& rules) {
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t eol = text.find('\n', pos);
+        if (eol == std::string::npos) eol = text.size();
+        std::string line = text.substr(pos, eol - pos);
+        pos = eol + 1;
+
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+
+        IgnoreRules::Rule rule;
+        if (line[0] == '!') {
+            rule.negate = true;
+            line.erase(0, 1);
+        } else if (line[0] == '\\') {
+            line.erase(0, 1);  // Escaped leading '#' or '!'
+        }
+        if (!line.empty() && line.back() == '/') {
+            rule.dir_only = true;
+            line.pop_back();
+        }
+        // "**/name" matches name at any depth, like a pattern without a slash
+        if (line.compare(0, 3, "**/") == 0 && line.find('/', 3) == std::string::npos) {
+            line.erase(0, 3);
+        }
+        if (line.find('/') != std::string::npos) {
+            rule.anchored = true;
+            if (line[0] == '/') line.erase(0, 1);
+        }
+        if (line.empty()) continue;
+        rule.pattern = line;
+        rules.push_back(std::move(rule));
+    }
+}
+
+bool IgnoreRules::ignored(const std::string& path, const std::string& name, bool isdir) const {
+    // Deeper .gitignore files take precedence, and later rules within one
+    // file override earlier ones
+    for (const IgnoreRules* r = this; r; r = r->parent.get()) {
+        for (auto it = r->rules.rbegin(); it != r->rules.rend(); ++it) {
+            if (it->dir_only && !isdir) continue;
+            bool match;
+            if (it->anchored) {
+                std::string rel = r->base.empty() ? path : path.substr(r->base.size() + 1);
+                // '**' has to cross directories, which FNM_PATHNAME forbids
+                int flags = it->pattern.find("**") != std::string::npos ? 0 : FNM_PATHNAME;
+                match = fnmatch(it->pattern.c_str(), rel.c_str(), flags) == 0;
+            } else {
+                match = fnmatch(it->pattern.c_str(), name.c_str(), 0) == 0;
+            }
+            if (match) return !it->negate;
+        }
+    }
+    return false;
+}
+
+// Grep
+
+Grep::Grep(std::string root, std::unique_ptr<Matcher> matcher, size_t max_results)
+    : root_(std::move(root)), matcher_(std::move(matcher)), max_results_(max_results) {}
+
+Grep::~Grep() {
+    cancel();
+    for (std::thread& t : workers_) t.join();
+    if (notify_[0] >= 0) close(notify_[0]);
+    if (notify_[1] >= 0) close(notify_[1]);
+}
+
+bool Grep::start(std::string& error) {
+    struct stat st;
+    if (stat(root_.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        error = "Not a directory: " + root_;
+        return false;
+    }
+    if (pipe(notify_) != 0) {
+        error = std::string("pipe: ") + std::strerror(errno);
+        return false;
+    }
+    for (int fd : notify_) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    queue_.push_back({"", true, nullptr});
+    unsigned n = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < n; i++) {
+        workers_.push_back(start_worker([this]() { work(); }));
+    }
+    return true;
+}
+
+void Grep::cancel() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cancelled_ = true;
+    }
+    work_cv_.notify_all();
+}
+
+void Grep::take(std::vector<Result>& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out.clear();
+    out.swap(results_);
+    notified_ = false;
+    char buf[64];
+    while (read(notify_[0], buf, sizeof(buf)) > 0) {}
+}
+
+// Called with mutex_ held. One byte in the pipe covers everything until
+// the next take().
+void Grep::notify() {
+    if (notified_) return;
+    notified_ = true;
+    (void)::write(notify_[1], "", 1);
+}
+
+void Grep::publish(std::vector<Result>& found) {
+    size_t room = max_results_ - total_results_;
+    if (found.size() >= room) {
+        found.resize(room);
+        cancelled_ = true;
+    }
+    total_results_ += found.size();
+    for (Result& r : found) results_.push_back(std::move(r));
+    notify();
+}
+
+void Grep::work() {
+    std::vector<Item> children;
+    std::vector<Result> found;
+    for (;;) {
+        Item item;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_cv_.wait(lock, [this]() { return cancelled_ || !queue_.empty() || busy_ == 0; });
+            if (cancelled_ || queue_.empty()) {
+                // Nothing queued and nobody left to queue more: finished
+                if (!done_.exchange(true)) notify();
+                break;
+            }
+            item = std::move(queue_.front());
+            queue_.pop_front();
+            busy_++;
+        }
+
+        children.clear();
+        found.clear();
+        if (item.isdir) {
+            list_dir(item, children);
+        } else {
+            search_file(item.path, found);
+        }
+
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            busy_--;
+            for (Item& child : children) queue_.push_back(std::move(child));
+            if (!found.empty() && !cancelled_) publish(found);
+            wake = !children.empty() || busy_ == 0 || cancelled_;
+        }
+        if (wake) work_cv_.notify_all();
+    }
+}
+
+void Grep::list_dir(const Item& dir, std::vector<Item>& out) {
+    std::string full = dir.path.empty() ? root_ : root_ + "/" + dir.path;
+    DIR* d = opendir(full.c_str());
+    if (!d) return;
+
+    std::shared_ptr<const IgnoreRules> rules = dir.rules;
+    MappedFile gitignore;
+    std::string error;
+    if (gitignore.open((full + "/.gitignore").c_str(), error)) {
+        auto own = std::make_shared<IgnoreRules>();
+        own->parent = dir.rules;
+        own->base = dir.path;
+        parse_gitignore(std::string(gitignore.data(), gitignore.size()), own->rules);
+        rules = own;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(d)) != nullptr) {
+        std::string name = entry->d_name;
+        if (name == "." || name == ".." || name == ".git") continue;
+        std::string path = dir.path.empty() ? name : dir.path + "/" + name;
+
+        bool isdir;
+        if (entry->d_type == DT_DIR) {
+            isdir = true;
+        } else if (entry->d_type == DT_REG) {
+            isdir = false;
+        } else {
+            // Symlinks to files are searched; symlinked directories are
+            // not followed, which also keeps cycles out
+            struct stat st;
+            if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK) continue;
+            if (lstat((full + "/" + name).c_str(), &st) != 0) continue;
+            if (S_ISDIR(st.st_mode)) {
+                isdir = true;
+            } else if (S_ISREG(st.st_mode) ||
+                       (S_ISLNK(st.st_mode) && stat((full + "/" + name).c_str(), &st) == 0 &&
+                        S_ISREG(st.st_mode))) {
+                isdir = false;
+            } else {
+                continue;
+            }
+        }
+        if (rules && rules->ignored(path, name, isdir)) continue;
+        out.push_back({std::move(path), isdir, rules});
+    }
+    closedir(d);
+}
+
+void Grep::search_file(const std::string& path, std::vector<Result>& out) {
+    MappedFile file;
+    std::string error;
+    if (!file.open((root_ + "/" + path).c_str(), error)) return;
+    files_++;
+
+    const char* data = file.data();
+    size_t size = file.size();
+    // A NUL byte near the start means a binary file
+    if (size == 0 || std::memchr(data, 0, std::min<size_t>(size, 8192))) return;
+    file.advise_sequential(true);
+
+    const char* end = data + size;
+    const char* p = data;
+    const char* line_start = data;
+    size_t line = 0;
+    size_t ms, ml;
+    while (p < end && !cancelled_ && matcher_->find(data, end, p, ms, ml)) {
+        const char* match = data + ms;
+        const char* nl;
+        while ((nl = static_cast<const char*>(std::memchr(line_start, '\n', match - line_start)))) {
+            line++;
+            line_start = nl + 1;
+        }
+        const char* eol = static_cast<const char*>(std::memchr(match, '\n', end - match));
+        if (!eol) eol = end;
+
+        size_t len = std::min<size_t>(eol - line_start, MAX_LINE);
+        if (len > 0 && line_start[len - 1] == '\r') len--;
+        out.push_back({path, line, static_cast<size_t>(match - line_start), std::string(line_start, len)});
+
+        // One result per line
+        p = eol + 1;
+        line_start = p;
+        line++;
+    }
+}
+
+}  // namespace catvim
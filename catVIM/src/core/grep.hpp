@@ -0,0 +1,96 @@
+#pragma once
+
+#include "search.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace catvim {
+
+// Rules from the .gitignore files between the search root and a directory
+// (innermost last). Shared by every path below that directory.
+struct IgnoreRules {
+    struct Rule {
+        std::string pattern;
+        bool negate = false;
+        bool dir_only = false;
+        bool anchored = false;  // Contains a '/': matched against the path from `base`
+    };
+
+    std::shared_ptr<const IgnoreRules> parent;
+    std::string base;  // Directory holding the .gitignore, relative to the root
+    std::vector<Rule> rules;
+
+    // `path` is relative to the search root
+    bool ignored(const std::string& path, const std::string& name, bool isdir) const;
+};
+
+// Searches every file under a directory for a pattern on a pool of worker
+// threads. Files are mmap()ed; binary files, .git and anything matched by
+// a .gitignore are skipped. Results stream in while the search runs:
+// notify_fd() becomes readable when take() has something new, and stays
+// quiet otherwise.
+class Grep {
+public:
+    struct Result {
+        std::string path;  // Relative to the root
+        size_t line;       // 0-based
+        size_t col;        // 0-based byte column
+        std::string text;  // The matching line, truncated
+    };
+
+    Grep(std::string root, std::unique_ptr<Matcher> matcher, size_t max_results);
+    ~Grep();
+    Grep(const Grep&) = delete;
+    Grep& operator=(const Grep&) = delete;
+
+    bool start(std::string& error);
+    void cancel();
+
+    int notify_fd() const { return notify_[0]; }
+    // Moves out the results found since the last call and clears the
+    // notification
+    void take(std::vector<Result>& out);
+    bool done() const { return done_; }
+    size_t files_searched() const { return files_; }
+
+private:
+    static const size_t MAX_LINE = 256;
+
+    struct Item {
+        std::string path;  // Relative to the root; "" is the root itself
+        bool isdir;
+        std::shared_ptr<const IgnoreRules> rules;
+    };
+
+    std::string root_;
+    std::unique_ptr<Matcher> matcher_;
+    size_t max_results_;
+    int notify_[2] = {-1, -1};
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::deque<Item> queue_;
+    size_t busy_ = 0;              // Workers holding an item
+    std::vector<Result> results_;
+    size_t total_results_ = 0;
+    bool notified_ = false;
+
+    std::atomic<bool> cancelled_{false};
+    std::atomic<bool> done_{false};
+    std::atomic<size_t> files_{0};
+
+    void work();
+    void list_dir(const Item& dir, std::vector<Item>& out);
+    void search_file(const std::string& path, std::vector<Result>& out);
+    void publish(std::vector<Result>& found);
+    void notify();
+};
+
+}  // namespace catvim
@@ -1,10 +1,13 @@
 #include "input.hpp"
+#include "unicode.hpp"
+#include <algorithm>
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
 
 namespace catvim {
 
-bool InputParser::parse(const std::string& input, Event& out, size_t& consumed) {
+bool InputParser::parse(std::string_view input, Event& out, size_t& consumed) {
     if (input.empty()) {
         consumed = 0;
         return false;
@@ -32,6 +35,29 @@ bool InputParser::parse(const std::string& input, Event& out, size_t& consumed)
         return true;
     }
     
+    // Non-ASCII character: wait for the whole UTF-8 sequence, and drop
+    // bytes that can't start one
+    if (c >= 0x80) {
+        size_t need = utf8_length(c);
+        if (need > 1 && input.size() < need) {
+            bool partial = true;
+            for (size_t i = 1; i < input.size(); i++) {
+                partial = partial && utf8_continuation(static_cast<unsigned char>(input[i]));
+            }
+            if (partial) {
+                consumed = 0;
+                return false;
+            }
+        }
+        size_t len;
+        char32_t ch = decode_utf8(input.data(), input.size(), len);
+        consumed = len;
+        if (ch == REPLACEMENT_CHAR && len == 1) return false;
+        out.type = EventType::KEY;
+        out.key = {KEY_CHAR, false, false, false, ch};
+        return true;
+    }
+    
     // Regular character
     out.type = EventType::KEY;
     out.key = {c, false, false, false};
@@ -39,7 +65,7 @@ bool InputParser::parse(const std::string& input, Event& out, size_t& consumed)
     return true;
 }
 
-bool InputParser::parse_escape_sequence(const std::string& input, Event& out, size_t& consumed) {
+bool InputParser::parse_escape_sequence(std::string_view input, Event& out, size_t& consumed) {
     if (input.size() < 2) {
         consumed = 0;
         return false;
@@ -59,7 +85,11 @@ bool InputParser::parse_escape_sequence(const std::string& input, Event& out, si
     }
     
     // SS3 sequences (F1-F4 on some terminals)
-    if (input[1] == 'O' && input.size() >= 3) {
+    if (input[1] == 'O' && input.size() < 3) {
+        consumed = 0;
+        return false;
+    }
+    if (input[1] == 'O') {
         out.type = EventType::KEY;
         switch (input[2]) {
             case 'P': out.key = {KEY_F1, false, false, false}; break;
@@ -81,7 +111,7 @@ bool InputParser::parse_escape_sequence(const std::string& input, Event& out, si
     return true;
 }
 
-bool InputParser::parse_csi_sequence(const std::string& input, Event& out, size_t& consumed) {
+bool InputParser::parse_csi_sequence(std::string_view input, Event& out, size_t& consumed) {
     // Looking for CSI sequences: \x1b[...
     if (input.size() < 3) {
         consumed = 0;
@@ -109,6 +139,16 @@ bool InputParser::parse_csi_sequence(const std::string& input, Event& out, size_
     char final_byte = input[end];
     consumed = end + 1;
     
+    // Mode report: \x1b[?2026;2$y
+    if (final_byte == 'y' && input[2] == '?' && input[end - 1] == '$') {
+        std::string params(input.begin() + 3, input.begin() + end - 1);
+        int mode = 0, value = 0;
+        if (std::sscanf(params.c_str(), "%d;%d", &mode, &value) != 2) return false;
+        out.type = EventType::MODE_REPORT;
+        out.mode = {mode, value};
+        return true;
+    }
+    
     out.type = EventType::KEY;
     out.key = {0, false, false, false};
     
@@ -151,7 +191,7 @@ bool InputParser::parse_csi_sequence(const std::string& input, Event& out, size_
     return out.key.key != 0;
 }
 
-bool InputParser::parse_mouse_sgr(const std::string& input, Event& out, size_t& consumed) {
+bool InputParser::parse_mouse_sgr(std::string_view input, Event& out, size_t& consumed) {
     // SGR format: \x1b[<Btn;X;Y[mM]
     // Find the terminator (m=release, M=press)
     size_t end = 3;
@@ -213,4 +253,107 @@ bool InputParser::parse_mouse_sgr(const std::string& input, Event& out, size_t&
     return true;
 }
 
+static const std::string_view PASTE_START = "\x1b[200~";
+static const std::string_view PASTE_END = "\x1b[201~";
+
+void InputQueue::feed(const char* data, size_t len) {
+    pending_.append(data, len);
+    parse_pending();
+}
+
+void InputQueue::parse_pending() {
+    size_t pos = 0;
+    while (pos < pending_.size()) {
+        std::string_view rest(pending_.data() + pos, pending_.size() - pos);
+        
+        if (in_paste_) {
+            size_t end = rest.find(PASTE_END);
+            if (end == std::string_view::npos) {
+                // Hold back what could be the start of the end marker
+                size_t take = rest.size() - std::min(rest.size(), PASTE_END.size() - 1);
+                paste_.append(rest.data(), take);
+                pos += take;
+                break;
+            }
+            paste_.append(rest.data(), end);
+            pos += end + PASTE_END.size();
+            in_paste_ = false;
+            push_paste();
+            continue;
+        }
+        
+        if (rest.substr(0, PASTE_START.size()) == PASTE_START) {
+            in_paste_ = true;
+            paste_.clear();
+            pos += PASTE_START.size();
+            continue;
+        }
+        
+        // Possibly the start of an escape sequence; see flush_escape()
+        if (rest.size() == 1 && rest[0] == 0x1b) break;
+        
+        Event event;
+        size_t consumed = 0;
+        if (parser_.parse(rest, event, consumed)) {
+            push(std::move(event));
+        }
+        if (consumed == 0) break;  // Incomplete sequence
+        pos += consumed;
+    }
+    pending_.erase(0, pos);
+}
+
+bool InputQueue::escape_pending() const {
+    return !in_paste_ && !pending_.empty() && pending_[0] == 0x1b;
+}
+
+void InputQueue::flush_escape() {
+    if (!escape_pending()) return;
+    Event event;
+    event.type = EventType::KEY;
+    event.key = {KEY_ESCAPE, false, false, false};
+    push(std::move(event));
+    pending_.erase(0, 1);
+    parse_pending();
+}
+
+void InputQueue::push_paste() {
+    // Terminals send line breaks in pasted text as CR
+    Event event;
+    event.type = EventType::PASTE;
+    event.text.reserve(paste_.size());
+    for (size_t i = 0; i < paste_.size(); i++) {
+        char c = paste_[i];
+        if (c == '\r') {
+            if (i + 1 < paste_.size() && paste_[i + 1] == '\n') i++;
+            c = '\n';
+        }
+        event.text += c;
+    }
+    paste_.clear();
+    push(std::move(event));
+}
+
+void InputQueue::push(Event&& event) {
+    if (count_ == ring_.size()) {
+        // Full: grow and unroll so the oldest event is at index 0
+        std::vector<Event> bigger(std::max<size_t>(64, ring_.size() * 2));
+        for (size_t i = 0; i < count_; i++) {
+            bigger[i] = std::move(ring_[(head_ + i) % ring_.size()]);
+        }
+        ring_.swap(bigger);
+        head_ = 0;
+    }
+    ring_[(head_ + count_) % ring_.size()] = std::move(event);
+    count_++;
+}
+
+bool InputQueue::pop(Event& out) {
+    if (count_ == 0) return false;
+    out = std::move(ring_[head_]);
+    head_ = (head_ + 1) % ring_.size();
+    count_--;
+    return true;
+}
+
 }  // namespace catvim
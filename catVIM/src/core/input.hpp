@@ -1,6 +1,8 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <vector>
 #include <cstdint>
 
 namespace catvim {
@@ -9,7 +11,9 @@ enum class EventType {
     NONE,
     KEY,
     MOUSE,
-    RESIZE
+    RESIZE,
+    PASTE,
+    MODE_REPORT  // Terminal's reply to a DECRQM query, not user input
 };
 
 enum class MouseButton {
@@ -33,6 +37,7 @@ struct KeyEvent {
     bool ctrl = false;
     bool alt = false;
     bool shift = false;
+    char32_t ch = 0;   // The character, when key is KEY_CHAR
 };
 
 struct MouseEvent {
@@ -44,12 +49,21 @@ struct MouseEvent {
     bool shift = false;
 };
 
+// DECRPM: \x1b[?<mode>;<value>$y
+// value: 0 = not recognized, 1 = set, 2 = reset, 3/4 = permanently set/reset
+struct ModeReport {
+    int mode;
+    int value;
+};
+
 struct Event {
     EventType type = EventType::NONE;
     union {
         KeyEvent key;
         MouseEvent mouse;
+        ModeReport mode;
     };
+    std::string text;  // PASTE only
     
     Event() : type(EventType::NONE) {}
 };
@@ -71,19 +85,51 @@ enum SpecialKey {
     KEY_INSERT,
     KEY_DELETE,
     KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5, KEY_F6,
-    KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_F11, KEY_F12
+    KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_F11, KEY_F12,
+    KEY_CHAR  // A non-ASCII character, typed as UTF-8
 };
 
 class InputParser {
 public:
     // Parse input bytes into an event
-    // Returns true if a complete event was parsed
-    bool parse(const std::string& input, Event& out, size_t& consumed);
+    // Returns true if a complete event was parsed. On false, `consumed` is
+    // the number of bytes to skip (an unrecognized sequence), or 0 when the
+    // input ends inside a sequence and more bytes are needed.
+    bool parse(std::string_view input, Event& out, size_t& consumed);
+
+private:
+    bool parse_escape_sequence(std::string_view input, Event& out, size_t& consumed);
+    bool parse_mouse_sgr(std::string_view input, Event& out, size_t& consumed);
+    bool parse_csi_sequence(std::string_view input, Event& out, size_t& consumed);
+};
+
+// Terminal bytes in, events out. Bytes that don't form a complete sequence
+// yet stay buffered until the next feed(), so nothing read from the terminal
+// is lost. Parsed events wait in a ring buffer until Lua drains them.
+class InputQueue {
+public:
+    void feed(const char* data, size_t len);
+    bool pop(Event& out);
+    size_t size() const { return count_; }
+    
+    // A lone ESC is held back in case the rest of an escape sequence is
+    // still in flight; call this once the ESC timeout has passed
+    bool escape_pending() const;
+    void flush_escape();
 
 private:
-    bool parse_escape_sequence(const std::string& input, Event& out, size_t& consumed);
-    bool parse_mouse_sgr(const std::string& input, Event& out, size_t& consumed);
-    bool parse_csi_sequence(const std::string& input, Event& out, size_t& consumed);
+    InputParser parser_;
+    std::string pending_;   // Unparsed bytes
+    bool in_paste_ = false;  // Between \x1b[200~ and \x1b[201~
+    std::string paste_;
+    
+    std::vector<Event> ring_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    
+    void parse_pending();
+    void push(Event&& event);
+    void push_paste();
 };
 
 }  // namespace catvim
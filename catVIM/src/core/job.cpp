@@ -0,0 +1,190 @@
+#include "job.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace catvim {
+
+Job::~Job() {
+    close_fd(in_);
+    close_fd(out_[STDOUT]);
+    close_fd(out_[STDERR]);
+    // Whoever drops a running job loses interest in it; don't leave a zombie
+    if (pid_ > 0 && !exited_) {
+        signal(SIGKILL);
+        wait();
+    }
+}
+
+void Job::close_fd(int& fd) {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+bool Job::start(const std::vector<std::string>& argv, const std::string& cwd, bool with_stdin,
+                std::string& error) {
+    if (argv.empty()) {
+        error = "Empty command";
+        return false;
+    }
+    // [stdin, stdout, stderr] x [read end, write end]
+    int fds[3][2] = {{-1, -1}, {-1, -1}, {-1, -1}};
+    auto fail = [&](const char* what, int err) {
+        for (auto& p : fds) {
+            for (int fd : p) {
+                if (fd >= 0) close(fd);
+            }
+        }
+        error = std::string(what) + ": " + std::strerror(err);
+        return false;
+    };
+    for (int i = with_stdin ? 0 : 1; i < 3; i++) {
+        if (pipe2(fds[i], O_CLOEXEC) != 0) return fail("pipe", errno);
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (with_stdin) {
+        posix_spawn_file_actions_adddup2(&actions, fds[0][0], STDIN_FILENO);
+    } else {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    }
+    posix_spawn_file_actions_adddup2(&actions, fds[1][1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fds[2][1], STDERR_FILENO);
+    if (!cwd.empty()) posix_spawn_file_actions_addchdir_np(&actions, cwd.c_str());
+
+    // The editor blocks the signals its event loop reads (SIGWINCH,
+    // SIGCHLD) and ignores SIGPIPE; the child must not inherit either
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t none, all;
+    sigemptyset(&none);
+    sigfillset(&all);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &all);
+    // A group of its own, so signal() reaches whatever the command started
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+    std::vector<char*> args;
+    for (const std::string& a : argv) args.push_back(const_cast<char*>(a.c_str()));
+    args.push_back(nullptr);
+    int err = posix_spawnp(&pid_, args[0], &actions, &attr, args.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0) {
+        pid_ = -1;
+        return fail(argv[0].c_str(), err);
+    }
+
+    // Keep our ends, close the child's
+    in_ = fds[0][1];
+    out_[STDOUT] = fds[1][0];
+    out_[STDERR] = fds[2][0];
+    for (int fd : {fds[0][0], fds[1][1], fds[2][1]}) {
+        if (fd >= 0) close(fd);
+    }
+    for (int fd : {in_, out_[STDOUT], out_[STDERR]}) {
+        if (fd >= 0) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    return true;
+}
+
+bool Job::read(Stream s, std::string& out) {
+    int& fd = out_[s];
+    if (fd < 0) return false;
+    char buf[65536];
+    for (;;) {
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            out.append(buf, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return true;
+        close_fd(fd);
+        return false;
+    }
+}
+
+bool Job::write(const char* data, size_t len) {
+    if (in_ < 0 || close_input_) return false;
+    pending_.append(data, len);
+    flush_input();
+    return true;
+}
+
+bool Job::flush_input() {
+    while (in_ >= 0 && pending_pos_ < pending_.size()) {
+        ssize_t n = ::write(in_, pending_.data() + pending_pos_, pending_.size() - pending_pos_);
+        if (n > 0) {
+            pending_pos_ += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            return false;
+        } else {
+            // The child closed its stdin; what's left can't be delivered
+            close_fd(in_);
+        }
+    }
+    pending_.clear();
+    pending_pos_ = 0;
+    if (close_input_) close_fd(in_);
+    return true;
+}
+
+void Job::close_input() {
+    close_input_ = true;
+    if (pending_.empty()) close_fd(in_);
+}
+
+bool Job::signal(int signo) {
+    if (pid_ <= 0 || exited_) return false;
+    return kill(-pid_, signo) == 0 || kill(pid_, signo) == 0;
+}
+
+void Job::set_status(int status) {
+    exited_ = true;
+    if (WIFSIGNALED(status)) {
+        term_signal_ = WTERMSIG(status);
+        exit_code_ = -1;
+    } else {
+        exit_code_ = WEXITSTATUS(status);
+    }
+}
+
+bool Job::reap() {
+    if (pid_ <= 0 || exited_) return exited_;
+    int status;
+    pid_t r = waitpid(pid_, &status, WNOHANG);
+    if (r == pid_) {
+        set_status(status);
+    } else if (r < 0 && errno == ECHILD) {
+        // Reaped elsewhere; the status is lost
+        exited_ = true;
+    }
+    return exited_;
+}
+
+void Job::wait() {
+    if (pid_ <= 0 || exited_) return;
+    int status;
+    pid_t r;
+    while ((r = waitpid(pid_, &status, 0)) < 0 && errno == EINTR) {}
+    if (r == pid_) {
+        set_status(status);
+    } else {
+        exited_ = true;
+    }
+}
+
+}  // namespace catvim
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+namespace catvim {
+
+// A child process that runs without blocking the editor. It is started
+// with posix_spawn in a process group of its own, with stdout and stderr
+// (and optionally stdin) connected to non-blocking pipes; the caller
+// watches the fds in its event loop and reads or writes when they are
+// ready. The child starts with default signal dispositions and nothing
+// blocked, whatever the editor itself has blocked or ignored.
+class Job {
+public:
+    enum Stream { STDOUT, STDERR };
+
+    Job() = default;
+    ~Job();
+    Job(const Job&) = delete;
+    Job& operator=(const Job&) = delete;
+
+    // argv[0] is looked up in PATH. `cwd` may be empty.
+    bool start(const std::vector<std::string>& argv, const std::string& cwd, bool with_stdin,
+               std::string& error);
+
+    pid_t pid() const { return pid_; }
+    int output_fd(Stream s) const { return out_[s]; }
+    int input_fd() const { return in_; }
+
+    // Appends what can be read from `s` right now to out. Returns false
+    // once the stream is at its end; it is closed then.
+    bool read(Stream s, std::string& out);
+    void close_output(Stream s) { close_fd(out_[s]); }
+
+    // Queues data for the child's stdin; false if stdin is closed
+    bool write(const char* data, size_t len);
+    // Writes as much queued input as the pipe takes; true when none is left
+    bool flush_input();
+    bool input_pending() const { return !pending_.empty(); }
+    // Closes stdin once the queued input is written
+    void close_input();
+
+    // Signals the whole process group
+    bool signal(int signo);
+
+    // Collects the exit status without waiting; true once the child exited
+    bool reap();
+    // Waits for the child to exit
+    void wait();
+    bool exited() const { return exited_; }
+    int exit_code() const { return exit_code_; }      // -1 if killed by a signal
+    int term_signal() const { return term_signal_; }  // 0 if it exited normally
+
+private:
+    pid_t pid_ = -1;
+    int in_ = -1;
+    int out_[2] = {-1, -1};
+    std::string pending_;
+    size_t pending_pos_ = 0;
+    bool close_input_ = false;
+    bool exited_ = false;
+    int exit_code_ = -1;
+    int term_signal_ = 0;
+
+    void close_fd(int& fd);
+    void set_status(int status);
+};
+
+}  // namespace catvim
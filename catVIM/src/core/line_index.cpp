@@ -0,0 +1,149 @@
+#include "line_index.hpp"
+#include "worker_thread.hpp"
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CATVIM_X86 1
+#endif
+
+namespace catvim {
+
+// Bit i is set where s[i] == '\n', for 64 bytes. The scan is bound by
+// reading the file, so SSE2 (always there on x86-64) is all it needs.
+#ifdef CATVIM_X86
+static inline uint64_t lf_mask(const char* s) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i * 16));
+        mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)))) << (i * 16);
+    }
+    return mask;
+}
+#else
+static inline uint64_t lf_mask(const char* s) {
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; i++) {
+        mask |= static_cast<uint64_t>(s[i] == '\n') << i;
+    }
+    return mask;
+}
+#endif
+
+// Position of the nth (0-based) set bit of mask (nth < popcount)
+static inline size_t nth_bit(uint64_t mask, size_t nth) {
+    for (; nth; nth--) mask &= mask - 1;
+    return __builtin_ctzll(mask);
+}
+
+size_t count_newlines(const char* s, size_t n) {
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        count += __builtin_popcountll(lf_mask(s + i));
+    }
+    return count + std::count(s + i, s + n, '\n');
+}
+
+LineIndex::~LineIndex() {
+    stop_ = true;
+    if (thread_.joinable()) thread_.join();
+}
+
+void LineIndex::start(const char* data, size_t head, size_t end) {
+    data_ = data;
+    end_ = end;
+    Scan first;
+    first.marks.push_back(first.last);
+    scan(first, std::min(head, end));
+    marks_.swap(first.marks);
+    indexed_ = published_.indexed = first.indexed;
+    count_ = published_.count = first.count;
+    ready_ = published_.ready = first.ready;
+    if (!done()) {
+        thread_ = start_worker(&LineIndex::run, this, std::move(first));
+    }
+}
+
+// Indexing thread
+void LineIndex::run(Scan progress) {
+    // Small enough that progress shows often and destruction doesn't wait
+    const size_t CHUNK = 4 << 20;
+    while (progress.indexed < end_ && !stop_) {
+        scan(progress, std::min(end_, progress.indexed + CHUNK));
+        std::lock_guard<std::mutex> lock(mutex_);
+        published_.marks.insert(published_.marks.end(), progress.marks.begin(), progress.marks.end());
+        progress.marks.clear();
+        published_.indexed = progress.indexed;
+        published_.count = progress.count;
+        published_.ready = progress.ready;
+    }
+}
+
+void LineIndex::scan(Scan& progress, size_t to) const {
+    size_t i = progress.indexed;
+    size_t count = progress.count;
+    Checkpoint& last = progress.last;
+    for (; i + 64 <= to; i += 64) {
+        // Checkpoints go at block boundaries, so up to 63 lines past STRIDE
+        if (count - last.count >= STRIDE || i - last.offset >= SPAN) {
+            last = {i, count};
+            progress.marks.push_back(last);
+        }
+        uint64_t mask = lf_mask(data_ + i);
+        if (!mask) continue;
+        count += __builtin_popcountll(mask);
+        progress.ready = i + 64 - __builtin_clzll(mask);
+    }
+    for (; i < to; i++) {
+        if (data_[i] != '\n') continue;
+        count++;
+        progress.ready = i + 1;
+    }
+    progress.indexed = to;
+    progress.count = count;
+}
+
+// UI thread
+bool LineIndex::poll() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (published_.indexed == indexed_) return false;
+    marks_.insert(marks_.end(), published_.marks.begin(), published_.marks.end());
+    published_.marks.clear();
+    indexed_ = published_.indexed;
+    count_ = published_.count;
+    ready_ = published_.ready;
+    return true;
+}
+
+size_t LineIndex::rank(size_t offset) const {
+    // Count on from the last checkpoint at or before offset
+    auto it = std::upper_bound(marks_.begin(), marks_.end(), offset, [](size_t off, const Checkpoint& c) {
+        return off < c.offset;
+    });
+    const Checkpoint& from = *(it - 1);
+    return from.count + count_newlines(data_ + from.offset, offset - from.offset);
+}
+
+size_t LineIndex::select(size_t k) const {
+    // The last checkpoint with at most k '\n's before it
+    auto it = std::upper_bound(marks_.begin(), marks_.end(), k, [](size_t n, const Checkpoint& c) {
+        return n < c.count;
+    });
+    size_t at = (it - 1)->offset;
+    size_t need = k - (it - 1)->count + 1;  // '\n's to pass, counting the one wanted
+    for (; at + 64 <= indexed_; at += 64) {
+        uint64_t mask = lf_mask(data_ + at);
+        size_t n = __builtin_popcountll(mask);
+        if (need <= n) return at + nth_bit(mask, need - 1);
+        need -= n;
+    }
+    for (; at < indexed_; at++) {
+        if (data_[at] == '\n' && --need == 0) return at;
+    }
+    return indexed_;
+}
+
+}  // namespace catvim
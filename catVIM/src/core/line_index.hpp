@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace catvim {
+
+// '\n' bytes in s[0, n)
+size_t count_newlines(const char* s, size_t n);
+
+// Line feed index for text too large to index before showing it (see
+// TextBuffer::load). Instead of every '\n' it keeps a checkpoint every
+// STRIDE lines or SPAN bytes, whichever comes first, so a 5 GB file of
+// 100M lines needs about 6 MB; lookups count from the nearest checkpoint.
+// The first part of the text is indexed by start() itself and the rest by
+// a background thread, which poll() collects from.
+class LineIndex {
+public:
+    static constexpr size_t STRIDE = 256;
+    static constexpr size_t SPAN = 64 * 1024;
+
+    LineIndex() = default;
+    LineIndex(const LineIndex&) = delete;
+    LineIndex& operator=(const LineIndex&) = delete;
+    ~LineIndex();
+
+    // Indexes data[0, head) now and data[head, end) on a background thread.
+    // data must stay valid until the index is destroyed.
+    void start(const char* data, size_t head, size_t end);
+
+    // Takes what the thread indexed since the last call; false if nothing
+    bool poll();
+
+    bool done() const { return indexed_ == end_; }
+    size_t indexed() const { return indexed_; }  // data[0, indexed()) is covered
+    size_t end() const { return end_; }
+    size_t count() const { return count_; }      // '\n's in the covered part
+    // Offset just past the last '\n' found, i.e. where the first line that
+    // is not known to be complete starts
+    size_t ready() const { return ready_; }
+
+    // '\n's in data[0, offset), offset <= indexed()
+    size_t rank(size_t offset) const;
+    // Offset of '\n' number k (0-based), k < count()
+    size_t select(size_t k) const;
+
+    size_t memory_bytes() const { return marks_.capacity() * sizeof(Checkpoint); }
+
+private:
+    // There are `count` '\n's before `offset`
+    struct Checkpoint {
+        size_t offset;
+        size_t count;
+    };
+
+    // Progress of a scan; the thread keeps its own and publishes it
+    struct Scan {
+        size_t indexed = 0;
+        size_t count = 0;
+        size_t ready = 0;
+        Checkpoint last{0, 0};
+        std::vector<Checkpoint> marks;  // Found since last published
+    };
+
+    const char* data_ = nullptr;
+    size_t end_ = 0;
+    size_t indexed_ = 0;
+    size_t count_ = 0;
+    size_t ready_ = 0;
+    std::vector<Checkpoint> marks_;  // Ascending in both fields
+
+    std::thread thread_;
+    std::atomic<bool> stop_{false};
+    std::mutex mutex_;
+    Scan published_;  // Guarded by mutex_; marks not yet taken by poll()
+
+    void run(Scan scan);
+    void scan(Scan& scan, size_t to) const;
+};
+
+}  // namespace catvim
@@ -1,10 +1,14 @@
 #include "lua_bindings.hpp"
-#include <fstream>
-#include <sstream>
+#include "embedded_lua.hpp"
+#include "unicode.hpp"
+#include <new>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <cstdlib>
 #include <cstring>
+#include <csignal>
+#include <cerrno>
+#include <poll.h>
 #include <unistd.h>
 
 namespace catvim {
@@ -12,6 +16,53 @@ namespace catvim {
 static LuaBindings* g_instance = nullptr;
 static bool g_should_quit = false;
 
+static const char* TEXT_BUFFER_MT = "catvim.TextBuffer";
+
+static const char* SEARCH_MT = "catvim.Search";
+static const char* GREP_MT = "catvim.Grep";
+static const char* WORD_INDEX_MT = "catvim.WordIndex";
+static const char* DIR_TREE_MT = "catvim.DirTree";
+static const char* JOB_MT = "catvim.Job";
+static const char* GC_SENTINEL_MT = "catvim.GcSentinel";
+
+// An unreferenced userdata whose finalizer counts a GC cycle and leaves
+// the next one behind: the collector frees one per cycle
+static void new_gc_sentinel(lua_State* L) {
+    lua_newuserdata(L, 0);
+    luaL_getmetatable(L, GC_SENTINEL_MT);
+    lua_setmetatable(L, -2);
+    lua_pop(L, 1);
+}
+
+static std::shared_ptr<TextBuffer>& check_text(lua_State* L, int idx = 1) {
+    return *static_cast<std::shared_ptr<TextBuffer>*>(luaL_checkudata(L, idx, TEXT_BUFFER_MT));
+}
+
+static Search& check_search(lua_State* L, int idx = 1) {
+    return **static_cast<Search**>(luaL_checkudata(L, idx, SEARCH_MT));
+}
+
+static Grep& check_grep(lua_State* L, int idx = 1) {
+    return **static_cast<Grep**>(luaL_checkudata(L, idx, GREP_MT));
+}
+
+static WordIndex& check_words(lua_State* L, int idx = 1) {
+    return **static_cast<WordIndex**>(luaL_checkudata(L, idx, WORD_INDEX_MT));
+}
+
+static DirTree& check_tree(lua_State* L, int idx = 1) {
+    return **static_cast<DirTree**>(luaL_checkudata(L, idx, DIR_TREE_MT));
+}
+
+static Job& check_job(lua_State* L, int idx = 1) {
+    return **static_cast<Job**>(luaL_checkudata(L, idx, JOB_MT));
+}
+
+// Lua lines/columns are 1-based; anything below 1 maps to an out-of-range index
+static size_t to_index(lua_Integer n) {
+    return n >= 1 ? static_cast<size_t>(n - 1) : static_cast<size_t>(-1);
+}
+
 LuaBindings* LuaBindings::instance() {
     return g_instance;
 }
@@ -22,6 +73,7 @@ LuaBindings::LuaBindings() {
 
 LuaBindings::~LuaBindings() {
     if (L_) {
+        closing_ = true;
         lua_close(L_);
     }
     g_instance = nullptr;
@@ -33,12 +85,26 @@ bool LuaBindings::init() {
     
     luaL_openlibs(L_);
     register_functions();
+    new_gc_sentinel(L_);
+    
+    std::string error;
+    if (!loop_.init(error)) {
+        fprintf(stderr, "Event loop: %s\n", error.c_str());
+        return false;
+    }
+    // Before init.lua runs, which may already start threads (opening a
+    // large file starts its line index)
+    loop_.on_signal(SIGWINCH, [this]() { dispatch_resize(); });
+    init_jobs();
     
     // Initialize terminal
     terminal_.enter_raw_mode();
     terminal_.enable_alternate_screen();
     terminal_.enable_mouse();
+    terminal_.enable_bracketed_paste();
     terminal_.hide_cursor();
+    terminal_.query_synchronized_output();
+    terminal_.flush();
     
     // Initialize renderer with terminal size
     Vec2 size = terminal_.get_size();
@@ -56,22 +122,39 @@ void LuaBindings::register_functions() {
     lua_pushcfunction(L_, lua_term_size); lua_setfield(L_, -2, "size");
     lua_pushcfunction(L_, lua_term_write); lua_setfield(L_, -2, "write");
     lua_pushcfunction(L_, lua_term_read); lua_setfield(L_, -2, "read");
+    lua_pushcfunction(L_, lua_term_events); lua_setfield(L_, -2, "events");
     lua_pushcfunction(L_, lua_term_clear); lua_setfield(L_, -2, "clear");
     lua_pushcfunction(L_, lua_term_move); lua_setfield(L_, -2, "move");
     lua_pushcfunction(L_, lua_term_show_cursor); lua_setfield(L_, -2, "show_cursor");
     lua_pushcfunction(L_, lua_term_hide_cursor); lua_setfield(L_, -2, "hide_cursor");
     lua_setfield(L_, -2, "term");
     
+    // catvim.loop
+    lua_newtable(L_);
+    lua_pushcfunction(L_, lua_loop_timer); lua_setfield(L_, -2, "timer");
+    lua_pushcfunction(L_, lua_loop_cancel); lua_setfield(L_, -2, "cancel");
+    lua_pushcfunction(L_, lua_loop_now); lua_setfield(L_, -2, "now");
+    lua_setfield(L_, -2, "loop");
+    
     // catvim.render
     lua_newtable(L_);
+    lua_pushcfunction(L_, lua_render_style); lua_setfield(L_, -2, "style");
     lua_pushcfunction(L_, lua_render_set); lua_setfield(L_, -2, "set");
     lua_pushcfunction(L_, lua_render_string); lua_setfield(L_, -2, "string");
+    lua_pushcfunction(L_, lua_render_line); lua_setfield(L_, -2, "line");
     lua_pushcfunction(L_, lua_render_clear); lua_setfield(L_, -2, "clear");
     lua_pushcfunction(L_, lua_render_flush); lua_setfield(L_, -2, "flush");
     lua_pushcfunction(L_, lua_render_box); lua_setfield(L_, -2, "box");
     lua_pushcfunction(L_, lua_render_resize); lua_setfield(L_, -2, "resize");
     lua_setfield(L_, -2, "render");
     
+    // catvim.utf8 (display columns of UTF-8 text)
+    lua_newtable(L_);
+    lua_pushcfunction(L_, lua_utf8_width); lua_setfield(L_, -2, "width");
+    lua_pushcfunction(L_, lua_utf8_col); lua_setfield(L_, -2, "col");
+    lua_pushcfunction(L_, lua_utf8_byte); lua_setfield(L_, -2, "byte");
+    lua_setfield(L_, -2, "utf8");
+    
     // catvim.fs
     lua_newtable(L_);
     lua_pushcfunction(L_, lua_fs_read); lua_setfield(L_, -2, "read");
@@ -79,8 +162,154 @@ void LuaBindings::register_functions() {
     lua_pushcfunction(L_, lua_fs_list); lua_setfield(L_, -2, "list");
     lua_pushcfunction(L_, lua_fs_exists); lua_setfield(L_, -2, "exists");
     lua_pushcfunction(L_, lua_fs_isdir); lua_setfield(L_, -2, "isdir");
+    lua_pushcfunction(L_, lua_fs_id); lua_setfield(L_, -2, "id");
+    lua_pushcfunction(L_, lua_fs_tree); lua_setfield(L_, -2, "tree");
     lua_setfield(L_, -2, "fs");
     
+    // catvim.profile
+    lua_newtable(L_);
+    lua_pushcfunction(L_, lua_profile_stats); lua_setfield(L_, -2, "stats");
+    lua_pushcfunction(L_, lua_profile_dump); lua_setfield(L_, -2, "dump");
+    lua_pushcfunction(L_, lua_profile_render_begin); lua_setfield(L_, -2, "render_begin");
+    lua_setfield(L_, -2, "profile");
+    luaL_newmetatable(L_, GC_SENTINEL_MT);
+    lua_pushcfunction(L_, lua_gc_sentinel); lua_setfield(L_, -2, "__gc");
+    lua_pop(L_, 1);
+    
+    // catvim.fs.tree (cached directory tree read in the background)
+    static const luaL_Reg tree_methods[] = {
+        {"expand", lua_tree_expand},
+        {"count", lua_tree_count},
+        {"rows", lua_tree_rows},
+        {"find", lua_tree_find},
+        {nullptr, nullptr}
+    };
+    luaL_newmetatable(L_, DIR_TREE_MT);
+    lua_newtable(L_);
+    luaL_setfuncs(L_, tree_methods, 0);
+    lua_setfield(L_, -2, "__index");
+    lua_pushcfunction(L_, lua_tree_gc); lua_setfield(L_, -2, "__gc");
+    lua_pop(L_, 1);
+    
+    // catvim.text (piece table buffers)
+    static const luaL_Reg text_methods[] = {
+        {"line_count", lua_text_line_count},
+        {"length", lua_text_length},
+        {"line", lua_text_line},
+        {"line_length", lua_text_line_length},
+        {"set_line", lua_text_set_line},
+        {"insert_line", lua_text_insert_line},
+        {"delete_line", lua_text_delete_line},
+        {"insert", lua_text_insert},
+        {"erase", lua_text_erase},
+        {"get_text", lua_text_get_text},
+        {"set_text", lua_text_set_text},
+        {"load", lua_text_load},
+        {"save", lua_text_save},
+        {"undo", lua_text_undo},
+        {"redo", lua_text_redo},
+        {"undo_mark", lua_text_undo_mark},
+        {"begin_transaction", lua_text_begin_transaction},
+        {"end_transaction", lua_text_end_transaction},
+        {"set_undo_budget", lua_text_set_undo_budget},
+        {"undo_bytes", lua_text_undo_bytes},
+        {"mark_saved", lua_text_mark_saved},
+        {"is_modified", lua_text_is_modified},
+        {"large", lua_text_large},
+        {"pending_line", lua_text_pending_line},
+        {"update_index", lua_text_update_index},
+        {"unload", lua_text_unload},
+        {"reload", lua_text_reload},
+        {"unloaded", lua_text_unloaded},
+        {"spill_undo", lua_text_spill_undo},
+        {"memory", lua_text_memory},
+        {nullptr, nullptr}
+    };
+    luaL_newmetatable(L_, TEXT_BUFFER_MT);
+    lua_newtable(L_);
+    luaL_setfuncs(L_, text_methods, 0);
+    lua_setfield(L_, -2, "__index");
+    lua_pushcfunction(L_, lua_text_gc); lua_setfield(L_, -2, "__gc");
+    lua_pop(L_, 1);
+    
+    lua_newtable(L_);
+    lua_pushcfunction(L_, lua_text_new); lua_setfield(L_, -2, "new");
+    lua_setfield(L_, -2, "text");
+    
+    // catvim.search (incremental search over a text buffer)
+    static const luaL_Reg search_methods[] = {
+        {"find", lua_search_find},
+        {"find_step", lua_search_find_step},
+        {"count_step", lua_search_count_step},
+        {"index", lua_search_index},
+        {"line_matches", lua_search_line_matches},
+        {nullptr, nullptr}
+    };
+    luaL_newmetatable(L_, SEARCH_MT);
+    lua_newtable(L_);
+    luaL_setfuncs(L_, search_methods, 0);
+    lua_setfield(L_, -2, "__index");
+    lua_pushcfunction(L_, lua_search_gc); lua_setfield(L_, -2, "__gc");
+    lua_pop(L_, 1);
+    
+    lua_newtable(L_);
+    lua_pushcfunction(L_, lua_search_new); lua_setfield(L_, -2, "new");
+    lua_setfield(L_, -2, "search");
+    
+    // catvim.grep (parallel search through a directory tree)
+    static const luaL_Reg grep_methods[] = {
+        {"cancel", lua_grep_cancel},
+        {"files", lua_grep_files},
+        {nullptr, nullptr}
+    };
+    luaL_newmetatable(L_, GREP_MT);
+    lua_newtable(L_);
+    luaL_setfuncs(L_, grep_methods, 0);
+    lua_setfield(L_, -2, "__index");
+    lua_pushcfunction(L_, lua_grep_gc); lua_setfield(L_, -2, "__gc");
+    lua_pop(L_, 1);
+    
+    lua_newtable(L_);
+    lua_pushcfunction(L_, lua_grep_start); lua_setfield(L_, -2, "start");
+    lua_setfield(L_, -2, "grep");
+    
+    // catvim.words (word index for completion)
+    static const luaL_Reg words_methods[] = {
+        {"complete", lua_words_complete},
+        {"size", lua_words_size},
+        {nullptr, nullptr}
+    };
+    luaL_newmetatable(L_, WORD_INDEX_MT);
+    lua_newtable(L_);
+    luaL_setfuncs(L_, words_methods, 0);
+    lua_setfield(L_, -2, "__index");
+    lua_pushcfunction(L_, lua_words_gc); lua_setfield(L_, -2, "__gc");
+    lua_pop(L_, 1);
+    
+    lua_newtable(L_);
+    lua_pushcfunction(L_, lua_words_new); lua_setfield(L_, -2, "new");
+    lua_setfield(L_, -2, "words");
+    
+    // catvim.job (child processes run from the event loop)
+    static const luaL_Reg job_methods[] = {
+        {"write", lua_job_write},
+        {"close", lua_job_close},
+        {"kill", lua_job_kill},
+        {"pid", lua_job_pid},
+        {"running", lua_job_running},
+        {nullptr, nullptr}
+    };
+    luaL_newmetatable(L_, JOB_MT);
+    lua_newtable(L_);
+    luaL_setfuncs(L_, job_methods, 0);
+    lua_setfield(L_, -2, "__index");
+    lua_pushcfunction(L_, lua_job_gc); lua_setfield(L_, -2, "__gc");
+    lua_pop(L_, 1);
+    
+    lua_newtable(L_);
+    lua_pushcfunction(L_, lua_job_start); lua_setfield(L_, -2, "start");
+    lua_setfield(L_, -2, "job");
+    
     // catvim.exec, catvim.quit
     lua_pushcfunction(L_, lua_exec); lua_setfield(L_, -2, "exec");
     lua_pushcfunction(L_, lua_quit); lua_setfield(L_, -2, "quit");
@@ -102,6 +331,63 @@ bool LuaBindings::load_file(const char* path) {
     return true;
 }
 
+// Loads an embedded module, with the chunk named after its source file
+static int load_embedded_chunk(lua_State* L, const EmbeddedLua& module) {
+    std::string chunkname = std::string("@src/lua/") + module.path;
+    return luaL_loadbuffer(L, reinterpret_cast<const char*>(module.data), module.size, chunkname.c_str());
+}
+
+// package.searchers entry: a loader for an embedded module, or why not
+static int embedded_searcher(lua_State* L) {
+    const char* name = luaL_checkstring(L, 1);
+    const EmbeddedLua* module = find_embedded_lua(name);
+    if (!module) {
+        lua_pushfstring(L, "\n\tno embedded module '%s'", name);
+        return 1;
+    }
+    if (load_embedded_chunk(L, *module) != 0) {
+        return luaL_error(L, "error loading module '%s': %s", name, lua_tostring(L, -1));
+    }
+    return 1;
+}
+
+void LuaBindings::use_embedded_modules() {
+    lua_getglobal(L_, "package");
+    lua_getfield(L_, -1, "searchers");
+    if (lua_isnil(L_, -1)) {
+        lua_pop(L_, 1);
+        lua_getfield(L_, -1, "loaders");  // Lua 5.1 / LuaJIT
+    }
+    // Second, after package.preload and ahead of the file searchers
+    int n = static_cast<int>(lua_rawlen(L_, -1));
+    for (int i = n; i >= 2; i--) {
+        lua_rawgeti(L_, -1, i);
+        lua_rawseti(L_, -2, i + 1);
+    }
+    lua_pushcfunction(L_, embedded_searcher);
+    lua_rawseti(L_, -2, 2);
+    lua_pop(L_, 2);
+}
+
+bool LuaBindings::load_embedded(const char* name) {
+    const EmbeddedLua* module = find_embedded_lua(name);
+    if (!module) {
+        fprintf(stderr, "No embedded module %s\n", name);
+        return false;
+    }
+    if (load_embedded_chunk(L_, *module) != 0) {
+        fprintf(stderr, "Error loading %s: %s\n", module->path, lua_tostring(L_, -1));
+        lua_pop(L_, 1);
+        return false;
+    }
+    if (lua_pcall(L_, 0, 0, 0) != 0) {
+        fprintf(stderr, "Error running %s: %s\n", module->path, lua_tostring(L_, -1));
+        lua_pop(L_, 1);
+        return false;
+    }
+    return true;
+}
+
 bool LuaBindings::call_function(const char* name, int nargs, int nresults) {
     lua_getglobal(L_, name);
     if (!lua_isfunction(L_, -1)) {
@@ -131,41 +417,26 @@ int LuaBindings::lua_term_write(lua_State* L) {
     return 0;
 }
 
-int LuaBindings::lua_term_read(lua_State* L) {
-    auto& term = instance()->terminal();
-    auto& parser = instance()->input();
-    
-    // Optional timeout argument (default 5ms for responsive feel)
-    int timeout_ms = 5;
-    if (lua_gettop(L) >= 1) {
-        timeout_ms = luaL_optinteger(L, 1, 5);
-    }
-    
-    // Wait for input with poll
-    if (!term.poll_input(timeout_ms)) {
-        lua_pushnil(L);
-        return 1;
-    }
-    
-    // Read all available bytes
-    std::string buf;
-    int c;
-    while ((c = term.read_byte()) != -1) {
-        buf += static_cast<char>(c);
-    }
-    
-    if (buf.empty()) {
-        lua_pushnil(L);
-        return 1;
+// How long a lone ESC waits for the rest of an escape sequence
+static const int ESC_TIMEOUT_MS = 25;
+// How long a replay keeps running after its last entry
+static const int REPLAY_SETTLE_MS = 250;
+
+// Waits up to timeout_ms for input and queues everything available
+static void fill_queue(Terminal& term, InputQueue& queue, int timeout_ms) {
+    if (queue.size() == 0 && term.poll_input(timeout_ms)) {
+        std::string bytes = term.read_available();
+        queue.feed(bytes.data(), bytes.size());
     }
-    
-    Event evt;
-    size_t consumed;
-    if (!parser.parse(buf, evt, consumed)) {
-        lua_pushnil(L);
-        return 1;
+    while (queue.escape_pending() && term.poll_input(ESC_TIMEOUT_MS)) {
+        std::string bytes = term.read_available();
+        if (bytes.empty()) break;
+        queue.feed(bytes.data(), bytes.size());
     }
-    
+    queue.flush_escape();
+}
+
+static void push_event(lua_State* L, const Event& evt) {
     lua_newtable(L);
     
     if (evt.type == EventType::KEY) {
@@ -179,6 +450,10 @@ int LuaBindings::lua_term_read(lua_State* L) {
         if (evt.key.key >= 32 && evt.key.key < 127) {
             char ch[2] = {static_cast<char>(evt.key.key), 0};
             lua_pushstring(L, ch); lua_setfield(L, -2, "char");
+        } else if (evt.key.key == KEY_CHAR) {
+            std::string ch;
+            append_utf8(ch, evt.key.ch);
+            lua_pushlstring(L, ch.data(), ch.size()); lua_setfield(L, -2, "char");
         }
     } else if (evt.type == EventType::MOUSE) {
         lua_pushstring(L, "mouse"); lua_setfield(L, -2, "type");
@@ -197,8 +472,54 @@ int LuaBindings::lua_term_read(lua_State* L) {
             case MouseAction::SCROLL: action = "scroll"; break;
         }
         lua_pushstring(L, action); lua_setfield(L, -2, "action");
+    } else if (evt.type == EventType::PASTE) {
+        lua_pushstring(L, "paste"); lua_setfield(L, -2, "type");
+        lua_pushlstring(L, evt.text.data(), evt.text.size()); lua_setfield(L, -2, "text");
+    }
+}
+
+// Pops the next event meant for Lua; terminal replies are handled here
+static bool pop_event(InputQueue& queue, Event& evt) {
+    while (queue.pop(evt)) {
+        if (evt.type != EventType::MODE_REPORT) return true;
+        LuaBindings::instance()->terminal().on_mode_report(evt.mode.mode, evt.mode.value);
     }
+    return false;
+}
+
+// catvim.term.read([timeout_ms]) -> one event or nil
+int LuaBindings::lua_term_read(lua_State* L) {
+    // Optional timeout argument (default 5ms for responsive feel)
+    int timeout_ms = luaL_optinteger(L, 1, 5);
+    auto& queue = instance()->input();
+    fill_queue(instance()->terminal(), queue, timeout_ms);
     
+    Event evt;
+    if (!pop_event(queue, evt)) {
+        lua_pushnil(L);
+        return 1;
+    }
+    push_event(L, evt);
+    return 1;
+}
+
+// Pushes an array of every queued event
+static void push_events(lua_State* L, InputQueue& queue) {
+    lua_createtable(L, static_cast<int>(queue.size()), 0);
+    Event evt;
+    int n = 0;
+    while (pop_event(queue, evt)) {
+        push_event(L, evt);
+        lua_rawseti(L, -2, ++n);
+    }
+}
+
+// catvim.term.events([timeout_ms]) -> array of every pending event
+int LuaBindings::lua_term_events(lua_State* L) {
+    int timeout_ms = luaL_optinteger(L, 1, 5);
+    auto& queue = instance()->input();
+    fill_queue(instance()->terminal(), queue, timeout_ms);
+    push_events(L, queue);
     return 1;
 }
 
@@ -224,81 +545,320 @@ int LuaBindings::lua_term_hide_cursor(lua_State*) {
     return 0;
 }
 
+// Event loop
+
+void LuaBindings::run() {
+    if (replay_log_) {
+        const auto& entries = replay_log_->entries();
+        int delay = entries.empty() || replay_fast_ ? 0 : static_cast<int>(entries[0].ms);
+        loop_.add_timer(delay, 0, [this]() { replay_step(); });
+    } else {
+        loop_.watch(STDIN_FILENO, EventLoop::READABLE, [this](uint32_t events) {
+            read_input(events);
+        });
+    }
+    if (record_log_) {
+        Vec2 size = terminal_.get_size();
+        record_log_->record_resize(size.x, size.y);
+    }
+    
+    while (!g_should_quit) {
+        loop_.run_once();
+        int64_t start = Profiler::now_ns();
+        frame_start_ns_ = start;
+        call_function("update");
+        profiler_.record(Profiler::UPDATE, start, Profiler::now_ns());
+        terminal_.flush();
+        profiler_.end_iteration(lua_gc(L_, LUA_GCCOUNT, 0));
+    }
+}
+
+void LuaBindings::record(std::unique_ptr<KeyLog> log) {
+    record_log_ = std::move(log);
+}
+
+void LuaBindings::replay(std::unique_ptr<KeyLog> log, bool fast) {
+    replay_log_ = std::move(log);
+    replay_fast_ = fast;
+    replay_next_ = 0;
+    latency_ = std::make_unique<LatencyRecorder>();
+}
+
+// Feeds the next entry of the replayed log and schedules the one after it
+void LuaBindings::replay_step() {
+    const auto& entries = replay_log_->entries();
+    if (replay_next_ >= entries.size()) {
+        // Give the last frame and any timers it set off time to finish
+        loop_.add_timer(REPLAY_SETTLE_MS, 0, []() { g_should_quit = true; });
+        return;
+    }
+    const KeyLog::Entry& entry = entries[replay_next_++];
+    if (entry.resize) {
+        if (terminal_.is_virtual()) terminal_.set_size(entry.width, entry.height);
+        dispatch_resize();
+    } else {
+        latency_->input_fed();
+        feed_input(entry.bytes);
+    }
+    int delay = 0;
+    if (!replay_fast_ && replay_next_ < entries.size()) {
+        delay = static_cast<int>(entries[replay_next_].ms - entry.ms);
+    }
+    loop_.add_timer(delay, 0, [this]() { replay_step(); });
+}
+
+void LuaBindings::read_input(uint32_t events) {
+    std::string bytes = terminal_.read_available();
+    if (bytes.empty()) {
+        // Readable with nothing to read: the terminal went away
+        if (events & EventLoop::HANGUP) g_should_quit = true;
+        return;
+    }
+    if (record_log_) record_log_->record_input(bytes);
+    feed_input(bytes);
+}
+
+void LuaBindings::feed_input(const std::string& bytes) {
+    int64_t start = Profiler::now_ns();
+    input_.feed(bytes.data(), bytes.size());
+    profiler_.record(Profiler::PARSE, start, Profiler::now_ns());
+    
+    // A lone ESC is only a key once nothing follows it for a moment
+    if (escape_timer_) loop_.cancel_timer(escape_timer_);
+    escape_timer_ = 0;
+    if (input_.escape_pending()) {
+        escape_timer_ = loop_.add_timer(ESC_TIMEOUT_MS, 0, [this]() {
+            escape_timer_ = 0;
+            input_.flush_escape();
+            dispatch_input();
+        });
+    }
+    dispatch_input();
+}
+
+void LuaBindings::dispatch_input() {
+    if (input_.size() == 0) return;
+    lua_getglobal(L_, "on_input");
+    if (!lua_isfunction(L_, -1)) {
+        lua_pop(L_, 1);
+        return;
+    }
+    int64_t start = Profiler::now_ns();
+    frame_start_ns_ = start;
+    push_events(L_, input_);
+    if (lua_pcall(L_, 1, 0, 0) != 0) {
+        fprintf(stderr, "Error calling on_input: %s\n", lua_tostring(L_, -1));
+        lua_pop(L_, 1);
+    }
+    int64_t end = Profiler::now_ns();
+    profiler_.record(Profiler::HANDLE, start, end);
+    if (latency_) latency_->input_handled(end - start);
+}
+
+void LuaBindings::dispatch_resize() {
+    Vec2 size = terminal_.get_size();
+    if (record_log_) record_log_->record_resize(size.x, size.y);
+    renderer_.resize(size.x, size.y);
+    lua_pushinteger(L_, size.x);
+    lua_pushinteger(L_, size.y);
+    lua_getglobal(L_, "on_resize");
+    if (!lua_isfunction(L_, -1)) {
+        lua_pop(L_, 3);
+        return;
+    }
+    lua_insert(L_, -3);
+    if (lua_pcall(L_, 2, 0, 0) != 0) {
+        fprintf(stderr, "Error calling on_resize: %s\n", lua_tostring(L_, -1));
+        lua_pop(L_, 1);
+    }
+}
+
+void LuaBindings::run_timer(int id, bool repeating) {
+    auto it = timer_refs_.find(id);
+    if (it == timer_refs_.end()) return;
+    int ref = it->second;
+    lua_rawgeti(L_, LUA_REGISTRYINDEX, ref);
+    if (!repeating) {
+        // One-shot: the loop already forgot it, so release the callback now
+        timer_refs_.erase(it);
+        luaL_unref(L_, LUA_REGISTRYINDEX, ref);
+    }
+    int64_t start = Profiler::now_ns();
+    frame_start_ns_ = start;
+    if (lua_pcall(L_, 0, 0, 0) != 0) {
+        fprintf(stderr, "Error in timer callback: %s\n", lua_tostring(L_, -1));
+        lua_pop(L_, 1);
+    }
+    profiler_.record(Profiler::TIMER, start, Profiler::now_ns());
+}
+
+// catvim.loop.timer(ms, fn[, repeat_ms]) -> id
+int LuaBindings::lua_loop_timer(lua_State* L) {
+    int delay_ms = luaL_checkinteger(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    int repeat_ms = luaL_optinteger(L, 3, 0);
+    
+    LuaBindings* self = instance();
+    lua_pushvalue(L, 2);
+    int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    bool repeating = repeat_ms > 0;
+    // The id is only known after add_timer returns, so the callback reads it back
+    auto id_slot = std::make_shared<int>(0);
+    int id = self->loop().add_timer(delay_ms, repeat_ms, [self, id_slot, repeating]() {
+        self->run_timer(*id_slot, repeating);
+    });
+    *id_slot = id;
+    self->timer_refs_[id] = ref;
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+// catvim.loop.cancel(id)
+int LuaBindings::lua_loop_cancel(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    LuaBindings* self = instance();
+    auto it = self->timer_refs_.find(id);
+    if (it == self->timer_refs_.end()) return 0;
+    luaL_unref(L, LUA_REGISTRYINDEX, it->second);
+    self->timer_refs_.erase(it);
+    self->loop().cancel_timer(id);
+    return 0;
+}
+
+// catvim.loop.now() -> monotonic milliseconds
+int LuaBindings::lua_loop_now(lua_State* L) {
+    lua_pushnumber(L, static_cast<lua_Number>(EventLoop::now_ms()));
+    return 1;
+}
+
 // Render functions
+
+// Reads a style table {fg = {r, g, b}, bg = {r, g, b}, bold, italic, underline}
+static Style read_style(lua_State* L, int idx) {
+    Style style;
+    if (!lua_istable(L, idx)) return style;
+    
+    lua_getfield(L, idx, "fg");
+    if (lua_istable(L, -1)) {
+        lua_rawgeti(L, -1, 1); int r = lua_tointeger(L, -1); lua_pop(L, 1);
+        lua_rawgeti(L, -1, 2); int g = lua_tointeger(L, -1); lua_pop(L, 1);
+        lua_rawgeti(L, -1, 3); int b = lua_tointeger(L, -1); lua_pop(L, 1);
+        style.fg = Color::RGB(r, g, b);
+    }
+    lua_pop(L, 1);
+    
+    lua_getfield(L, idx, "bg");
+    if (lua_istable(L, -1)) {
+        lua_rawgeti(L, -1, 1); int r = lua_tointeger(L, -1); lua_pop(L, 1);
+        lua_rawgeti(L, -1, 2); int g = lua_tointeger(L, -1); lua_pop(L, 1);
+        lua_rawgeti(L, -1, 3); int b = lua_tointeger(L, -1); lua_pop(L, 1);
+        style.bg = Color::RGB(r, g, b);
+    }
+    lua_pop(L, 1);
+    
+    lua_getfield(L, idx, "bold");
+    if (lua_toboolean(L, -1)) style.attrs = style.attrs | Attr::BOLD;
+    lua_pop(L, 1);
+    
+    lua_getfield(L, idx, "italic");
+    if (lua_toboolean(L, -1)) style.attrs = style.attrs | Attr::ITALIC;
+    lua_pop(L, 1);
+    
+    lua_getfield(L, idx, "underline");
+    if (lua_toboolean(L, -1)) style.attrs = style.attrs | Attr::UNDERLINE;
+    lua_pop(L, 1);
+    
+    return style;
+}
+
+// A style argument is either an id from catvim.render.style() or a style
+// table, which is interned on the spot. Anything else is the default style.
+static StyleId to_style(lua_State* L, int idx) {
+    Renderer& renderer = LuaBindings::instance()->renderer();
+    if (lua_type(L, idx) == LUA_TNUMBER) {
+        lua_Integer id = lua_tointeger(L, idx);
+        return id > 0 && static_cast<size_t>(id) < renderer.style_count() ? static_cast<StyleId>(id) : 0;
+    }
+    if (lua_istable(L, idx)) return renderer.intern_style(read_style(L, idx));
+    return 0;
+}
+
+// catvim.render.style(style) -> id
+int LuaBindings::lua_render_style(lua_State* L) {
+    lua_pushinteger(L, to_style(L, 1));
+    return 1;
+}
+
 int LuaBindings::lua_render_set(lua_State* L) {
     int x = luaL_checkinteger(L, 1);
     int y = luaL_checkinteger(L, 2);
-    const char* ch = luaL_checkstring(L, 3);
-    
-    Style style;
-    if (lua_gettop(L) >= 4 && lua_istable(L, 4)) {
-        lua_getfield(L, 4, "fg");
-        if (lua_istable(L, -1)) {
-            lua_rawgeti(L, -1, 1); int r = lua_tointeger(L, -1); lua_pop(L, 1);
-            lua_rawgeti(L, -1, 2); int g = lua_tointeger(L, -1); lua_pop(L, 1);
-            lua_rawgeti(L, -1, 3); int b = lua_tointeger(L, -1); lua_pop(L, 1);
-            style.fg = Color::RGB(r, g, b);
-        }
-        lua_pop(L, 1);
-        
-        lua_getfield(L, 4, "bg");
-        if (lua_istable(L, -1)) {
-            lua_rawgeti(L, -1, 1); int r = lua_tointeger(L, -1); lua_pop(L, 1);
-            lua_rawgeti(L, -1, 2); int g = lua_tointeger(L, -1); lua_pop(L, 1);
-            lua_rawgeti(L, -1, 3); int b = lua_tointeger(L, -1); lua_pop(L, 1);
-            style.bg = Color::RGB(r, g, b);
-        }
-        lua_pop(L, 1);
-        
-        lua_getfield(L, 4, "bold");
-        if (lua_toboolean(L, -1)) style.attrs = style.attrs | Attr::BOLD;
-        lua_pop(L, 1);
-        
-        lua_getfield(L, 4, "italic");
-        if (lua_toboolean(L, -1)) style.attrs = style.attrs | Attr::ITALIC;
-        lua_pop(L, 1);
-        
-        lua_getfield(L, 4, "underline");
-        if (lua_toboolean(L, -1)) style.attrs = style.attrs | Attr::UNDERLINE;
-        lua_pop(L, 1);
-    }
+    size_t len = 0;
+    const char* ch = luaL_checklstring(L, 3, &len);
+    StyleId style = to_style(L, 4);
     
-    instance()->renderer().set_cell(x - 1, y - 1, ch[0], style);
+    size_t used;
+    char32_t cp = len > 0 ? decode_utf8(ch, len, used) : U' ';
+    instance()->renderer().set_cell(x - 1, y - 1, cp, style);
     return 0;
 }
 
+// catvim.render.string(x, y, text, style) -> columns taken
 int LuaBindings::lua_render_string(lua_State* L) {
     int x = luaL_checkinteger(L, 1);
     int y = luaL_checkinteger(L, 2);
-    const char* str = luaL_checkstring(L, 3);
+    size_t len = 0;
+    const char* str = luaL_checklstring(L, 3, &len);
+    StyleId style = to_style(L, 4);
     
-    Style style;
-    // Parse style if provided (same as lua_render_set)
-    if (lua_gettop(L) >= 4 && lua_istable(L, 4)) {
-        lua_getfield(L, 4, "fg");
-        if (lua_istable(L, -1)) {
-            lua_rawgeti(L, -1, 1); int r = lua_tointeger(L, -1); lua_pop(L, 1);
-            lua_rawgeti(L, -1, 2); int g = lua_tointeger(L, -1); lua_pop(L, 1);
-            lua_rawgeti(L, -1, 3); int b = lua_tointeger(L, -1); lua_pop(L, 1);
-            style.fg = Color::RGB(r, g, b);
-        }
-        lua_pop(L, 1);
-        
-        lua_getfield(L, 4, "bg");
-        if (lua_istable(L, -1)) {
-            lua_rawgeti(L, -1, 1); int r = lua_tointeger(L, -1); lua_pop(L, 1);
-            lua_rawgeti(L, -1, 2); int g = lua_tointeger(L, -1); lua_pop(L, 1);
-            lua_rawgeti(L, -1, 3); int b = lua_tointeger(L, -1); lua_pop(L, 1);
-            style.bg = Color::RGB(r, g, b);
+    int columns = instance()->renderer().set_string(x - 1, y - 1, std::string_view(str, len), style);
+    lua_pushinteger(L, columns);
+    return 1;
+}
+
+// catvim.render.line(x, y, text, spans [, width])
+// spans is a flat array of (start, length, style) triples: 1-based byte
+// offsets into text and byte counts, painted over the columns those bytes
+// take; later spans paint over earlier ones. Cells past the end of text up
+// to width are blanks that still take span styles, one per byte past it.
+int LuaBindings::lua_render_line(lua_State* L) {
+    int x = luaL_checkinteger(L, 1);
+    int y = luaL_checkinteger(L, 2);
+    size_t len = 0;
+    const char* text = luaL_checklstring(L, 3, &len);
+    int width = luaL_optinteger(L, 5, static_cast<lua_Integer>(len));
+    
+    LuaBindings* self = instance();
+    auto& renderer = self->renderer();
+    const std::vector<int>& columns = self->line_columns_;
+    renderer.set_line(x - 1, y - 1, std::string_view(text, len), width, &self->line_columns_);
+    if (!lua_istable(L, 4)) return 0;
+    
+    // Column of byte offset b; empty columns means ASCII
+    size_t laid = columns.empty() ? 0 : columns.size() - 1;
+    auto column = [&](size_t b) -> int {
+        if (columns.empty()) return static_cast<int>(b);
+        return b < laid ? columns[b] : columns[laid] + static_cast<int>(b - laid);
+    };
+    
+    int n = static_cast<int>(lua_rawlen(L, 4));
+    for (int i = 1; i + 2 <= n; i += 3) {
+        lua_rawgeti(L, 4, i);
+        lua_rawgeti(L, 4, i + 1);
+        lua_rawgeti(L, 4, i + 2);
+        lua_Integer start = lua_tointeger(L, -3);
+        lua_Integer count = lua_tointeger(L, -2);
+        if (start >= 1 && count > 0) {
+            size_t b0 = static_cast<size_t>(start - 1);
+            size_t b1 = b0 + static_cast<size_t>(count);
+            // A span ending inside a character (or before its combining
+            // marks) covers all of it
+            while (b1 < laid && columns[b1] == columns[b1 - 1]) b1++;
+            int c0 = column(b0);
+            int c1 = std::min(column(b1), width);
+            if (c1 > c0) renderer.style_span(x - 1 + c0, y - 1, c1 - c0, to_style(L, -1));
         }
-        lua_pop(L, 1);
-        
-        lua_getfield(L, 4, "bold");
-        if (lua_toboolean(L, -1)) style.attrs = style.attrs | Attr::BOLD;
-        lua_pop(L, 1);
+        lua_pop(L, 3);
     }
-    
-    instance()->renderer().set_string(x - 1, y - 1, str, style);
     return 0;
 }
 
@@ -308,9 +868,25 @@ int LuaBindings::lua_render_clear(lua_State*) {
 }
 
 int LuaBindings::lua_render_flush(lua_State*) {
-    std::string output = instance()->renderer().flush();
-    instance()->terminal().write(output);
-    instance()->terminal().flush();
+    LuaBindings* self = instance();
+    Profiler& profiler = self->profiler_;
+    int64_t start = Profiler::now_ns();
+    int64_t render_start = self->render_start_ns_ ? self->render_start_ns_ : self->frame_start_ns_;
+    self->render_start_ns_ = 0;
+    profiler.record(Profiler::RENDER, render_start, start);
+    
+    const std::string& frame = self->renderer_.flush();
+    int64_t encoded = Profiler::now_ns();
+    profiler.record(Profiler::ENCODE, start, encoded);
+    size_t written = self->terminal_.bytes_written();
+    self->terminal_.write_frame(frame);
+    int64_t end = Profiler::now_ns();
+    profiler.record(Profiler::WRITE, encoded, end);
+    profiler.frame_written(self->terminal_.bytes_written() - written);
+    
+    if (self->latency_) {
+        self->latency_->frame_written(start - self->frame_start_ns_, end - start, frame.size());
+    }
     return 0;
 }
 
@@ -319,8 +895,7 @@ int LuaBindings::lua_render_box(lua_State* L) {
     int y = luaL_checkinteger(L, 2);
     int w = luaL_checkinteger(L, 3);
     int h = luaL_checkinteger(L, 4);
-    Style style;
-    instance()->renderer().draw_box(x - 1, y - 1, w, h, style);
+    instance()->renderer().draw_box(x - 1, y - 1, w, h, to_style(L, 5));
     return 0;
 }
 
@@ -332,31 +907,88 @@ int LuaBindings::lua_render_resize(lua_State* L) {
     return 2;
 }
 
+// UTF-8 functions
+
+// catvim.utf8.width(s) -> display columns
+int LuaBindings::lua_utf8_width(lua_State* L) {
+    size_t len = 0;
+    const char* s = luaL_checklstring(L, 1, &len);
+    lua_pushinteger(L, text_width(s, len));
+    return 1;
+}
+
+// catvim.utf8.col(s, i) -> 1-based column of the character holding byte i.
+// Bytes past the end count one column each, like the cursor after the
+// last character.
+int LuaBindings::lua_utf8_col(lua_State* L) {
+    size_t len = 0;
+    const char* s = luaL_checklstring(L, 1, &len);
+    lua_Integer i = luaL_checkinteger(L, 2);
+    if (i <= 1) {
+        lua_pushinteger(L, 1);
+        return 1;
+    }
+    size_t b = static_cast<size_t>(i - 1);
+    if (b >= len) {
+        lua_pushinteger(L, text_width(s, len) + static_cast<lua_Integer>(b - len) + 1);
+        return 1;
+    }
+    while (b > 0 && utf8_continuation(static_cast<unsigned char>(s[b]))) b--;
+    lua_pushinteger(L, text_width(s, b) + 1);
+    return 1;
+}
+
+// catvim.utf8.byte(s, col) -> 1-based index of the first byte of the
+// character covering column col (the inverse of col)
+int LuaBindings::lua_utf8_byte(lua_State* L) {
+    size_t len = 0;
+    const char* s = luaL_checklstring(L, 1, &len);
+    lua_Integer col = luaL_checkinteger(L, 2);
+    lua_Integer x = 1;  // Column of the character at b
+    size_t b = 0;
+    while (b < len) {
+        size_t run = ascii_prefix(s + b, len - b);
+        if (col - x < static_cast<lua_Integer>(run)) {
+            lua_pushinteger(L, static_cast<lua_Integer>(b) + std::max<lua_Integer>(col - x, 0) + 1);
+            return 1;
+        }
+        b += run;
+        x += static_cast<lua_Integer>(run);
+        if (b == len) break;
+        size_t n;
+        int w = char_width(decode_utf8(s + b, len - b, n));
+        if (w > 0 && col < x + w) break;
+        b += n;
+        x += w;
+    }
+    lua_pushinteger(L, static_cast<lua_Integer>(b) + std::max<lua_Integer>(col - x, 0) + 1);
+    return 1;
+}
+
 // File system functions
 int LuaBindings::lua_fs_read(lua_State* L) {
     const char* path = luaL_checkstring(L, 1);
-    std::ifstream file(path);
-    if (!file) {
+    MappedFile file;
+    std::string error;
+    if (!file.open(path, error)) {
         lua_pushnil(L);
-        lua_pushstring(L, "Failed to open file");
+        lua_pushstring(L, error.c_str());
         return 2;
     }
-    std::stringstream ss;
-    ss << file.rdbuf();
-    lua_pushstring(L, ss.str().c_str());
+    lua_pushlstring(L, file.data(), file.size());
     return 1;
 }
 
 int LuaBindings::lua_fs_write(lua_State* L) {
     const char* path = luaL_checkstring(L, 1);
-    const char* data = luaL_checkstring(L, 2);
-    std::ofstream file(path);
-    if (!file) {
+    size_t len = 0;
+    const char* data = luaL_checklstring(L, 2, &len);
+    std::string error;
+    if (!replace_file(path, data, len, error)) {
         lua_pushboolean(L, false);
-        lua_pushstring(L, "Failed to open file for writing");
+        lua_pushstring(L, error.c_str());
         return 2;
     }
-    file << data;
     lua_pushboolean(L, true);
     return 1;
 }
@@ -404,24 +1036,1010 @@ int LuaBindings::lua_fs_isdir(lua_State* L) {
     return 1;
 }
 
+// catvim.fs.id(path) -> a string naming the file (device and inode), the
+// same for every path to it, or nil if it doesn't exist
+int LuaBindings::lua_fs_id(lua_State* L) {
+    const char* path = luaL_checkstring(L, 1);
+    FileStamp stamp;
+    if (!stat_file(path, stamp)) {
+        lua_pushnil(L);
+        return 1;
+    }
+    std::string id = std::to_string(stamp.dev) + ":" + std::to_string(stamp.ino);
+    lua_pushlstring(L, id.data(), id.size());
+    return 1;
+}
+
+// Directory tree functions
+
+// Applies finished directory reads and calls the tree's Lua callback if
+// the visible rows changed
+void LuaBindings::update_tree(DirTree* tree) {
+    auto it = tree_refs_.find(tree);
+    if (it == tree_refs_.end() || !tree->update()) return;
+    lua_rawgeti(L_, LUA_REGISTRYINDEX, it->second);
+    if (lua_pcall(L_, 0, 0, 0) != 0) {
+        fprintf(stderr, "Error in tree callback: %s\n", lua_tostring(L_, -1));
+        lua_pop(L_, 1);
+    }
+}
+
+// catvim.fs.tree(dir, callback) -> tree, or nil and an error message
+// Reads `dir` in the background and keeps it current; callback() is
+// called whenever the visible rows change.
+int LuaBindings::lua_fs_tree(lua_State* L) {
+    const char* root = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    auto tree = std::make_unique<DirTree>(root);
+    std::string error;
+    if (!tree->start(error)) {
+        lua_pushnil(L);
+        lua_pushstring(L, error.c_str());
+        return 2;
+    }
+
+    LuaBindings* self = instance();
+    DirTree* raw = tree.release();
+    void* mem = lua_newuserdata(L, sizeof(DirTree*));
+    *static_cast<DirTree**>(mem) = raw;
+    luaL_getmetatable(L, DIR_TREE_MT);
+    lua_setmetatable(L, -2);
+
+    lua_pushvalue(L, 2);
+    self->tree_refs_[raw] = luaL_ref(L, LUA_REGISTRYINDEX);
+    self->loop_.watch(raw->notify_fd(), EventLoop::READABLE, [self, raw](uint32_t) {
+        self->update_tree(raw);
+    });
+    return 1;
+}
+
+int LuaBindings::lua_tree_gc(lua_State* L) {
+    auto* tree = static_cast<DirTree**>(luaL_checkudata(L, 1, DIR_TREE_MT));
+    if (*tree) {
+        LuaBindings* self = instance();
+        auto it = self->tree_refs_.find(*tree);
+        if (it != self->tree_refs_.end()) {
+            self->loop_.unwatch((*tree)->notify_fd());
+            luaL_unref(L, LUA_REGISTRYINDEX, it->second);
+            self->tree_refs_.erase(it);
+        }
+        delete *tree;
+        *tree = nullptr;
+    }
+    return 0;
+}
+
+// tree:expand(path, expanded); the directory is read in the background if
+// it isn't cached yet
+int LuaBindings::lua_tree_expand(lua_State* L) {
+    DirTree& tree = check_tree(L);
+    const char* path = luaL_checkstring(L, 2);
+    tree.set_expanded(path, lua_isnone(L, 3) || lua_toboolean(L, 3));
+    return 0;
+}
+
+// tree:count() -> number of visible rows
+int LuaBindings::lua_tree_count(lua_State* L) {
+    lua_pushinteger(L, check_tree(L).row_count());
+    return 1;
+}
+
+// tree:rows(first, count) -> {name, path, isdir, depth, expanded, loading}
+// for visible rows first .. first + count - 1
+int LuaBindings::lua_tree_rows(lua_State* L) {
+    DirTree& tree = check_tree(L);
+    size_t first = to_index(luaL_checkinteger(L, 2));
+    lua_Integer count = luaL_checkinteger(L, 3);
+    lua_newtable(L);
+    int i = 1;
+    for (size_t r = first; r < tree.row_count() && i <= count; r++) {
+        const DirTree::Row& row = tree.row(r);
+        lua_createtable(L, 0, 6);
+        lua_pushlstring(L, row.path.data() + row.name, row.path.size() - row.name); lua_setfield(L, -2, "name");
+        lua_pushlstring(L, row.path.data(), row.path.size()); lua_setfield(L, -2, "path");
+        lua_pushboolean(L, row.isdir); lua_setfield(L, -2, "isdir");
+        lua_pushinteger(L, row.depth); lua_setfield(L, -2, "depth");
+        lua_pushboolean(L, row.expanded); lua_setfield(L, -2, "expanded");
+        lua_pushboolean(L, row.loading); lua_setfield(L, -2, "loading");
+        lua_rawseti(L, -2, i++);
+    }
+    return 1;
+}
+
+// tree:find(path) -> index of the row showing path, or nil
+int LuaBindings::lua_tree_find(lua_State* L) {
+    DirTree& tree = check_tree(L);
+    size_t i = tree.find(luaL_checkstring(L, 2));
+    if (i == tree.row_count()) {
+        lua_pushnil(L);
+    } else {
+        lua_pushinteger(L, i + 1);
+    }
+    return 1;
+}
+
+// Text buffer functions
+int LuaBindings::lua_text_new(lua_State* L) {
+    size_t len = 0;
+    const char* str = luaL_optlstring(L, 1, "", &len);
+    void* mem = lua_newuserdata(L, sizeof(std::shared_ptr<TextBuffer>));
+    new (mem) std::shared_ptr<TextBuffer>(std::make_shared<TextBuffer>(std::string(str, len)));
+    luaL_getmetatable(L, TEXT_BUFFER_MT);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+int LuaBindings::lua_text_gc(lua_State* L) {
+    auto* text = static_cast<std::shared_ptr<TextBuffer>*>(luaL_checkudata(L, 1, TEXT_BUFFER_MT));
+    text->~shared_ptr();
+    return 0;
+}
+
+int LuaBindings::lua_text_line_count(lua_State* L) {
+    lua_pushinteger(L, check_text(L)->line_count());
+    return 1;
+}
+
+int LuaBindings::lua_text_length(lua_State* L) {
+    lua_pushinteger(L, check_text(L)->length());
+    return 1;
+}
+
+int LuaBindings::lua_text_line(lua_State* L) {
+    auto& text = check_text(L);
+    std::string line = text->line(to_index(luaL_checkinteger(L, 2)));
+    lua_pushlstring(L, line.data(), line.size());
+    return 1;
+}
+
+int LuaBindings::lua_text_line_length(lua_State* L) {
+    auto& text = check_text(L);
+    lua_pushinteger(L, text->line_length(to_index(luaL_checkinteger(L, 2))));
+    return 1;
+}
+
+// The editing methods return whether the text changed; edits reaching
+// into the pending line of a large file (see text:pending_line()) don't
+static int push_changed(lua_State* L, const TextBuffer& text, uint64_t version) {
+    lua_pushboolean(L, text.version() != version);
+    return 1;
+}
+
+int LuaBindings::lua_text_set_line(lua_State* L) {
+    auto& text = check_text(L);
+    size_t len = 0;
+    const char* str = luaL_checklstring(L, 3, &len);
+    uint64_t version = text->version();
+    text->set_line(to_index(luaL_checkinteger(L, 2)), std::string(str, len));
+    return push_changed(L, *text, version);
+}
+
+int LuaBindings::lua_text_insert_line(lua_State* L) {
+    auto& text = check_text(L);
+    size_t len = 0;
+    const char* str = luaL_optlstring(L, 3, "", &len);
+    uint64_t version = text->version();
+    text->insert_line(to_index(luaL_checkinteger(L, 2)), std::string(str, len));
+    return push_changed(L, *text, version);
+}
+
+int LuaBindings::lua_text_delete_line(lua_State* L) {
+    auto& text = check_text(L);
+    uint64_t version = text->version();
+    text->delete_line(to_index(luaL_checkinteger(L, 2)));
+    return push_changed(L, *text, version);
+}
+
+int LuaBindings::lua_text_insert(lua_State* L) {
+    auto& text = check_text(L);
+    size_t line = to_index(luaL_checkinteger(L, 2));
+    size_t col = to_index(luaL_checkinteger(L, 3));
+    size_t len = 0;
+    const char* str = luaL_checklstring(L, 4, &len);
+    uint64_t version = text->version();
+    if (line < text->line_count()) {
+        text->insert(text->offset_of(line, col), str, len);
+    }
+    return push_changed(L, *text, version);
+}
+
+int LuaBindings::lua_text_erase(lua_State* L) {
+    auto& text = check_text(L);
+    size_t line = to_index(luaL_checkinteger(L, 2));
+    size_t col = to_index(luaL_checkinteger(L, 3));
+    lua_Integer count = luaL_checkinteger(L, 4);
+    uint64_t version = text->version();
+    if (line < text->line_count() && count > 0) {
+        text->erase(text->offset_of(line, col), static_cast<size_t>(count));
+    }
+    return push_changed(L, *text, version);
+}
+
+int LuaBindings::lua_text_get_text(lua_State* L) {
+    std::string str = check_text(L)->text();
+    lua_pushlstring(L, str.data(), str.size());
+    return 1;
+}
+
+int LuaBindings::lua_text_set_text(lua_State* L) {
+    auto& text = check_text(L);
+    size_t len = 0;
+    const char* str = luaL_checklstring(L, 2, &len);
+    text->set_text(std::string(str, len));
+    return 0;
+}
+
+// text:load(path [, large_threshold]) -> true, or nil and an error message.
+// Files of at least large_threshold bytes are opened in large file mode.
+int LuaBindings::lua_text_load(lua_State* L) {
+    auto& text = check_text(L);
+    const char* path = luaL_checkstring(L, 2);
+    lua_Integer threshold = luaL_optinteger(L, 3, 0);
+    std::string error;
+    if (!text->load(path, error, threshold > 0 ? static_cast<size_t>(threshold) : SIZE_MAX)) {
+        lua_pushnil(L);
+        lua_pushstring(L, error.c_str());
+        return 2;
+    }
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+// text:save(path) -> true, or nil and an error message
+int LuaBindings::lua_text_save(lua_State* L) {
+    auto& text = check_text(L);
+    const char* path = luaL_checkstring(L, 2);
+    std::string error;
+    if (!text->save(path, error)) {
+        lua_pushnil(L);
+        lua_pushstring(L, error.c_str());
+        return 2;
+    }
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+// Pushes the 1-based line/col of `offset`, used to place the cursor after undo/redo
+static int push_position(lua_State* L, const TextBuffer& text, size_t offset) {
+    size_t line, col;
+    text.position_of(offset, line, col);
+    lua_pushinteger(L, line + 1);
+    lua_pushinteger(L, col + 1);
+    return 2;
+}
+
+// text:undo() / text:redo() -> line, col, first_changed_line (nil if nothing to do)
+int LuaBindings::lua_text_undo(lua_State* L) {
+    auto& text = check_text(L);
+    size_t offset, first;
+    if (!text->undo(offset, first)) {
+        lua_pushnil(L);
+        return 1;
+    }
+    push_position(L, *text, offset);
+    size_t first_line, first_col;
+    text->position_of(first, first_line, first_col);
+    lua_pushinteger(L, first_line + 1);
+    return 3;
+}
+
+int LuaBindings::lua_text_redo(lua_State* L) {
+    auto& text = check_text(L);
+    size_t offset, first;
+    if (!text->redo(offset, first)) {
+        lua_pushnil(L);
+        return 1;
+    }
+    push_position(L, *text, offset);
+    size_t first_line, first_col;
+    text->position_of(first, first_line, first_col);
+    lua_pushinteger(L, first_line + 1);
+    return 3;
+}
+
+int LuaBindings::lua_text_undo_mark(lua_State* L) {
+    check_text(L)->journal().mark();
+    return 0;
+}
+
+int LuaBindings::lua_text_begin_transaction(lua_State* L) {
+    check_text(L)->journal().begin_transaction();
+    return 0;
+}
+
+int LuaBindings::lua_text_end_transaction(lua_State* L) {
+    check_text(L)->journal().end_transaction();
+    return 0;
+}
+
+int LuaBindings::lua_text_set_undo_budget(lua_State* L) {
+    auto& text = check_text(L);
+    lua_Integer bytes = luaL_checkinteger(L, 2);
+    text->journal().set_budget(bytes > 0 ? static_cast<size_t>(bytes) : 0);
+    return 0;
+}
+
+int LuaBindings::lua_text_undo_bytes(lua_State* L) {
+    lua_pushinteger(L, check_text(L)->journal().bytes());
+    return 1;
+}
+
+int LuaBindings::lua_text_mark_saved(lua_State* L) {
+    check_text(L)->journal().mark_saved();
+    return 0;
+}
+
+int LuaBindings::lua_text_is_modified(lua_State* L) {
+    lua_pushboolean(L, check_text(L)->journal().is_modified());
+    return 1;
+}
+
+int LuaBindings::lua_text_large(lua_State* L) {
+    lua_pushboolean(L, check_text(L)->large());
+    return 1;
+}
+
+// text:pending_line() -> line, fraction of the file indexed; nil once a
+// large file is fully indexed (and always for other files)
+int LuaBindings::lua_text_pending_line(lua_State* L) {
+    auto& text = check_text(L);
+    size_t line = text->pending_line();
+    if (line == TextBuffer::NPOS) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushinteger(L, line + 1);
+    lua_pushnumber(L, text->index_progress());
+    return 2;
+}
+
+// text:update_index() -> line, added: the pending line became `added`
+// lines; nil if the index thread found nothing new
+int LuaBindings::lua_text_update_index(lua_State* L) {
+    auto& text = check_text(L);
+    size_t line, added;
+    if (!text->update_index(line, added)) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushinteger(L, line + 1);
+    lua_pushinteger(L, added);
+    return 2;
+}
+
+// text:unload() -> true if the text was freed (only unmodified file text is)
+int LuaBindings::lua_text_unload(lua_State* L) {
+    lua_pushboolean(L, check_text(L)->unload());
+    return 1;
+}
+
+// text:reload() -> true and whether the file changed since it was unloaded,
+// or nil and an error message
+int LuaBindings::lua_text_reload(lua_State* L) {
+    auto& text = check_text(L);
+    std::string error;
+    bool changed;
+    if (!text->reload(error, changed)) {
+        lua_pushnil(L);
+        lua_pushstring(L, error.c_str());
+        return 2;
+    }
+    lua_pushboolean(L, true);
+    lua_pushboolean(L, changed);
+    return 2;
+}
+
+int LuaBindings::lua_text_unloaded(lua_State* L) {
+    lua_pushboolean(L, check_text(L)->unloaded());
+    return 1;
+}
+
+// text:spill_undo(path) -> true, or nil and an error message. The history
+// comes back by itself at the next edit, undo or redo.
+int LuaBindings::lua_text_spill_undo(lua_State* L) {
+    auto& text = check_text(L);
+    const char* path = luaL_checkstring(L, 2);
+    std::string error;
+    if (!text->journal().spill(path, error)) {
+        lua_pushnil(L);
+        lua_pushstring(L, error.empty() ? "Undo history not spilled" : error.c_str());
+        return 2;
+    }
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+// text:memory() -> bytes held for the text, its indexes and undo history
+int LuaBindings::lua_text_memory(lua_State* L) {
+    lua_pushinteger(L, check_text(L)->memory_bytes());
+    return 1;
+}
+
+// Search functions
+
+// catvim.search.new(text, pattern [, {regex=, icase=}]) -> search, or nil
+// and an error message
+int LuaBindings::lua_search_new(lua_State* L) {
+    auto& text = check_text(L);
+    size_t len = 0;
+    const char* pattern = luaL_checklstring(L, 2, &len);
+    bool regex = false;
+    bool icase = false;
+    if (lua_istable(L, 3)) {
+        lua_getfield(L, 3, "regex"); regex = lua_toboolean(L, -1); lua_pop(L, 1);
+        lua_getfield(L, 3, "icase"); icase = lua_toboolean(L, -1); lua_pop(L, 1);
+    }
+
+    auto matcher = std::make_unique<Matcher>();
+    std::string error;
+    if (!matcher->compile(std::string(pattern, len), regex, icase, error)) {
+        lua_pushnil(L);
+        lua_pushstring(L, error.c_str());
+        return 2;
+    }
+    void* mem = lua_newuserdata(L, sizeof(Search*));
+    *static_cast<Search**>(mem) = new Search(text, std::move(matcher));
+    luaL_getmetatable(L, SEARCH_MT);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+int LuaBindings::lua_search_gc(lua_State* L) {
+    auto* search = static_cast<Search**>(luaL_checkudata(L, 1, SEARCH_MT));
+    delete *search;
+    *search = nullptr;
+    return 0;
+}
+
+// Byte offset of a 1-based (line, col), clamped to the text
+static size_t search_offset(const TextBuffer& text, lua_State* L, int idx) {
+    size_t line = to_index(luaL_checkinteger(L, idx));
+    size_t col = to_index(luaL_checkinteger(L, idx + 1));
+    if (line >= text.line_count()) return text.length();
+    return text.offset_of(line, col == static_cast<size_t>(-1) ? 0 : col);
+}
+
+// search:find(line, col [, direction]) starts looking for the nearest match
+// after (direction >= 0) or before the position; see find_step()
+int LuaBindings::lua_search_find(lua_State* L) {
+    Search& search = check_search(L);
+    size_t offset = search_offset(search.text(), L, 2);
+    search.start_find(offset, static_cast<int>(luaL_optinteger(L, 4, 1)));
+    return 0;
+}
+
+// search:find_step(budget_ms) -> line, col, len, wrapped; false when there
+// is no match; nil when the budget ran out first (call again later)
+int LuaBindings::lua_search_find_step(lua_State* L) {
+    Search& search = check_search(L);
+    size_t start = 0, len = 0;
+    bool wrapped = false;
+    switch (search.find_step(luaL_optinteger(L, 2, 0), start, len, wrapped)) {
+    case Search::Status::PENDING:
+        lua_pushnil(L);
+        return 1;
+    case Search::Status::NOT_FOUND:
+        lua_pushboolean(L, false);
+        return 1;
+    case Search::Status::FOUND:
+        break;
+    }
+    size_t line, col;
+    search.text().position_of(start, line, col);
+    lua_pushinteger(L, line + 1);
+    lua_pushinteger(L, col + 1);
+    lua_pushinteger(L, len);
+    lua_pushboolean(L, wrapped);
+    return 4;
+}
+
+// search:count_step(budget_ms) -> matches counted so far, done
+int LuaBindings::lua_search_count_step(lua_State* L) {
+    Search& search = check_search(L);
+    bool done = search.count_step(luaL_optinteger(L, 2, 0));
+    lua_pushinteger(L, search.count());
+    lua_pushboolean(L, done);
+    return 2;
+}
+
+// search:index(line, col) -> 1-based index of the match there, or nil
+// until counting is done
+int LuaBindings::lua_search_index(lua_State* L) {
+    Search& search = check_search(L);
+    if (!search.counted()) return 0;
+    lua_pushinteger(L, search.index_of(search_offset(search.text(), L, 2)));
+    return 1;
+}
+
+// search:line_matches(line) -> { col1, len1, col2, len2, ... }
+int LuaBindings::lua_search_line_matches(lua_State* L) {
+    Search& search = check_search(L);
+    std::vector<std::pair<size_t, size_t>> matches;
+    search.line_matches(to_index(luaL_checkinteger(L, 2)), matches);
+    lua_createtable(L, static_cast<int>(matches.size() * 2), 0);
+    int i = 1;
+    for (const auto& m : matches) {
+        lua_pushinteger(L, m.first + 1); lua_rawseti(L, -2, i++);
+        lua_pushinteger(L, m.second); lua_rawseti(L, -2, i++);
+    }
+    return 1;
+}
+
+// Grep functions
+
+// Hands the results found since last time to the grep's Lua callback as
+// callback(results, done); after the final call the callback is released
+void LuaBindings::deliver_grep(Grep* grep) {
+    auto it = grep_refs_.find(grep);
+    if (it == grep_refs_.end()) return;
+    std::vector<Grep::Result> results;
+    bool done = grep->done();
+    grep->take(results);
+
+    lua_rawgeti(L_, LUA_REGISTRYINDEX, it->second);
+    if (done) stop_grep(grep);
+    lua_createtable(L_, static_cast<int>(results.size()), 0);
+    for (size_t i = 0; i < results.size(); i++) {
+        const Grep::Result& r = results[i];
+        lua_createtable(L_, 0, 4);
+        lua_pushlstring(L_, r.path.data(), r.path.size()); lua_setfield(L_, -2, "path");
+        lua_pushinteger(L_, r.line + 1); lua_setfield(L_, -2, "line");
+        lua_pushinteger(L_, r.col + 1); lua_setfield(L_, -2, "col");
+        lua_pushlstring(L_, r.text.data(), r.text.size()); lua_setfield(L_, -2, "text");
+        lua_rawseti(L_, -2, static_cast<int>(i + 1));
+    }
+    lua_pushboolean(L_, done);
+    if (lua_pcall(L_, 2, 0, 0) != 0) {
+        fprintf(stderr, "Error in grep callback: %s\n", lua_tostring(L_, -1));
+        lua_pop(L_, 1);
+    }
+}
+
+void LuaBindings::stop_grep(Grep* grep) {
+    auto it = grep_refs_.find(grep);
+    if (it == grep_refs_.end()) return;
+    loop_.unwatch(grep->notify_fd());
+    luaL_unref(L_, LUA_REGISTRYINDEX, it->second);
+    grep_refs_.erase(it);
+}
+
+// catvim.grep.start(dir, pattern, {regex=, icase=, max=}, callback)
+//   -> grep, or nil and an error message
+// callback(results, done) gets batches of {path, line, col, text} as
+// workers find them. The search stops when the grep is cancelled or
+// garbage collected.
+int LuaBindings::lua_grep_start(lua_State* L) {
+    const char* root = luaL_checkstring(L, 1);
+    size_t len = 0;
+    const char* pattern = luaL_checklstring(L, 2, &len);
+    bool regex = false;
+    bool icase = false;
+    lua_Integer max = 10000;
+    if (lua_istable(L, 3)) {
+        lua_getfield(L, 3, "regex"); regex = lua_toboolean(L, -1); lua_pop(L, 1);
+        lua_getfield(L, 3, "icase"); icase = lua_toboolean(L, -1); lua_pop(L, 1);
+        lua_getfield(L, 3, "max"); max = luaL_optinteger(L, -1, max); lua_pop(L, 1);
+    }
+    luaL_checktype(L, 4, LUA_TFUNCTION);
+
+    auto matcher = std::make_unique<Matcher>();
+    std::string error;
+    if (!matcher->compile(std::string(pattern, len), regex, icase, error)) {
+        lua_pushnil(L);
+        lua_pushstring(L, error.c_str());
+        return 2;
+    }
+    auto grep = std::make_unique<Grep>(root, std::move(matcher), max > 0 ? max : 1);
+    if (!grep->start(error)) {
+        lua_pushnil(L);
+        lua_pushstring(L, error.c_str());
+        return 2;
+    }
+
+    LuaBindings* self = instance();
+    Grep* raw = grep.release();
+    void* mem = lua_newuserdata(L, sizeof(Grep*));
+    *static_cast<Grep**>(mem) = raw;
+    luaL_getmetatable(L, GREP_MT);
+    lua_setmetatable(L, -2);
+
+    lua_pushvalue(L, 4);
+    self->grep_refs_[raw] = luaL_ref(L, LUA_REGISTRYINDEX);
+    self->loop_.watch(raw->notify_fd(), EventLoop::READABLE, [self, raw](uint32_t) {
+        self->deliver_grep(raw);
+    });
+    return 1;
+}
+
+int LuaBindings::lua_grep_gc(lua_State* L) {
+    auto* grep = static_cast<Grep**>(luaL_checkudata(L, 1, GREP_MT));
+    if (*grep) {
+        instance()->stop_grep(*grep);
+        delete *grep;
+        *grep = nullptr;
+    }
+    return 0;
+}
+
+// grep:cancel(); the callback still gets a final call with done = true
+int LuaBindings::lua_grep_cancel(lua_State* L) {
+    check_grep(L).cancel();
+    return 0;
+}
+
+// grep:files() -> files searched so far
+int LuaBindings::lua_grep_files(lua_State* L) {
+    lua_pushinteger(L, check_grep(L).files_searched());
+    return 1;
+}
+
+// Word index functions
+
+// catvim.words.new(text) -> index that follows the text's edits
+int LuaBindings::lua_words_new(lua_State* L) {
+    auto& text = check_text(L);
+    void* mem = lua_newuserdata(L, sizeof(WordIndex*));
+    *static_cast<WordIndex**>(mem) = new WordIndex(text);
+    luaL_getmetatable(L, WORD_INDEX_MT);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+int LuaBindings::lua_words_gc(lua_State* L) {
+    auto* words = static_cast<WordIndex**>(luaL_checkudata(L, 1, WORD_INDEX_MT));
+    delete *words;
+    *words = nullptr;
+    return 0;
+}
+
+// index:complete(query, line [, limit]) -> array of words, best first
+int LuaBindings::lua_words_complete(lua_State* L) {
+    WordIndex& words = check_words(L);
+    size_t len = 0;
+    const char* query = luaL_checklstring(L, 2, &len);
+    size_t line = to_index(luaL_checkinteger(L, 3));
+    lua_Integer limit = luaL_optinteger(L, 4, 10);
+
+    std::vector<std::string> out;
+    words.complete(std::string(query, len), line == static_cast<size_t>(-1) ? 0 : line,
+                   limit > 0 ? static_cast<size_t>(limit) : 0, out);
+    lua_createtable(L, static_cast<int>(out.size()), 0);
+    for (size_t i = 0; i < out.size(); i++) {
+        lua_pushlstring(L, out[i].data(), out[i].size());
+        lua_rawseti(L, -2, static_cast<int>(i + 1));
+    }
+    return 1;
+}
+
+// index:size() -> number of distinct words
+int LuaBindings::lua_words_size(lua_State* L) {
+    lua_pushinteger(L, check_words(L).size());
+    return 1;
+}
+
+// Job functions
+
+// Set up by init(), before any thread exists: SIGCHLD becomes an event
+// loop signal and SIGPIPE harmless (writing to a job that closed its
+// stdin must not kill the editor)
+void LuaBindings::init_jobs() {
+    signal(SIGPIPE, SIG_IGN);
+    loop_.on_signal(SIGCHLD, [this]() {
+        std::vector<Job*> exited;
+        for (auto& entry : jobs_) {
+            if (entry.first->reap()) exited.push_back(entry.first);
+        }
+        for (Job* job : exited) finish_job(job);
+    });
+}
+
+// Calls the job callback held in `ref` (if any) with the values pushed
+// above it by the caller
+void LuaBindings::call_job_callback(int ref, int nargs) {
+    if (ref == LUA_NOREF) {
+        lua_pop(L_, nargs);
+        return;
+    }
+    lua_rawgeti(L_, LUA_REGISTRYINDEX, ref);
+    lua_insert(L_, -1 - nargs);
+    if (lua_pcall(L_, nargs, 0, 0) != 0) {
+        fprintf(stderr, "Error in job callback: %s\n", lua_tostring(L_, -1));
+        lua_pop(L_, 1);
+    }
+}
+
+// Hands what the job wrote to `s` to on_stdout/on_stderr; stops watching
+// the stream at its end
+void LuaBindings::job_output(Job* job, Job::Stream s) {
+    auto it = jobs_.find(job);
+    if (it == jobs_.end()) return;
+    int fd = job->output_fd(s);
+    std::string data;
+    if (!job->read(s, data)) loop_.unwatch(fd);
+    if (data.empty()) return;
+    lua_pushlstring(L_, data.data(), data.size());
+    call_job_callback(s == Job::STDOUT ? it->second.on_stdout : it->second.on_stderr, 1);
+}
+
+// Writes queued stdin while the pipe takes it
+void LuaBindings::job_input(Job* job) {
+    int fd = job->input_fd();
+    if (fd < 0) return;
+    if (job->flush_input()) {
+        loop_.unwatch(fd);
+    } else if (!loop_.watch(fd, EventLoop::WRITABLE, [this, job](uint32_t) { job_input(job); })) {
+        job->close_input();
+    }
+}
+
+// The job exited: delivers the rest of its output, then on_exit(code,
+// signal), and lets go of it. Output from processes it left running
+// behind is not waited for.
+void LuaBindings::finish_job(Job* job) {
+    if (!jobs_.count(job)) return;
+    for (Job::Stream s : {Job::STDOUT, Job::STDERR}) {
+        int fd = job->output_fd(s);
+        if (fd < 0) continue;
+        job_output(job, s);
+        if (job->output_fd(s) >= 0) {
+            loop_.unwatch(fd);
+            job->close_output(s);
+        }
+    }
+    if (job->input_fd() >= 0) loop_.unwatch(job->input_fd());
+
+    auto it = jobs_.find(job);
+    if (it == jobs_.end()) return;
+    JobRefs refs = it->second;
+    jobs_.erase(it);
+    if (refs.timer) loop_.cancel_timer(refs.timer);
+
+    lua_pushinteger(L_, job->exit_code());
+    lua_pushinteger(L_, job->term_signal());
+    call_job_callback(refs.on_exit, 2);
+    for (int ref : {refs.on_stdout, refs.on_stderr, refs.on_exit, refs.self}) {
+        luaL_unref(L_, LUA_REGISTRYINDEX, ref);
+    }
+}
+
+// Asks the job to stop, and makes sure after KILL_GRACE_MS
+void LuaBindings::stop_job(Job* job, int signo) {
+    auto it = jobs_.find(job);
+    if (it == jobs_.end()) return;
+    job->signal(signo);
+    if (signo == SIGKILL) return;
+    if (it->second.timer) loop_.cancel_timer(it->second.timer);
+    it->second.timer = loop_.add_timer(KILL_GRACE_MS, 0, [this, job]() {
+        auto it = jobs_.find(job);
+        if (it == jobs_.end()) return;
+        it->second.timer = 0;
+        job->signal(SIGKILL);
+    });
+}
+
+static int optional_ref(lua_State* L, int table, const char* field) {
+    lua_getfield(L, table, field);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        return LUA_NOREF;
+    }
+    luaL_checktype(L, -1, LUA_TFUNCTION);
+    return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+// catvim.job.start(cmd, {cwd=, stdin=, timeout=, on_stdout=, on_stderr=,
+//                        on_exit=}) -> job, or nil and an error message
+// cmd is a shell command line, or an argv table run directly. Output is
+// streamed to on_stdout(data)/on_stderr(data) as it arrives;
+// on_exit(code, signal) comes last (code is -1 if a signal killed it).
+// With stdin = true the job reads what job:write() sends. A timeout in
+// milliseconds stops the job like job:kill().
+int LuaBindings::lua_job_start(lua_State* L) {
+    std::vector<std::string> argv;
+    if (lua_istable(L, 1)) {
+        for (int i = 1;; i++) {
+            lua_rawgeti(L, 1, i);
+            if (lua_isnil(L, -1)) {
+                lua_pop(L, 1);
+                break;
+            }
+            argv.push_back(luaL_checkstring(L, -1));
+            lua_pop(L, 1);
+        }
+    } else {
+        argv = {"/bin/sh", "-c", luaL_checkstring(L, 1)};
+    }
+
+    std::string cwd;
+    bool with_stdin = false;
+    lua_Integer timeout = 0;
+    JobRefs refs;
+    if (lua_istable(L, 2)) {
+        lua_getfield(L, 2, "cwd"); if (lua_isstring(L, -1)) cwd = lua_tostring(L, -1); lua_pop(L, 1);
+        lua_getfield(L, 2, "stdin"); with_stdin = lua_toboolean(L, -1); lua_pop(L, 1);
+        lua_getfield(L, 2, "timeout"); timeout = luaL_optinteger(L, -1, 0); lua_pop(L, 1);
+        refs.on_stdout = optional_ref(L, 2, "on_stdout");
+        refs.on_stderr = optional_ref(L, 2, "on_stderr");
+        refs.on_exit = optional_ref(L, 2, "on_exit");
+    }
+
+    LuaBindings* self = instance();
+    auto job = std::make_unique<Job>();
+    std::string error;
+    if (!job->start(argv, cwd, with_stdin, error)) {
+        for (int ref : {refs.on_stdout, refs.on_stderr, refs.on_exit}) luaL_unref(L, LUA_REGISTRYINDEX, ref);
+        lua_pushnil(L);
+        lua_pushstring(L, error.c_str());
+        return 2;
+    }
+
+    Job* raw = job.release();
+    void* mem = lua_newuserdata(L, sizeof(Job*));
+    *static_cast<Job**>(mem) = raw;
+    luaL_getmetatable(L, JOB_MT);
+    lua_setmetatable(L, -2);
+    // A running job stays alive without a Lua reference to it
+    lua_pushvalue(L, -1);
+    refs.self = luaL_ref(L, LUA_REGISTRYINDEX);
+    self->jobs_[raw] = refs;
+
+    for (Job::Stream s : {Job::STDOUT, Job::STDERR}) {
+        self->loop_.watch(raw->output_fd(s), EventLoop::READABLE, [self, raw, s](uint32_t) {
+            self->job_output(raw, s);
+        });
+    }
+    if (timeout > 0) {
+        self->jobs_[raw].timer = self->loop_.add_timer(static_cast<int>(timeout), 0, [self, raw]() {
+            auto it = self->jobs_.find(raw);
+            if (it == self->jobs_.end()) return;
+            it->second.timer = 0;
+            self->stop_job(raw, SIGTERM);
+        });
+    }
+    // SIGCHLD goes to the loop from before the spawn, so even a job that
+    // exits at once finishes from there, never before this returns
+    return 1;
+}
+
+int LuaBindings::lua_job_gc(lua_State* L) {
+    auto* job = static_cast<Job**>(luaL_checkudata(L, 1, JOB_MT));
+    // Only reached for finished jobs, or when the editor shuts down, where
+    // ~Job kills what is still running
+    delete *job;
+    *job = nullptr;
+    return 0;
+}
+
+// job:write(data) -> false if stdin is closed
+int LuaBindings::lua_job_write(lua_State* L) {
+    Job& job = check_job(L);
+    size_t len = 0;
+    const char* data = luaL_checklstring(L, 2, &len);
+    bool ok = job.write(data, len);
+    if (ok && job.input_pending()) instance()->job_input(&job);
+    lua_pushboolean(L, ok);
+    return 1;
+}
+
+// job:close(); closes stdin once everything written has been sent
+int LuaBindings::lua_job_close(lua_State* L) {
+    Job& job = check_job(L);
+    int fd = job.input_fd();
+    job.close_input();
+    if (fd >= 0 && job.input_fd() < 0) instance()->loop_.unwatch(fd);
+    return 0;
+}
+
+// job:kill([signal]) sends SIGTERM (or the given signal number) to the
+// job's process group, and SIGKILL if it is still running a little later
+int LuaBindings::lua_job_kill(lua_State* L) {
+    Job& job = check_job(L);
+    instance()->stop_job(&job, static_cast<int>(luaL_optinteger(L, 2, SIGTERM)));
+    return 0;
+}
+
+// job:pid() -> process id
+int LuaBindings::lua_job_pid(lua_State* L) {
+    lua_pushinteger(L, check_job(L).pid());
+    return 1;
+}
+
+// job:running() -> true until on_exit has been called
+int LuaBindings::lua_job_running(lua_State* L) {
+    Job& job = check_job(L);
+    lua_pushboolean(L, instance()->jobs_.count(&job) > 0);
+    return 1;
+}
+
+// Profiler
+
+static void push_percentiles(lua_State* L, const Profiler::Percentiles& p) {
+    lua_newtable(L);
+    lua_pushnumber(L, p.p50); lua_setfield(L, -2, "p50");
+    lua_pushnumber(L, p.p99); lua_setfield(L, -2, "p99");
+    lua_pushnumber(L, p.max); lua_setfield(L, -2, "max");
+}
+
+// catvim.profile.stats([frames=120]) -> {frames, seconds, lua_kb,
+// gc_cycles, busy, bytes, phases = {{name, p50, p99, max}, ...}}
+// Times are in ms; busy is the frame's top-level work.
+int LuaBindings::lua_profile_stats(lua_State* L) {
+    size_t frames = static_cast<size_t>(luaL_optinteger(L, 1, 120));
+    Profiler::Stats stats = instance()->profiler_.stats(frames);
+    lua_newtable(L);
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.frames)); lua_setfield(L, -2, "frames");
+    lua_pushnumber(L, stats.seconds); lua_setfield(L, -2, "seconds");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.lua_kb)); lua_setfield(L, -2, "lua_kb");
+    lua_pushinteger(L, stats.gc_cycles); lua_setfield(L, -2, "gc_cycles");
+    push_percentiles(L, stats.busy_ms); lua_setfield(L, -2, "busy");
+    push_percentiles(L, stats.bytes); lua_setfield(L, -2, "bytes");
+    lua_newtable(L);
+    for (int p = 0; p < Profiler::PHASES; p++) {
+        push_percentiles(L, stats.phase_ms[p]);
+        lua_pushstring(L, Profiler::phase_name(p)); lua_setfield(L, -2, "name");
+        lua_rawseti(L, -2, p + 1);
+    }
+    lua_setfield(L, -2, "phases");
+    return 1;
+}
+
+// catvim.profile.dump(path) -> true | nil, err
+int LuaBindings::lua_profile_dump(lua_State* L) {
+    const char* path = luaL_checkstring(L, 1);
+    std::string error;
+    if (!instance()->profiler_.write_trace(path, error)) {
+        lua_pushnil(L);
+        lua_pushstring(L, error.c_str());
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// catvim.profile.render_begin(): drawing starts here; the render phase
+// runs to the next catvim.render.flush()
+int LuaBindings::lua_profile_render_begin(lua_State*) {
+    instance()->render_start_ns_ = Profiler::now_ns();
+    return 0;
+}
+
+// __gc of the sentinel (see new_gc_sentinel)
+int LuaBindings::lua_gc_sentinel(lua_State* L) {
+    LuaBindings* self = instance();
+    if (!self || self->closing_) return 0;
+    self->profiler_.gc_cycle();
+    new_gc_sentinel(L);
+    return 0;
+}
+
+// catvim.exec(cmd) -> stdout, exit code
+// Runs a shell command and waits for it; catvim.job.start doesn't wait.
 int LuaBindings::lua_exec(lua_State* L) {
     const char* cmd = luaL_checkstring(L, 1);
-    FILE* pipe = popen(cmd, "r");
-    if (!pipe) {
+    Job job;
+    std::string error;
+    if (!job.start({"/bin/sh", "-c", cmd}, "", false, error)) {
         lua_pushnil(L);
-        lua_pushstring(L, "Failed to execute command");
+        lua_pushstring(L, error.c_str());
         return 2;
     }
     
+    // stderr is read too (and dropped) so the child can't block on it, and
+    // it can't scribble over the screen
     std::string result;
-    char buffer[128];
-    while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-        result += buffer;
+    std::string ignored;
+    struct pollfd fds[2] = {{job.output_fd(Job::STDOUT), POLLIN, 0}, {job.output_fd(Job::STDERR), POLLIN, 0}};
+    while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) break;
+        if (fds[0].revents && !job.read(Job::STDOUT, result)) fds[0].fd = -1;
+        if (fds[1].revents && !job.read(Job::STDERR, ignored)) fds[1].fd = -1;
+        ignored.clear();
     }
-    int status = pclose(pipe);
+    job.wait();
     
-    lua_pushstring(L, result.c_str());
-    lua_pushinteger(L, WEXITSTATUS(status));
+    lua_pushlstring(L, result.data(), result.size());
+    lua_pushinteger(L, job.term_signal() ? 128 + job.term_signal() : job.exit_code());
     return 2;
 }
 
@@ -4,6 +4,17 @@
 #include "terminal.hpp"
 #include "input.hpp"
 #include "renderer.hpp"
+#include "text_buffer.hpp"
+#include "file_io.hpp"
+#include "event_loop.hpp"
+#include "search.hpp"
+#include "grep.hpp"
+#include "word_index.hpp"
+#include "dir_tree.hpp"
+#include "job.hpp"
+#include "replay.hpp"
+#include "profiler.hpp"
+#include <map>
 #include <memory>
 
 namespace catvim {
@@ -15,12 +26,30 @@ public:
     
     bool init();
     bool load_file(const char* path);
+    // Lets require() find the modules linked into the binary before
+    // looking on disk, and runs one of them like load_file()
+    void use_embedded_modules();
+    bool load_embedded(const char* name);
     bool call_function(const char* name, int nargs = 0, int nresults = 0);
     
+    // Runs the event loop until catvim.quit(). Lua is called back through
+    // the globals on_input(events) and on_resize(width, height), timer
+    // callbacks, and update() after every batch.
+    void run();
+    
+    // Saves every input chunk and resize to `log` (--record)
+    void record(std::unique_ptr<KeyLog> log);
+    // Feeds `log` to the editor instead of the terminal's input (--replay),
+    // at its recorded pace or, if `fast`, back to back; run() returns
+    // shortly after the last entry. Latency is measured throughout.
+    void replay(std::unique_ptr<KeyLog> log, bool fast);
+    std::string replay_report() const { return latency_ ? latency_->report() : ""; }
+    
     lua_State* state() { return L_; }
     Terminal& terminal() { return terminal_; }
     Renderer& renderer() { return renderer_; }
-    InputParser& input() { return input_; }
+    InputQueue& input() { return input_; }
+    EventLoop& loop() { return loop_; }
     
     // Singleton access for Lua callbacks
     static LuaBindings* instance();
@@ -29,31 +58,156 @@ private:
     lua_State* L_ = nullptr;
     Terminal terminal_;
     Renderer renderer_;
-    InputParser input_;
+    InputQueue input_;
+    EventLoop loop_;
+    int escape_timer_ = 0;
+    std::map<int, int> timer_refs_;  // Timer id -> registry ref of its Lua callback
+    std::map<Grep*, int> grep_refs_;  // Running grep -> registry ref of its Lua callback
+    std::map<DirTree*, int> tree_refs_;  // Directory tree -> registry ref of its Lua callback
+
+    // Registry refs held for a running job: the job itself and its callbacks
+    struct JobRefs {
+        int self = LUA_NOREF;
+        int on_stdout = LUA_NOREF;
+        int on_stderr = LUA_NOREF;
+        int on_exit = LUA_NOREF;
+        int timer = 0;  // Timeout or kill timer
+    };
+    static const int KILL_GRACE_MS = 2000;
+    std::map<Job*, JobRefs> jobs_;
+    
+    std::unique_ptr<KeyLog> record_log_;
+    std::unique_ptr<KeyLog> replay_log_;
+    size_t replay_next_ = 0;
+    bool replay_fast_ = false;
+    std::unique_ptr<LatencyRecorder> latency_;
+    int64_t frame_start_ns_ = 0;  // When the Lua callback now running was entered
+    int64_t render_start_ns_ = 0;  // catvim.profile.render_begin(), until the flush
+    std::vector<int> line_columns_;  // Byte -> column map, reused by catvim.render.line
+    Profiler profiler_;
+    bool closing_ = false;
     
     void register_functions();
+    void read_input(uint32_t events);
+    void feed_input(const std::string& bytes);
+    void replay_step();
+    void dispatch_input();
+    void dispatch_resize();
+    void run_timer(int id, bool repeating);
+    void deliver_grep(Grep* grep);
+    void stop_grep(Grep* grep);
+    void update_tree(DirTree* tree);
+    void init_jobs();
+    void call_job_callback(int ref, int nargs);
+    void job_output(Job* job, Job::Stream s);
+    void job_input(Job* job);
+    void finish_job(Job* job);
+    void stop_job(Job* job, int signo);
     
     // Lua-exposed functions
     static int lua_term_size(lua_State* L);
     static int lua_term_write(lua_State* L);
     static int lua_term_read(lua_State* L);
+    static int lua_term_events(lua_State* L);
     static int lua_term_clear(lua_State* L);
     static int lua_term_move(lua_State* L);
     static int lua_term_show_cursor(lua_State* L);
     static int lua_term_hide_cursor(lua_State* L);
     
+    static int lua_loop_timer(lua_State* L);
+    static int lua_loop_cancel(lua_State* L);
+    static int lua_loop_now(lua_State* L);
+    
+    static int lua_render_style(lua_State* L);
     static int lua_render_set(lua_State* L);
     static int lua_render_string(lua_State* L);
+    static int lua_render_line(lua_State* L);
     static int lua_render_clear(lua_State* L);
     static int lua_render_flush(lua_State* L);
     static int lua_render_box(lua_State* L);
     static int lua_render_resize(lua_State* L);
     
+    static int lua_utf8_width(lua_State* L);
+    static int lua_utf8_col(lua_State* L);
+    static int lua_utf8_byte(lua_State* L);
+    
     static int lua_fs_read(lua_State* L);
     static int lua_fs_write(lua_State* L);
     static int lua_fs_list(lua_State* L);
     static int lua_fs_exists(lua_State* L);
     static int lua_fs_isdir(lua_State* L);
+    static int lua_fs_id(lua_State* L);
+    static int lua_fs_tree(lua_State* L);
+
+    static int lua_tree_gc(lua_State* L);
+    static int lua_tree_expand(lua_State* L);
+    static int lua_tree_count(lua_State* L);
+    static int lua_tree_rows(lua_State* L);
+    static int lua_tree_find(lua_State* L);
+    
+    static int lua_text_new(lua_State* L);
+    static int lua_text_gc(lua_State* L);
+    static int lua_text_line_count(lua_State* L);
+    static int lua_text_length(lua_State* L);
+    static int lua_text_line(lua_State* L);
+    static int lua_text_line_length(lua_State* L);
+    static int lua_text_set_line(lua_State* L);
+    static int lua_text_insert_line(lua_State* L);
+    static int lua_text_delete_line(lua_State* L);
+    static int lua_text_insert(lua_State* L);
+    static int lua_text_erase(lua_State* L);
+    static int lua_text_get_text(lua_State* L);
+    static int lua_text_set_text(lua_State* L);
+    static int lua_text_load(lua_State* L);
+    static int lua_text_save(lua_State* L);
+    static int lua_text_undo(lua_State* L);
+    static int lua_text_redo(lua_State* L);
+    static int lua_text_undo_mark(lua_State* L);
+    static int lua_text_begin_transaction(lua_State* L);
+    static int lua_text_end_transaction(lua_State* L);
+    static int lua_text_set_undo_budget(lua_State* L);
+    static int lua_text_undo_bytes(lua_State* L);
+    static int lua_text_mark_saved(lua_State* L);
+    static int lua_text_is_modified(lua_State* L);
+    static int lua_text_large(lua_State* L);
+    static int lua_text_pending_line(lua_State* L);
+    static int lua_text_update_index(lua_State* L);
+    static int lua_text_unload(lua_State* L);
+    static int lua_text_reload(lua_State* L);
+    static int lua_text_unloaded(lua_State* L);
+    static int lua_text_spill_undo(lua_State* L);
+    static int lua_text_memory(lua_State* L);
+
+    static int lua_search_new(lua_State* L);
+    static int lua_search_gc(lua_State* L);
+    static int lua_search_find(lua_State* L);
+    static int lua_search_find_step(lua_State* L);
+    static int lua_search_count_step(lua_State* L);
+    static int lua_search_index(lua_State* L);
+    static int lua_search_line_matches(lua_State* L);
+
+    static int lua_grep_start(lua_State* L);
+    static int lua_grep_gc(lua_State* L);
+    static int lua_grep_cancel(lua_State* L);
+    static int lua_grep_files(lua_State* L);
+
+    static int lua_words_new(lua_State* L);
+    static int lua_words_gc(lua_State* L);
+    static int lua_words_complete(lua_State* L);
+    static int lua_words_size(lua_State* L);
+    
+    static int lua_job_start(lua_State* L);
+    static int lua_job_gc(lua_State* L);
+    static int lua_job_write(lua_State* L);
+    static int lua_job_close(lua_State* L);
+    static int lua_job_kill(lua_State* L);
+    static int lua_job_pid(lua_State* L);
+    static int lua_job_running(lua_State* L);
+    
+    static int lua_profile_stats(lua_State* L);
+    static int lua_profile_dump(lua_State* L);
+    static int lua_profile_render_begin(lua_State* L);
+    static int lua_gc_sentinel(lua_State* L);
     
     static int lua_exec(lua_State* L);
     static int lua_quit(lua_State* L);
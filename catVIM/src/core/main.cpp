@@ -1,84 +1,126 @@
 #include "lua_bindings.hpp"
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
+#include <fcntl.h>
+#include <memory>
 #include <unistd.h>
 #include <libgen.h>
-
-extern bool catvim_should_quit();
+#include <vector>
 
 int main(int argc, char* argv[]) {
-    catvim::LuaBindings app;
-    
-    if (!app.init()) {
-        fprintf(stderr, "Failed to initialize catVIM\n");
+    // Options for the core; everything else is passed on to Lua
+    //   --record F    save terminal input to the key log F
+    //   --replay F    feed the key log F instead and report latency on exit
+    //   --fast        replay without the recorded pauses
+    //   --headless    replay without a terminal
+    //   --capture F   with --headless, write the output to F
+    const char* record_path = nullptr;
+    const char* replay_path = nullptr;
+    const char* capture_path = nullptr;
+    bool fast = false;
+    bool headless = false;
+    std::vector<const char*> args;
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(a, "--record") == 0 && has_value) {
+            record_path = argv[++i];
+        } else if (strcmp(a, "--replay") == 0 && has_value) {
+            replay_path = argv[++i];
+        } else if (strcmp(a, "--capture") == 0 && has_value) {
+            capture_path = argv[++i];
+        } else if (strcmp(a, "--fast") == 0) {
+            fast = true;
+        } else if (strcmp(a, "--headless") == 0) {
+            headless = true;
+        } else {
+            args.push_back(a);
+        }
+    }
+    if (headless && !replay_path) {
+        fprintf(stderr, "--headless needs --replay\n");
         return 1;
     }
     
-    // Find Lua scripts path
-    // First try: ./src/lua/init.lua (development)
-    // Second try: ~/.config/catvim/init.lua (installed)
-    const char* lua_paths[] = {
-        "./src/lua/init.lua",
-        nullptr  // Will be set to home config path
-    };
-    
-    char config_path[512];
-    const char* home = getenv("HOME");
-    if (home) {
-        snprintf(config_path, sizeof(config_path), "%s/.config/catvim/init.lua", home);
-        lua_paths[1] = config_path;
+    std::string error;
+    auto replay_log = std::make_unique<catvim::KeyLog>();
+    if (replay_path && !replay_log->load(replay_path, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    auto record_log = std::make_unique<catvim::KeyLog>();
+    if (record_path && !record_log->create(record_path, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    int capture_fd = -1;
+    if (capture_path) {
+        capture_fd = open(capture_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (capture_fd < 0) {
+            fprintf(stderr, "%s: %s\n", capture_path, strerror(errno));
+            return 1;
+        }
     }
     
-    // Set package path for Lua modules
-    lua_getglobal(app.state(), "package");
-    lua_getfield(app.state(), -1, "path");
-    std::string path = lua_tostring(app.state(), -1);
-    
-    path += ";./src/lua/?.lua;./src/lua/?/init.lua";
-    if (home) {
-        path += ";";
-        path += home;
-        path += "/.config/catvim/?.lua;";
-        path += home;
-        path += "/.config/catvim/?/init.lua";
+    auto owner = std::make_unique<catvim::LuaBindings>();
+    catvim::LuaBindings& app = *owner;
+    if (headless) {
+        int width, height;
+        replay_log->initial_size(width, height);
+        app.terminal().make_virtual(width, height, capture_fd);
     }
+    if (record_path) app.record(std::move(record_log));
+    if (replay_path) app.replay(std::move(replay_log), fast);
     
-    lua_pushstring(app.state(), path.c_str());
-    lua_setfield(app.state(), -3, "path");
-    lua_pop(app.state(), 2);
+    if (!app.init()) {
+        fprintf(stderr, "Failed to initialize catVIM\n");
+        return 1;
+    }
     
-    // Load init.lua
-    bool loaded = false;
-    for (const char* p : lua_paths) {
-        if (p && access(p, R_OK) == 0) {
-            if (app.load_file(p)) {
-                loaded = true;
-                break;
-            }
-        }
+    // The Lua scripts are linked into the binary, so nothing is looked up
+    // on disk. CATVIM_LUA_DIR=src/lua runs them from a source tree instead,
+    // for working on them without rebuilding.
+    bool loaded;
+    const char* lua_dir = getenv("CATVIM_LUA_DIR");
+    if (lua_dir && *lua_dir) {
+        std::string dir = lua_dir;
+        lua_getglobal(app.state(), "package");
+        lua_getfield(app.state(), -1, "path");
+        std::string path = dir + "/?.lua;" + dir + "/?/init.lua;" + lua_tostring(app.state(), -1);
+        lua_pushstring(app.state(), path.c_str());
+        lua_setfield(app.state(), -3, "path");
+        lua_pop(app.state(), 2);
+        loaded = app.load_file((dir + "/init.lua").c_str());
+    } else {
+        app.use_embedded_modules();
+        loaded = app.load_embedded("init");
     }
     
     if (!loaded) {
-        fprintf(stderr, "Could not find init.lua\nTry running from catVIM directory or install with 'make install'\n");
+        fprintf(stderr, "Could not load init.lua\n");
         return 1;
     }
     
     // Pass command line args to Lua
     lua_newtable(app.state());
-    for (int i = 1; i < argc; i++) {
-        lua_pushstring(app.state(), argv[i]);
-        lua_rawseti(app.state(), -2, i);
+    for (size_t i = 0; i < args.size(); i++) {
+        lua_pushstring(app.state(), args[i]);
+        lua_rawseti(app.state(), -2, static_cast<int>(i + 1));
     }
     lua_setglobal(app.state(), "arg");
     
     // Call init()
     app.call_function("init");
     
-    // Main loop - poll() in term.read() handles timing
-    while (!catvim_should_quit()) {
-        app.call_function("update");
-    }
+    // Main loop - sleeps until input, a resize or a timer needs handling
+    app.run();
     
-    // Cleanup is handled by LuaBindings destructor
+    // Cleanup is handled by LuaBindings destructor; the report goes out
+    // once the terminal is back to normal
+    std::string report = app.replay_report();
+    owner.reset();
+    if (capture_fd >= 0) close(capture_fd);
+    fputs(report.c_str(), stdout);
     return 0;
 }
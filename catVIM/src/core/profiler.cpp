@@ -0,0 +1,120 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace catvim {
+
+static const char* PHASE_NAMES[] = {"parse", "handle", "update", "timer", "render", "encode", "write"};
+
+const char* Profiler::phase_name(int phase) {
+    return phase >= 0 && phase < PHASES ? PHASE_NAMES[phase] : "?";
+}
+
+int64_t Profiler::now_ns() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+Profiler::Profiler(size_t frames, size_t spans) : frames_(frames), spans_(spans) {}
+
+void Profiler::record(Phase phase, int64_t start_ns, int64_t end_ns) {
+    spans_[span_count_++ % spans_.size()] = {start_ns, end_ns - start_ns, phase};
+    current_.phase_ns[phase] += end_ns - start_ns;
+}
+
+void Profiler::frame_written(size_t bytes) {
+    current_.bytes += bytes;
+    drawn_ = true;
+}
+
+void Profiler::end_iteration(size_t lua_kb) {
+    if (!drawn_) return;
+    current_.end_ns = now_ns();
+    current_.lua_kb = lua_kb;
+    current_.gc_cycles = gc_cycles_;
+    frames_[frame_count_++ % frames_.size()] = current_;
+    current_ = {};
+    drawn_ = false;
+    gc_cycles_ = 0;
+}
+
+static Profiler::Percentiles percentiles(std::vector<double>& values) {
+    Profiler::Percentiles p;
+    if (values.empty()) return p;
+    std::sort(values.begin(), values.end());
+    auto at = [&](double q) { return values[static_cast<size_t>(q * (values.size() - 1) + 0.5)]; };
+    p.p50 = at(0.5);
+    p.p99 = at(0.99);
+    p.max = values.back();
+    return p;
+}
+
+Profiler::Stats Profiler::stats(size_t frames) const {
+    Stats s;
+    s.frames = std::min({frames, frame_count_, frames_.size()});
+    if (s.frames == 0) return s;
+
+    size_t first = frame_count_ - s.frames;
+    auto frame = [&](size_t i) -> const Frame& { return frames_[(first + i) % frames_.size()]; };
+    s.seconds = (frame(s.frames - 1).end_ns - frame(0).end_ns) / 1e9;
+    s.lua_kb = frame(s.frames - 1).lua_kb;
+
+    std::vector<double> values(s.frames);
+    for (int p = 0; p < PHASES; p++) {
+        for (size_t i = 0; i < s.frames; i++) values[i] = frame(i).phase_ns[p] / 1e6;
+        s.phase_ms[p] = percentiles(values);
+    }
+    for (size_t i = 0; i < s.frames; i++) {
+        const Frame& f = frame(i);
+        values[i] = (f.phase_ns[PARSE] + f.phase_ns[HANDLE] + f.phase_ns[UPDATE] + f.phase_ns[TIMER]) / 1e6;
+    }
+    s.busy_ms = percentiles(values);
+    for (size_t i = 0; i < s.frames; i++) {
+        values[i] = static_cast<double>(frame(i).bytes);
+        s.gc_cycles += frame(i).gc_cycles;
+    }
+    s.bytes = percentiles(values);
+    return s;
+}
+
+bool Profiler::write_trace(const char* path, std::string& error) const {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        error = std::string(path) + ": " + std::strerror(errno);
+        return false;
+    }
+
+    size_t span_first = span_count_ - std::min(span_count_, spans_.size());
+    size_t frame_first = frame_count_ - std::min(frame_count_, frames_.size());
+    int64_t base = span_count_ > span_first ? spans_[span_first % spans_.size()].start_ns : 0;
+
+    // Timestamps are microseconds from the oldest span
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"catvim\"}}");
+    for (size_t i = span_first; i < span_count_; i++) {
+        const Span& s = spans_[i % spans_.size()];
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+                phase_name(s.phase), (s.start_ns - base) / 1e3, s.dur_ns / 1e3);
+    }
+    for (size_t i = frame_first; i < frame_count_; i++) {
+        const Frame& fr = frames_[i % frames_.size()];
+        if (fr.end_ns < base) continue;
+        double ts = (fr.end_ns - base) / 1e3;
+        fprintf(f, ",\n{\"name\":\"frame\",\"ph\":\"i\",\"s\":\"p\",\"pid\":1,\"tid\":1,\"ts\":%.3f,"
+                   "\"args\":{\"bytes\":%zu,\"gc_cycles\":%d}}",
+                ts, fr.bytes, fr.gc_cycles);
+        fprintf(f, ",\n{\"name\":\"lua heap\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"KB\":%zu}}", ts,
+                fr.lua_kb);
+    }
+    fprintf(f, "\n]}\n");
+
+    bool ok = !ferror(f);
+    if (fclose(f) != 0) ok = false;
+    if (!ok) error = std::string(path) + ": write failed";
+    return ok;
+}
+
+}  // namespace catvim
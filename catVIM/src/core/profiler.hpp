@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace catvim {
+
+// Timings of the main loop, always on. Each phase of work is recorded as
+// a span (start and duration) in a fixed ring, and added to the frame
+// being built; the frame is committed to a second ring at the end of the
+// loop iteration that wrote it, so it also carries the input handling
+// that led up to it. Recording is two clock reads and a store; nothing
+// is allocated after construction and old entries are overwritten.
+//
+// Phases nest: render, encode and write happen inside update or timer.
+class Profiler {
+public:
+    enum Phase {
+        PARSE,   // Decoding terminal input
+        HANDLE,  // on_input
+        UPDATE,  // update()
+        TIMER,   // Lua timer callbacks
+        RENDER,  // State:render up to catvim.render.flush()
+        ENCODE,  // Renderer::flush
+        WRITE,   // Terminal write syscalls
+        PHASES
+    };
+    static const char* phase_name(int phase);
+    static int64_t now_ns();
+
+    struct Frame {
+        int64_t end_ns;
+        int64_t phase_ns[PHASES];
+        size_t bytes;
+        size_t lua_kb;   // Lua heap when the frame was committed
+        int gc_cycles;   // Lua GC cycles completed while it was built
+    };
+
+    struct Percentiles {
+        double p50 = 0, p99 = 0, max = 0;
+    };
+    struct Stats {
+        size_t frames = 0;
+        double seconds = 0;  // From the first frame to the last
+        Percentiles phase_ms[PHASES];
+        Percentiles busy_ms;  // parse + handle + update + timer
+        Percentiles bytes;
+        size_t lua_kb = 0;
+        int gc_cycles = 0;
+    };
+
+    explicit Profiler(size_t frames = 1024, size_t spans = 16384);
+
+    void record(Phase phase, int64_t start_ns, int64_t end_ns);
+    void frame_written(size_t bytes);
+    void gc_cycle() { gc_cycles_++; }
+    // End of a loop iteration: commits the frame if one was written
+    void end_iteration(size_t lua_kb);
+
+    // Over the last `frames` committed frames
+    Stats stats(size_t frames) const;
+
+    // Chrome trace event JSON (chrome://tracing, Perfetto) of the spans
+    // and frames still in the rings
+    bool write_trace(const char* path, std::string& error) const;
+
+private:
+    struct Span {
+        int64_t start_ns;
+        int64_t dur_ns;
+        int phase;
+    };
+
+    std::vector<Frame> frames_;
+    size_t frame_count_ = 0;  // Ever committed; frames_[i % size] is the ring
+    std::vector<Span> spans_;
+    size_t span_count_ = 0;
+
+    Frame current_ = {};
+    bool drawn_ = false;
+    int gc_cycles_ = 0;
+};
+
+}  // namespace catvim
@@ -1,9 +1,24 @@
 #include "renderer.hpp"
-#include <sstream>
+#include "unicode.hpp"
+#include <algorithm>
 #include <cstring>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CATVIM_X86 1
+#endif
+
 namespace catvim {
 
+// Never produced by Lua; marks front buffer cells whose on-screen content is unknown
+static const char32_t INVALID_CHAR = 0xFFFFFFFF;
+
+// Outside Unicode; the second cell of a double-width character
+static const char32_t WIDE_TAIL = 0x110000;
+
+// Base for combining marks that have no character to combine with
+static const char32_t DOTTED_CIRCLE = 0x25CC;
+
 bool Style::operator==(const Style& other) const {
     if (fg.is_default != other.fg.is_default) return false;
     if (!fg.is_default && (fg.r != other.fg.r || fg.g != other.fg.g || fg.b != other.fg.b)) return false;
@@ -12,130 +27,435 @@ bool Style::operator==(const Style& other) const {
     return attrs == other.attrs;
 }
 
-Renderer::Renderer() {}
+// Packs a style into one integer for palette lookups: 25 bits per color
+// (24-bit RGB plus a default flag) and 8 bits of attributes
+static uint64_t style_key(const Style& style) {
+    auto color_key = [](const Color& c) -> uint64_t {
+        if (c.is_default) return 1u << 24;
+        return (static_cast<uint64_t>(c.r) << 16) | (c.g << 8) | c.b;
+    };
+    return color_key(style.fg) | (color_key(style.bg) << 25) |
+           (static_cast<uint64_t>(style.attrs) << 50);
+}
+
+Renderer::Renderer() {
+    palette_.push_back(Style{});
+    palette_index_[style_key(Style{})] = 0;
+    marks_.emplace_back();
+    marks_index_[""] = 0;
+}
+
+StyleId Renderer::intern_style(const Style& style) {
+    uint64_t key = style_key(style);
+    auto it = palette_index_.find(key);
+    if (it != palette_index_.end()) return it->second;
+    if (palette_.size() > UINT16_MAX) return 0;
+    
+    StyleId id = static_cast<StyleId>(palette_.size());
+    palette_.push_back(style);
+    palette_index_.emplace(key, id);
+    return id;
+}
 
 void Renderer::resize(int width, int height) {
     width_ = width;
     height_ = height;
-    front_buffer_.resize(width * height);
+    // The terminal contents are unknown after a resize: make every front
+    // cell differ so the next flush repaints the whole screen
+    front_buffer_.assign(width * height, Cell{INVALID_CHAR, 0});
     back_buffer_.resize(width * height);
+    dirty_rows_.assign(height, 1);
+    out_.reserve(width * height * 8);
     clear();
 }
 
-void Renderer::set_cell(int x, int y, char32_t ch, const Style& style) {
+void Renderer::set_cell(int x, int y, char32_t ch, StyleId style) {
     if (!in_bounds(x, y)) return;
-    back_buffer_[index(x, y)] = {ch, style};
+    Cell* row = &back_buffer_[index(0, y)];
+    int width = char_width(ch);
+    if (width == 0) {
+        std::string mark;
+        append_utf8(mark, ch);
+        put_glyph(row, x, DOTTED_CIRCLE, 1, style);
+        row[x].marks = add_marks(0, mark.data(), mark.size());
+    } else {
+        if (width == 2 && x + 1 == width_) {
+            ch = ' ';  // A wide character can't start in the last column
+            width = 1;
+        }
+        put_glyph(row, x, ch, width, style);
+    }
+    touch(y);
 }
 
 void Renderer::set_cell(int x, int y, char32_t ch) {
     set_cell(x, y, ch, current_style_);
 }
 
-void Renderer::set_string(int x, int y, const std::string& str, const Style& style) {
-    for (size_t i = 0; i < str.size() && x + static_cast<int>(i) < width_; i++) {
-        set_cell(x + i, y, static_cast<char32_t>(str[i]), style);
+int Renderer::set_string(int x, int y, std::string_view str, StyleId style) {
+    if (!in_bounds(x, y)) return 0;
+    touch(y);
+    return put_text(x, y, str, width_, style, nullptr) - x;
+}
+
+void Renderer::set_line(int x, int y, std::string_view str, int width, std::vector<int>* columns) {
+    if (columns) columns->clear();
+    if (!in_bounds(x, y)) return;
+    int end = std::min(x + width, width_);
+    Cell* row = &back_buffer_[index(0, y)];
+    touch(y);
+    
+    split_wide(row, x);
+    split_wide(row, end);
+    int cx;
+    size_t fit = std::min(str.size(), static_cast<size_t>(std::max(end - x, 0)));
+    if (ascii_prefix(str.data(), fit) == fit) {
+        // The common case: one cell per byte, and bytes are columns
+        for (size_t i = 0; i < fit; i++) {
+            row[x + i] = {static_cast<char32_t>(str[i]), 0, 0};
+        }
+        cx = x + static_cast<int>(fit);
+    } else {
+        cx = put_text(x, y, str, end, 0, columns);
+    }
+    for (; cx < end; cx++) row[cx] = Cell{};
+}
+
+// Lays out UTF-8 text from column x up to column end (exclusive) and
+// returns the column after it. ASCII runs are found a vector at a time
+// and copied straight into cells; everything else is decoded one code
+// point at a time.
+int Renderer::put_text(int x, int y, std::string_view str, int end, StyleId style, std::vector<int>* columns) {
+    Cell* row = &back_buffer_[index(0, y)];
+    const char* s = str.data();
+    size_t n = str.size();
+    int start = x;
+    size_t i = 0;
+    while (i < n && x < end) {
+        size_t run = ascii_prefix(s + i, std::min(n - i, static_cast<size_t>(end - x)));
+        if (run > 0) {
+            split_wide(row, x);
+            split_wide(row, x + static_cast<int>(run));
+            for (size_t k = 0; k < run; k++) {
+                row[x + k] = {static_cast<char32_t>(s[i + k]), style, 0};
+                if (columns) columns->push_back(x + static_cast<int>(k) - start);
+            }
+            x += static_cast<int>(run);
+            i += run;
+            continue;
+        }
+        
+        size_t len;
+        char32_t ch = decode_utf8(s + i, n - i, len);
+        int width = char_width(ch);
+        int column = x;
+        if (width == 0 && x > start) {
+            // Combining: joins the character before it
+            column = row[x - 1].ch == WIDE_TAIL ? x - 2 : x - 1;
+            row[column].marks = add_marks(row[column].marks, s + i, len);
+        } else if (width == 0) {
+            put_glyph(row, x, DOTTED_CIRCLE, 1, style);
+            row[x].marks = add_marks(0, s + i, len);
+            x++;
+        } else {
+            if (width == 2 && x + 1 >= end) {
+                ch = ' ';  // Half of it would be clipped
+                width = 1;
+            }
+            put_glyph(row, x, ch, width, style);
+            x += width;
+        }
+        if (columns) columns->insert(columns->end(), len, column - start);
+        i += len;
+    }
+    if (columns) columns->push_back(x - start);
+    return x;
+}
+
+void Renderer::put_glyph(Cell* row, int x, char32_t ch, int width, StyleId style) {
+    split_wide(row, x);
+    split_wide(row, x + width);
+    row[x] = {ch, style, 0};
+    if (width == 2) row[x + 1] = {WIDE_TAIL, style, 0};
+}
+
+// About to write from column x onwards, or up to just before it: if that
+// cuts a double-width character in half, blank both halves
+void Renderer::split_wide(Cell* row, int x) {
+    if (x <= 0 || x >= width_ || row[x].ch != WIDE_TAIL) return;
+    row[x - 1].ch = ' ';
+    row[x - 1].marks = 0;
+    row[x].ch = ' ';
+}
+
+uint16_t Renderer::add_marks(uint16_t marks, const char* s, size_t len) {
+    std::string key = marks_[marks];
+    key.append(s, len);
+    auto it = marks_index_.find(key);
+    if (it != marks_index_.end()) return it->second;
+    if (marks_.size() > UINT16_MAX) return marks;
+    
+    uint16_t id = static_cast<uint16_t>(marks_.size());
+    marks_.push_back(key);
+    marks_index_.emplace(std::move(key), id);
+    return id;
+}
+
+void Renderer::style_span(int x, int y, int len, StyleId style) {
+    if (y < 0 || y >= height_) return;
+    int end = std::min(x + len, width_);
+    touch(y);
+    for (int cx = std::max(x, 0); cx < end; cx++) {
+        back_buffer_[index(cx, y)].style = style;
     }
 }
 
 void Renderer::clear() {
-    Cell empty = {' ', Style{}};
+    Cell empty = {' ', 0};
     std::fill(back_buffer_.begin(), back_buffer_.end(), empty);
+    std::fill(dirty_rows_.begin(), dirty_rows_.end(), 1);
 }
 
 void Renderer::clear_line(int y) {
     if (y < 0 || y >= height_) return;
-    Cell empty = {' ', Style{}};
+    Cell empty = {' ', 0};
+    touch(y);
     for (int x = 0; x < width_; x++) {
         back_buffer_[index(x, y)] = empty;
     }
 }
 
-std::string Renderer::char32_to_utf8(char32_t cp) {
-    std::string result;
-    if (cp < 0x80) {
-        result += static_cast<char>(cp);
-    } else if (cp < 0x800) {
-        result += static_cast<char>(0xC0 | (cp >> 6));
-        result += static_cast<char>(0x80 | (cp & 0x3F));
-    } else if (cp < 0x10000) {
-        result += static_cast<char>(0xE0 | (cp >> 12));
-        result += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
-        result += static_cast<char>(0x80 | (cp & 0x3F));
+// Unchanged cells between two changed spans are re-sent rather than jumped
+// over when the gap is this small; a cursor jump costs about as many bytes.
+static const int MAX_SPAN_GAP = 4;
+
+static void append_uint(std::string& out, unsigned v) {
+    char buf[10];
+    int n = 0;
+    do {
+        buf[n++] = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n) out += buf[--n];
+}
+
+static bool same_color(const Color& a, const Color& b) {
+    if (a.is_default != b.is_default) return false;
+    return a.is_default || (a.r == b.r && a.g == b.g && a.b == b.b);
+}
+
+static void append_param(std::string& out, bool& first, unsigned v) {
+    if (!first) out += ';';
+    first = false;
+    append_uint(out, v);
+}
+
+static void append_color(std::string& out, bool& first, const Color& c, unsigned base) {
+    if (c.is_default) {
+        append_param(out, first, base + 9);  // 39 / 49
+        return;
+    }
+    append_param(out, first, base + 8);      // 38 / 48
+    append_param(out, first, 2);
+    append_param(out, first, c.r);
+    append_param(out, first, c.g);
+    append_param(out, first, c.b);
+}
+
+void Renderer::move_cursor(int x, int y) {
+    if (x == cursor_x_ && y == cursor_y_) return;
+    
+    if (y == cursor_y_ && cursor_x_ >= 0 && x > cursor_x_) {
+        // Forward on the same row: CUF is shorter than CUP
+        out_ += "\x1b[";
+        if (x - cursor_x_ > 1) append_uint(out_, x - cursor_x_);
+        out_ += 'C';
+    } else if (x == 0 && cursor_y_ >= 0 && y == cursor_y_ + 1) {
+        out_ += "\r\n";
     } else {
-        result += static_cast<char>(0xF0 | (cp >> 18));
-        result += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
-        result += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
-        result += static_cast<char>(0x80 | (cp & 0x3F));
+        out_ += "\x1b[";
+        append_uint(out_, y + 1);
+        if (x > 0) {
+            out_ += ';';
+            append_uint(out_, x + 1);
+        }
+        out_ += 'H';
     }
-    return result;
+    cursor_x_ = x;
+    cursor_y_ = y;
 }
 
-std::string Renderer::style_to_escape(const Style& style) {
-    std::ostringstream oss;
-    oss << "\x1b[0";  // Reset
+// Emit only the SGR parameters that differ from the current pen
+void Renderer::set_pen(StyleId id) {
+    if (id == pen_) return;
     
-    if (style.attrs & Attr::BOLD) oss << ";1";
-    if (style.attrs & Attr::DIM) oss << ";2";
-    if (style.attrs & Attr::ITALIC) oss << ";3";
-    if (style.attrs & Attr::UNDERLINE) oss << ";4";
-    if (style.attrs & Attr::BLINK) oss << ";5";
-    if (style.attrs & Attr::REVERSE) oss << ";7";
-    if (style.attrs & Attr::STRIKETHROUGH) oss << ";9";
+    out_ += "\x1b[";
+    bool first = true;
     
-    if (!style.fg.is_default) {
-        oss << ";38;2;" << (int)style.fg.r << ";" << (int)style.fg.g << ";" << (int)style.fg.b;
+    if (id == 0) {
+        out_ += "0m";
+        pen_ = id;
+        return;
     }
-    if (!style.bg.is_default) {
-        oss << ";48;2;" << (int)style.bg.r << ";" << (int)style.bg.g << ";" << (int)style.bg.b;
+    
+    const Style& style = palette_[id];
+    const Style& pen = palette_[pen_];
+    Attr on = style.attrs;
+    Attr had = pen.attrs;
+    // Bold and dim share one "off" code
+    bool drop_intensity = ((had & Attr::BOLD) && !(on & Attr::BOLD)) ||
+                          ((had & Attr::DIM) && !(on & Attr::DIM));
+    if (drop_intensity) {
+        append_param(out_, first, 22);
+        had = static_cast<Attr>(static_cast<uint8_t>(had) &
+                                ~static_cast<uint8_t>(Attr::BOLD | Attr::DIM));
     }
     
-    oss << "m";
-    return oss.str();
+    struct AttrCode { Attr attr; unsigned set; unsigned reset; };
+    static const AttrCode codes[] = {
+        {Attr::BOLD, 1, 22}, {Attr::DIM, 2, 22}, {Attr::ITALIC, 3, 23},
+        {Attr::UNDERLINE, 4, 24}, {Attr::BLINK, 5, 25}, {Attr::REVERSE, 7, 27},
+        {Attr::STRIKETHROUGH, 9, 29},
+    };
+    for (const auto& c : codes) {
+        bool want = on & c.attr;
+        bool have = had & c.attr;
+        if (want && !have) append_param(out_, first, c.set);
+        else if (!want && have && c.reset != 22) append_param(out_, first, c.reset);
+    }
+    
+    if (!same_color(style.fg, pen.fg)) append_color(out_, first, style.fg, 30);
+    if (!same_color(style.bg, pen.bg)) append_color(out_, first, style.bg, 40);
+    
+    out_ += 'm';
+    pen_ = id;
 }
 
-std::string Renderer::flush() {
-    std::ostringstream out;
-    
-    Style last_style;
-    bool first = true;
+void Renderer::put_char(const Cell& cell, int width) {
+    append_utf8(out_, cell.ch);
+    if (cell.marks) out_ += marks_[cell.marks];
+    cursor_x_ += width;
+    if (cursor_x_ >= width_) {
+        // Pending-wrap state differs between terminals; force an absolute move
+        cursor_x_ = -1;
+        cursor_y_ = -1;
+    }
+}
+
+void Renderer::encode_span(int y, int x0, int x1) {
+    const Cell* row = &back_buffer_[index(0, y)];
+    if (row[x0].ch == WIDE_TAIL && x0 > 0) x0--;  // Redraw the whole character
+    move_cursor(x0, y);
+    for (int x = x0; x < x1; x++) {
+        const Cell& cell = row[x];
+        if (cell.ch == WIDE_TAIL) continue;  // Covered by the character before
+        set_pen(cell.style);
+        put_char(cell, x + 1 < width_ && row[x + 1].ch == WIDE_TAIL ? 2 : 1);
+    }
+}
+
+// Row diffing. Cells are 8 bytes with no padding, so two cells are equal
+// exactly when their bytes are; the kernels below compare several cells
+// per instruction and return the index of the first differing cell at or
+// after `from` (or n when the rest of the row matches).
+
+static size_t next_diff_scalar(const Cell* a, const Cell* b, size_t from, size_t n) {
+    for (size_t i = from; i < n; i++) {
+        uint64_t x, y;
+        std::memcpy(&x, &a[i], sizeof(x));
+        std::memcpy(&y, &b[i], sizeof(y));
+        if (x != y) return i;
+    }
+    return n;
+}
+
+#ifdef CATVIM_X86
+// Two cells per compare; SSE2 is always available on x86-64
+static size_t next_diff_sse2(const Cell* a, const Cell* b, size_t from, size_t n) {
+    size_t i = from;
+    for (; i + 2 <= n; i += 2) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+        if (mask != 0xFFFF) return i + ((mask & 0xFF) == 0xFF ? 1 : 0);
+    }
+    return next_diff_scalar(a, b, i, n);
+}
+
+// Four cells per compare
+__attribute__((target("avx2")))
+static size_t next_diff_avx2(const Cell* a, const Cell* b, size_t from, size_t n) {
+    size_t i = from;
+    for (; i + 4 <= n; i += 4) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(va, vb)));
+        if (mask != 0xF) return i + __builtin_ctz(~mask & 0xF);
+    }
+    return next_diff_sse2(a, b, i, n);
+}
+#endif
+
+using NextDiffFn = size_t (*)(const Cell*, const Cell*, size_t, size_t);
+
+static NextDiffFn pick_next_diff() {
+#ifdef CATVIM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return next_diff_avx2;
+    return next_diff_sse2;
+#else
+    return next_diff_scalar;
+#endif
+}
+
+static const NextDiffFn next_diff = pick_next_diff();
+
+const std::string& Renderer::flush() {
+    out_.clear();
+    cursor_x_ = cursor_y_ = -1;  // Lua may have moved the cursor since last frame
+    rows_flushed_ = 0;
     
     for (int y = 0; y < height_; y++) {
-        bool line_changed = false;
-        for (int x = 0; x < width_; x++) {
-            if (back_buffer_[index(x, y)] != front_buffer_[index(x, y)]) {
-                line_changed = true;
-                break;
-            }
-        }
+        if (!dirty_rows_[y]) continue;
+        dirty_rows_[y] = 0;
+        rows_flushed_++;
         
-        if (!line_changed) continue;
+        const Cell* back = &back_buffer_[index(0, y)];
+        Cell* front = &front_buffer_[index(0, y)];
+        size_t width = static_cast<size_t>(width_);
         
-        // Move to start of line
-        out << "\x1b[" << (y + 1) << ";1H";
+        size_t x = next_diff(back, front, 0, width);
+        if (x == width) continue;  // Rewritten with the same contents
         
-        for (int x = 0; x < width_; x++) {
-            const Cell& cell = back_buffer_[index(x, y)];
-            
-            if (first || cell.style != last_style) {
-                out << style_to_escape(cell.style);
-                last_style = cell.style;
-                first = false;
+        int span_start = -1;
+        int span_end = -1;
+        while (x < width) {
+            int cx = static_cast<int>(x);
+            if (span_start >= 0 && cx - span_end > MAX_SPAN_GAP) {
+                encode_span(y, span_start, span_end);
+                span_start = -1;
             }
-            
-            out << char32_to_utf8(cell.ch);
+            if (span_start < 0) span_start = cx;
+            span_end = cx + 1;
+            x = next_diff(back, front, x + 1, width);
         }
+        encode_span(y, span_start, span_end);
+        
+        // Only rows that changed are synced; the back buffer keeps the
+        // full frame because Lua only repaints damaged rows
+        std::memcpy(front, back, width * sizeof(Cell));
     }
     
-    // Reset style at end
-    out << "\x1b[0m";
-    
-    // Swap buffers
-    front_buffer_ = back_buffer_;
+    // Leave the terminal with default attributes between frames
+    if (pen_ != 0) {
+        out_ += "\x1b[0m";
+        pen_ = 0;
+    }
     
-    return out.str();
+    return out_;
 }
 
-void Renderer::draw_box(int x, int y, int w, int h, const Style& style) {
+void Renderer::draw_box(int x, int y, int w, int h, StyleId style) {
     if (w < 2 || h < 2) return;
     
     // Corners (ASCII)
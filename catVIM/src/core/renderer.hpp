@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <cstdint>
 
 namespace catvim {
@@ -46,15 +48,23 @@ struct Style {
     bool operator!=(const Style& other) const { return !(*this == other); }
 };
 
+// Index into the renderer's style palette; 0 is the default style
+using StyleId = uint16_t;
+
+// Eight bytes with no padding, so rows can be compared as raw memory.
+// A double-width character takes two cells: the character itself and a
+// tail cell after it that draws nothing.
 struct Cell {
     char32_t ch = ' ';
-    Style style;
+    StyleId style = 0;
+    uint16_t marks = 0;  // Combining marks drawn over ch; 0 = none
     
     bool operator==(const Cell& other) const {
-        return ch == other.ch && style == other.style;
+        return ch == other.ch && style == other.style && marks == other.marks;
     }
     bool operator!=(const Cell& other) const { return !(*this == other); }
 };
+static_assert(sizeof(Cell) == 8, "Cell must pack into 8 bytes");
 
 class Renderer {
 public:
@@ -64,19 +74,38 @@ public:
     int width() const { return width_; }
     int height() const { return height_; }
     
-    void set_cell(int x, int y, char32_t ch, const Style& style);
+    // Style palette: each distinct style is stored once and cells refer to
+    // it by id. Ids stay valid for the lifetime of the renderer; when the
+    // palette is full, new styles fall back to the default (id 0).
+    StyleId intern_style(const Style& style);
+    const Style& style(StyleId id) const { return palette_[id]; }
+    size_t style_count() const { return palette_.size(); }
+    
+    void set_cell(int x, int y, char32_t ch, StyleId style);
     void set_cell(int x, int y, char32_t ch);
-    void set_string(int x, int y, const std::string& str, const Style& style);
-    void set_style(const Style& style) { current_style_ = style; }
+    // Lays out UTF-8 text, clipped at the right edge; returns the columns
+    // it took, which differs from its size for non-ASCII text
+    int set_string(int x, int y, std::string_view str, StyleId style);
+    // Writes `width` cells of UTF-8 text (blank-padded) with the default
+    // style; style_span() then colors ranges of the row. If `columns` is
+    // given it receives the column (relative to x) of each byte of str
+    // that was laid out, plus one entry for the column after them, or is
+    // left empty when that text is ASCII and bytes are columns.
+    void set_line(int x, int y, std::string_view str, int width, std::vector<int>* columns = nullptr);
+    void style_span(int x, int y, int len, StyleId style);
+    void set_style(StyleId style) { current_style_ = style; }
     
     void clear();
     void clear_line(int y);
     
-    // Render to terminal - returns escape sequence string
-    std::string flush();
+    // Render to terminal - returns the escape sequences for changed cells.
+    // Only rows written since the last flush are compared.
+    // The returned buffer is owned by the renderer and reused every frame.
+    const std::string& flush();
+    int rows_flushed() const { return rows_flushed_; }  // Rows compared by the last flush
     
     // Draw primitives
-    void draw_box(int x, int y, int w, int h, const Style& style);
+    void draw_box(int x, int y, int w, int h, StyleId style);
     void draw_hline(int x, int y, int len, char32_t ch = U'─');
     void draw_vline(int x, int y, int len, char32_t ch = U'│');
 
@@ -85,15 +114,39 @@ private:
     int height_ = 0;
     std::vector<Cell> front_buffer_;
     std::vector<Cell> back_buffer_;
-    Style current_style_;
+    std::vector<uint8_t> dirty_rows_;  // Rows written to since the last flush
+    int rows_flushed_ = 0;
+    StyleId current_style_ = 0;
+    
+    std::vector<Style> palette_;
+    std::unordered_map<uint64_t, StyleId> palette_index_;  // Packed style -> id
+    
+    // Distinct combining mark sequences (UTF-8) that cells refer to by id;
+    // like styles, a full table drops new ones
+    std::vector<std::string> marks_;
+    std::unordered_map<std::string, uint16_t> marks_index_;
+    
+    // Frame encoder state: output bytes plus what the terminal currently has
+    std::string out_;
+    StyleId pen_ = 0;
+    int cursor_x_ = -1;  // -1 = unknown
+    int cursor_y_ = -1;
     
     size_t index(int x, int y) const { return y * width_ + x; }
+    void touch(int y) { dirty_rows_[y] = 1; }
     bool in_bounds(int x, int y) const {
         return x >= 0 && x < width_ && y >= 0 && y < height_;
     }
     
-    std::string style_to_escape(const Style& style);
-    std::string char32_to_utf8(char32_t ch);
+    int put_text(int x, int y, std::string_view str, int end, StyleId style, std::vector<int>* columns);
+    void put_glyph(Cell* row, int x, char32_t ch, int width, StyleId style);
+    void split_wide(Cell* row, int x);
+    uint16_t add_marks(uint16_t marks, const char* s, size_t len);
+    
+    void encode_span(int y, int x0, int x1);
+    void move_cursor(int x, int y);
+    void set_pen(StyleId id);
+    void put_char(const Cell& cell, int width);
 };
 
 }  // namespace catvim
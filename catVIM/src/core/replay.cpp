@@ -0,0 +1,185 @@
+#include "replay.hpp"
+#include "event_loop.hpp"
+#include "file_io.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+namespace catvim {
+
+static const char HEADER[] = "catvim-keylog 1";
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+KeyLog::~KeyLog() {
+    if (file_) fclose(file_);
+}
+
+bool KeyLog::load(const char* path, std::string& error) {
+    MappedFile file;
+    if (!file.open(path, error)) return false;
+    std::string text(file.data(), file.size());
+
+    size_t pos = 0;
+    size_t line_no = 0;
+    while (pos < text.size()) {
+        size_t eol = text.find('\n', pos);
+        if (eol == std::string::npos) eol = text.size();
+        std::string line = text.substr(pos, eol - pos);
+        pos = eol + 1;
+        line_no++;
+        if (line.empty()) continue;
+        if (line_no == 1) {
+            if (line != HEADER) {
+                error = std::string(path) + ": not a catvim key log";
+                return false;
+            }
+            continue;
+        }
+
+        Entry entry;
+        long long ms = 0;
+        char kind[16] = {};
+        int used = 0;
+        if (sscanf(line.c_str(), "%lld %15s %n", &ms, kind, &used) < 2) {
+            error = std::string(path) + ":" + std::to_string(line_no) + ": bad entry";
+            return false;
+        }
+        entry.ms = ms;
+        entry.resize = strcmp(kind, "size") == 0;
+        if (entry.resize) {
+            if (sscanf(line.c_str() + used, "%d %d", &entry.width, &entry.height) != 2) {
+                error = std::string(path) + ":" + std::to_string(line_no) + ": bad size";
+                return false;
+            }
+        } else if (strcmp(kind, "input") == 0) {
+            const char* hex = line.c_str() + used;
+            size_t n = strlen(hex);
+            for (size_t i = 0; i + 1 < n; i += 2) {
+                int hi = hex_value(hex[i]), lo = hex_value(hex[i + 1]);
+                if (hi < 0 || lo < 0) break;
+                entry.bytes += static_cast<char>(hi * 16 + lo);
+            }
+        } else {
+            continue;  // Entries from a newer version
+        }
+        entries_.push_back(std::move(entry));
+    }
+    return true;
+}
+
+void KeyLog::initial_size(int& width, int& height) const {
+    width = 80;
+    height = 24;
+    for (const Entry& e : entries_) {
+        if (e.resize) {
+            width = e.width;
+            height = e.height;
+            return;
+        }
+    }
+}
+
+bool KeyLog::create(const char* path, std::string& error) {
+    file_ = fopen(path, "w");
+    if (!file_) {
+        error = std::string(path) + ": " + std::strerror(errno);
+        return false;
+    }
+    fprintf(file_, "%s\n", HEADER);
+    fflush(file_);
+    start_ms_ = EventLoop::now_ms();
+    return true;
+}
+
+void KeyLog::record_input(const std::string& bytes) {
+    if (!file_) return;
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(bytes.size() * 2);
+    for (unsigned char c : bytes) {
+        hex += digits[c >> 4];
+        hex += digits[c & 15];
+    }
+    fprintf(file_, "%lld input %s\n", static_cast<long long>(EventLoop::now_ms() - start_ms_), hex.c_str());
+    // Flushed per entry so a crash still leaves a usable log
+    fflush(file_);
+}
+
+void KeyLog::record_resize(int width, int height) {
+    if (!file_) return;
+    fprintf(file_, "%lld size %d %d\n", static_cast<long long>(EventLoop::now_ms() - start_ms_), width, height);
+    fflush(file_);
+}
+
+// LatencyRecorder
+
+int64_t LatencyRecorder::now_ns() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void LatencyRecorder::input_fed() {
+    pending_.push_back({now_ns()});
+    inputs_++;
+}
+
+void LatencyRecorder::input_handled(int64_t ns) {
+    if (!pending_.empty()) pending_.back().handle += ns;
+}
+
+void LatencyRecorder::frame_written(int64_t render_ns, int64_t flush_ns, size_t bytes) {
+    int64_t now = now_ns();
+    frames_++;
+    frame_bytes_ += bytes;
+    for (const Pending& p : pending_) {
+        samples_.push_back({now - p.fed, p.handle, render_ns, flush_ns});
+    }
+    pending_.clear();
+}
+
+std::string LatencyRecorder::report() const {
+    char line[160];
+    std::string out;
+    snprintf(line, sizeof(line), "replay: %zu inputs, %zu frames, %zu inputs without a frame, %.0f bytes/frame\n",
+             inputs_, frames_, inputs_ - samples_.size(), frames_ ? double(frame_bytes_) / frames_ : 0.0);
+    out += line;
+    snprintf(line, sizeof(line), "%-8s %10s %10s %10s %10s %10s\n", "metric", "p50_ms", "p90_ms", "p99_ms", "max_ms",
+             "mean_ms");
+    out += line;
+
+    const struct {
+        const char* name;
+        int64_t Sample::*field;
+    } metrics[] = {
+        {"latency", &Sample::latency},
+        {"handle", &Sample::handle},
+        {"render", &Sample::render},
+        {"flush", &Sample::flush},
+    };
+    std::vector<int64_t> values;
+    for (const auto& m : metrics) {
+        values.clear();
+        for (const Sample& s : samples_) values.push_back(s.*m.field);
+        if (values.empty()) values.push_back(0);
+        std::sort(values.begin(), values.end());
+        auto pct = [&](double p) {
+            size_t i = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+            return values[i] / 1e6;
+        };
+        double sum = 0;
+        for (int64_t v : values) sum += v;
+        snprintf(line, sizeof(line), "%-8s %10.3f %10.3f %10.3f %10.3f %10.3f\n", m.name, pct(0.5), pct(0.9),
+                 pct(0.99), values.back() / 1e6, sum / values.size() / 1e6);
+        out += line;
+    }
+    return out;
+}
+
+}  // namespace catvim
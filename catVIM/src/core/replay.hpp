@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace catvim {
+
+// A recording of terminal input: every chunk read from the terminal and
+// every resize, with its time since the recording started. Saved as text:
+//
+//   catvim-keylog 1
+//   <ms> size <width> <height>
+//   <ms> input <bytes as hex>
+class KeyLog {
+public:
+    struct Entry {
+        int64_t ms;
+        bool resize;
+        std::string bytes;  // Input
+        int width = 0;      // Resize
+        int height = 0;
+    };
+
+    KeyLog() = default;
+    ~KeyLog();
+    KeyLog(const KeyLog&) = delete;
+    KeyLog& operator=(const KeyLog&) = delete;
+
+    bool load(const char* path, std::string& error);
+    const std::vector<Entry>& entries() const { return entries_; }
+    // Size of the recorded terminal: the first resize entry, else 80x24
+    void initial_size(int& width, int& height) const;
+
+    // Recording: entries are appended to the file as they happen
+    bool create(const char* path, std::string& error);
+    void record_input(const std::string& bytes);
+    void record_resize(int width, int height);
+
+private:
+    std::vector<Entry> entries_;
+    FILE* file_ = nullptr;
+    int64_t start_ms_ = 0;
+};
+
+// Per-input latency while a KeyLog is replayed. Each input is followed to
+// the first frame written after it:
+//
+//   latency  input fed -> frame written
+//   handle   on_input for it
+//   render   Lua work from the start of the callback that drew the frame
+//            up to catvim.render.flush()
+//   flush    Renderer::flush and the terminal write
+class LatencyRecorder {
+public:
+    static int64_t now_ns();
+
+    void input_fed();
+    void input_handled(int64_t ns);
+    void frame_written(int64_t render_ns, int64_t flush_ns, size_t bytes);
+
+    // Percentile table for stdout
+    std::string report() const;
+
+private:
+    struct Pending {
+        int64_t fed;
+        int64_t handle = 0;
+    };
+    struct Sample {
+        int64_t latency;
+        int64_t handle;
+        int64_t render;
+        int64_t flush;
+    };
+
+    std::vector<Pending> pending_;
+    std::vector<Sample> samples_;
+    size_t inputs_ = 0;
+    size_t frames_ = 0;
+    size_t frame_bytes_ = 0;
+};
+
+}  // namespace catvim
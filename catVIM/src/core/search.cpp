@@ -0,0 +1,420 @@
+#include "search.hpp"
+#include "event_loop.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CATVIM_X86 1
+#endif
+
+namespace catvim {
+
+// Literal search
+
+static inline unsigned char fold(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline unsigned char upper(unsigned char c) {
+    return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+struct Needle {
+    const unsigned char* s;  // Lowercased when ignore_case
+    size_t len;
+    bool ignore_case;
+
+    bool matches_at(const unsigned char* p) const {
+        if (!ignore_case) return std::memcmp(p, s, len) == 0;
+        for (size_t i = 0; i < len; i++) {
+            if (fold(p[i]) != s[i]) return false;
+        }
+        return true;
+    }
+};
+
+static const size_t NPOS = static_cast<size_t>(-1);
+
+static size_t find_literal_scalar(const unsigned char* hay, size_t from, size_t n, const Needle& nd) {
+    if (n < nd.len) return NPOS;
+    size_t last = n - nd.len;
+    if (!nd.ignore_case) {
+        // memchr is vectorized by libc
+        const unsigned char* p = hay + from;
+        const unsigned char* stop = hay + last + 1;
+        while (p < stop) {
+            p = static_cast<const unsigned char*>(std::memchr(p, nd.s[0], stop - p));
+            if (!p) return NPOS;
+            if (nd.matches_at(p)) return p - hay;
+            p++;
+        }
+        return NPOS;
+    }
+    for (size_t i = from; i <= last; i++) {
+        if (fold(hay[i]) == nd.s[0] && nd.matches_at(hay + i)) return i;
+    }
+    return NPOS;
+}
+
+#ifdef CATVIM_X86
+// Compares 16 candidate positions at once against the needle's first and
+// last bytes (both cases when ignoring case); only positions where both
+// agree are verified in full.
+static size_t find_literal_sse2(const unsigned char* hay, size_t from, size_t n, const Needle& nd) {
+    if (n < nd.len) return NPOS;
+    size_t last = n - nd.len;
+    unsigned char f = nd.s[0];
+    unsigned char l = nd.s[nd.len - 1];
+    __m128i f_lo = _mm_set1_epi8(static_cast<char>(f));
+    __m128i f_up = _mm_set1_epi8(static_cast<char>(nd.ignore_case ? upper(f) : f));
+    __m128i l_lo = _mm_set1_epi8(static_cast<char>(l));
+    __m128i l_up = _mm_set1_epi8(static_cast<char>(nd.ignore_case ? upper(l) : l));
+
+    size_t i = from;
+    for (; i + 16 <= last + 1; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i + nd.len - 1));
+        __m128i first = _mm_or_si128(_mm_cmpeq_epi8(a, f_lo), _mm_cmpeq_epi8(a, f_up));
+        __m128i final = _mm_or_si128(_mm_cmpeq_epi8(b, l_lo), _mm_cmpeq_epi8(b, l_up));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(first, final)));
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (nd.matches_at(hay + at)) return at;
+            mask &= mask - 1;
+        }
+    }
+    return find_literal_scalar(hay, i, n, nd);
+}
+
+__attribute__((target("avx2")))
+static size_t find_literal_avx2(const unsigned char* hay, size_t from, size_t n, const Needle& nd) {
+    if (n < nd.len) return NPOS;
+    size_t last = n - nd.len;
+    unsigned char f = nd.s[0];
+    unsigned char l = nd.s[nd.len - 1];
+    __m256i f_lo = _mm256_set1_epi8(static_cast<char>(f));
+    __m256i f_up = _mm256_set1_epi8(static_cast<char>(nd.ignore_case ? upper(f) : f));
+    __m256i l_lo = _mm256_set1_epi8(static_cast<char>(l));
+    __m256i l_up = _mm256_set1_epi8(static_cast<char>(nd.ignore_case ? upper(l) : l));
+
+    size_t i = from;
+    for (; i + 32 <= last + 1; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + i + nd.len - 1));
+        __m256i first = _mm256_or_si256(_mm256_cmpeq_epi8(a, f_lo), _mm256_cmpeq_epi8(a, f_up));
+        __m256i final = _mm256_or_si256(_mm256_cmpeq_epi8(b, l_lo), _mm256_cmpeq_epi8(b, l_up));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(first, final)));
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (nd.matches_at(hay + at)) return at;
+            mask &= mask - 1;
+        }
+    }
+    return find_literal_sse2(hay, i, n, nd);
+}
+#endif
+
+using FindLiteralFn = size_t (*)(const unsigned char*, size_t, size_t, const Needle&);
+
+static FindLiteralFn pick_find_literal() {
+#ifdef CATVIM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return find_literal_avx2;
+    return find_literal_sse2;
+#else
+    return find_literal_scalar;
+#endif
+}
+
+static const FindLiteralFn find_literal = pick_find_literal();
+
+// Matcher
+
+Matcher::~Matcher() {
+    if (compiled_) regfree(&re_);
+}
+
+bool Matcher::compile(const std::string& pattern, bool regex, bool ignore_case, std::string& error) {
+    if (pattern.empty()) {
+        error = "Empty pattern";
+        return false;
+    }
+    if (pattern.find('\n') != std::string::npos) {
+        error = "Pattern contains a newline";
+        return false;
+    }
+    regex_ = regex;
+    ignore_case_ = ignore_case;
+    if (!regex) {
+        needle_ = pattern;
+        if (ignore_case) {
+            for (char& c : needle_) c = static_cast<char>(fold(static_cast<unsigned char>(c)));
+        }
+        return true;
+    }
+
+    int flags = REG_EXTENDED | REG_NEWLINE;
+    if (ignore_case) flags |= REG_ICASE;
+    int rc = regcomp(&re_, pattern.c_str(), flags);
+    if (rc != 0) {
+        char buf[256];
+        regerror(rc, &re_, buf, sizeof(buf));
+        error = std::string("Invalid pattern: ") + buf;
+        return false;
+    }
+    compiled_ = true;
+    return true;
+}
+
+bool Matcher::find(const char* begin, const char* end, const char* from,
+                   size_t& match_start, size_t& match_len) const {
+    if (from >= end) return false;
+    if (!regex_) {
+        Needle nd{reinterpret_cast<const unsigned char*>(needle_.data()), needle_.size(), ignore_case_};
+        size_t at = find_literal(reinterpret_cast<const unsigned char*>(begin),
+                                 from - begin, end - begin, nd);
+        if (at == NPOS) return false;
+        match_start = at;
+        match_len = nd.len;
+        return true;
+    }
+
+    // ^ must not match in the middle of a line
+    int flags = (from > begin && from[-1] != '\n') ? REG_NOTBOL : 0;
+    regmatch_t m;
+#ifdef REG_STARTEND
+    m.rm_so = from - begin;
+    m.rm_eo = end - begin;
+    if (regexec(&re_, begin, 1, &m, flags | REG_STARTEND) != 0) return false;
+#else
+    std::string copy(from, end);
+    if (regexec(&re_, copy.c_str(), 1, &m, flags) != 0) return false;
+    m.rm_so += from - begin;
+    m.rm_eo += from - begin;
+#endif
+    match_start = m.rm_so;
+    match_len = m.rm_eo - m.rm_so;
+    return true;
+}
+
+// Search
+
+Search::Search(std::shared_ptr<TextBuffer> text, std::unique_ptr<Matcher> matcher)
+    : text_(std::move(text)), matcher_(std::move(matcher)) {
+    version_ = text_->version();
+}
+
+void Search::check_version() {
+    if (text_->version() == version_) return;
+    version_ = text_->version();
+    block_counts_.clear();
+    total_ = 0;
+    counted_ = false;
+    if (finding_) start_find(std::min(origin_, text_->length()), direction_);
+}
+
+size_t Search::line_start_at(size_t offset) const {
+    size_t line, col;
+    text_->position_of(offset, line, col);
+    return offset - col;
+}
+
+// End of the line containing `offset` (just past its '\n'), or `offset`
+// itself if it already is a line start
+size_t Search::line_end_at(size_t offset) const {
+    size_t len = text_->length();
+    if (offset >= len) return len;
+    size_t line, col;
+    text_->position_of(offset, line, col);
+    if (col == 0) return offset;
+    return line + 1 < text_->line_count() ? text_->line_start(line + 1) : len;
+}
+
+static const char* last_newline(const char* p, size_t n) {
+    while (n > 0) {
+        if (p[--n] == '\n') return p + n;
+    }
+    return nullptr;
+}
+
+template <typename Fn>
+void Search::scan(size_t from, size_t to, Fn&& fn) const {
+    if (from >= to) return;
+    bool stop = false;
+    auto run = [&](const char* seg, size_t len, size_t at) {
+        const char* end = seg + len;
+        const char* p = seg;
+        size_t ms, ml;
+        while (!stop && p < end && matcher_->find(seg, end, p, ms, ml)) {
+            if (!fn(at + ms, ml)) stop = true;
+            p = seg + ms + 1;
+        }
+    };
+
+    // Pieces don't end at line boundaries: a line split across chunks is
+    // copied into `carry` and searched once it is complete
+    std::string carry;
+    size_t carry_at = 0;
+    size_t off = from;
+    text_->for_each_chunk(from, to - from, [&](const char* p, size_t n) {
+        if (stop) return;
+        size_t chunk_end = off + n;
+        if (!carry.empty()) {
+            const char* nl = static_cast<const char*>(std::memchr(p, '\n', n));
+            if (!nl) {
+                carry.append(p, n);
+                off = chunk_end;
+                return;
+            }
+            size_t k = nl - p + 1;
+            carry.append(p, k);
+            run(carry.data(), carry.size(), carry_at);
+            carry.clear();
+            p += k;
+            n -= k;
+            off += k;
+        }
+        if (n > 0) {
+            const char* nl = last_newline(p, n);
+            size_t whole = nl ? nl - p + 1 : 0;
+            if (whole) run(p, whole, off);
+            if (whole < n) {
+                carry.assign(p + whole, n - whole);
+                carry_at = off + whole;
+            }
+        }
+        off = chunk_end;
+    });
+    if (!stop && !carry.empty()) run(carry.data(), carry.size(), carry_at);
+}
+
+size_t Search::count_range(size_t lo, size_t hi) const {
+    size_t n = 0;
+    scan(line_start_at(lo), line_end_at(hi), [&](size_t start, size_t) {
+        if (start >= hi) return false;
+        if (start >= lo) n++;
+        return true;
+    });
+    return n;
+}
+
+void Search::line_matches(size_t line, std::vector<std::pair<size_t, size_t>>& out) const {
+    out.clear();
+    if (line >= text_->line_count()) return;
+    std::string text = text_->line(line);
+    const char* begin = text.data();
+    const char* end = begin + text.size();
+    const char* p = begin;
+    size_t ms, ml;
+    while (p < end && matcher_->find(begin, end, p, ms, ml)) {
+        out.emplace_back(ms, ml);
+        p = begin + ms + 1;
+    }
+}
+
+void Search::start_find(size_t offset, int direction) {
+    origin_ = offset;
+    direction_ = direction >= 0 ? 1 : -1;
+    wrapped_ = false;
+    finding_ = true;
+    pos_ = direction_ > 0 ? line_start_at(offset) : offset;
+}
+
+// True once a wrapped search has come back around to the origin
+bool Search::find_exhausted() const {
+    if (!wrapped_) return false;
+    if (direction_ > 0) return pos_ > origin_ || pos_ >= text_->length();
+    return pos_ <= line_start_at(origin_);
+}
+
+Search::Status Search::find_step(int64_t budget_ms, size_t& match_start, size_t& match_len, bool& wrapped) {
+    check_version();
+    if (!finding_) return Status::NOT_FOUND;
+    size_t len = text_->length();
+    int64_t deadline = EventLoop::now_ms() + budget_ms;
+
+    do {
+        bool found = false;
+        size_t start = 0, mlen = 0;
+        if (direction_ > 0) {
+            if (find_exhausted()) break;
+            size_t hi = line_end_at(std::min(pos_ + BLOCK, len));
+            if (hi <= pos_) hi = len;
+            scan(pos_, hi, [&](size_t s, size_t l) {
+                // Before wrapping only matches after the origin count;
+                // after wrapping the first one found is the answer
+                if (!wrapped_ && s <= origin_) return true;
+                found = true;
+                start = s;
+                mlen = l;
+                return false;
+            });
+            if (found && wrapped_ && start > origin_) {
+                // Nothing between the start of the text and the origin
+                pos_ = len;
+                break;
+            }
+            pos_ = hi;
+            if (!found && !wrapped_ && pos_ >= len) {
+                wrapped_ = true;
+                pos_ = 0;
+            }
+        } else {
+            if (find_exhausted()) break;
+            size_t lo = line_start_at(pos_ > BLOCK ? pos_ - BLOCK : 0);
+            // The last match starting before pos_ in this window
+            size_t limit = pos_;
+            scan(lo, line_end_at(pos_), [&](size_t s, size_t l) {
+                if (s >= limit) return false;
+                found = true;
+                start = s;
+                mlen = l;
+                return true;
+            });
+            pos_ = lo;
+            if (!found && !wrapped_ && pos_ == 0) {
+                wrapped_ = true;
+                pos_ = len;
+            }
+        }
+        if (found) {
+            finding_ = false;
+            match_start = start;
+            match_len = mlen;
+            wrapped = wrapped_;
+            return Status::FOUND;
+        }
+    } while (EventLoop::now_ms() < deadline);
+
+    if (!find_exhausted()) return Status::PENDING;
+    finding_ = false;
+    return Status::NOT_FOUND;
+}
+
+bool Search::count_step(int64_t budget_ms) {
+    check_version();
+    if (counted_) return true;
+    size_t len = text_->length();
+    int64_t deadline = EventLoop::now_ms() + budget_ms;
+    do {
+        size_t lo = block_counts_.size() * BLOCK;
+        if (lo >= len) {
+            counted_ = true;
+            return true;
+        }
+        size_t n = count_range(lo, std::min(lo + BLOCK, len));
+        block_counts_.push_back(n);
+        total_ += n;
+    } while (EventLoop::now_ms() < deadline);
+    return false;
+}
+
+size_t Search::index_of(size_t offset) const {
+    size_t block = offset / BLOCK;
+    size_t before = 0;
+    for (size_t i = 0; i < block && i < block_counts_.size(); i++) before += block_counts_[i];
+    return before + count_range(block * BLOCK, offset) + 1;
+}
+
+}  // namespace catvim
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "text_buffer.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <regex.h>
+
+namespace catvim {
+
+// A compiled search pattern. Literal patterns are located with a SIMD
+// filter on their first and last bytes; regex patterns (POSIX extended)
+// go through regexec(). Matching is line based: a match never contains
+// a newline, and ^/$ anchor at line boundaries.
+class Matcher {
+public:
+    Matcher() = default;
+    ~Matcher();
+    Matcher(const Matcher&) = delete;
+    Matcher& operator=(const Matcher&) = delete;
+
+    bool compile(const std::string& pattern, bool regex, bool ignore_case, std::string& error);
+
+    // Finds the first match starting at or after `from` in [begin, end).
+    // `begin` must be the start of a line and `end` the end of one.
+    bool find(const char* begin, const char* end, const char* from,
+              size_t& match_start, size_t& match_len) const;
+
+private:
+    bool regex_ = false;
+    bool compiled_ = false;
+    regex_t re_;
+    std::string needle_;       // Literal; lowercased when ignoring case
+    bool ignore_case_ = false;
+};
+
+// Incremental search over a TextBuffer. Finding the next match and
+// counting all of them are done in steps bounded by a time budget, so
+// even a multi-gigabyte file never stalls the event loop; callers resume
+// the work from a timer. Any edit to the text (see TextBuffer::version)
+// restarts pending work.
+class Search {
+public:
+    enum class Status { FOUND, NOT_FOUND, PENDING };
+
+    Search(std::shared_ptr<TextBuffer> text, std::unique_ptr<Matcher> matcher);
+
+    const TextBuffer& text() const { return *text_; }
+
+    // Matches on one line as (col, len) pairs, for highlighting
+    void line_matches(size_t line, std::vector<std::pair<size_t, size_t>>& out) const;
+
+    // Starts looking for the nearest match after (direction > 0) or
+    // before `offset`, wrapping around the end of the text
+    void start_find(size_t offset, int direction);
+    Status find_step(int64_t budget_ms, size_t& match_start, size_t& match_len, bool& wrapped);
+
+    // Counts matches; returns true once all of them are counted
+    bool count_step(int64_t budget_ms);
+    size_t count() const { return total_; }
+    bool counted() const { return counted_; }
+    // 1-based index of the match starting at `offset` (after counting)
+    size_t index_of(size_t offset) const;
+
+private:
+    // Work is split into blocks of this many bytes, snapped to lines
+    static const size_t BLOCK = 1 << 20;
+
+    std::shared_ptr<TextBuffer> text_;
+    std::unique_ptr<Matcher> matcher_;
+    uint64_t version_ = 0;
+
+    // Find state
+    size_t origin_ = 0;
+    int direction_ = 1;
+    bool wrapped_ = false;
+    size_t pos_ = 0;     // Next byte to scan (forward) or end of the next window (backward)
+    bool finding_ = false;
+
+    // Count state: matches per BLOCK-sized range of start offsets
+    std::vector<size_t> block_counts_;
+    size_t total_ = 0;
+    bool counted_ = false;
+
+    void check_version();
+    bool find_exhausted() const;
+    size_t line_start_at(size_t offset) const;
+    size_t line_end_at(size_t offset) const;
+
+    // Calls fn(start, len) for each match in [from, to); both are line
+    // boundaries. Overlapping matches are all reported, as n/N visit each
+    // of them. Stops early when fn returns false.
+    template <typename Fn>
+    void scan(size_t from, size_t to, Fn&& fn) const;
+    size_t count_range(size_t lo, size_t hi) const;
+};
+
+}  // namespace catvim
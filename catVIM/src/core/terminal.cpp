@@ -1,22 +1,40 @@
 #include "terminal.hpp"
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <poll.h>
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
 
 namespace catvim {
 
-Terminal::Terminal() {}
+Terminal::Terminal() : in_fd_(STDIN_FILENO), out_fd_(STDOUT_FILENO) {}
+
+void Terminal::make_virtual(int width, int height, int out_fd) {
+    virtual_ = true;
+    virtual_size_ = {width, height};
+    in_fd_ = -1;
+    out_fd_ = out_fd;
+}
 
 Terminal::~Terminal() {
+    if (bracketed_paste_) disable_bracketed_paste();
     if (mouse_enabled_) disable_mouse();
     if (alternate_screen_) disable_alternate_screen();
-    if (raw_mode_enabled_) exit_raw_mode();
+    if (raw_mode_enabled_) {
+        show_cursor();
+        flush();
+        exit_raw_mode();
+    }
 }
 
 void Terminal::enter_raw_mode() {
     if (raw_mode_enabled_) return;
+    if (virtual_) {
+        raw_mode_enabled_ = true;
+        return;
+    }
     
     tcgetattr(STDIN_FILENO, &original_termios_);
     struct termios raw = original_termios_;
@@ -39,7 +57,7 @@ void Terminal::enter_raw_mode() {
 
 void Terminal::exit_raw_mode() {
     if (!raw_mode_enabled_) return;
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &original_termios_);
+    if (!virtual_) tcsetattr(STDIN_FILENO, TCSAFLUSH, &original_termios_);
     raw_mode_enabled_ = false;
 }
 
@@ -49,7 +67,6 @@ void Terminal::enable_mouse() {
     write("\x1b[?1000h");  // Enable mouse button tracking
     write("\x1b[?1002h");  // Enable button event tracking (drag)
     write("\x1b[?1006h");  // Enable SGR extended mode
-    flush();
     mouse_enabled_ = true;
 }
 
@@ -58,39 +75,113 @@ void Terminal::disable_mouse() {
     write("\x1b[?1006l");
     write("\x1b[?1002l");
     write("\x1b[?1000l");
-    flush();
     mouse_enabled_ = false;
 }
 
 void Terminal::enable_alternate_screen() {
     if (alternate_screen_) return;
     write("\x1b[?1049h");
-    flush();
     alternate_screen_ = true;
 }
 
 void Terminal::disable_alternate_screen() {
     if (!alternate_screen_) return;
     write("\x1b[?1049l");
-    flush();
     alternate_screen_ = false;
 }
 
+// Pasted text arrives wrapped in \x1b[200~ ... \x1b[201~
+void Terminal::enable_bracketed_paste() {
+    if (bracketed_paste_) return;
+    write("\x1b[?2004h");
+    bracketed_paste_ = true;
+}
+
+void Terminal::disable_bracketed_paste() {
+    if (!bracketed_paste_) return;
+    write("\x1b[?2004l");
+    bracketed_paste_ = false;
+}
+
+// Writes every byte of iov[0..count), resuming after short writes and
+// waiting out EAGAIN. Output is dropped if the terminal reports an error.
+void Terminal::write_all(struct iovec* iov, int count) {
+    for (int i = 0; i < count; i++) bytes_written_ += iov[i].iov_len;
+    if (out_fd_ < 0) return;
+    while (count > 0) {
+        ssize_t n = writev(out_fd_, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = {out_fd_, POLLOUT, 0};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return;
+        }
+        size_t written = static_cast<size_t>(n);
+        while (count > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
 void Terminal::write(const std::string& data) {
-    ::write(STDOUT_FILENO, data.c_str(), data.size());
+    out_ += data;
 }
 
 void Terminal::write(const char* data, size_t len) {
-    ::write(STDOUT_FILENO, data, len);
+    out_.append(data, len);
 }
 
 void Terminal::flush() {
-    fsync(STDOUT_FILENO);
+    if (out_.empty()) return;
+    struct iovec iov = {&out_[0], out_.size()};
+    write_all(&iov, 1);
+    out_.clear();
+}
+
+static const char SYNC_BEGIN[] = "\x1b[?2026h";
+static const char SYNC_END[] = "\x1b[?2026l";
+
+void Terminal::write_frame(const std::string& frame) {
+    if (frame.empty()) {
+        flush();
+        return;
+    }
+    // The terminal holds the screen from the begin marker until the end
+    // marker, so a frame is never shown half drawn
+    if (synchronized_output_) out_ += SYNC_BEGIN;
+    struct iovec iov[3];
+    int count = 0;
+    if (!out_.empty()) iov[count++] = {&out_[0], out_.size()};
+    iov[count++] = {const_cast<char*>(frame.data()), frame.size()};
+    if (synchronized_output_) {
+        iov[count++] = {const_cast<char*>(SYNC_END), sizeof(SYNC_END) - 1};
+    }
+    write_all(iov, count);
+    out_.clear();
+}
+
+void Terminal::query_synchronized_output() {
+    write("\x1b[?2026$p");
+}
+
+void Terminal::on_mode_report(int mode, int value) {
+    if (mode == 2026) {
+        synchronized_output_ = value == 1 || value == 2;
+    }
 }
 
 int Terminal::read_byte() {
     char c;
-    if (read(STDIN_FILENO, &c, 1) == 1) {
+    if (in_fd_ >= 0 && read(in_fd_, &c, 1) == 1) {
         return static_cast<unsigned char>(c);
     }
     return -1;
@@ -98,15 +189,17 @@ int Terminal::read_byte() {
 
 std::string Terminal::read_available() {
     std::string result;
-    char buf[128];
+    char buf[4096];
     ssize_t n;
-    while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+    if (in_fd_ < 0) return result;
+    while ((n = read(in_fd_, buf, sizeof(buf))) > 0) {
         result.append(buf, n);
     }
     return result;
 }
 
 Vec2 Terminal::get_size() {
+    if (virtual_) return virtual_size_;
     struct winsize ws;
     if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
         return {80, 24};  // Default fallback
@@ -134,7 +227,7 @@ void Terminal::show_cursor() {
 
 bool Terminal::poll_input(int timeout_ms) {
     struct pollfd pfd;
-    pfd.fd = STDIN_FILENO;
+    pfd.fd = in_fd_;
     pfd.events = POLLIN;
     return poll(&pfd, 1, timeout_ms) > 0;
 }
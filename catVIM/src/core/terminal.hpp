@@ -2,6 +2,7 @@
 
 #include <string>
 #include <termios.h>
+#include <sys/uio.h>
 
 namespace catvim {
 
@@ -13,6 +14,15 @@ class Terminal {
 public:
     Terminal();
     ~Terminal();
+    
+    // Headless mode: no tty at all. The size is fixed (until set_size()),
+    // modes are tracked but no termios are touched, nothing is read, and
+    // output goes to out_fd, or nowhere if it is -1. Call before anything
+    // is written.
+    void make_virtual(int width, int height, int out_fd);
+    bool is_virtual() const { return virtual_; }
+    void set_size(int width, int height) { virtual_size_ = {width, height}; }
+    size_t bytes_written() const { return bytes_written_; }
 
     void enter_raw_mode();
     void exit_raw_mode();
@@ -20,11 +30,24 @@ public:
     void disable_mouse();
     void enable_alternate_screen();
     void disable_alternate_screen();
+    void enable_bracketed_paste();
+    void disable_bracketed_paste();
     
+    // Output is buffered until flush(), which sends it with as few write()
+    // calls as the terminal allows
     void write(const std::string& data);
     void write(const char* data, size_t len);
     void flush();
     
+    // Sends pending output plus a rendered frame in one writev(), wrapped in
+    // synchronized-update markers (DEC mode 2026) when the terminal has them
+    void write_frame(const std::string& frame);
+    
+    // Asks whether mode 2026 is supported; the reply arrives as input
+    // (EventType::MODE_REPORT) and is passed to on_mode_report()
+    void query_synchronized_output();
+    void on_mode_report(int mode, int value);
+    
     int read_byte();  // Non-blocking single byte read
     std::string read_available();  // Non-blocking read all available
     bool poll_input(int timeout_ms);  // Wait for input with timeout
@@ -40,6 +63,17 @@ private:
     bool raw_mode_enabled_ = false;
     bool mouse_enabled_ = false;
     bool alternate_screen_ = false;
+    bool bracketed_paste_ = false;
+    bool synchronized_output_ = false;
+    std::string out_;  // Written but not yet sent
+    
+    int in_fd_;
+    int out_fd_;
+    bool virtual_ = false;
+    Vec2 virtual_size_ = {80, 24};
+    size_t bytes_written_ = 0;
+    
+    void write_all(struct iovec* iov, int count);
 };
 
 }  // namespace catvim
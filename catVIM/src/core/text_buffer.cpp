@@ -0,0 +1,587 @@
+#include "text_buffer.hpp"
+#include <cstring>
+
+namespace catvim {
+
+TextBuffer::TextBuffer() {
+    nodes_.emplace_back();  // Null sentinel
+}
+
+TextBuffer::TextBuffer(std::string text) : TextBuffer() {
+    set_text(std::move(text));
+}
+
+void TextBuffer::index_lfs(const char* data, size_t base, size_t len, std::vector<size_t>& out) {
+    const char* p = data + base;
+    const char* end = p + len;
+    while (p < end) {
+        const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!nl) break;
+        out.push_back(nl - data);
+        p = nl + 1;
+    }
+}
+
+void TextBuffer::set_text(std::string text) {
+    line_index_.reset();  // Its thread reads the old text
+    original_file_.reset();
+    original_text_ = std::move(text);
+    path_.clear();
+    unloaded_ = false;
+    journal_.clear();
+    reset_original(original_text_.data(), original_text_.size());
+}
+
+bool TextBuffer::load(const char* path, std::string& error, size_t large_threshold) {
+    // A failed open leaves the current contents alone
+    auto file = std::make_unique<MappedFile>();
+    if (!file->open(path, error)) return false;
+    path_ = path;
+    large_threshold_ = large_threshold;
+    journal_.clear();
+    use_file(std::move(file));
+    return true;
+}
+
+void TextBuffer::use_file(std::unique_ptr<MappedFile> file) {
+    line_index_.reset();
+    original_file_ = std::move(file);
+    stamp_ = original_file_->stamp();
+    unloaded_ = false;
+    std::string().swap(original_text_);
+
+    // A large file is read sequentially until update_index() sees the
+    // index thread finish
+    bool large = original_file_->size() >= large_threshold_;
+    original_file_->advise_sequential(true);
+    reset_original(original_file_->data(), original_file_->size(), large);
+    if (!large) original_file_->advise_sequential(false);
+}
+
+bool TextBuffer::save(const char* path, std::string& error) {
+    AtomicWriter writer;
+    if (!writer.open(path, error)) return false;
+    for_each_chunk(0, length(), [&](const char* p, size_t n) { writer.write(p, n); });
+    if (!writer.commit(error)) return false;
+    // The text is the file's now; a failed stat only costs the undo
+    // history if the buffer is unloaded and reloaded
+    path_ = path;
+    if (!stat_file(path, stamp_)) stamp_ = FileStamp();
+    return true;
+}
+
+bool TextBuffer::unload() {
+    if (unloaded_ || path_.empty() || journal_.is_modified()) return false;
+    line_index_.reset();
+    original_file_.reset();
+    // Swapped with empty containers so the memory is given back
+    std::string().swap(original_text_);
+    std::string().swap(add_);
+    std::vector<size_t>().swap(original_lfs_);
+    std::vector<size_t>().swap(add_lfs_);
+    std::vector<size_t>().swap(tail_lfs_);
+    std::vector<Node>(1).swap(nodes_);
+    std::vector<uint32_t>().swap(free_);
+    unloaded_ = true;
+    reset_original("", 0);
+    return true;
+}
+
+bool TextBuffer::reload(std::string& error, bool& changed) {
+    changed = false;
+    if (!unloaded_) return true;
+    auto file = std::make_unique<MappedFile>();
+    if (!file->open(path_.c_str(), error)) return false;
+    // The journal's offsets are only good for the text it was recorded on
+    changed = file->stamp() != stamp_;
+    if (changed) journal_.clear();
+    use_file(std::move(file));
+    return true;
+}
+
+size_t TextBuffer::memory_bytes() const {
+    size_t bytes = nodes_.capacity() * sizeof(Node) + free_.capacity() * sizeof(uint32_t);
+    bytes += (original_lfs_.capacity() + add_lfs_.capacity() + tail_lfs_.capacity()) * sizeof(size_t);
+    bytes += add_.capacity() + original_text_.capacity() + journal_.bytes();
+    if (original_file_) bytes += original_size_;
+    if (line_index_) bytes += line_index_->memory_bytes();
+    return bytes;
+}
+
+int TextBuffer::add_listener(Listener listener) {
+    int id = next_listener_id_++;
+    listeners_[id] = std::move(listener);
+    return id;
+}
+
+void TextBuffer::remove_listener(int id) {
+    listeners_.erase(id);
+}
+
+void TextBuffer::reset_original(const char* data, size_t size, bool large) {
+    version_++;
+    nodes_.resize(1);
+    free_.clear();
+    root_ = 0;
+    add_.clear();
+    add_lfs_.clear();
+    original_ = data;
+    original_size_ = size;
+    original_lfs_.clear();
+    tail_lfs_.clear();
+    gap_start_ = tail_start_ = gap_offset_ = 0;
+
+    if (large) {
+        index_large();
+    } else {
+        // memchr is vectorized in libc, so this runs at memory bandwidth
+        index_lfs(original_, 0, original_size_, original_lfs_);
+        if (original_size_ > 0) {
+            root_ = alloc_node({ORIGINAL, 0, original_size_, original_lfs_.size()});
+        }
+    }
+    for (auto& entry : listeners_) entry.second.reset();
+}
+
+// The first and last megabyte are indexed before the file is shown, so
+// its top and (for G) its bottom can be displayed at once; the line index
+// thread takes the part in between
+void TextBuffer::index_large() {
+    const size_t EDGE = 1 << 20;
+    size_t tail_from = original_size_ > EDGE ? original_size_ - EDGE : 0;
+    const char* nl = static_cast<const char*>(
+        std::memchr(original_ + tail_from, '\n', original_size_ - tail_from));
+    tail_start_ = nl ? nl - original_ + 1 : original_size_;
+    index_lfs(original_, tail_start_, original_size_ - tail_start_, tail_lfs_);
+
+    line_index_ = std::make_unique<LineIndex>();
+    line_index_->start(original_, EDGE, tail_start_);
+    gap_start_ = line_index_->done() ? tail_start_ : line_index_->ready();
+    gap_offset_ = gap_start_;
+
+    if (gap_start_ > 0) {
+        root_ = alloc_node({ORIGINAL, 0, gap_start_, count_lfs(ORIGINAL, 0, gap_start_)});
+    }
+    if (gap_start_ < tail_start_) {
+        root_ = merge(root_, alloc_node(gap_piece()));
+    }
+    if (tail_start_ < original_size_) {
+        root_ = merge(root_, alloc_node({ORIGINAL, tail_start_, original_size_ - tail_start_, tail_lfs_.size()}));
+    }
+}
+
+TextBuffer::Piece TextBuffer::gap_piece() const {
+    size_t len = tail_start_ - gap_start_;
+    return {GAP, gap_start_, len, count_lfs(GAP, gap_start_, len)};
+}
+
+size_t TextBuffer::pending_line() const {
+    if (gap_start_ == tail_start_) return NPOS;
+    return lfs_before(gap_offset_);
+}
+
+double TextBuffer::index_progress() const {
+    if (!line_index_ || line_index_->done()) return 1.0;
+    return static_cast<double>(line_index_->indexed()) / line_index_->end();
+}
+
+bool TextBuffer::update_index(size_t& line, size_t& added) {
+    if (gap_start_ == tail_start_ || !line_index_->poll()) return false;
+    // Only complete lines leave the gap, except at the end of the file
+    size_t ready = line_index_->done() ? tail_start_ : line_index_->ready();
+    if (ready == gap_start_) return false;
+    line = pending_line();
+    size_t before = line_count();
+
+    // Take the GAP piece out and put back the part now indexed, followed
+    // by what is left of it. Offsets stay the same, so no listener runs.
+    uint32_t l, gap, r;
+    split(root_, gap_offset_, l, r);
+    split(r, tail_start_ - gap_start_, gap, r);
+    free_tree(gap);
+    Piece piece{ORIGINAL, gap_start_, ready - gap_start_, count_lfs(ORIGINAL, gap_start_, ready - gap_start_)};
+    if (!extend_last(l, piece)) {
+        l = merge(l, alloc_node(piece));
+    }
+    gap_start_ = ready;
+    gap_offset_ += piece.len;
+    if (gap_start_ < tail_start_) {
+        l = merge(l, alloc_node(gap_piece()));
+    } else {
+        original_file_->advise_sequential(false);
+    }
+    root_ = merge(l, r);
+    added = line_count() + 1 - before;
+    return true;
+}
+
+// Whether editing [offset, offset + len) would change the pending line,
+// including by joining it with the line before
+bool TextBuffer::touches_gap(size_t offset, size_t len) const {
+    if (gap_start_ == tail_start_) return false;
+    size_t gap_end = gap_offset_ + tail_start_ - gap_start_;
+    if (original_[tail_start_ - 1] != '\n') gap_end++;  // Appending to an unterminated last line
+    return offset + len >= gap_offset_ && offset < gap_end;
+}
+
+std::string TextBuffer::text() const {
+    return substr(0, length());
+}
+
+size_t TextBuffer::count_lfs(BufferId buf, size_t start, size_t len) const {
+    if (buf == GAP) {
+        // Only the '\n' ending the gap counts, so it reads as one line
+        size_t last = tail_start_ - 1;
+        return start <= last && last < start + len && original_[last] == '\n';
+    }
+    if (buf == ORIGINAL && line_index_) {
+        size_t end = start + len;
+        size_t count = 0;
+        if (start < tail_start_) {
+            count += line_index_->rank(std::min(end, tail_start_)) - line_index_->rank(start);
+            start = tail_start_;
+        }
+        if (end > start) {
+            auto lo = std::lower_bound(tail_lfs_.begin(), tail_lfs_.end(), start);
+            count += std::lower_bound(lo, tail_lfs_.end(), end) - lo;
+        }
+        return count;
+    }
+    const auto& v = lfs(buf);
+    auto lo = std::lower_bound(v.begin(), v.end(), start);
+    auto hi = std::lower_bound(lo, v.end(), start + len);
+    return hi - lo;
+}
+
+size_t TextBuffer::nth_lf(BufferId buf, size_t start, size_t nth) const {
+    if (buf == GAP) return tail_start_ - 1;
+    const std::vector<size_t>* v = &lfs(buf);
+    if (buf == ORIGINAL && line_index_) {
+        if (start < tail_start_) {
+            size_t k = line_index_->rank(start) + nth - 1;
+            if (k < line_index_->count()) return line_index_->select(k);
+            // Runs on into the tail (once the index is complete)
+            nth = k - line_index_->count() + 1;
+            start = tail_start_;
+        }
+        v = &tail_lfs_;
+    }
+    size_t first = std::lower_bound(v->begin(), v->end(), start) - v->begin();
+    return (*v)[first + nth - 1];
+}
+
+size_t TextBuffer::find_lf(size_t nth) const {
+    uint32_t t = root_;
+    size_t base = 0;
+    while (t) {
+        const Node& n = nodes_[t];
+        size_t left_lfs = sub_lfs(n.left);
+        if (nth <= left_lfs) {
+            t = n.left;
+            continue;
+        }
+        nth -= left_lfs;
+        base += sub_len(n.left);
+        if (nth <= n.piece.lfs) {
+            return base + nth_lf(n.piece.buf, n.piece.start, nth) - n.piece.start;
+        }
+        nth -= n.piece.lfs;
+        base += n.piece.len;
+        t = n.right;
+    }
+    return length();
+}
+
+size_t TextBuffer::lfs_before(size_t offset) const {
+    uint32_t t = root_;
+    size_t count = 0;
+    while (t && offset) {
+        const Node& n = nodes_[t];
+        size_t left_len = sub_len(n.left);
+        if (offset <= left_len) {
+            t = n.left;
+            continue;
+        }
+        offset -= left_len;
+        count += sub_lfs(n.left);
+        if (offset <= n.piece.len) {
+            return count + count_lfs(n.piece.buf, n.piece.start, offset);
+        }
+        offset -= n.piece.len;
+        count += n.piece.lfs;
+        t = n.right;
+    }
+    return count;
+}
+
+size_t TextBuffer::line_start(size_t line) const {
+    if (line == 0) return 0;
+    if (line >= line_count()) return length();
+    return find_lf(line) + 1;
+}
+
+size_t TextBuffer::line_length(size_t line) const {
+    if (line >= line_count() || line == pending_line()) return 0;
+    size_t start = line_start(line);
+    size_t end = line + 1 < line_count() ? find_lf(line + 1) : length();
+    return end - start;
+}
+
+std::string TextBuffer::line(size_t line) const {
+    if (line >= line_count() || line == pending_line()) return std::string();
+    size_t start = line_start(line);
+    size_t end = line + 1 < line_count() ? find_lf(line + 1) : length();
+    return substr(start, end - start);
+}
+
+std::string TextBuffer::substr(size_t offset, size_t len) const {
+    std::string out;
+    if (offset >= length()) return out;
+    len = std::min(len, length() - offset);
+    out.reserve(len);
+    for_each_chunk(offset, len, [&](const char* p, size_t n) { out.append(p, n); });
+    return out;
+}
+
+size_t TextBuffer::offset_of(size_t line, size_t col) const {
+    if (line >= line_count()) return length();
+    return line_start(line) + std::min(col, line_length(line));
+}
+
+void TextBuffer::position_of(size_t offset, size_t& line, size_t& col) const {
+    offset = std::min(offset, length());
+    line = lfs_before(offset);
+    col = offset - line_start(line);
+}
+
+void TextBuffer::insert(size_t offset, const char* data, size_t len) {
+    if (len == 0) return;
+    offset = std::min(offset, length());
+    if (touches_gap(offset, 0)) return;
+    if (!replaying_) journal_.record_insert(offset, data, len);
+    version_++;
+    for (auto& entry : listeners_) entry.second.before(offset, 0);
+
+    size_t start = add_.size();
+    size_t lf_count = add_lfs_.size();
+    add_.append(data, len);
+    index_lfs(add_.data(), start, len, add_lfs_);
+    Piece piece{ADD, start, len, add_lfs_.size() - lf_count};
+
+    uint32_t l, r;
+    split(root_, offset, l, r);
+    // Consecutive typing appends to the same piece instead of adding nodes
+    if (!extend_last(l, piece)) {
+        uint32_t node = alloc_node(piece);
+        l = merge(l, node);
+    }
+    root_ = merge(l, r);
+    if (offset < gap_offset_) gap_offset_ += len;
+    for (auto& entry : listeners_) entry.second.after(offset, len);
+}
+
+void TextBuffer::erase(size_t offset, size_t len) {
+    if (offset >= length() || len == 0) return;
+    len = std::min(len, length() - offset);
+    if (touches_gap(offset, len)) return;
+    if (!replaying_) journal_.record_erase(offset, substr(offset, len));
+    version_++;
+    for (auto& entry : listeners_) entry.second.before(offset, len);
+
+    uint32_t a, b, mid, c;
+    split(root_, offset, a, b);
+    split(b, len, mid, c);
+    free_tree(mid);
+    root_ = merge(a, c);
+    if (offset < gap_offset_) gap_offset_ -= len;
+    for (auto& entry : listeners_) entry.second.after(offset, 0);
+}
+
+void TextBuffer::set_line(size_t line, const std::string& text) {
+    if (line >= line_count()) return;
+    size_t start = line_start(line);
+    erase(start, line_length(line));
+    insert(start, text.data(), text.size());
+}
+
+void TextBuffer::insert_line(size_t line, const std::string& text) {
+    if (line < line_count()) {
+        std::string s = text + "\n";
+        insert(line_start(line), s.data(), s.size());
+    } else {
+        std::string s = "\n" + text;
+        insert(length(), s.data(), s.size());
+    }
+}
+
+void TextBuffer::delete_line(size_t line) {
+    size_t count = line_count();
+    if (line >= count) return;
+    if (count == 1) {
+        erase(0, length());
+    } else if (line + 1 < count) {
+        size_t start = line_start(line);
+        erase(start, line_start(line + 1) - start);
+    } else {
+        // Last line: remove the newline that precedes it
+        size_t start = line_start(line) - 1;
+        erase(start, length() - start);
+    }
+}
+
+void TextBuffer::apply(const EditOp& op, bool inverse) {
+    if (op.insert != inverse) {
+        insert(op.offset, op.text.data(), op.text.size());
+    } else {
+        erase(op.offset, op.text.size());
+    }
+}
+
+size_t TextBuffer::first_offset(const UndoGroup& group) const {
+    size_t first = length();
+    for (const auto& op : group.ops) first = std::min(first, op.offset);
+    return first;
+}
+
+bool TextBuffer::undo(size_t& offset, size_t& first) {
+    UndoGroup group;
+    if (!journal_.take_undo(group)) return false;
+    replaying_ = true;
+    for (auto it = group.ops.rbegin(); it != group.ops.rend(); ++it) {
+        apply(*it, true);
+    }
+    replaying_ = false;
+    offset = group.ops.empty() ? 0 : group.ops.front().offset;
+    first = first_offset(group);
+    journal_.push_undone(std::move(group));
+    return true;
+}
+
+bool TextBuffer::redo(size_t& offset, size_t& first) {
+    UndoGroup group;
+    if (!journal_.take_redo(group)) return false;
+    replaying_ = true;
+    for (const auto& op : group.ops) {
+        apply(op, false);
+    }
+    replaying_ = false;
+    offset = group.ops.empty() ? 0 : group.ops.front().offset;
+    first = first_offset(group);
+    journal_.push_redone(std::move(group));
+    return true;
+}
+
+uint32_t TextBuffer::next_prio() {
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    return seed_;
+}
+
+uint32_t TextBuffer::alloc_node(const Piece& piece) {
+    uint32_t idx;
+    if (!free_.empty()) {
+        idx = free_.back();
+        free_.pop_back();
+    } else {
+        idx = static_cast<uint32_t>(nodes_.size());
+        nodes_.emplace_back();
+    }
+    Node& n = nodes_[idx];
+    n.piece = piece;
+    n.left = n.right = 0;
+    n.prio = next_prio();
+    update(idx);
+    return idx;
+}
+
+void TextBuffer::free_tree(uint32_t t) {
+    if (!t) return;
+    free_tree(nodes_[t].left);
+    free_tree(nodes_[t].right);
+    free_.push_back(t);
+}
+
+void TextBuffer::update(uint32_t t) {
+    Node& n = nodes_[t];
+    n.sub_len = sub_len(n.left) + n.piece.len + sub_len(n.right);
+    n.sub_lfs = sub_lfs(n.left) + n.piece.lfs + sub_lfs(n.right);
+}
+
+void TextBuffer::split(uint32_t t, size_t offset, uint32_t& l, uint32_t& r) {
+    if (!t) {
+        l = r = 0;
+        return;
+    }
+
+    size_t left_len = sub_len(nodes_[t].left);
+    size_t piece_len = nodes_[t].piece.len;
+    uint32_t a, b;
+
+    if (offset <= left_len) {
+        split(nodes_[t].left, offset, a, b);
+        nodes_[t].left = b;
+        update(t);
+        l = a;
+        r = t;
+    } else if (offset >= left_len + piece_len) {
+        split(nodes_[t].right, offset - left_len - piece_len, a, b);
+        nodes_[t].right = a;
+        update(t);
+        l = t;
+        r = b;
+    } else {
+        // Offset falls inside this node's piece: cut it in two
+        size_t within = offset - left_len;
+        Piece head = nodes_[t].piece;
+        Piece tail = head;
+        tail.start += within;
+        tail.len -= within;
+        tail.lfs = count_lfs(tail.buf, tail.start, tail.len);
+        head.len = within;
+        head.lfs -= tail.lfs;
+
+        uint32_t right = nodes_[t].right;
+        nodes_[t].piece = head;
+        nodes_[t].right = 0;
+        update(t);
+
+        uint32_t tail_node = alloc_node(tail);  // May grow nodes_
+        l = t;
+        r = merge(tail_node, right);
+    }
+}
+
+uint32_t TextBuffer::merge(uint32_t a, uint32_t b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (nodes_[a].prio > nodes_[b].prio) {
+        uint32_t m = merge(nodes_[a].right, b);
+        nodes_[a].right = m;
+        update(a);
+        return a;
+    }
+    uint32_t m = merge(a, nodes_[b].left);
+    nodes_[b].left = m;
+    update(b);
+    return b;
+}
+
+bool TextBuffer::extend_last(uint32_t t, const Piece& piece) {
+    if (!t) return false;
+    bool extended;
+    if (nodes_[t].right) {
+        extended = extend_last(nodes_[t].right, piece);
+    } else {
+        Piece& last = nodes_[t].piece;
+        extended = last.buf == piece.buf && last.buf != GAP && last.start + last.len == piece.start;
+        if (extended) {
+            last.len += piece.len;
+            last.lfs += piece.lfs;
+        }
+    }
+    if (extended) update(t);
+    return extended;
+}
+
+}  // namespace catvim
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "undo_journal.hpp"
+#include "file_io.hpp"
+#include "line_index.hpp"
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace catvim {
+
+// Piece table text storage.
+//
+// The document is a sequence of pieces, each pointing into either the
+// original text or an append-only add buffer. Pieces live in a treap whose
+// nodes carry subtree byte and line-feed counts, so offset/line lookups and
+// edits are O(log n) no matter how large the file is. Lines and columns are
+// 0-based here; the Lua bindings convert to 1-based.
+class TextBuffer {
+public:
+    TextBuffer();
+    explicit TextBuffer(std::string text);
+
+    void set_text(std::string text);
+    // Maps the file and uses it as the original text; unedited lines are
+    // read straight from the mapping. Clears undo history like set_text().
+    //
+    // Files of at least large_threshold bytes are not indexed up front:
+    // their first and last megabyte are, and a LineIndex thread works
+    // through the rest. Until it is done, the part it has not reached
+    // reads as one empty pending line that can't be edited, and
+    // update_index() turns what the thread found into lines.
+    bool load(const char* path, std::string& error, size_t large_threshold = SIZE_MAX);
+    // Streams the pieces to `path` through an AtomicWriter; no copy of the
+    // whole text is made
+    bool save(const char* path, std::string& error);
+    std::string text() const;
+
+    // Frees the text and its indexes, keeping the undo journal, if the
+    // text is what was last loaded from or saved to a file. The buffer
+    // reads as empty until reload() maps the file again; `changed` tells
+    // whether the file was modified meanwhile, in which case its new
+    // contents are used and the undo history is cleared.
+    bool unload();
+    bool reload(std::string& error, bool& changed);
+    bool unloaded() const { return unloaded_; }
+    // Heap and mapped bytes held for the text, its indexes and the journal
+    size_t memory_bytes() const;
+
+    // Bumped by every change to the text; lets readers that work across
+    // several calls (e.g. Search) notice that offsets have moved
+    uint64_t version() const { return version_; }
+
+    // Lets indexes over the text follow edits instead of rescanning it.
+    // before(offset, len) runs while [offset, offset + len) still holds the
+    // old text and after(offset, len) once it holds the new text; reset()
+    // runs after set_text() or load() replaced everything.
+    struct Listener {
+        std::function<void(size_t offset, size_t len)> before;
+        std::function<void(size_t offset, size_t len)> after;
+        std::function<void()> reset;
+    };
+    int add_listener(Listener listener);
+    void remove_listener(int id);
+
+    // Large file mode (see load())
+    bool large() const { return line_index_ != nullptr; }
+    // Line standing for the part of a large file not indexed yet, or NPOS
+    size_t pending_line() const;
+    // Fraction of the file indexed so far (1 when done)
+    double index_progress() const;
+    // Takes what the index thread found: the pending line became `added`
+    // lines starting at `line`. Offsets do not move. False if nothing new.
+    bool update_index(size_t& line, size_t& added);
+
+    static constexpr size_t NPOS = static_cast<size_t>(-1);
+
+    size_t length() const { return sub_len(root_); }
+    size_t line_count() const { return sub_lfs(root_) + 1; }
+
+    // Byte offset of the first byte of `line`, and its length without '\n'
+    size_t line_start(size_t line) const;
+    size_t line_length(size_t line) const;
+    std::string line(size_t line) const;
+    std::string substr(size_t offset, size_t len) const;
+
+    // Offset of (line, col); col is clamped to the line length
+    size_t offset_of(size_t line, size_t col) const;
+    void position_of(size_t offset, size_t& line, size_t& col) const;
+
+    // Edits reaching into the pending line of a large file are ignored
+    // (version() doesn't change)
+    void insert(size_t offset, const char* data, size_t len);
+    void erase(size_t offset, size_t len);
+
+    // Line-level helpers used by the editor
+    void set_line(size_t line, const std::string& text);
+    void insert_line(size_t line, const std::string& text);
+    void delete_line(size_t line);
+
+    // Undo/redo replay the journal; `offset` receives where the change was
+    // and `first` the lowest offset it touched (text before it is unchanged)
+    bool undo(size_t& offset, size_t& first);
+    bool redo(size_t& offset, size_t& first);
+    UndoJournal& journal() { return journal_; }
+
+    // Calls fn(const char*, size_t) for each contiguous chunk in [offset, offset + len)
+    template <typename Fn>
+    void for_each_chunk(size_t offset, size_t len, Fn&& fn) const {
+        visit(root_, offset, len, fn);
+    }
+
+private:
+    // GAP is the part of a large file's original text the index hasn't
+    // reached; there is at most one GAP piece and it is never split
+    enum BufferId : uint8_t { ORIGINAL = 0, ADD = 1, GAP = 2 };
+
+    struct Piece {
+        BufferId buf;
+        size_t start;
+        size_t len;
+        size_t lfs;
+    };
+
+    struct Node {
+        Piece piece;
+        uint32_t left = 0;
+        uint32_t right = 0;
+        uint32_t prio = 0;
+        size_t sub_len = 0;
+        size_t sub_lfs = 0;
+    };
+
+    // The original text is either owned (set_text) or a file mapping (load)
+    const char* original_ = "";
+    size_t original_size_ = 0;
+    std::string original_text_;
+    std::unique_ptr<MappedFile> original_file_;
+    std::string add_;
+    std::vector<size_t> original_lfs_;  // Offsets of '\n' in original_
+    std::vector<size_t> add_lfs_;       // Offsets of '\n' in add_
+
+    // Large files: original_[0, gap_start_) is covered by line_index_,
+    // [gap_start_, tail_start_) is the GAP piece (at document offset
+    // gap_offset_) and [tail_start_, size) was indexed into tail_lfs_ by
+    // load(). Declared after original_file_ so the thread stops first.
+    std::unique_ptr<LineIndex> line_index_;
+    std::vector<size_t> tail_lfs_;
+    size_t gap_start_ = 0;
+    size_t tail_start_ = 0;
+    size_t gap_offset_ = 0;
+
+    // File the text last came from or went to, and its stamp then
+    std::string path_;
+    FileStamp stamp_;
+    size_t large_threshold_ = SIZE_MAX;
+    bool unloaded_ = false;
+
+    // Node 0 is the null sentinel (all counts zero)
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> free_;
+    uint32_t root_ = 0;
+    uint32_t seed_ = 0x9e3779b9u;
+    uint64_t version_ = 0;
+    std::map<int, Listener> listeners_;
+    int next_listener_id_ = 1;
+
+    UndoJournal journal_;
+    bool replaying_ = false;  // Suppresses journaling during undo/redo
+
+    const char* data(BufferId buf) const { return buf == ADD ? add_.data() : original_; }
+    const std::vector<size_t>& lfs(BufferId buf) const { return buf == ORIGINAL ? original_lfs_ : add_lfs_; }
+
+    size_t sub_len(uint32_t t) const { return nodes_[t].sub_len; }
+    size_t sub_lfs(uint32_t t) const { return nodes_[t].sub_lfs; }
+    size_t count_lfs(BufferId buf, size_t start, size_t len) const;
+    // Offset in buf of the nth (1-based) '\n' from start
+    size_t nth_lf(BufferId buf, size_t start, size_t nth) const;
+    size_t find_lf(size_t nth) const;  // Offset of the nth (1-based) '\n'
+    size_t lfs_before(size_t offset) const;
+    void apply(const EditOp& op, bool inverse);
+    size_t first_offset(const UndoGroup& group) const;
+
+    void use_file(std::unique_ptr<MappedFile> file);
+    void reset_original(const char* data, size_t size, bool large = false);
+    void index_large();
+    Piece gap_piece() const;
+    bool touches_gap(size_t offset, size_t len) const;
+    uint32_t alloc_node(const Piece& piece);
+    void free_tree(uint32_t t);
+    void update(uint32_t t);
+    void split(uint32_t t, size_t offset, uint32_t& l, uint32_t& r);
+    uint32_t merge(uint32_t a, uint32_t b);
+    bool extend_last(uint32_t t, const Piece& piece);
+    uint32_t next_prio();
+
+    template <typename Fn>
+    void visit(uint32_t t, size_t off, size_t len, Fn& fn) const {
+        while (t && len) {
+            const Node& n = nodes_[t];
+            size_t ll = sub_len(n.left);
+            if (off < ll) {
+                size_t take = std::min(len, ll - off);
+                visit(n.left, off, take, fn);
+                len -= take;
+                off = ll;
+                if (!len) return;
+            }
+            off -= ll;
+            if (off < n.piece.len) {
+                size_t take = std::min(len, n.piece.len - off);
+                fn(data(n.piece.buf) + n.piece.start + off, take);
+                len -= take;
+                off = 0;
+            } else {
+                off -= n.piece.len;
+            }
+            t = n.right;
+        }
+    }
+
+    static void index_lfs(const char* data, size_t base, size_t len, std::vector<size_t>& out);
+};
+
+}  // namespace catvim
@@ -0,0 +1,254 @@
+#include "undo_journal.hpp"
+#include "file_io.hpp"
+#include <cstring>
+#include <unistd.h>
+
+namespace catvim {
+
+UndoJournal::~UndoJournal() {
+    if (spilled()) ::unlink(spill_path_.c_str());
+}
+
+UndoGroup& UndoJournal::open_group() {
+    unspill();
+    drop_redo();
+    if (!open_ || undo_.empty()) {
+        UndoGroup group;
+        group.serial = next_serial_++;
+        undo_.push_back(std::move(group));
+        open_ = true;
+    }
+    return undo_.back();
+}
+
+void UndoJournal::add_bytes(UndoGroup& group, size_t n) {
+    group.bytes += n;
+    bytes_ += n;
+    trim();
+}
+
+void UndoJournal::record_insert(size_t offset, const char* data, size_t len) {
+    if (len == 0) return;
+    UndoGroup& group = open_group();
+
+    // Typing: extend the previous insert when this one continues it
+    if (!group.ops.empty()) {
+        EditOp& last = group.ops.back();
+        if (last.insert && last.offset + last.text.size() == offset) {
+            last.text.append(data, len);
+            add_bytes(group, len);
+            return;
+        }
+    }
+
+    group.ops.push_back({true, offset, std::string(data, len)});
+    add_bytes(group, op_cost(group.ops.back()));
+}
+
+void UndoJournal::record_erase(size_t offset, std::string text) {
+    if (text.empty()) return;
+    UndoGroup& group = open_group();
+
+    // Backspacing: extend the previous erase when this one ends where it began
+    if (!group.ops.empty()) {
+        EditOp& last = group.ops.back();
+        if (!last.insert && offset + text.size() == last.offset) {
+            size_t n = text.size();
+            last.text.insert(0, text);
+            last.offset = offset;
+            add_bytes(group, n);
+            return;
+        }
+    }
+
+    group.ops.push_back({false, offset, std::move(text)});
+    add_bytes(group, op_cost(group.ops.back()));
+}
+
+void UndoJournal::mark() {
+    if (depth_ == 0) open_ = false;
+}
+
+void UndoJournal::begin_transaction() {
+    if (depth_++ == 0) open_ = false;
+}
+
+void UndoJournal::end_transaction() {
+    if (depth_ > 0 && --depth_ == 0) open_ = false;
+}
+
+bool UndoJournal::take_undo(UndoGroup& out) {
+    unspill();
+    open_ = false;
+    if (undo_.empty()) return false;
+    out = std::move(undo_.back());
+    undo_.pop_back();
+    return true;
+}
+
+bool UndoJournal::take_redo(UndoGroup& out) {
+    unspill();
+    open_ = false;
+    if (redo_.empty()) return false;
+    out = std::move(redo_.back());
+    redo_.pop_back();
+    return true;
+}
+
+void UndoJournal::push_redone(UndoGroup group) {
+    undo_.push_back(std::move(group));
+    trim();
+}
+
+void UndoJournal::clear() {
+    if (spilled()) {
+        ::unlink(spill_path_.c_str());
+        spill_path_.clear();
+    }
+    undo_.clear();
+    redo_.clear();
+    open_ = false;
+    depth_ = 0;
+    bytes_ = 0;
+    saved_serial_ = 0;
+    base_serial_ = 0;
+}
+
+// Spill file: the undo and redo group counts, then each group (undo
+// oldest first, then redo) as serial, op count and per op insert, offset,
+// length and text. Numbers are native u64s; the file never leaves this
+// machine or outlives the process.
+
+bool UndoJournal::spill(const std::string& path, std::string& error) {
+    if (spilled() || depth_ > 0) return false;
+
+    // The writer keeps pointers until it flushes, so the numbers go in a
+    // vector that is sized up front and never reallocates
+    size_t count = 2;
+    auto each_group = [&](auto fn) {
+        for (const auto& group : undo_) fn(group);
+        for (const auto& group : redo_) fn(group);
+    };
+    each_group([&](const UndoGroup& group) { count += 2 + 3 * group.ops.size(); });
+    std::vector<uint64_t> numbers;
+    numbers.reserve(count);
+
+    AtomicWriter writer;
+    if (!writer.open(path.c_str(), error)) return false;
+    auto put = [&](size_t n) {
+        const uint64_t* at = &numbers.front() + numbers.size();
+        numbers.push_back(n);
+        return at;
+    };
+    bool ok = true;
+    numbers.push_back(undo_.size());
+    numbers.push_back(redo_.size());
+    ok = writer.write(reinterpret_cast<const char*>(numbers.data()), 2 * sizeof(uint64_t));
+    each_group([&](const UndoGroup& group) {
+        const uint64_t* head = put(group.serial);
+        put(group.ops.size());
+        ok = ok && writer.write(reinterpret_cast<const char*>(head), 2 * sizeof(uint64_t));
+        for (const auto& op : group.ops) {
+            head = put(op.insert);
+            put(op.offset);
+            put(op.text.size());
+            ok = ok && writer.write(reinterpret_cast<const char*>(head), 3 * sizeof(uint64_t));
+            ok = ok && writer.write(op.text.data(), op.text.size());
+        }
+    });
+    if (!ok) {
+        writer.abort();
+        error = "Cannot write undo history";
+        return false;
+    }
+    if (!writer.commit(error)) return false;
+
+    spilled_top_ = top_serial();
+    spill_path_ = path;
+    // Swapping with empty containers gives the memory back
+    std::deque<UndoGroup>().swap(undo_);
+    std::vector<UndoGroup>().swap(redo_);
+    bytes_ = 0;
+    open_ = false;
+    return true;
+}
+
+bool UndoJournal::read_spill(const char* data, size_t size) {
+    size_t at = 0;
+    auto number = [&](uint64_t& n) {
+        if (size - at < sizeof(n)) return false;
+        std::memcpy(&n, data + at, sizeof(n));
+        at += sizeof(n);
+        return true;
+    };
+    uint64_t groups[2];
+    if (!number(groups[0]) || !number(groups[1])) return false;
+    for (int stack = 0; stack < 2; stack++) {
+        for (uint64_t g = 0; g < groups[stack]; g++) {
+            UndoGroup group;
+            uint64_t ops;
+            if (!number(group.serial) || !number(ops)) return false;
+            for (uint64_t i = 0; i < ops; i++) {
+                uint64_t insert, offset, len;
+                if (!number(insert) || !number(offset) || !number(len) || size - at < len) return false;
+                group.ops.push_back({insert != 0, offset, std::string(data + at, len)});
+                at += len;
+                group.bytes += op_cost(group.ops.back());
+            }
+            bytes_ += group.bytes;
+            if (stack == 0) {
+                undo_.push_back(std::move(group));
+            } else {
+                redo_.push_back(std::move(group));
+            }
+        }
+    }
+    return at == size;
+}
+
+void UndoJournal::unspill() {
+    if (!spilled()) return;
+    std::string path;
+    path.swap(spill_path_);
+
+    MappedFile file;
+    std::string error;
+    bool ok = file.open(path.c_str(), error) && read_spill(file.data(), file.size());
+    file.close();
+    ::unlink(path.c_str());
+    if (!ok || top_serial() != spilled_top_) {
+        // Lost: keep is_modified() answering as before
+        bool modified = spilled_top_ != saved_serial_;
+        undo_.clear();
+        redo_.clear();
+        bytes_ = 0;
+        base_serial_ = 0;
+        saved_serial_ = modified ? UINT64_MAX : 0;
+    }
+}
+
+void UndoJournal::set_budget(size_t bytes) {
+    budget_ = bytes;
+    trim();
+}
+
+void UndoJournal::trim() {
+    // Redo entries are discarded by the next edit anyway; never drop the
+    // group that is still being recorded
+    while (bytes_ > budget_ && undo_.size() > 1) {
+        const UndoGroup& oldest = undo_.front();
+        // The state before it can't be reached any more; if that was the
+        // save point, nothing can match it again
+        if (saved_serial_ < oldest.serial) saved_serial_ = UINT64_MAX;
+        base_serial_ = oldest.serial;
+        bytes_ -= oldest.bytes;
+        undo_.pop_front();
+    }
+}
+
+void UndoJournal::drop_redo() {
+    for (const auto& group : redo_) bytes_ -= group.bytes;
+    redo_.clear();
+}
+
+}  // namespace catvim
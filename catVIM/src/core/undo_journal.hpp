@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <cstddef>
+
+namespace catvim {
+
+// One primitive edit: `text` was inserted at, or erased from, `offset`
+struct EditOp {
+    bool insert;
+    size_t offset;
+    std::string text;
+};
+
+// Edits that are undone/redone together (a command, an insert session...)
+struct UndoGroup {
+    uint64_t serial = 0;
+    size_t bytes = 0;
+    std::vector<EditOp> ops;
+};
+
+// Operation log for undo/redo. Only the changed text is stored, so memory
+// and undo cost scale with the size of the edits rather than the file.
+// Undo history is trimmed oldest-first once undo + redo text exceeds the
+// byte budget.
+class UndoJournal {
+public:
+    UndoJournal() = default;
+    UndoJournal(const UndoJournal&) = delete;
+    UndoJournal& operator=(const UndoJournal&) = delete;
+    ~UndoJournal();
+
+    void record_insert(size_t offset, const char* data, size_t len);
+    void record_erase(size_t offset, std::string text);
+
+    // Close the open group; the next edit starts a new one.
+    // Ignored inside a transaction.
+    void mark();
+    void begin_transaction();
+    void end_transaction();
+
+    bool take_undo(UndoGroup& out);
+    bool take_redo(UndoGroup& out);
+    void push_undone(UndoGroup group) { redo_.push_back(std::move(group)); }
+    void push_redone(UndoGroup group);
+
+    void clear();
+
+    // Moves the history to a file at `path`, for a buffer that is not being
+    // edited; it is read back (and the file removed) by the next edit,
+    // undo or redo. Nothing changes if the file can't be written. A history
+    // that can't be read back is lost, but is_modified() stays correct.
+    bool spill(const std::string& path, std::string& error);
+    bool spilled() const { return !spill_path_.empty(); }
+
+    void set_budget(size_t bytes);
+    size_t budget() const { return budget_; }
+    size_t bytes() const { return bytes_; }  // In memory (none while spilled)
+    size_t undo_depth() const { return undo_.size(); }
+    size_t redo_depth() const { return redo_.size(); }
+
+    // Save point tracking for the modified flag. Once trim() drops the
+    // state that was saved, no undo or redo gets back to it, so the text
+    // counts as modified until the next save.
+    void mark_saved() {
+        saved_serial_ = top_serial();
+        open_ = false;  // Later edits must get a new serial
+    }
+    bool is_modified() const { return top_serial() != saved_serial_; }
+
+private:
+    std::deque<UndoGroup> undo_;
+    std::vector<UndoGroup> redo_;
+    bool open_ = false;        // undo_.back() still accepts edits
+    int depth_ = 0;            // Transaction nesting
+    uint64_t next_serial_ = 1;
+    uint64_t saved_serial_ = 0;
+    uint64_t base_serial_ = 0;  // State before undo_.front(): 0, or the last trimmed group
+    size_t bytes_ = 0;
+    size_t budget_ = 64 * 1024 * 1024;
+    std::string spill_path_;
+    uint64_t spilled_top_ = 0;  // top_serial() when spilled
+
+    bool read_spill(const char* data, size_t size);
+    void unspill();
+
+    static size_t op_cost(const EditOp& op) { return sizeof(EditOp) + op.text.size(); }
+    uint64_t top_serial() const {
+        if (spilled()) return spilled_top_;
+        return undo_.empty() ? base_serial_ : undo_.back().serial;
+    }
+    UndoGroup& open_group();
+    void add_bytes(UndoGroup& group, size_t n);
+    void trim();
+    void drop_redo();
+};
+
+}  // namespace catvim
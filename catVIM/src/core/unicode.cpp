@@ -0,0 +1,130 @@
+#include "unicode.hpp"
+#include "unicode_tables.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CATVIM_X86 1
+#endif
+
+namespace catvim {
+
+// ASCII scanning: a byte is ASCII exactly when its high bit is clear, so
+// the kernels test the high bits of a whole word or vector at once
+
+static size_t ascii_prefix_scalar(const char* s, size_t n) {
+    const uint64_t HIGH_BITS = 0x8080808080808080ull;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, s + i, sizeof(w));
+        if (w & HIGH_BITS) break;
+    }
+    while (i < n && static_cast<unsigned char>(s[i]) < 0x80) i++;
+    return i;
+}
+
+#ifdef CATVIM_X86
+// Sixteen bytes per step; SSE2 is always available on x86-64
+static size_t ascii_prefix_sse2(const char* s, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + ascii_prefix_scalar(s + i, n - i);
+}
+
+// Thirty-two bytes per step
+__attribute__((target("avx2")))
+static size_t ascii_prefix_avx2(const char* s, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        unsigned mask = static_cast<unsigned>(
+            _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i))));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + ascii_prefix_sse2(s + i, n - i);
+}
+#endif
+
+using AsciiPrefixFn = size_t (*)(const char*, size_t);
+
+static AsciiPrefixFn pick_ascii_prefix() {
+#ifdef CATVIM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return ascii_prefix_avx2;
+    return ascii_prefix_sse2;
+#else
+    return ascii_prefix_scalar;
+#endif
+}
+
+static const AsciiPrefixFn ascii_prefix_impl = pick_ascii_prefix();
+
+size_t ascii_prefix(const char* s, size_t n) {
+    return ascii_prefix_impl(s, n);
+}
+
+char32_t decode_utf8(const char* s, size_t n, size_t& len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s);
+    len = 1;
+    if (p[0] < 0x80) return p[0];
+
+    size_t need = utf8_length(p[0]);
+    if (need == 1 || n < need) return REPLACEMENT_CHAR;
+    for (size_t i = 1; i < need; i++) {
+        if (!utf8_continuation(p[i])) return REPLACEMENT_CHAR;
+    }
+
+    char32_t cp;
+    switch (need) {
+    case 2:
+        // Lead bytes C0 and C1 (overlong) were rejected by utf8_length()
+        cp = ((p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+        break;
+    case 3:
+        cp = ((p[0] & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+        if (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF)) return REPLACEMENT_CHAR;
+        break;
+    default:
+        cp = ((p[0] & 0x07) << 18) | ((p[1] & 0x3F) << 12) | ((p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+        if (cp < 0x10000 || cp > 0x10FFFF) return REPLACEMENT_CHAR;
+        break;
+    }
+    len = need;
+    return cp;
+}
+
+template <size_t N>
+static bool in_table(const CodeRange (&table)[N], char32_t cp) {
+    // First range starting after cp; the one before it may contain cp
+    const CodeRange* it = std::upper_bound(table, table + N, cp, [](char32_t c, const CodeRange& r) {
+        return c < r.first;
+    });
+    return it != table && cp <= (it - 1)->last;
+}
+
+int table_char_width(char32_t cp) {
+    if (in_table(ZERO_WIDTH, cp)) return 0;
+    if (cp >= DOUBLE_WIDTH[0].first && in_table(DOUBLE_WIDTH, cp)) return 2;
+    return 1;
+}
+
+int text_width(const char* s, size_t n) {
+    int width = 0;
+    size_t i = 0;
+    while (i < n) {
+        size_t run = ascii_prefix(s + i, n - i);
+        width += static_cast<int>(run);
+        i += run;
+        if (i == n) break;
+        size_t len;
+        width += char_width(decode_utf8(s + i, n - i, len));
+        i += len;
+    }
+    return width;
+}
+
+}  // namespace catvim
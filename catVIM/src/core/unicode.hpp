@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace catvim {
+
+// Substituted for bytes that are not valid UTF-8
+constexpr char32_t REPLACEMENT_CHAR = 0xFFFD;
+
+// Length of the leading run of ASCII bytes in s[0, n). Scans 16 or 32
+// bytes per step, so all-ASCII text costs little more than a copy.
+size_t ascii_prefix(const char* s, size_t n);
+
+// Decodes the code point starting at s[0] (n >= 1) and sets len to the
+// bytes it takes. Truncated, overlong or otherwise invalid sequences give
+// REPLACEMENT_CHAR with len 1, so decoding always moves forward.
+char32_t decode_utf8(const char* s, size_t n, size_t& len);
+
+// Bytes in the sequence a lead byte starts (1 for invalid lead bytes)
+inline size_t utf8_length(unsigned char lead) {
+    if (lead < 0xC2) return 1;
+    if (lead < 0xE0) return 2;
+    if (lead < 0xF0) return 3;
+    return lead < 0xF5 ? 4 : 1;
+}
+
+inline bool utf8_continuation(unsigned char c) { return (c & 0xC0) == 0x80; }
+
+// Appends cp to out as UTF-8
+inline void append_utf8(std::string& out, char32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// Looked up in the width tables; char_width() answers the common case
+int table_char_width(char32_t cp);
+
+// Terminal columns a code point takes: 0 for combining marks and format
+// characters, 2 for East Asian wide and fullwidth characters, else 1
+inline int char_width(char32_t cp) {
+    return cp < 0x300 ? 1 : table_char_width(cp);
+}
+
+// Display width of UTF-8 text
+int text_width(const char* s, size_t n);
+
+}  // namespace catvim
@@ -0,0 +1,250 @@
+#include "word_index.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace catvim {
+
+static inline bool is_word_char(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static inline unsigned char fold(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline bool is_upper(unsigned char c) { return c >= 'A' && c <= 'Z'; }
+static inline bool is_lower(unsigned char c) { return c >= 'a' && c <= 'z'; }
+
+WordIndex::WordIndex(std::shared_ptr<TextBuffer> text) : text_(std::move(text)) {
+    TextBuffer::Listener listener;
+    listener.before = [this](size_t offset, size_t len) { adjust_lines(offset, len, -1); };
+    listener.after = [this](size_t offset, size_t len) { adjust_lines(offset, len, +1); };
+    listener.reset = [this]() { stale_ = true; };
+    listener_ = text_->add_listener(std::move(listener));
+}
+
+WordIndex::~WordIndex() {
+    text_->remove_listener(listener_);
+}
+
+// Calls fn(word, len) for each word of a usable length that doesn't start
+// with a digit (numbers are not worth completing)
+template <typename Fn>
+void WordIndex::tokenize(const char* p, size_t n, Fn&& fn) {
+    size_t i = 0;
+    while (i < n) {
+        while (i < n && !is_word_char(p[i])) i++;
+        size_t start = i;
+        while (i < n && is_word_char(p[i])) i++;
+        size_t len = i - start;
+        if (len >= MIN_WORD && len <= MAX_WORD && !(p[start] >= '0' && p[start] <= '9')) {
+            fn(p + start, len);
+        }
+    }
+}
+
+// One bit per letter (case folded), digit and '_'; a query can only match
+// words whose mask contains all of its bits
+uint64_t WordIndex::mask_of(const char* p, size_t n) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = fold(p[i]);
+        if (c >= 'a' && c <= 'z') {
+            mask |= 1ull << (c - 'a');
+        } else if (c >= '0' && c <= '9') {
+            mask |= 1ull << (26 + c - '0');
+        } else if (c == '_') {
+            mask |= 1ull << 36;
+        }
+    }
+    return mask;
+}
+
+void WordIndex::adjust(const char* word, size_t len, int delta) {
+    key_.assign(word, len);
+    auto it = ids_.find(key_);
+    if (delta > 0) {
+        if (it == ids_.end()) {
+            uint32_t id = static_cast<uint32_t>(words_.size());
+            words_.push_back({key_, 0});
+            masks_.push_back(mask_of(word, len));
+            firsts_.push_back(fold(word[0]));
+            it = ids_.emplace(key_, id).first;
+        }
+        words_[it->second].count += delta;
+        return;
+    }
+    if (it == ids_.end()) return;
+    uint32_t id = it->second;
+    if (words_[id].count > static_cast<uint32_t>(-delta)) {
+        words_[id].count += delta;
+        return;
+    }
+    // Last occurrence gone: move the final word into its slot
+    ids_.erase(it);
+    uint32_t last = static_cast<uint32_t>(words_.size() - 1);
+    if (id != last) {
+        words_[id] = std::move(words_[last]);
+        masks_[id] = masks_[last];
+        firsts_[id] = firsts_[last];
+        ids_[words_[id].text] = id;
+    }
+    words_.pop_back();
+    masks_.pop_back();
+    firsts_.pop_back();
+}
+
+// Adds (delta = +1) or removes (-1) the words of the whole lines spanning
+// [offset, offset + len). Words never contain '\n', so retokenizing whole
+// lines before and after an edit keeps the counts exact.
+void WordIndex::adjust_lines(size_t offset, size_t len, int delta) {
+    if (stale_) return;
+    size_t first, last, col;
+    text_->position_of(offset, first, col);
+    size_t start = offset - col;
+    text_->position_of(offset + len, last, col);
+    size_t end = last + 1 < text_->line_count() ? text_->line_start(last + 1) : text_->length();
+    std::string lines = text_->substr(start, end - start);
+    tokenize(lines.data(), lines.size(), [&](const char* w, size_t n) { adjust(w, n, delta); });
+}
+
+void WordIndex::rebuild() {
+    words_.clear();
+    masks_.clear();
+    firsts_.clear();
+    ids_.clear();
+    stale_ = false;
+
+    // A word split across two pieces is carried over to the next one
+    std::string carry;
+    auto add = [&](const char* w, size_t n) { adjust(w, n, +1); };
+    text_->for_each_chunk(0, text_->length(), [&](const char* p, size_t n) {
+        size_t i = 0;
+        if (!carry.empty()) {
+            while (i < n && is_word_char(p[i])) i++;
+            carry.append(p, i);
+            if (i == n) return;
+            tokenize(carry.data(), carry.size(), add);
+            carry.clear();
+        }
+        size_t end = n;
+        while (end > i && is_word_char(p[end - 1])) end--;
+        tokenize(p + i, end - i, add);
+        carry.assign(p + end, n - end);
+    });
+    tokenize(carry.data(), carry.size(), add);
+}
+
+// Records how far from `line` each word within NEARBY_LINES of it occurs
+void WordIndex::mark_nearby(size_t line) {
+    if (near_stamp_.size() < words_.size()) {
+        near_stamp_.resize(words_.size(), 0);
+        near_dist_.resize(words_.size(), 0);
+    }
+    if (++stamp_ == 0) {
+        std::fill(near_stamp_.begin(), near_stamp_.end(), 0);
+        stamp_ = 1;
+    }
+
+    size_t count = text_->line_count();
+    line = std::min(line, count - 1);
+    size_t first = line > NEARBY_LINES ? line - NEARBY_LINES : 0;
+    size_t last = std::min(line + NEARBY_LINES, count - 1);
+    size_t start = text_->line_start(first);
+    size_t end = last + 1 < count ? text_->line_start(last + 1) : text_->length();
+    std::string lines = text_->substr(start, end - start);
+
+    const char* p = lines.data();
+    const char* stop = p + lines.size();
+    size_t current = first;
+    while (p < stop) {
+        const char* nl = static_cast<const char*>(std::memchr(p, '\n', stop - p));
+        const char* eol = nl ? nl : stop;
+        uint32_t dist = static_cast<uint32_t>(current > line ? current - line : line - current);
+        tokenize(p, eol - p, [&](const char* w, size_t n) {
+            key_.assign(w, n);
+            auto it = ids_.find(key_);
+            if (it == ids_.end()) return;
+            uint32_t id = it->second;
+            if (near_stamp_[id] != stamp_ || dist < near_dist_[id]) {
+                near_stamp_[id] = stamp_;
+                near_dist_[id] = dist;
+            }
+        });
+        p = eol + 1;
+        current++;
+    }
+}
+
+// Fuzzy match score of `query` against `word`; false if the query is not a
+// subsequence of it starting at its first letter (case-insensitive).
+// Consecutive runs, matches at word boundaries (after '_' or at a capital)
+// and exact case score higher; skipped letters cost a little.
+bool WordIndex::score(const std::string& word, const std::string& query, int& s) {
+    if (fold(word[0]) != fold(query[0])) return false;
+    s = word[0] == query[0] ? 1 : 0;
+    size_t prev = 0;
+    size_t wi = 1;
+    bool prefix = true;
+    for (size_t qi = 1; qi < query.size(); qi++) {
+        unsigned char q = fold(query[qi]);
+        while (wi < word.size() && fold(word[wi]) != q) wi++;
+        if (wi == word.size()) return false;
+        if (wi == prev + 1) {
+            s += 8;
+        } else {
+            prefix = false;
+            s -= std::min<int>(static_cast<int>(wi - prev - 1), 6);
+            unsigned char before = word[wi - 1];
+            unsigned char here = word[wi];
+            if (before == '_' || (is_lower(before) && is_upper(here))) s += 6;
+        }
+        if (word[wi] == query[qi]) s += 1;
+        prev = wi++;
+    }
+    if (prefix) s += 16;
+    // Among otherwise equal matches, prefer the shorter word
+    s -= static_cast<int>((word.size() - query.size()) / 4);
+    return true;
+}
+
+void WordIndex::complete(const std::string& query, size_t line, size_t limit, std::vector<std::string>& out) {
+    out.clear();
+    if (query.empty() || limit == 0) return;
+    if (stale_) rebuild();
+    mark_nearby(line);
+
+    struct Candidate {
+        int score;
+        uint32_t id;
+    };
+    std::vector<Candidate> found;
+    uint64_t need = mask_of(query.data(), query.size());
+    unsigned char first = fold(query[0]);
+    size_t n = masks_.size();
+    for (size_t id = 0; id < n; id++) {
+        if ((masks_[id] & need) != need || firsts_[id] != first) continue;
+        const Word& w = words_[id];
+        if (w.text.size() <= query.size()) continue;
+        int s;
+        if (!score(w.text, query, s)) continue;
+
+        // Frequency: roughly log2 of the count
+        s += 2 * (32 - __builtin_clz(w.count));
+        // Locality: words near the cursor, the closer the better
+        if (near_stamp_[id] == stamp_) {
+            s += 4 + static_cast<int>(12 * (NEARBY_LINES - near_dist_[id]) / NEARBY_LINES);
+        }
+        found.push_back({s, static_cast<uint32_t>(id)});
+    }
+
+    auto better = [this](const Candidate& a, const Candidate& b) {
+        if (a.score != b.score) return a.score > b.score;
+        return words_[a.id].text < words_[b.id].text;
+    };
+    size_t k = std::min(limit, found.size());
+    std::partial_sort(found.begin(), found.begin() + k, found.end(), better);
+    for (size_t i = 0; i < k; i++) out.push_back(words_[found[i].id].text);
+}
+
+}  // namespace catvim
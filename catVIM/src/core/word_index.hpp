@@ -0,0 +1,72 @@
+#pragma once
+
+#include "text_buffer.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+namespace catvim {
+
+// The distinct words of a TextBuffer and how often each occurs, for
+// completion. The index follows the buffer's edit notifications: an edit
+// only retokenizes the lines it touched. It is built on first use and
+// rebuilt lazily after the buffer is reset (set_text/load).
+//
+// Completion is a fuzzy subsequence match anchored at the first letter,
+// ranked by match quality, word frequency and closeness to the cursor.
+class WordIndex {
+public:
+    explicit WordIndex(std::shared_ptr<TextBuffer> text);
+    ~WordIndex();
+    WordIndex(const WordIndex&) = delete;
+    WordIndex& operator=(const WordIndex&) = delete;
+
+    // The best `limit` completions of `query`, best first. `line` is the
+    // cursor line (0-based); words on lines near it rank higher.
+    void complete(const std::string& query, size_t line, size_t limit, std::vector<std::string>& out);
+
+    size_t size() const { return words_.size(); }
+
+private:
+    static const size_t MIN_WORD = 3;
+    static const size_t MAX_WORD = 64;     // Longer tokens are data, not identifiers
+    static const size_t NEARBY_LINES = 100;
+
+    struct Word {
+        std::string text;
+        uint32_t count;
+    };
+
+    std::shared_ptr<TextBuffer> text_;
+    int listener_ = 0;
+    bool stale_ = true;
+
+    // words_[i], masks_[i] and firsts_[i] (case folded first letter)
+    // describe the same word; the last two are kept apart so the prefilter
+    // scans dense arrays
+    std::vector<Word> words_;
+    std::vector<uint64_t> masks_;
+    std::vector<unsigned char> firsts_;
+    std::unordered_map<std::string, uint32_t> ids_;
+    std::string key_;  // Reused for lookups
+
+    // Scratch for complete(): distance from the cursor of nearby words,
+    // valid where near_stamp_[id] == stamp_
+    std::vector<uint32_t> near_stamp_;
+    std::vector<uint32_t> near_dist_;
+    uint32_t stamp_ = 0;
+
+    void rebuild();
+    void adjust(const char* word, size_t len, int delta);
+    void adjust_lines(size_t offset, size_t len, int delta);
+    void mark_nearby(size_t line);
+
+    template <typename Fn>
+    static void tokenize(const char* p, size_t n, Fn&& fn);
+    static uint64_t mask_of(const char* p, size_t n);
+    static bool score(const std::string& word, const std::string& query, int& s);
+};
+
+}  // namespace catvim
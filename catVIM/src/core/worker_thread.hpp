@@ -0,0 +1,27 @@
+#pragma once
+
+#include <csignal>
+#include <pthread.h>
+#include <thread>
+#include <utility>
+
+namespace catvim {
+
+// Starts a background thread with every signal blocked. Signals meant for
+// the event loop (EventLoop::on_signal) then always reach the thread that
+// reads them, whenever they were registered.
+template <typename... Args>
+std::thread start_worker(Args&&... args) {
+    struct MaskAll {
+        sigset_t old;
+        MaskAll() {
+            sigset_t all;
+            sigfillset(&all);
+            pthread_sigmask(SIG_SETMASK, &all, &old);
+        }
+        ~MaskAll() { pthread_sigmask(SIG_SETMASK, &old, nullptr); }
+    } mask;
+    return std::thread(std::forward<Args>(args)...);
+}
+
+}  // namespace catvim
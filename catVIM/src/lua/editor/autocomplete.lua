@@ -16,7 +16,41 @@ function M:new()
     return self
 end
 
-function M:gather_candidates(buffer, prefix)
+-- Popup rows; also the number of candidates asked for
+local MAX_CANDIDATES = 10
+
+-- Large files have no word index (building one reads the whole file);
+-- completion looks at this many lines either side of the cursor instead,
+-- and at no more than NEARBY_BYTES of them
+local NEARBY_LINES = 200
+local NEARBY_BYTES = 256 * 1024
+
+-- Words starting with prefix on the lines around `line`, nearest first
+local function nearby_words(buffer, prefix, line, max)
+    local words = {}
+    local seen = { [prefix] = true }
+    local budget = NEARBY_BYTES
+    for distance = 0, NEARBY_LINES do
+        for _, n in ipairs(distance == 0 and { line } or { line - distance, line + distance }) do
+            if n >= 1 and n <= buffer:line_count() then
+                if budget <= 0 then return words end
+                local text = buffer:get_line(n)
+                if #text > budget then text = text:sub(1, budget) end
+                budget = budget - #text
+                for word in text:gmatch("[%w_]+") do
+                    if not seen[word] and word:sub(1, #prefix) == prefix then
+                        seen[word] = true
+                        table.insert(words, word)
+                        if #words >= max then return words end
+                    end
+                end
+            end
+        end
+    end
+    return words
+end
+
+function M:gather_candidates(buffer, prefix, line)
     if #prefix < 2 then return {} end
     
     local candidates = {}
@@ -26,29 +60,29 @@ function M:gather_candidates(buffer, prefix)
     local lang = Syntax.languages[buffer.filetype]
     if lang and lang.keywords then
         for _, kw in ipairs(lang.keywords) do
-            if kw:sub(1, #prefix) == prefix then
+            if kw:sub(1, #prefix) == prefix and kw ~= prefix then
                 table.insert(candidates, { text = kw, type = "keyword" })
                 seen[kw] = true
             end
         end
     end
     
-    -- 2. Words in buffer (simple scan)
-    -- Scan nearby lines first for performance? Or just full scan.
-    -- For now, scan visible lines or whole buffer (if small)
-    -- Let's limit to nearby 100 lines
-    local start_line = math.max(1, #buffer.lines - 500) -- limit scan
-    for i = 1, #buffer.lines do
-        local line = buffer.lines[i]
-        for word in line:gmatch("[%w_]+") do
-            if #word > #prefix and word:sub(1, #prefix) == prefix and not seen[word] then
-                table.insert(candidates, { text = word, type = "text" })
-                seen[word] = true
-            end
+    -- 2. Words in the buffer, fuzzy matched and ranked natively (closer
+    -- matches, frequent words and words near the cursor first)
+    local words
+    if buffer.large then
+        words = nearby_words(buffer, prefix, line, MAX_CANDIDATES)
+    else
+        words = buffer:word_index():complete(prefix, line, MAX_CANDIDATES)
+    end
+    for _, word in ipairs(words) do
+        if #candidates >= MAX_CANDIDATES then break end
+        if not seen[word] then
+            table.insert(candidates, { text = word, type = "text" })
+            seen[word] = true
         end
     end
     
-    table.sort(candidates, function(a, b) return a.text < b.text end)
     return candidates
 end
 
@@ -66,7 +100,7 @@ function M:trigger(state)
     
     local prefix = line:sub(prefix_start, col - 1)
     
-    self.candidates = self:gather_candidates(state.buffer, prefix)
+    self.candidates = self:gather_candidates(state.buffer, prefix, state.cursor.line)
     
     if #self.candidates > 0 then
         self.visible = true
@@ -88,13 +122,16 @@ function M:accept(state)
     if not self.visible or #self.candidates == 0 then return false end
     
     local selected = self.candidates[self.selection]
-    local suffix = selected.text:sub(#self.prefix + 1)
+    local line = state.cursor.line
     
-    -- Insert suffix
-    for i = 1, #suffix do
-        state.buffer:insert_char(state.cursor.line, state.cursor.col, suffix:sub(i, i))
-        state.cursor:move(1, 0)
+    -- Fuzzy matches need not start with the typed prefix, so replace it
+    if selected.text:sub(1, #self.prefix) == self.prefix then
+        state.buffer:insert_text(line, state.cursor.col, selected.text:sub(#self.prefix + 1))
+    else
+        state.buffer:delete_text(line, self.base_x, #self.prefix)
+        state.buffer:insert_text(line, self.base_x, selected.text)
     end
+    state.cursor:move_to(line, self.base_x + #selected.text)
     
     self:hide()
     return true
@@ -120,8 +157,9 @@ function M:render(state)
     end
     
     -- Calculate x position (gutter offset)
-    local gutter_width = state.show_line_numbers and 4 or 0
-    local screen_x = self.base_x + gutter_width
+    local gutter_width = state.show_line_numbers and state.gutter_width or 0
+    local line = state.buffer:get_line(state.cursor.line)
+    local screen_x = catvim.utf8.col(line, self.base_x) + gutter_width
     
     -- Don't render if off screen
     if screen_y < 1 or screen_y > state.height then return end
@@ -134,8 +172,8 @@ function M:render(state)
     local h = math.min(#self.candidates, 10)
     
     -- Draw box background
-    local style = colors.styles.popup or { fg = colors.colors.fg, bg = colors.colors.bg_light }
-    local sel_style = colors.styles.popup_selected or { fg = colors.colors.bg, bg = colors.colors.blue }
+    local style = colors.ids.popup
+    local sel_style = colors.ids.popup_selected
     
     -- Ensure popup doesn't go off screen bottom
     local render_y = screen_y + 1
@@ -5,96 +5,208 @@ Buffer.__index = Buffer
 function Buffer:new(opts)
     opts = opts or {}
     local self = setmetatable({}, Buffer)
-    self.lines = opts.lines or {""}
+    -- Text lives in a native piece table (catvim.text); lines are 1-based
+    self.text = catvim.text.new(opts.lines and table.concat(opts.lines, "\n") or "")
     self.filepath = opts.filepath or nil
     self.modified = false
     self.readonly = opts.readonly or false
     self.filetype = opts.filetype or "text"
     self.name = opts.name or "[No Name]"
-    -- Undo/redo history
-    self.undo_stack = {}
-    self.redo_stack = {}
-    self.max_history = 100
+    -- Undo/redo history is an operation journal kept by catvim.text;
+    -- old entries are dropped once it exceeds the byte budget
+    self.undo_budget = opts.undo_budget or 64 * 1024 * 1024
+    self.text:set_undo_budget(self.undo_budget)
+    self.listeners = {}
+    self.index_listeners = {}
+    self.words = nil  -- catvim.words index, created on first completion
+    -- Set by load(): a file opened in large file mode is only ever worked
+    -- on around the viewport (no whole-file highlighting or word index)
+    self.large = false
+    self.index_timer = nil
     return self
 end
 
--- Save state for undo
-function Buffer:save_state()
-    -- Deep copy lines
-    local snapshot = {}
-    for i, line in ipairs(self.lines) do
-        snapshot[i] = line
+-- Word index for completion. It follows edits to the text natively, so it
+-- is never rescanned once built.
+function Buffer:word_index()
+    if not self.words then
+        self.words = catvim.words.new(self.text)
     end
-    table.insert(self.undo_stack, snapshot)
-    -- Limit history size
-    if #self.undo_stack > self.max_history then
-        table.remove(self.undo_stack, 1)
+    return self.words
+end
+
+-- Register fn(first, removed, added), called after lines first..first+removed-1
+-- were replaced by `added` lines. removed == nil means every line from
+-- `first` on may have changed.
+function Buffer:on_lines(fn)
+    table.insert(self.listeners, fn)
+end
+
+function Buffer:notify(first, removed, added)
+    for _, fn in ipairs(self.listeners) do
+        fn(first, removed, added)
+    end
+end
+
+-- Register fn(line, added), called when the pending line of a large file
+-- became `added` lines because the index thread got further. Unlike an
+-- edit, this moves every line below it without anyone having asked.
+function Buffer:on_index(fn)
+    table.insert(self.index_listeners, fn)
+end
+
+-- Line still being indexed in a large file and the fraction of the file
+-- indexed so far, or nil
+function Buffer:pending_line()
+    return self.text:pending_line()
+end
+
+-- How often the index thread's progress is picked up
+local INDEX_POLL_MS = 50
+
+function Buffer:poll_index()
+    local line, added = self.text:update_index()
+    if line then
+        self:notify(line, 1, added)
+        for _, fn in ipairs(self.index_listeners) do
+            fn(line, added)
+        end
+    end
+    if not self.text:pending_line() and self.index_timer then
+        catvim.loop.cancel(self.index_timer)
+        self.index_timer = nil
+    end
+end
+
+-- Report an edit starting on `line`, given the line count before it
+function Buffer:changed(line, before)
+    local after = self.text:line_count()
+    self.modified = true
+    if after >= before then
+        self:notify(line, 1, 1 + after - before)
+    else
+        self:notify(line, 1 + before - after, 1)
     end
-    -- Clear redo stack on new edit
-    self.redo_stack = {}
 end
 
+-- Start a new undo step; edits until the next call are undone together
+function Buffer:save_state()
+    self.text:undo_mark()
+end
+
+-- Group every edit until end_transaction() into one undo step
+function Buffer:begin_transaction()
+    self.text:begin_transaction()
+end
+
+function Buffer:end_transaction()
+    self.text:end_transaction()
+end
+
+-- Returns the position of the change on success
 function Buffer:undo()
-    if #self.undo_stack == 0 then
+    local line, col, first = self.text:undo()
+    if not line then
         return false
     end
-    -- Save current state to redo
-    local current = {}
-    for i, line in ipairs(self.lines) do
-        current[i] = line
-    end
-    table.insert(self.redo_stack, current)
-    -- Restore previous state
-    self.lines = table.remove(self.undo_stack)
-    self.modified = #self.undo_stack > 0
-    return true
+    self.modified = self.text:is_modified()
+    self:notify(first)
+    return true, line, col
 end
 
 function Buffer:redo()
-    if #self.redo_stack == 0 then
+    local line, col, first = self.text:redo()
+    if not line then
         return false
     end
-    -- Save current to undo
-    local current = {}
-    for i, line in ipairs(self.lines) do
-        current[i] = line
-    end
-    table.insert(self.undo_stack, current)
-    -- Restore redo state
-    self.lines = table.remove(self.redo_stack)
-    self.modified = true
-    return true
+    self.modified = self.text:is_modified()
+    self:notify(first)
+    return true, line, col
 end
 
-function Buffer:load(filepath)
-    local content, err = catvim.fs.read(filepath)
-    if not content then
+-- Files of large_threshold bytes or more open in large file mode: the
+-- first screen shows at once and lines are indexed in the background
+function Buffer:load(filepath, large_threshold)
+    -- The file is mapped, not read into Lua
+    local ok, err = self.text:load(filepath, large_threshold)
+    if not ok then
         return false, err
     end
     
-    self.lines = {}
-    for line in (content .. "\n"):gmatch("([^\n]*)\n") do
-        table.insert(self.lines, line)
-    end
-    if #self.lines == 0 then
-        self.lines = {""}
-    end
-    
     self.filepath = filepath
     self.name = filepath:match("([^/]+)$") or filepath
     self.modified = false
+    self.large = self.text:large()
     self:detect_filetype()
+    self:notify(1)
+    self:start_indexing()
     return true
 end
 
+function Buffer:start_indexing()
+    if self.text:pending_line() and not self.index_timer then
+        self.index_timer = catvim.loop.timer(INDEX_POLL_MS, function() self:poll_index() end, INDEX_POLL_MS)
+    end
+end
+
+-- Bytes held natively for the text, its indexes and undo history
+function Buffer:memory()
+    return self.text:memory()
+end
+
+function Buffer:unloaded()
+    return self.text:unloaded()
+end
+
+-- For a buffer that is not shown: moves its undo history to a temp file
+-- and, if the text is the same as the file's, frees the text too, to be
+-- mapped again by reload(). Modified text has nowhere else to live, so
+-- it stays; the journal decides what is modified, as self.modified is
+-- only updated by edits through this object.
+function Buffer:release()
+    if self.text:undo_bytes() > 0 then
+        local path = os.tmpname()
+        if not self.text:spill_undo(path) then
+            os.remove(path)
+        end
+    end
+    if self.text:is_modified() or not self.text:unload() then return end
+    if self.index_timer then
+        catvim.loop.cancel(self.index_timer)
+        self.index_timer = nil
+    end
+    self.words = nil
+    self:notify(1)
+end
+
+-- Maps the file again after release(). Returns true and whether the file
+-- was changed meanwhile (the undo history is gone then), or false and an
+-- error, leaving the buffer empty.
+function Buffer:reload()
+    if not self.text:unloaded() then return true, false end
+    local ok, changed = self.text:reload()
+    if not ok then
+        -- Without the file the history has nothing to apply to
+        self.text:set_text("")
+        self.large = false
+        self:notify(1)
+        return false, changed
+    end
+    self.large = self.text:large()
+    self.modified = self.text:is_modified()
+    self:notify(1)
+    self:start_indexing()
+    return true, changed
+end
+
 function Buffer:save(filepath)
     filepath = filepath or self.filepath
     if not filepath then
         return false, "No filepath specified"
     end
     
-    local content = table.concat(self.lines, "\n")
-    local ok, err = catvim.fs.write(filepath, content)
+    -- Written natively from the piece table to a temp file, then renamed
+    local ok, err = self.text:save(filepath)
     if not ok then
         return false, err
     end
@@ -102,6 +214,7 @@ function Buffer:save(filepath)
     self.filepath = filepath
     self.name = filepath:match("([^/]+)$") or filepath
     self.modified = false
+    self.text:mark_saved()
     return true
 end
 
@@ -118,66 +231,95 @@ function Buffer:detect_filetype()
     self.filetype = map[ext] or "text"
 end
 
+function Buffer:set_lines(lines)
+    self.text:set_text(table.concat(lines, "\n"))
+    self.large = false
+    self:notify(1)
+end
+
 function Buffer:line_count()
-    return #self.lines
+    return self.text:line_count()
 end
 
 function Buffer:get_line(n)
-    return self.lines[n] or ""
+    return self.text:line(n)
+end
+
+function Buffer:line_length(n)
+    return self.text:line_length(n)
 end
 
+-- The edits below do nothing on the pending line of a large file (the
+-- text methods return false then)
 function Buffer:set_line(n, text)
-    if n >= 1 and n <= #self.lines then
-        self.lines[n] = text
+    if n >= 1 and n <= self.text:line_count() and self.text:set_line(n, text) then
         self.modified = true
+        self:notify(n, 1, 1)
     end
 end
 
 function Buffer:insert_line(n, text)
-    table.insert(self.lines, n, text or "")
+    local count = self.text:line_count()
+    if not self.text:insert_line(n, text or "") then return end
     self.modified = true
+    self:notify(math.min(n, count + 1), 0, 1)
 end
 
 function Buffer:delete_line(n)
-    if #self.lines > 1 then
-        table.remove(self.lines, n)
-        self.modified = true
+    local count = self.text:line_count()
+    if n < 1 or n > count then return end
+    if not self.text:delete_line(n) then return end
+    self.modified = true
+    if count == 1 then
+        self:notify(1, 1, 1)
     else
-        self.lines[1] = ""
-        self.modified = true
+        self:notify(n, 1, 0)
+    end
+end
+
+function Buffer:insert_text(line, col, text)
+    local before = self.text:line_count()
+    if self.text:insert(line, col, text) then
+        self:changed(line, before)
+    end
+end
+
+function Buffer:delete_text(line, col, count)
+    local before = self.text:line_count()
+    if self.text:erase(line, col, count) then
+        self:changed(line, before)
     end
 end
 
 function Buffer:insert_char(line, col, char)
-    local l = self.lines[line] or ""
-    self.lines[line] = l:sub(1, col - 1) .. char .. l:sub(col)
-    self.modified = true
+    self:insert_text(line, col, char)
 end
 
+-- Deletes the character before (line, col); returns true and where that
+-- character started, or false at the start of the buffer
 function Buffer:delete_char(line, col)
-    local l = self.lines[line] or ""
     if col > 1 then
-        self.lines[line] = l:sub(1, col - 2) .. l:sub(col)
-        self.modified = true
-        return true
+        -- The whole UTF-8 character, continuation bytes and all
+        local text = self:get_line(line)
+        local start = col - 1
+        while start > 1 do
+            local b = text:byte(start)
+            if not b or b < 0x80 or b >= 0xC0 then break end
+            start = start - 1
+        end
+        self:delete_text(line, start, col - start)
+        return true, line, start
     elseif line > 1 then
-        -- Join with previous line
-        local prev = self.lines[line - 1] or ""
-        self.lines[line - 1] = prev .. l
-        table.remove(self.lines, line)
-        self.modified = true
-        return true, #prev + 1
+        -- Join with previous line by removing its newline
+        local prev_len = self.text:line_length(line - 1)
+        self:delete_text(line - 1, prev_len + 1, 1)
+        return true, line - 1, prev_len + 1
     end
     return false
 end
 
 function Buffer:split_line(line, col)
-    local l = self.lines[line] or ""
-    local before = l:sub(1, col - 1)
-    local after = l:sub(col)
-    self.lines[line] = before
-    table.insert(self.lines, line + 1, after)
-    self.modified = true
+    self:insert_text(line, col, "\n")
 end
 
 return Buffer
@@ -0,0 +1,100 @@
+-- catVIM Buffer list - The open buffers (:ls, :b N, :bn, :bp)
+--
+-- Buffers that are not shown keep their text, undo history and the
+-- state stored with them by the caller, until the native memory of all
+-- buffers exceeds the budget. Then the least recently shown ones are
+-- released (see Buffer:release): undo history goes to a temp file and
+-- text that is still what the file holds is unmapped, to be mapped again
+-- when the buffer is shown.
+local BufferList = {}
+BufferList.__index = BufferList
+
+function BufferList:new(opts)
+    local self = setmetatable({}, BufferList)
+    self.items = {}     -- {buffer, used, ...}; :b N is items[N]
+    self.current = 0    -- Index of the buffer shown
+    self.budget = opts and opts.budget or 128 * 1024 * 1024
+    self.clock = 0      -- Stamps `used`
+    return self
+end
+
+-- Appends an entry for `buffer`; the caller may keep its own fields in it
+function BufferList:add(buffer)
+    local item = { buffer = buffer, used = 0 }
+    self.items[#self.items + 1] = item
+    return #self.items, item
+end
+
+function BufferList:get(index)
+    return self.items[index or self.current]
+end
+
+-- Index of the buffer holding `path`, by file identity so that different
+-- spellings of a path find the same buffer
+function BufferList:find(path)
+    local id = catvim.fs.id(path)
+    for i, item in ipairs(self.items) do
+        local filepath = item.buffer.filepath
+        if filepath == path or (id and filepath and catvim.fs.id(filepath) == id) then
+            return i
+        end
+    end
+    return nil
+end
+
+function BufferList:select(index)
+    self.clock = self.clock + 1
+    self.current = index
+    self.items[index].used = self.clock
+end
+
+-- First modified buffer, current one first
+function BufferList:modified()
+    local current = self.items[self.current]
+    if current and current.buffer.modified then return self.current end
+    for i, item in ipairs(self.items) do
+        if item.buffer.modified then return i end
+    end
+    return nil
+end
+
+function BufferList:memory()
+    local total = 0
+    for _, item in ipairs(self.items) do
+        total = total + item.buffer:memory()
+    end
+    return total
+end
+
+-- Releases buffers, least recently shown first, until the total is within
+-- the budget. on_release(item) is called for each one so the caller can
+-- drop what it keeps for it.
+function BufferList:enforce(on_release)
+    local total = self:memory()
+    if total <= self.budget then return end
+    local idle = {}
+    for i, item in ipairs(self.items) do
+        if i ~= self.current then idle[#idle + 1] = item end
+    end
+    table.sort(idle, function(a, b) return a.used < b.used end)
+    for _, item in ipairs(idle) do
+        local before = item.buffer:memory()
+        item.buffer:release()
+        if on_release then on_release(item) end
+        total = total - (before - item.buffer:memory())
+        if total <= self.budget then return end
+    end
+end
+
+-- One line for :ls, e.g. `1 init.lua  2 %src/modes.lua+  3 buffer.lua (unloaded)`
+function BufferList:describe()
+    local parts = {}
+    for i, item in ipairs(self.items) do
+        local buffer = item.buffer
+        parts[#parts + 1] = i .. " " .. (i == self.current and "%" or "") .. (buffer.filepath or buffer.name)
+            .. (buffer.modified and "+" or "") .. (buffer:unloaded() and " (unloaded)" or "")
+    end
+    return table.concat(parts, "  ")
+end
+
+return BufferList
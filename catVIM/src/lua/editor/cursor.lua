@@ -1,12 +1,36 @@
 -- catVIM Cursor - Cursor position and movement
+--
+-- col is a byte index into the line and always sits on the first byte of
+-- a UTF-8 character; target_col is a display column, so vertical moves
+-- keep the cursor visually in place across wide and multi-byte text.
 local Cursor = {}
 Cursor.__index = Cursor
 
+local function is_continuation(byte)
+    return byte ~= nil and byte >= 0x80 and byte < 0xC0
+end
+
+-- First byte of the character holding byte col
+local function char_start(text, col)
+    while col > 1 and is_continuation(text:byte(col)) do
+        col = col - 1
+    end
+    return col
+end
+
+local function next_char(text, col)
+    col = col + 1
+    while is_continuation(text:byte(col)) do
+        col = col + 1
+    end
+    return col
+end
+
 function Cursor:new(buffer)
     local self = setmetatable({}, Cursor)
     self.line = 1
     self.col = 1
-    self.target_col = 1  -- For vertical movement memory
+    self.target_col = 1  -- Display column, for vertical movement memory
     self.buffer = buffer
     return self
 end
@@ -23,33 +47,69 @@ function Cursor:clamp()
     local max_line = self.buffer:line_count()
     self.line = math.max(1, math.min(self.line, max_line))
     
-    -- Clamp column
-    local line_len = #self.buffer:get_line(self.line)
+    -- Clamp column, onto the start of a character
+    local line_len = self.buffer:line_length(self.line)
     self.col = math.max(1, math.min(self.col, line_len + 1))
+    if self.col > 1 and self.col <= line_len then
+        self.col = char_start(self.buffer:get_line(self.line), self.col)
+    end
+end
+
+-- Sets target_col from where the cursor is now
+function Cursor:remember_col()
+    if self.col == 1 then
+        self.target_col = 1
+    else
+        self.target_col = catvim.utf8.col(self.buffer:get_line(self.line), self.col)
+    end
 end
 
+-- Moves dx characters along the line and dy lines
 function Cursor:move(dx, dy)
     self.line = self.line + dy
-    self.col = self.col + dx
-    
-    if dx ~= 0 then
-        self.target_col = self.col
-    end
-    
     self:clamp()
     
-    -- Restore target column on vertical movement
-    if dy ~= 0 and dx == 0 then
-        local line_len = #self.buffer:get_line(self.line)
-        self.col = math.min(self.target_col, line_len + 1)
+    if dx ~= 0 then
+        local text = self.buffer:get_line(self.line)
+        local col = self.col
+        for _ = 1, math.abs(dx) do
+            if dx > 0 then
+                col = next_char(text, col)
+            elseif col > 1 then
+                col = char_start(text, col - 1)
+            end
+        end
+        self.col = col
+        self:clamp()
+        self:remember_col()
+    elseif dy ~= 0 then
+        -- Restore target column on vertical movement
+        self.col = catvim.utf8.byte(self.buffer:get_line(self.line), self.target_col)
+        self:clamp()
     end
 end
 
 function Cursor:move_to(line, col)
     self.line = line
     self.col = col
-    self.target_col = col
     self:clamp()
+    self:remember_col()
+end
+
+-- Same as move_to, but col is a display column (a mouse click)
+function Cursor:move_to_column(line, column)
+    self.line = line
+    self:clamp()
+    self.col = catvim.utf8.byte(self.buffer:get_line(self.line), column)
+    self:clamp()
+    self:remember_col()
+end
+
+-- Bytes in the character under the cursor (1 past the end of the line)
+function Cursor:char_length()
+    local text = self.buffer:get_line(self.line)
+    if self.col > #text then return 1 end
+    return next_char(text, self.col) - self.col
 end
 
 function Cursor:line_start()
@@ -58,16 +118,16 @@ function Cursor:line_start()
 end
 
 function Cursor:line_end()
-    local line_len = #self.buffer:get_line(self.line)
+    local line_len = self.buffer:line_length(self.line)
     self.col = line_len + 1
-    self.target_col = self.col
+    self:remember_col()
 end
 
 function Cursor:first_non_blank()
     local line = self.buffer:get_line(self.line)
     local pos = line:find("%S") or 1
     self.col = pos
-    self.target_col = pos
+    self:remember_col()
 end
 
 function Cursor:word_forward()
@@ -85,7 +145,7 @@ function Cursor:word_forward()
     else
         self:line_end()
     end
-    self.target_col = self.col
+    self:remember_col()
 end
 
 function Cursor:word_backward()
@@ -102,8 +162,8 @@ function Cursor:word_backward()
     
     -- Find previous word start
     local word_start = before:match(".*()%w+%s*$") or before:match(".*()%S+%s*$")
-    self.col = word_start or 1
-    self.target_col = self.col
+    self.col = char_start(line, word_start or 1)
+    self:remember_col()
 end
 
 function Cursor:goto_line(n)
@@ -0,0 +1,163 @@
+-- catVIM Highlighter - Incremental syntax highlighting for a buffer
+--
+-- Caches each line's highlights along with the lexer state at the end of the
+-- line, so only lines that changed (or scroll into view) get lexed. After an
+-- edit, states are re-lexed forward from the changed lines until one matches
+-- the cached value again; everything past that point is still valid.
+--
+-- Large files (buffer.large) are only lexed around the viewport: lexing
+-- starts from the default state at most LARGE_CONTEXT lines above the
+-- lines shown, so a comment opened further up is not seen.
+local Syntax = require("editor.syntax")
+
+local LARGE_CONTEXT = 200
+
+local Highlighter = {}
+Highlighter.__index = Highlighter
+
+function Highlighter:new(buffer)
+    local self = setmetatable({}, Highlighter)
+    self.buffer = buffer
+    self:reset()
+    buffer:on_lines(function(first, removed, added)
+        self:invalidate(first, removed, added)
+    end)
+    return self
+end
+
+function Highlighter:reset()
+    self.filetype = self.buffer.filetype
+    -- lines[i] = { state = lexer state at the end of line i,
+    --              tokens = cached highlights, from = state they were lexed from }
+    -- A nil entry means the line's text changed since it was cached.
+    self.lines = {}
+    self.first = 1     -- Lowest index that may hold an entry (see window())
+    self.count = 0     -- Highest index that may hold an entry
+    self.known = 0     -- lines[first..known].state is up to date
+    self.dirty_to = 0  -- Convergence in sync() is only trusted past this line
+end
+
+-- Large files: start over from line n - LARGE_CONTEXT when n is outside
+-- the lines lexed so far or far below them
+function Highlighter:window(n)
+    if n >= self.first and n <= self.known + LARGE_CONTEXT then return end
+    self:reset()
+    self.first = math.max(1, n - LARGE_CONTEXT)
+    self.count = self.first - 1
+    self.known = self.first - 1
+    self.dirty_to = self.known
+end
+
+-- Buffer listener: lines first..first+removed-1 became `added` lines
+function Highlighter:invalidate(first, removed, added)
+    local lines = self.lines
+    if self.buffer.large then
+        -- Re-lexing the window is cheap; shifting entries in a table indexed
+        -- by line numbers in the millions is not
+        if first <= self.count then self:reset() end
+        return
+    end
+    if not removed then
+        for i = first, self.count do lines[i] = nil end
+        self.count = math.min(self.count, first - 1)
+        self.known = math.min(self.known, first - 1)
+        return
+    end
+
+    -- Shift the cached tail to its new line numbers
+    local delta = added - removed
+    if self.count >= first then
+        local tail = first + removed
+        if delta > 0 then
+            for i = self.count, tail, -1 do lines[i + delta] = lines[i] end
+        elseif delta < 0 then
+            for i = tail, self.count do lines[i + delta] = lines[i] end
+            for i = math.max(self.count + delta + 1, first), self.count do lines[i] = nil end
+        end
+        for i = first, first + added - 1 do lines[i] = nil end
+        self.count = math.max(self.count + delta, first - 1)
+    end
+
+    if self.dirty_to >= first + removed then
+        self.dirty_to = self.dirty_to + delta
+    end
+    self.dirty_to = math.max(self.dirty_to, first + added - 1)
+    self.known = math.min(self.known, first - 1)
+end
+
+function Highlighter:state_before(n)
+    local entry = n > 1 and self.lines[n - 1]
+    return entry and entry.state or false
+end
+
+-- Bring lines[1..n].state up to date
+function Highlighter:sync(n)
+    if self.buffer.filetype ~= self.filetype then
+        self:reset()
+    end
+    if self.buffer.large then
+        self:window(n)
+    end
+    local lines = self.lines
+    local i = self.known
+    while i < n do
+        i = i + 1
+        local state_in = self:state_before(i)
+        local entry = lines[i]
+        local state
+        if entry and entry.tokens and entry.from == state_in then
+            state = entry.state
+        else
+            state = Syntax.line_state(self.buffer:get_line(i), self.filetype, state_in)
+        end
+
+        if entry and i > self.dirty_to and entry.state == state and i < self.count then
+            -- Same text, same end state: the cached states after this line
+            -- were lexed from the same input and are still correct
+            i = self.count
+        else
+            entry = entry or {}
+            if entry.from ~= state_in then
+                if entry.tokens then self:restyled(i) end
+                entry.tokens, entry.from = nil, nil
+            end
+            entry.state = state
+            lines[i] = entry
+        end
+        self.known = i
+    end
+    self.count = math.max(self.count, self.known)
+    -- Cached states after here were lexed from this line's old state, so
+    -- they can't be trusted to agree with anything before it
+    if self.known < self.count then
+        self.dirty_to = math.max(self.dirty_to, self.known)
+    end
+end
+
+-- Records that line n's cached highlights were dropped because the lexer
+-- state flowing into it changed (e.g. a block comment was opened above it)
+function Highlighter:restyled(n)
+    self.restyled_first = math.min(self.restyled_first or n, n)
+    self.restyled_last = math.max(self.restyled_last or n, n)
+end
+
+-- Range of lines restyled since the last call, or nil
+function Highlighter:take_restyled()
+    local first, last = self.restyled_first, self.restyled_last
+    self.restyled_first, self.restyled_last = nil, nil
+    return first, last
+end
+
+-- Highlights for line n (see Syntax.highlight_line)
+function Highlighter:highlights(n)
+    self:sync(n)
+    local state_in = self:state_before(n)
+    local entry = self.lines[n]
+    if not entry.tokens or entry.from ~= state_in then
+        entry.tokens = Syntax.highlight_line(self.buffer:get_line(n), self.filetype, state_in)
+        entry.from = state_in
+    end
+    return entry.tokens
+end
+
+return Highlighter
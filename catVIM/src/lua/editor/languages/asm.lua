@@ -0,0 +1,71 @@
+-- catVIM syntax: x86/ARM64 assembly. Loaded by editor/syntax.lua the first time a
+-- buffer of this type is highlighted.
+return {
+    keywords = {},  -- Instructions handled separately
+    types = {},
+    instructions_x86 = {
+        -- Data movement
+        "mov", "movzx", "movsx", "lea", "push", "pop", "xchg",
+        -- Arithmetic
+        "add", "sub", "mul", "imul", "div", "idiv", "inc", "dec", "neg",
+        -- Logic
+        "and", "or", "xor", "not", "shl", "shr", "sar", "rol", "ror",
+        -- Compare/test
+        "cmp", "test",
+        -- Jumps
+        "jmp", "je", "jne", "jz", "jnz", "jg", "jge", "jl", "jle",
+        "ja", "jae", "jb", "jbe", "jo", "jno", "js", "jns",
+        -- Call/return
+        "call", "ret", "leave", "enter",
+        -- Stack
+        "pusha", "popa", "pushf", "popf",
+        -- String
+        "rep", "movs", "cmps", "scas", "lods", "stos",
+        -- System
+        "syscall", "sysenter", "int", "iret", "cli", "sti", "hlt", "nop",
+        -- SSE/AVX (common)
+        "movaps", "movups", "addps", "subps", "mulps", "divps",
+    },
+    instructions_arm64 = {
+        -- Data movement
+        "mov", "mvn", "ldr", "str", "ldp", "stp", "adr", "adrp",
+        -- Arithmetic
+        "add", "adds", "sub", "subs", "mul", "madd", "msub", "neg",
+        -- Logic
+        "and", "ands", "orr", "eor", "bic", "lsl", "lsr", "asr", "ror",
+        -- Compare
+        "cmp", "cmn", "tst",
+        -- Branch
+        "b", "bl", "br", "blr", "ret", "cbz", "cbnz", "tbz", "tbnz",
+        "b.eq", "b.ne", "b.lt", "b.le", "b.gt", "b.ge",
+        -- System
+        "svc", "hvc", "smc", "nop", "wfi", "wfe",
+    },
+    registers_x86 = {
+        "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "rsp",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+        "eax", "ebx", "ecx", "edx", "esi", "edi", "ebp", "esp",
+        "ax", "bx", "cx", "dx", "si", "di", "bp", "sp",
+        "al", "bl", "cl", "dl", "ah", "bh", "ch", "dh",
+        "rip", "eip", "ip", "cs", "ds", "es", "fs", "gs", "ss",
+        "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+    },
+    registers_arm64 = {
+        "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9",
+        "x10", "x11", "x12", "x13", "x14", "x15", "x16", "x17", "x18",
+        "x19", "x20", "x21", "x22", "x23", "x24", "x25", "x26", "x27",
+        "x28", "x29", "x30", "sp", "lr", "xzr", "wzr",
+        "w0", "w1", "w2", "w3", "w4", "w5", "w6", "w7", "w8", "w9",
+        "v0", "v1", "v2", "v3", "q0", "q1", "q2", "q3",
+    },
+    patterns = {
+        { pattern = "[;#].-$", style = "comment" },  -- Comment
+        { pattern = '".-"', style = "string" },
+        { pattern = "'.-'", style = "string" },
+        { pattern = "0x[%da-fA-F]+", style = "number" },
+        { pattern = "0b[01]+", style = "number" },
+        { pattern = "%$?%d+", style = "number" },
+        { pattern = "^%s*%.%w+", style = "preprocessor" },  -- Directives
+        { pattern = "^%s*[%w_]+:", style = "label" },  -- Labels
+    },
+}
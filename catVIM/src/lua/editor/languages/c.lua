@@ -0,0 +1,40 @@
+-- catVIM syntax: C/C++. Loaded by editor/syntax.lua the first time a
+-- buffer of this type is highlighted.
+return {
+    keywords = {
+        "auto", "break", "case", "const", "continue", "default", "do",
+        "else", "enum", "extern", "for", "goto", "if", "inline",
+        "register", "restrict", "return", "sizeof", "static", "struct",
+        "switch", "typedef", "union", "volatile", "while",
+        -- C++ extras
+        "alignas", "alignof", "and", "and_eq", "asm", "bitand", "bitor",
+        "catch", "class", "compl", "constexpr", "const_cast", "decltype",
+        "delete", "dynamic_cast", "explicit", "export", "false", "friend",
+        "mutable", "namespace", "new", "noexcept", "not", "not_eq",
+        "nullptr", "operator", "or", "or_eq", "private", "protected",
+        "public", "reinterpret_cast", "static_assert", "static_cast",
+        "template", "this", "throw", "true", "try", "typeid", "typename",
+        "using", "virtual", "xor", "xor_eq", "override", "final"
+    },
+    types = {
+        "void", "char", "short", "int", "long", "float", "double",
+        "signed", "unsigned", "bool", "size_t", "int8_t", "int16_t",
+        "int32_t", "int64_t", "uint8_t", "uint16_t", "uint32_t", "uint64_t",
+        "char16_t", "char32_t", "wchar_t", "string", "vector", "map",
+        "set", "list", "array", "unique_ptr", "shared_ptr"
+    },
+    blocks = {
+        { open = "/%*", close = "*/", style = "comment" },
+    },
+    line_comment = "//",
+    patterns = {
+        { pattern = "//.-$", style = "comment" },
+        { pattern = '".-"', style = "string" },
+        { pattern = "'.-'", style = "string" },
+        { pattern = "^%s*#%w+", style = "preprocessor" },
+        { pattern = "0x[%da-fA-F]+[uUlL]*", style = "number" },
+        { pattern = "0b[01]+[uUlL]*", style = "number" },
+        { pattern = "%d+%.?%d*[fFlLuU]*", style = "number" },
+        { pattern = "[%+%-%%%*/%^&|=<>!~]", style = "operator" },
+    },
+}
@@ -0,0 +1,28 @@
+-- catVIM syntax: Lua. Loaded by editor/syntax.lua the first time a
+-- buffer of this type is highlighted.
+return {
+    keywords = {
+        "and", "break", "do", "else", "elseif", "end", "false", "for",
+        "function", "goto", "if", "in", "local", "nil", "not", "or",
+        "repeat", "return", "then", "true", "until", "while"
+    },
+    types = {
+        "string", "number", "boolean", "table", "function", "thread",
+        "userdata", "nil"
+    },
+    -- Constructs that may span lines; "%s" in close is the opener's capture
+    blocks = {
+        { open = "%-%-%[(=*)%[", close = "]%s]", style = "comment" },
+        { open = "%[(=*)%[", close = "]%s]", style = "string" },  -- Long strings
+    },
+    line_comment = "--",
+    patterns = {
+        { pattern = "%-%-.-$", style = "comment" },  -- Single line comment
+        { pattern = '".-"', style = "string" },
+        { pattern = "'.-'", style = "string" },
+        { pattern = "0x[%da-fA-F]+", style = "number" },
+        { pattern = "%d+%.?%d*", style = "number" },
+        { pattern = "[%+%-%%%*/%^#=<>~]", style = "operator" },
+        { pattern = "function%s+([%w_]+)", style = "function_name", capture = 1 },
+    },
+}
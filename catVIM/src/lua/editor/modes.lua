@@ -5,14 +5,19 @@ M.current = "normal"
 M.handlers = {}
 M.on_change = nil  -- Callback when mode changes
 
--- Search state
+-- Search state. The query (a catvim.search) does the matching natively;
+-- finding and counting run in short slices continued from loop timers, so
+-- even a huge file never holds up a keystroke.
 M.search = {
     pattern = "",
-    matches = {},
-    current_match = 0,
-    direction = 1  -- 1 = forward, -1 = backward
+    query = nil,       -- Compiled pattern; also drives match highlighting
+    direction = 1,     -- 1 = forward, -1 = backward
+    find_timer = nil,
+    count_timer = nil,
 }
 
+local SEARCH_SLICE_MS = 5
+
 -- Clipboard for yank/paste
 M.clipboard = {
     text = {},      -- Lines of text
@@ -36,16 +41,16 @@ function M.register(name, handler)
     M.handlers[name] = handler
 end
 
-function M.switch(new_mode)
+function M.switch(new_mode, state)
     if M.handlers[M.current] and M.handlers[M.current].on_exit then
-        M.handlers[M.current]:on_exit()
+        M.handlers[M.current]:on_exit(state)
     end
     
     local old_mode = M.current
     M.current = new_mode
     
     if M.handlers[new_mode] and M.handlers[new_mode].on_enter then
-        M.handlers[new_mode]:on_enter()
+        M.handlers[new_mode]:on_enter(state)
     end
     
     if M.on_change then
@@ -61,6 +66,33 @@ function M.handle(event, state)
     return false
 end
 
+-- Pasted text (bracketed paste) goes to the current mode in one piece
+function M.paste(text, state)
+    local handler = M.handlers[M.current]
+    if handler and handler.paste then
+        return handler:paste(text, state)
+    end
+    return false
+end
+
+-- Drops the last UTF-8 character of s
+local function drop_last_char(s)
+    return (s:gsub("[^\128-\191][\128-\191]*$", ""))
+end
+
+-- Inserts text at the cursor and leaves the cursor after it
+local function insert_at_cursor(text, state)
+    local line, col = state.cursor.line, state.cursor.col
+    state.buffer:insert_text(line, col, text)
+    
+    local breaks = select(2, text:gsub("\n", ""))
+    if breaks == 0 then
+        state.cursor:move_to(line, col + #text)
+    else
+        state.cursor:move_to(line + breaks, #text:match("[^\n]*$") + 1)
+    end
+end
+
 -- Normal mode handler
 local Normal = {}
 Normal.__index = Normal
@@ -95,31 +127,32 @@ function Normal:handle(event, state)
     
     -- Mode switches
     if char == "i" then
-        M.switch("insert")
+        M.switch("insert", state)
         return true
     elseif char == "I" then
         state.cursor:first_non_blank()
-        M.switch("insert")
+        M.switch("insert", state)
         return true
     elseif char == "a" then
         state.cursor:move(1, 0)
-        M.switch("insert")
+        M.switch("insert", state)
         return true
     elseif char == "A" then
         state.cursor:line_end()
-        M.switch("insert")
+        M.switch("insert", state)
         return true
     elseif char == "o" then
+        -- Enter insert first so the new line is part of the same undo step
+        M.switch("insert", state)
         local line = state.cursor.line
         state.buffer:insert_line(line + 1, "")
         state.cursor:move_to(line + 1, 1)
-        M.switch("insert")
         return true
     elseif char == "O" then
+        M.switch("insert", state)
         local line = state.cursor.line
         state.buffer:insert_line(line, "")
         state.cursor:move_to(line, 1)
-        M.switch("insert")
         return true
     elseif char == "v" then
         M.switch("visual")
@@ -184,9 +217,8 @@ function Normal:handle(event, state)
         state.buffer:save_state()  -- Save for undo
         local line = state.cursor.line
         local col = state.cursor.col
-        local text = state.buffer:get_line(line)
-        if col <= #text then
-            state.buffer:set_line(line, text:sub(1, col - 1) .. text:sub(col + 1))
+        if col <= state.buffer:line_length(line) then
+            state.buffer:delete_text(line, col, state.cursor:char_length())
         end
         return true
     elseif char == "d" then
@@ -238,12 +270,12 @@ function Normal:handle(event, state)
             state.cursor:move(0, 1)
             state:show_message(#M.clipboard.text .. " line(s) pasted", "info")
         else
-            -- Paste text after cursor
-            local line = state.buffer:get_line(state.cursor.line)
-            local col = state.cursor.col
-            local new_line = line:sub(1, col) .. M.clipboard.text[1] .. line:sub(col + 1)
-            state.buffer:set_line(state.cursor.line, new_line)
-            state.cursor:move(#M.clipboard.text[1], 0)
+            -- Paste text after cursor, leaving the cursor on its last character
+            local text = M.clipboard.text[1]
+            local at = math.min(state.cursor.col + state.cursor:char_length(), state.buffer:line_length(state.cursor.line) + 1)
+            state.buffer:insert_text(state.cursor.line, at, text)
+            state.cursor:move_to(state.cursor.line, at + #text)
+            state.cursor:move(-1, 0)
         end
         return true
     end
@@ -263,18 +295,16 @@ function Normal:handle(event, state)
             state:show_message(#M.clipboard.text .. " line(s) pasted", "info")
         else
             -- Paste text before cursor
-            local line = state.buffer:get_line(state.cursor.line)
-            local col = state.cursor.col
-            local new_line = line:sub(1, col - 1) .. M.clipboard.text[1] .. line:sub(col)
-            state.buffer:set_line(state.cursor.line, new_line)
+            state.buffer:insert_text(state.cursor.line, state.cursor.col, M.clipboard.text[1])
         end
         return true
     end
     
     -- Undo/Redo
     if char == "u" then
-        if state.buffer:undo() then
-            state.cursor:clamp()
+        local ok, line, col = state.buffer:undo()
+        if ok then
+            state.cursor:move_to(line, col)
             state:show_message("Undo", "info")
         else
             state:show_message("Already at oldest change", "warning")
@@ -283,8 +313,9 @@ function Normal:handle(event, state)
     end
     
     if ctrl and (key == KEY.CTRL_R or char == "r") then
-        if state.buffer:redo() then
-            state.cursor:clamp()
+        local ok, line, col = state.buffer:redo()
+        if ok then
+            state.cursor:move_to(line, col)
             state:show_message("Redo", "info")
         else
             state:show_message("Already at newest change", "warning")
@@ -295,11 +326,11 @@ function Normal:handle(event, state)
     -- Search
     if char == "/" then
         M.search.direction = 1
-        M.switch("search")
+        M.switch("search", state)
         return true
     elseif char == "?" then
         M.search.direction = -1
-        M.switch("search")
+        M.switch("search", state)
         return true
     end
     
@@ -326,26 +357,41 @@ function Normal:handle(event, state)
     return false
 end
 
+function Normal:paste(text, state)
+    self.pending = nil
+    state.buffer:save_state()
+    insert_at_cursor(text, state)
+    state.buffer:save_state()
+    return true
+end
+
 -- Insert mode handler
 local Insert = {}
 Insert.__index = Insert
 
 function Insert:new()
-    return setmetatable({has_edited = false}, Insert)
+    return setmetatable({buffer = nil}, Insert)
 end
 
-function Insert:on_enter()
-    self.has_edited = false
+-- The whole insert session is one undo step
+function Insert:on_enter(state)
+    if state then
+        self.buffer = state.buffer
+        self.buffer:begin_transaction()
+    end
 end
 
 function Insert:on_exit()
     -- Autocomplete is hidden in handle() before switch
+    if self.buffer then
+        self.buffer:end_transaction()
+        self.buffer = nil
+    end
 end
 
 function Insert:save_for_undo(state)
-    if not self.has_edited then
-        state.buffer:save_state()
-        self.has_edited = true
+    if not self.buffer then
+        self:on_enter(state)
     end
 end
 
@@ -372,7 +418,7 @@ function Insert:handle(event, state)
     if key == KEY.ESCAPE or (ctrl and (key == 3 or char == "c")) then
         if ac then ac:hide() end
         state.cursor:move(-1, 0)
-        M.switch("normal")
+        M.switch("normal", state)
         return true
     end
     
@@ -395,13 +441,9 @@ function Insert:handle(event, state)
     -- Backspace
     if key == KEY.BACKSPACE then
         self:save_for_undo(state)
-        local ok, new_col = state.buffer:delete_char(state.cursor.line, state.cursor.col)
+        local ok, line, col = state.buffer:delete_char(state.cursor.line, state.cursor.col)
         if ok then
-            if new_col then
-                state.cursor:move_to(state.cursor.line - 1, new_col)
-            else
-                state.cursor:move(-1, 0)
-            end
+            state.cursor:move_to(line, col)
         end
         if ac then ac:trigger(state) end
         return true
@@ -438,14 +480,14 @@ function Insert:handle(event, state)
         return true 
     end
     
-    -- Printable characters
-    if char and #char == 1 and key >= 32 and key < 127 then
+    -- Printable characters (char is also set for typed non-ASCII ones)
+    if char and (#char > 1 or key >= 32 and key < 127) then
         self:save_for_undo(state)
         state.buffer:insert_char(state.cursor.line, state.cursor.col, char)
         state.cursor:move(1, 0)
         
-        if ac and char:match("[%w_]") then
-            ac:trigger(state)
+        if char:match("[%w_]") then
+            state:get_autocomplete():trigger(state)
         else
             if ac then ac:hide() end
         end
@@ -455,6 +497,13 @@ function Insert:handle(event, state)
     return false
 end
 
+function Insert:paste(text, state)
+    if state.autocomplete then state.autocomplete:hide() end
+    self:save_for_undo(state)
+    insert_at_cursor(text, state)
+    return true
+end
+
 -- Visual mode handler (basic)
 local Visual = {}
 Visual.__index = Visual
@@ -525,14 +574,14 @@ function Command:handle(event, state)
     
     if key == KEY.BACKSPACE then
         if #self.input > 0 then
-            self.input = self.input:sub(1, -2)
+            self.input = drop_last_char(self.input)
         else
             M.switch("normal")
         end
         return true
     end
     
-    if char and #char == 1 and key >= 32 and key < 127 then
+    if char and (#char > 1 or key >= 32 and key < 127) then
         self.input = self.input .. char
         return true
     end
@@ -540,32 +589,69 @@ function Command:handle(event, state)
     return false
 end
 
+function Command:paste(text)
+    -- Only the first line; a newline would run the command
+    self.input = self.input .. text:match("^[^\n]*")
+    return true
+end
+
 function Command:execute(state)
     local cmd = self.input:match("^%s*(.-)%s*$")  -- Trim
     
     if cmd == "w" or cmd == "write" then
         state:save()
     elseif cmd == "q" or cmd == "quit" then
-        if state.buffer.modified then
-            state:show_message("Unsaved changes! Use :q! to force quit", "error")
-        else
-            catvim.quit()
-        end
+        state:quit()
     elseif cmd == "q!" then
         catvim.quit()
     elseif cmd == "wq" or cmd == "x" then
         state:save()
-        catvim.quit()
+        state:quit()
     elseif cmd == "e" or cmd == "edit" then
-        if state.buffer.filepath then
-            state:open_file(state.buffer.filepath)
-        else
-            state:show_message("No file to reload", "warning")
-        end
+        state:reload_file()
     elseif cmd:match("^e%s+") or cmd:match("^edit%s+") then
         local path = cmd:match("^e%s+(.+)$")
         if not path then path = cmd:match("^edit%s+(.+)$") end
         state:open_file(path)
+    elseif cmd:match("^grep%s+") then
+        state:grep(cmd:match("^grep%s+(.+)$"))
+    elseif cmd == "grep" then
+        state.quickfix:stop()
+        state:show_message("grep stopped", "info")
+    elseif cmd == "make" or cmd:match("^make%s") then
+        state:make(cmd:match("^make%s*(.-)$"))
+    elseif cmd == "cn" or cmd == "cnext" then
+        state:quickfix_jump(state.quickfix.index + 1)
+    elseif cmd == "cp" or cmd == "cprev" or cmd == "cN" then
+        state:quickfix_jump(state.quickfix.index - 1)
+    elseif cmd == "cfirst" then
+        state:quickfix_jump(1)
+    elseif cmd == "clast" then
+        state:quickfix_jump(math.huge)
+    elseif cmd:match("^cc%s*%d*$") then
+        state:quickfix_jump(tonumber(cmd:match("%d+")) or state.quickfix.index)
+    elseif cmd == "profile" then
+        state:toggle_profiler()
+    elseif cmd:match("^profile%s+dump") then
+        state:profile_dump(cmd:match("^profile%s+dump%s*(.-)$"))
+    elseif cmd:match("^set%s+largefile=%d+$") then
+        -- Size in MB from which files open in large file mode
+        state.large_file_threshold = tonumber(cmd:match("%d+$")) * 1024 * 1024
+        state:show_message("Large file mode from " .. cmd:match("%d+$") .. " MB", "info")
+    elseif cmd == "ls" or cmd == "buffers" then
+        state:list_buffers()
+    elseif cmd:match("^b%s*%d+$") then
+        state:switch_buffer(tonumber(cmd:match("%d+")))
+    elseif cmd == "bn" or cmd == "bnext" then
+        state:switch_buffer(state.buffers.current + 1, true)
+    elseif cmd == "bp" or cmd == "bprev" or cmd == "bN" then
+        state:switch_buffer(state.buffers.current - 1, true)
+    elseif cmd:match("^set%s+buffermem=%d+$") then
+        -- MB of native memory buffers may use before idle ones are released
+        state:set_buffer_budget(tonumber(cmd:match("%d+$")))
+    elseif cmd == "noh" or cmd == "nohlsearch" then
+        M.cancel_search()
+        M.search.query = nil
     elseif cmd:match("^%d+$") then
         state.cursor:goto_line(tonumber(cmd))
     else
@@ -573,7 +659,9 @@ function Command:execute(state)
     end
 end
 
--- Search mode handler
+-- Search mode handler. Every change to the input restarts the search
+-- from where the cursor was when the mode was entered and previews the
+-- nearest match; Escape puts the cursor back.
 local Search = {}
 Search.__index = Search
 
@@ -581,14 +669,28 @@ function Search:new()
     return setmetatable({input = ""}, Search)
 end
 
-function Search:on_enter()
+function Search:on_enter(state)
     self.input = ""
+    self.origin_line, self.origin_col = state.cursor.line, state.cursor.col
+    self.saved_query = M.search.query
 end
 
 function Search:on_exit()
     -- Keep pattern for n/N navigation
 end
 
+function Search:preview(state)
+    M.cancel_search()
+    state.cursor:move_to(self.origin_line, self.origin_col)
+    -- Incomplete regexes are expected while typing; just show nothing
+    M.search.query = self.input ~= "" and M.compile_search(state, self.input) or nil
+    local query = M.search.query
+    if not query then return end
+    M.run_find(query, self.origin_line, self.origin_col, M.search.direction, function(line, col)
+        if line then state.cursor:move_to(line, col) end
+    end)
+end
+
 function Search:handle(event, state)
     if event.type ~= "key" then return false end
     
@@ -596,12 +698,22 @@ function Search:handle(event, state)
     local char = event.char
     
     if key == KEY.ESCAPE then
-        M.search.pattern = ""
+        M.cancel_search()
+        M.search.query = self.saved_query
+        state.cursor:move_to(self.origin_line, self.origin_col)
         M.switch("normal")
         return true
     end
     
     if key == KEY.ENTER then
+        M.cancel_search()
+        state.cursor:move_to(self.origin_line, self.origin_col)
+        if self.input == "" then
+            M.search.query = self.saved_query
+            M.switch("normal")
+            M.find_next(state, M.search.direction)
+            return true
+        end
         M.search.pattern = self.input
         M.do_search(state)
         M.switch("normal")
@@ -610,94 +722,132 @@ function Search:handle(event, state)
     
     if key == KEY.BACKSPACE then
         if #self.input > 0 then
-            self.input = self.input:sub(1, -2)
+            self.input = drop_last_char(self.input)
+            self:preview(state)
         else
+            M.cancel_search()
+            M.search.query = self.saved_query
             M.switch("normal")
         end
         return true
     end
     
-    if char and #char == 1 and key >= 32 and key < 127 then
+    if char and (#char > 1 or key >= 32 and key < 127) then
         self.input = self.input .. char
+        self:preview(state)
         return true
     end
     
     return false
 end
 
+function Search:paste(text, state)
+    self.input = self.input .. text:match("^[^\n]*")
+    self:preview(state)
+    return true
+end
+
 -- Search functions
-function M.do_search(state)
-    local pattern = M.search.pattern
-    if pattern == "" then return end
-    
-    M.search.matches = {}
-    
-    -- Find all matches
-    for line_num = 1, state.buffer:line_count() do
-        local line = state.buffer:get_line(line_num)
-        local start = 1
-        while true do
-            local s, e = line:find(pattern, start, true)  -- Plain text search
-            if s then
-                table.insert(M.search.matches, {line = line_num, col = s, end_col = e})
-                start = e + 1
-            else
-                break
-            end
+
+-- Patterns are literal by default. Like Vim, \v anywhere makes the pattern
+-- a regex (POSIX extended), \c ignores case and \C forces matching it.
+function M.parse_pattern(input)
+    local opts = {}
+    local pattern = input:gsub("\\([vcC])", function(flag)
+        if flag == "v" then
+            opts.regex = true
+        else
+            opts.icase = flag == "c"
+        end
+        return ""
+    end)
+    return pattern, opts
+end
+
+function M.compile_search(state, input)
+    local pattern, opts = M.parse_pattern(input)
+    if pattern == "" then return nil, "Empty pattern" end
+    return catvim.search.new(state.buffer.text, pattern, opts)
+end
+
+function M.cancel_search()
+    if M.search.find_timer then catvim.loop.cancel(M.search.find_timer) end
+    if M.search.count_timer then catvim.loop.cancel(M.search.count_timer) end
+    M.search.find_timer = nil
+    M.search.count_timer = nil
+end
+
+-- Looks for the nearest match from (line, col) in a slice at a time and
+-- calls done(line, col, wrapped) with the match, or done(nil)
+function M.run_find(query, line, col, direction, done)
+    query:find(line, col, direction)
+    local function step()
+        M.search.find_timer = nil
+        local l, c, _, wrapped = query:find_step(SEARCH_SLICE_MS)
+        if l == nil then
+            M.search.find_timer = catvim.loop.timer(0, step)
+        elseif l then
+            done(l, c, wrapped)
+        else
+            done(nil)
         end
     end
-    
-    if #M.search.matches == 0 then
-        state:show_message("Pattern not found: " .. pattern, "warning")
-        return
-    end
-    
-    -- Find first match after cursor
-    local cursor_line = state.cursor.line
-    local cursor_col = state.cursor.col
-    
-    for i, match in ipairs(M.search.matches) do
-        if match.line > cursor_line or (match.line == cursor_line and match.col > cursor_col) then
-            M.search.current_match = i
-            state.cursor:move_to(match.line, match.col)
-            state:show_message("/" .. pattern .. " [" .. i .. "/" .. #M.search.matches .. "]", "info")
+    step()
+end
+
+-- Counts matches in the background, then reports "[i/N]" for the match at
+-- the cursor
+function M.report_count(state, query, line, col, wrap_msg)
+    local function step()
+        M.search.count_timer = nil
+        local count, done = query:count_step(SEARCH_SLICE_MS)
+        if not done then
+            M.search.count_timer = catvim.loop.timer(0, step)
             return
         end
+        local index = query:index(line, col)
+        state:show_message("/" .. M.search.pattern .. " [" .. index .. "/" .. count .. "]" .. wrap_msg, "info")
     end
+    state:show_message("/" .. M.search.pattern .. wrap_msg, "info")
+    step()
+end
+
+function M.do_search(state, direction)
+    local pattern = M.search.pattern
+    if pattern == "" then return end
     
-    -- Wrap to first match
-    M.search.current_match = 1
-    local match = M.search.matches[1]
-    state.cursor:move_to(match.line, match.col)
-    state:show_message("/" .. pattern .. " [1/" .. #M.search.matches .. "] (wrapped)", "info")
+    local query, err = M.compile_search(state, pattern)
+    M.search.query = query
+    if not query then
+        state:show_message(err, "error")
+        return
+    end
+    M.jump(state, query, direction or M.search.direction)
 end
 
-function M.find_next(state, direction)
-    if M.search.pattern == "" or #M.search.matches == 0 then
-        if M.search.pattern == "" then
-            state:show_message("No search pattern", "warning")
-        else
+function M.jump(state, query, direction)
+    M.cancel_search()
+    M.run_find(query, state.cursor.line, state.cursor.col, direction, function(line, col, wrapped)
+        if not line then
             state:show_message("Pattern not found: " .. M.search.pattern, "warning")
+            return
         end
+        state.cursor:move_to(line, col)
+        M.report_count(state, query, line, col, wrapped and " (wrapped)" or "")
+    end)
+end
+
+function M.find_next(state, direction)
+    if M.search.pattern == "" then
+        state:show_message("No search pattern", "warning")
         return
     end
-    
-    local next_idx = M.search.current_match + direction
-    if next_idx > #M.search.matches then
-        next_idx = 1
-    elseif next_idx < 1 then
-        next_idx = #M.search.matches
-    end
-    
-    M.search.current_match = next_idx
-    local match = M.search.matches[next_idx]
-    state.cursor:move_to(match.line, match.col)
-    
-    local wrap_msg = ""
-    if (direction > 0 and next_idx == 1) or (direction < 0 and next_idx == #M.search.matches) then
-        wrap_msg = " (wrapped)"
+    -- After :noh the pattern is still remembered
+    if not M.search.query then
+        M.do_search(state, direction)
+        return
     end
-    state:show_message("/" .. M.search.pattern .. " [" .. next_idx .. "/" .. #M.search.matches .. "]" .. wrap_msg, "info")
+    M.jump(state, M.search.query, direction)
 end
 
 -- Register default modes
@@ -0,0 +1,139 @@
+-- catVIM Quickfix - A list of file locations to step through
+--
+-- Filled by :grep, which searches a directory tree on native worker
+-- threads (catvim.grep), or by :make, which runs a build as a background
+-- job (catvim.job) and picks the file:line: locations out of its output.
+-- Items are appended as they stream in, so the list can be walked with
+-- :cn/:cp while the search or build is still running.
+local Quickfix = {}
+Quickfix.__index = Quickfix
+
+function Quickfix:new()
+    local self = setmetatable({}, Quickfix)
+    self.items = {}     -- {path, line, col, text}
+    self.index = 0      -- Current item, 0 before the first jump
+    self.title = ""
+    self.kind = "grep"  -- What filled the list: "grep" or "make"
+    self.job = nil      -- Running catvim.grep or catvim.job
+    return self
+end
+
+function Quickfix:running()
+    return self.job ~= nil
+end
+
+function Quickfix:stop()
+    if self.job then
+        if self.kind == "make" then
+            self.job:kill()
+        else
+            self.job:cancel()
+        end
+        self.job = nil
+    end
+end
+
+-- Starts searching `root` for `pattern`, replacing the list. on_update(done)
+-- is called after every batch of results.
+function Quickfix:grep(root, pattern, opts, on_update)
+    self:stop()
+    self.items = {}
+    self.index = 0
+    self.title = pattern
+    self.kind = "grep"
+    self.root = root
+
+    local job, err
+    job, err = catvim.grep.start(root, pattern, opts, function(results, done)
+        -- A newer :grep replaced this one
+        if self.job ~= job then return end
+        local items = self.items
+        for _, r in ipairs(results) do
+            items[#items + 1] = r
+        end
+        if done then self.job = nil end
+        on_update(done)
+    end)
+    self.job = job
+    return job ~= nil, err
+end
+
+-- "path:line:col: message" or "path:line: message", as compilers print them
+local function parse_location(line)
+    local path, lnum, col, text = line:match("^([^:%s][^:]*):(%d+):(%d+):%s*(.*)$")
+    if not path then
+        path, lnum, text = line:match("^([^:%s][^:]*):(%d+):%s*(.*)$")
+    end
+    if not path then return nil end
+    return {path = path, line = tonumber(lnum), col = tonumber(col) or 1, text = text}
+end
+
+-- Runs shell command `cmd` in the background, replacing the list with the
+-- locations it prints on stdout or stderr. on_update(done, code) is called
+-- when locations arrive and when the command exits.
+function Quickfix:make(cmd, on_update)
+    self:stop()
+    self.items = {}
+    self.index = 0
+    self.title = cmd
+    self.kind = "make"
+    self.root = "."
+
+    local job, err
+    -- Output arrives in arbitrary chunks; keep each stream's unfinished line
+    local partial = {stdout = "", stderr = ""}
+    local function collect(stream, data, flush)
+        if self.job ~= job then return end
+        local text = partial[stream] .. data
+        local items = self.items
+        local before = #items
+        local rest = 1
+        for line, next_pos in text:gmatch("([^\n]*)\n()") do
+            items[#items + 1] = parse_location(line)
+            rest = next_pos
+        end
+        text = text:sub(rest)
+        if flush and text ~= "" then
+            items[#items + 1] = parse_location(text)
+            text = ""
+        end
+        partial[stream] = text
+        if #items > before and not flush then on_update(false) end
+    end
+
+    job, err = catvim.job.start(cmd, {
+        on_stdout = function(data) collect("stdout", data) end,
+        on_stderr = function(data) collect("stderr", data) end,
+        on_exit = function(code, signal)
+            if self.job ~= job then return end
+            collect("stdout", "", true)
+            collect("stderr", "", true)
+            self.job = nil
+            on_update(true, signal ~= 0 and 128 + signal or code)
+        end,
+    })
+    self.job = job
+    return job ~= nil, err
+end
+
+function Quickfix:path(item)
+    if self.root == "." then return item.path end
+    return self.root .. "/" .. item.path
+end
+
+-- Moves to item n (clamped); returns it, or nil when the list is empty
+function Quickfix:select(n)
+    local count = #self.items
+    if count == 0 then return nil end
+    self.index = math.max(1, math.min(n, count))
+    return self.items[self.index]
+end
+
+function Quickfix:describe()
+    local item = self.items[self.index]
+    local total = #self.items .. (self.job and "+" or "")
+    return "(" .. self.index .. " of " .. total .. ") " .. item.path .. ":" .. item.line .. ": " ..
+        item.text:match("^%s*(.-)%s*$")
+end
+
+return Quickfix
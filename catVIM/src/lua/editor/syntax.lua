@@ -19,145 +19,11 @@ M.styles = {
     constant = { fg = colors.colors.orange }, 
 }
 
--- Language definitions
-M.languages = {}
-
--- Lua syntax
-M.languages.lua = {
-    keywords = {
-        "and", "break", "do", "else", "elseif", "end", "false", "for",
-        "function", "goto", "if", "in", "local", "nil", "not", "or",
-        "repeat", "return", "then", "true", "until", "while"
-    },
-    types = {
-        "string", "number", "boolean", "table", "function", "thread",
-        "userdata", "nil"
-    },
-    patterns = {
-        { pattern = "%-%-.-$", style = "comment" },  -- Single line comment
-        { pattern = "%-%-%[%[.-%]%]", style = "comment" },  -- Multi-line comment
-        { pattern = '".-"', style = "string" },
-        { pattern = "'.-'", style = "string" },
-        { pattern = "%[%[.-%]%]", style = "string" },  -- Long strings
-        { pattern = "0x[%da-fA-F]+", style = "number" },
-        { pattern = "%d+%.?%d*", style = "number" },
-        { pattern = "[%+%-%%%*/%^#=<>~]", style = "operator" },
-        { pattern = "function%s+([%w_]+)", style = "function_name", capture = 1 },
-    },
-}
-
--- C/C++ syntax
-M.languages.c = {
-    keywords = {
-        "auto", "break", "case", "const", "continue", "default", "do",
-        "else", "enum", "extern", "for", "goto", "if", "inline",
-        "register", "restrict", "return", "sizeof", "static", "struct",
-        "switch", "typedef", "union", "volatile", "while",
-        -- C++ extras
-        "alignas", "alignof", "and", "and_eq", "asm", "bitand", "bitor",
-        "catch", "class", "compl", "constexpr", "const_cast", "decltype",
-        "delete", "dynamic_cast", "explicit", "export", "false", "friend",
-        "mutable", "namespace", "new", "noexcept", "not", "not_eq",
-        "nullptr", "operator", "or", "or_eq", "private", "protected",
-        "public", "reinterpret_cast", "static_assert", "static_cast",
-        "template", "this", "throw", "true", "try", "typeid", "typename",
-        "using", "virtual", "xor", "xor_eq", "override", "final"
-    },
-    types = {
-        "void", "char", "short", "int", "long", "float", "double",
-        "signed", "unsigned", "bool", "size_t", "int8_t", "int16_t",
-        "int32_t", "int64_t", "uint8_t", "uint16_t", "uint32_t", "uint64_t",
-        "char16_t", "char32_t", "wchar_t", "string", "vector", "map",
-        "set", "list", "array", "unique_ptr", "shared_ptr"
-    },
-    patterns = {
-        { pattern = "//.-$", style = "comment" },
-        { pattern = "/%*.-%*/", style = "comment" },
-        { pattern = '".-"', style = "string" },
-        { pattern = "'.-'", style = "string" },
-        { pattern = "^%s*#%w+", style = "preprocessor" },
-        { pattern = "0x[%da-fA-F]+[uUlL]*", style = "number" },
-        { pattern = "0b[01]+[uUlL]*", style = "number" },
-        { pattern = "%d+%.?%d*[fFlLuU]*", style = "number" },
-        { pattern = "[%+%-%%%*/%^&|=<>!~]", style = "operator" },
-    },
-}
-M.languages.cpp = M.languages.c
-M.languages.h = M.languages.c
-M.languages.hpp = M.languages.c
-
--- x86/ARM64 Assembly syntax
-M.languages.asm = {
-    keywords = {},  -- Instructions handled separately
-    types = {},
-    instructions_x86 = {
-        -- Data movement
-        "mov", "movzx", "movsx", "lea", "push", "pop", "xchg",
-        -- Arithmetic
-        "add", "sub", "mul", "imul", "div", "idiv", "inc", "dec", "neg",
-        -- Logic
-        "and", "or", "xor", "not", "shl", "shr", "sar", "rol", "ror",
-        -- Compare/test
-        "cmp", "test",
-        -- Jumps
-        "jmp", "je", "jne", "jz", "jnz", "jg", "jge", "jl", "jle",
-        "ja", "jae", "jb", "jbe", "jo", "jno", "js", "jns",
-        -- Call/return
-        "call", "ret", "leave", "enter",
-        -- Stack
-        "pusha", "popa", "pushf", "popf",
-        -- String
-        "rep", "movs", "cmps", "scas", "lods", "stos",
-        -- System
-        "syscall", "sysenter", "int", "iret", "cli", "sti", "hlt", "nop",
-        -- SSE/AVX (common)
-        "movaps", "movups", "addps", "subps", "mulps", "divps",
-    },
-    instructions_arm64 = {
-        -- Data movement
-        "mov", "mvn", "ldr", "str", "ldp", "stp", "adr", "adrp",
-        -- Arithmetic
-        "add", "adds", "sub", "subs", "mul", "madd", "msub", "neg",
-        -- Logic
-        "and", "ands", "orr", "eor", "bic", "lsl", "lsr", "asr", "ror",
-        -- Compare
-        "cmp", "cmn", "tst",
-        -- Branch
-        "b", "bl", "br", "blr", "ret", "cbz", "cbnz", "tbz", "tbnz",
-        "b.eq", "b.ne", "b.lt", "b.le", "b.gt", "b.ge",
-        -- System
-        "svc", "hvc", "smc", "nop", "wfi", "wfe",
-    },
-    registers_x86 = {
-        "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "rsp",
-        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
-        "eax", "ebx", "ecx", "edx", "esi", "edi", "ebp", "esp",
-        "ax", "bx", "cx", "dx", "si", "di", "bp", "sp",
-        "al", "bl", "cl", "dl", "ah", "bh", "ch", "dh",
-        "rip", "eip", "ip", "cs", "ds", "es", "fs", "gs", "ss",
-        "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
-    },
-    registers_arm64 = {
-        "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9",
-        "x10", "x11", "x12", "x13", "x14", "x15", "x16", "x17", "x18",
-        "x19", "x20", "x21", "x22", "x23", "x24", "x25", "x26", "x27",
-        "x28", "x29", "x30", "sp", "lr", "xzr", "wzr",
-        "w0", "w1", "w2", "w3", "w4", "w5", "w6", "w7", "w8", "w9",
-        "v0", "v1", "v2", "v3", "q0", "q1", "q2", "q3",
-    },
-    patterns = {
-        { pattern = "[;#].-$", style = "comment" },  -- Comment
-        { pattern = '".-"', style = "string" },
-        { pattern = "'.-'", style = "string" },
-        { pattern = "0x[%da-fA-F]+", style = "number" },
-        { pattern = "0b[01]+", style = "number" },
-        { pattern = "%$?%d+", style = "number" },
-        { pattern = "^%s*%.%w+", style = "preprocessor" },  -- Directives
-        { pattern = "^%s*[%w_]+:", style = "label" },  -- Labels
-    },
-}
-M.languages.s = M.languages.asm
-M.languages.S = M.languages.asm
+-- Renderer ids for the styles above
+M.ids = {}
+for name, style in pairs(M.styles) do
+    M.ids[name] = catvim.render.style(style)
+end
 
 -- Build keyword lookup tables for fast matching
 local function build_lookup(lang)
@@ -198,14 +64,102 @@ local function build_lookup(lang)
     end
 end
 
-for _, lang in pairs(M.languages) do
-    build_lookup(lang)
+-- Language definitions, by filetype. Each lives in editor/languages and is
+-- loaded, with its lookup sets built, the first time it is asked for.
+M.filetypes = {
+    lua = "lua",
+    c = "c", cpp = "c", h = "c", hpp = "c",
+    asm = "asm", s = "asm", S = "asm",
+}
+M.languages = setmetatable({}, {
+    __index = function(languages, filetype)
+        local name = M.filetypes[filetype]
+        if not name then return nil end
+        local lang = require("editor.languages." .. name)
+        if not lang.keyword_set then build_lookup(lang) end
+        languages[filetype] = lang
+        return lang
+    end,
+})
+
+-- Skips a quoted string starting at `q`; returns the position after it
+local function skip_string(line, q)
+    local quote = line:sub(q, q)
+    local stop = "[\\" .. quote .. "]"
+    local i = q + 1
+    while true do
+        local j = line:find(stop, i)
+        if not j then return #line + 1 end
+        if line:sub(j, j) == quote then return j + 1 end
+        i = j + 2  -- Escaped character
+    end
 end
 
--- Highlight a single line, returns list of {start, len, style}
-function M.highlight_line(line, filetype)
+-- Finds the multi-line constructs (block comments, long strings) in a line.
+-- `state` is the lexer state at the start of the line: false, or the style
+-- and closing delimiter of an unterminated block, e.g. "comment*/".
+-- Returns a list of {start, finish, style} regions and the state at the end
+-- of the line.
+local function scan_blocks(line, lang, state)
+    local regions = {}
+    if not lang.blocks then return regions, false end
+    
+    local pos = 1
+    if state then
+        local style, close = state:match("^([%a_]+)(.*)$")
+        local _, e = line:find(close, 1, true)
+        if not e then
+            regions[1] = { 1, #line, style }
+            return regions, state
+        end
+        regions[1] = { 1, e, style }
+        pos = e + 1
+    end
+    
+    while pos <= #line do
+        local best_s, best_e, best_block, best_level
+        for _, block in ipairs(lang.blocks) do
+            local s, e, level = line:find(block.open, pos)
+            if s and (not best_s or s < best_s) then
+                best_s, best_e, best_block, best_level = s, e, block, level
+            end
+        end
+        if not best_s then break end
+        
+        -- Openers inside a line comment or a string don't count
+        local c = lang.line_comment and line:find(lang.line_comment, pos, true)
+        local q = line:find("[\"']", pos)
+        if c and c < best_s and (not q or c < q) then break end
+        
+        if q and q < best_s then
+            pos = skip_string(line, q)
+        else
+            local close = best_block.close:format(best_level or "")
+            local _, e = line:find(close, best_e + 1, true)
+            if not e then
+                regions[#regions + 1] = { best_s, #line, best_block.style }
+                return regions, best_block.style .. close
+            end
+            regions[#regions + 1] = { best_s, e, best_block.style }
+            pos = e + 1
+        end
+    end
+    return regions, false
+end
+
+-- Lexer state at the end of `line` given the state at its start
+function M.line_state(line, filetype, state)
+    local lang = M.languages[filetype]
+    if not lang then return false end
+    local _, state_out = scan_blocks(line, lang, state or false)
+    return state_out
+end
+
+-- Highlight a single line, returns a list of {start, finish, style} and the
+-- lexer state at the end of the line (see scan_blocks)
+function M.highlight_line(line, filetype, state)
     local lang = M.languages[filetype]
-    if not lang then return {} end
+    if not lang then return {}, false end
     
     local highlights = {}
     local covered = {}  -- Track which positions are already highlighted
@@ -218,6 +172,22 @@ function M.highlight_line(line, filetype)
         end
     end
     
+    -- Block comments and long strings first; blank them out so the
+    -- single-line patterns below never match inside them
+    local regions, state_out = scan_blocks(line, lang, state or false)
+    if #regions > 0 then
+        local parts = {}
+        local prev = 1
+        for _, r in ipairs(regions) do
+            mark(r[1], r[2], r[3])
+            parts[#parts + 1] = line:sub(prev, r[1] - 1)
+            parts[#parts + 1] = string.rep(" ", r[2] - r[1] + 1)
+            prev = r[2] + 1
+        end
+        parts[#parts + 1] = line:sub(prev)
+        line = table.concat(parts)
+    end
+    
     -- Apply pattern-based highlights first
     if lang.patterns then
         for _, pat in ipairs(lang.patterns) do
@@ -257,7 +227,7 @@ function M.highlight_line(line, filetype)
         end
     end
     
-    return highlights
+    return highlights, state_out
 end
 
 -- Get style for a character position
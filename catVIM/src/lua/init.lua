@@ -3,34 +3,72 @@ local Buffer = require("editor.buffer")
 local Cursor = require("editor.cursor")
 local Modes = require("editor.modes")
 local Syntax = require("editor.syntax")
+local Highlighter = require("editor.highlighter")
 local colors = require("ui.colors")
 local icons = require("ui.icons")
 local Button = require("ui.button")
 local StatusLine = require("ui.statusline")
-local Explorer = require("ui.explorer")
 local Cmdline = require("ui.cmdline")
-local Autocomplete = require("editor.autocomplete") 
+local Frame = require("ui.frame")
+local Quickfix = require("editor.quickfix")
+local BufferList = require("editor.buffer_list")
 
 -- Global editor state
 local State = {
     width = 80,
     height = 24,
-    buffer = nil,
+    buffer = nil,       -- The buffer shown, buffers:get().buffer
+    buffers = nil,      -- BufferList of every open file
     cursor = nil,
     scroll_y = 0,
-    explorer = nil,
+    explorer = nil,     -- Explorer, autocomplete popup and :profile overlay:
+    autocomplete = nil, -- their modules are loaded and the objects created
+    profiler = nil,     -- on first use (see State:toggle_explorer)
+    cwd = ".",          -- Explorer root and :grep directory
     statusline = nil,
     cmdline = nil,
     show_line_numbers = true,
+    -- Files this large open in large file mode (see Buffer:load); :set
+    -- largefile=<MB> changes it
+    large_file_threshold = 64 * 1024 * 1024,
+    -- Native memory all buffers may use before the least recently shown
+    -- ones are released; :set buffermem=<MB> changes it
+    buffer_memory_budget = 128 * 1024 * 1024,
     gutter_width = 4,
     mouse_x = 0,
     mouse_y = 0,
+    frame = nil,
+    view = {},        -- What the last tracked frame showed (see track_changes)
+    popup_rect = nil, -- Screen rect the autocomplete popup was last drawn in
+    profiler_rect = nil, -- Same for the :profile overlay
 }
 
+-- Syntax style merged onto a line's base style (keeps bg from cursor line).
+-- Every combination is registered up front; rendering only looks up ids.
+local merged_ids = {}
+for _, base_name in ipairs({ "normal", "cursor_line" }) do
+    local base_style = colors.styles[base_name]
+    local by_syntax = {}
+    for syntax_name, char_style in pairs(Syntax.styles) do
+        by_syntax[syntax_name] = catvim.render.style({
+            fg = char_style.fg or base_style.fg,
+            bg = base_style.bg,
+            bold = char_style.bold,
+            italic = char_style.italic
+        })
+    end
+    merged_ids[base_name] = by_syntax
+end
+
 -- Initialize state
 function State:init()
-    self.buffer = Buffer:new()
-    self.cursor = Cursor:new(self.buffer)
+    self.buffers = BufferList:new({ budget = self.buffer_memory_budget })
+    self.cursor = Cursor:new()
+    self.frame = Frame:new({
+        fps = 60,
+        draw = function(damage) self:render(damage) end
+    })
+    self:show_buffer(self:add_buffer(Buffer:new()))
     
     -- Get terminal size
     local size = catvim.term.size()
@@ -41,26 +79,12 @@ function State:init()
     self.statusline = StatusLine:new()
     self.statusline.on_save = function() self:save() end
     self.statusline.on_open = function() 
-        self.explorer:toggle()
-    end
-    self.statusline.on_quit = function() 
-        if self.buffer.modified then
-            self:show_message("Unsaved changes! Use :q! to quit", "error")
-        else
-            catvim.quit()
-        end
+        self:toggle_explorer()
     end
-    
-    self.explorer = Explorer:new({
-        width = 25,
-        cwd = ".",
-        on_select = function(path)
-            self:open_file(path)
-        end
-    })
+    self.statusline.on_quit = function() self:quit() end
     
     self.cmdline = Cmdline:new()
-    self.autocomplete = Autocomplete:new()
+    self.quickfix = Quickfix:new()
     
     -- Set mode change callback
     Modes.on_change = function(new_mode, old_mode)
@@ -86,27 +110,262 @@ function State:resize()
     
     -- Position UI elements
     local editor_x = 1
-    if self.explorer.visible then
+    if self.explorer and self.explorer.visible then
         self.explorer:set_bounds(1, 1, 25, self.height - 2)
         editor_x = 26
     end
     
     self.statusline:set_pos(self.height, self.width)
     self.cmdline:set_pos(self.height, self.width)
+    self.frame:damage_all()
+end
+
+-- Most sessions never open these, so startup skips loading them
+function State:toggle_explorer()
+    if not self.explorer then
+        self.explorer = require("ui.explorer"):new({
+            width = 25,
+            cwd = self.cwd,
+            on_select = function(path)
+                self:open_file(path)
+            end
+        })
+    end
+    self.explorer:toggle()
+    self:resize()
+end
+
+function State:get_autocomplete()
+    if not self.autocomplete then
+        self.autocomplete = require("editor.autocomplete"):new()
+    end
+    return self.autocomplete
+end
+
+function State:toggle_profiler()
+    if not self.profiler then
+        self.profiler = require("ui.profiler"):new()
+    end
+    self.profiler:toggle()
+end
+
+-- Adds a buffer to the list, with a highlighter and the view shown when
+-- it is switched back to; returns its index
+function State:add_buffer(buffer)
+    local index, item = self.buffers:add(buffer)
+    item.highlighter = Highlighter:new(buffer)
+    item.view = { line = 1, col = 1, target_col = 1, scroll_y = 0 }
+    buffer:on_lines(function(first, removed, added)
+        if buffer ~= self.buffer then return end
+        if removed and removed == added then
+            self:damage_lines(first, first + added - 1)
+        else
+            -- Lines moved: everything below the edit shifts
+            self:damage_lines(first, math.huge)
+        end
+    end)
+    -- Lines indexed in a large file push the cursor and view down with
+    -- the text they were on
+    buffer:on_index(function(line, added)
+        local view = buffer == self.buffer and self.cursor or item.view
+        if view.line > line then
+            view.line = view.line + added - 1
+        end
+        local scroll = buffer == self.buffer and self or item.view
+        if scroll.scroll_y >= line then
+            scroll.scroll_y = scroll.scroll_y + added - 1
+        end
+    end)
+    return index
+end
+
+-- Shows buffer `index`, where its cursor and scroll position were left
+function State:show_buffer(index)
+    local buffers = self.buffers
+    local old = buffers:get()
+    if old then
+        local cursor = self.cursor
+        old.view = { line = cursor.line, col = cursor.col, target_col = cursor.target_col, scroll_y = self.scroll_y }
+    end
+    
+    -- A released buffer maps its file again
+    local item = buffers:get(index)
+    local ok, result = item.buffer:reload()
+    if not ok then
+        self:show_message("Error: " .. (result or "Unknown error"), "error")
+    elseif result then
+        self:show_message(item.buffer.name .. " changed on disk; reloaded without undo history", "warning")
+    end
+    buffers:select(index)
+    self.buffer = item.buffer
+    self.highlighter = item.highlighter
+    local view = item.view
+    self.cursor.line, self.cursor.col, self.cursor.target_col = view.line, view.col, view.target_col
+    self.cursor:set_buffer(self.buffer)
+    self.scroll_y = view.scroll_y
+    
+    -- The search query was compiled against the other buffer's text; n
+    -- compiles the pattern again
+    Modes.cancel_search()
+    Modes.search.query = nil
+    self.frame:damage_all()
+    
+    self:enforce_buffer_budget()
 end
 
+function State:enforce_buffer_budget()
+    self.buffers:enforce(function(released)
+        if released.buffer:unloaded() then released.highlighter:reset() end
+    end)
+end
+
+-- :e <path>: switches to the file's buffer if it has one, else loads it
+-- into a new buffer (or over an untouched [No Name] one)
 function State:open_file(path)
-    local ok, err = self.buffer:load(path)
+    local index = self.buffers:find(path)
+    if index then
+        self:switch_buffer(index)
+        return true
+    end
+    
+    local buffer = self.buffer
+    if buffer.filepath or buffer.modified then buffer = Buffer:new() end
+    local ok, err = buffer:load(path, self.large_file_threshold)
+    if not ok then
+        self:show_message("Error: " .. (err or "Unknown error"), "error")
+        return false
+    end
+    if buffer == self.buffer then
+        self.cursor:file_start()
+        self.scroll_y = 0
+    else
+        self:show_buffer(self:add_buffer(buffer))
+    end
+    self:show_message((buffer.large and "Opened (large file mode): " or "Opened: ") .. path, "info")
+    return true
+end
+
+-- :e with no path: reads the current file again
+function State:reload_file()
+    local buffer = self.buffer
+    if not buffer.filepath then
+        self:show_message("No file to reload", "warning")
+        return
+    end
+    local ok, err = buffer:load(buffer.filepath, self.large_file_threshold)
     if ok then
-        self.cursor:set_buffer(self.buffer)
         self.cursor:file_start()
         self.scroll_y = 0
-        self:show_message("Opened: " .. path, "info")
+        self:show_message("Reloaded: " .. buffer.filepath, "info")
     else
         self:show_message("Error: " .. (err or "Unknown error"), "error")
     end
 end
 
+-- :b N, and :bn/:bp with wrap = true
+function State:switch_buffer(index, wrap)
+    local count = #self.buffers.items
+    if wrap then
+        index = (index - 1) % count + 1
+    elseif not self.buffers:get(index) then
+        self:show_message("No buffer " .. index, "error")
+        return
+    end
+    -- Before show_buffer(), which may have something to say about reloading
+    self:show_message("Buffer " .. index .. ": " .. self.buffers:get(index).buffer.name, "info")
+    if index ~= self.buffers.current then self:show_buffer(index) end
+end
+
+function State:list_buffers()
+    local buffers = self.buffers
+    self:show_message(string.format("%s  [%.1f of %d MB]", buffers:describe(),
+        buffers:memory() / (1024 * 1024), math.floor(buffers.budget / (1024 * 1024))), "info")
+end
+
+function State:set_buffer_budget(mb)
+    self.buffers.budget = mb * 1024 * 1024
+    self:enforce_buffer_budget()
+    self:show_message("Buffer memory budget " .. mb .. " MB", "info")
+end
+
+-- :q refuses while any buffer has unsaved changes
+function State:quit()
+    local index = self.buffers:modified()
+    if index then
+        local name = self.buffers:get(index).buffer.name
+        self:show_message("Unsaved changes in " .. name .. "! Use :q! to quit", "error")
+    else
+        catvim.quit()
+    end
+end
+
+-- :grep <pattern> over the working directory; takes the same \v and \c
+-- flags as / search
+function State:grep(input)
+    local pattern, opts = Modes.parse_pattern(input)
+    local qf = self.quickfix
+    local ok, err = qf:grep(self.cwd, pattern, opts, function(done)
+        local count = #qf.items
+        if done then
+            self:show_message("grep: " .. count .. " match" .. (count == 1 and "" or "es") .. " for " .. pattern,
+                count > 0 and "info" or "warning")
+        elseif qf.index == 0 then
+            self:show_message("grep: " .. count .. " matches so far, :cn to jump", "info")
+        end
+    end)
+    if not ok then
+        self:show_message("grep: " .. err, "error")
+    end
+end
+
+-- :make [args] runs make as a background job; the file:line: locations
+-- it prints go to the quickfix list while it runs
+function State:make(args)
+    local cmd = args ~= "" and "make " .. args or "make"
+    local qf = self.quickfix
+    local ok, err = qf:make(cmd, function(done, code)
+        local count = #qf.items
+        if done then
+            local status = code == 0 and "done" or "failed (exit " .. code .. ")"
+            self:show_message(cmd .. ": " .. status .. ", " .. count .. " location" .. (count == 1 and "" or "s"),
+                code == 0 and "info" or "error")
+        elseif qf.index == 0 then
+            self:show_message(cmd .. ": " .. count .. " locations so far, :cn to jump", "info")
+        end
+    end)
+    if ok then
+        self:show_message(cmd .. ": running", "info")
+    else
+        self:show_message(cmd .. ": " .. err, "error")
+    end
+end
+
+-- :profile dump [path] writes the recorded frames as a Chrome trace
+function State:profile_dump(path)
+    if path == "" then path = "catvim-trace.json" end
+    local ok, err = catvim.profile.dump(path)
+    if ok then
+        self:show_message("Trace written: " .. path, "info")
+    else
+        self:show_message("profile: " .. err, "error")
+    end
+end
+
+-- Jumps to quickfix item n (:cn, :cp, :cc)
+function State:quickfix_jump(n)
+    local qf = self.quickfix
+    local item = qf:select(n)
+    if not item then
+        self:show_message(qf:running() and qf.kind .. ": no locations yet" or "Quickfix list is empty", "warning")
+        return
+    end
+    
+    local path = qf:path(item)
+    if path ~= self.buffer.filepath and not self:open_file(path) then return end
+    self.cursor:move_to(item.line, item.col)
+    self:show_message(qf:describe(), "info")
+end
+
 function State:save()
     if not self.buffer.filepath then
         self:show_message("No filename. Use :w <filename>", "warning")
@@ -131,7 +390,7 @@ function State:editor_bounds()
     local w = self.width - self.gutter_width
     local h = self.height - 2  -- Leave room for statusline and toolbar
     
-    if self.explorer.visible then
+    if self.explorer and self.explorer.visible then
         x = x + self.explorer.width
         w = w - self.explorer.width
     end
@@ -139,140 +398,269 @@ function State:editor_bounds()
     return x, y, w, h
 end
 
-function State:render()
-    catvim.render.clear()
-    
-    local editor_x, editor_y, editor_w, editor_h = self:editor_bounds()
-    local gutter_x = editor_x - self.gutter_width
-    
-    -- Ensure cursor is visible
+-- Marks the screen rows showing buffer lines first..last (clipped to the view)
+function State:damage_lines(first, last)
+    local _, editor_y, _, editor_h = self:editor_bounds()
+    local top = math.max(first - self.scroll_y, 1)
+    local bottom = math.min((last or first) - self.scroll_y, editor_h)
+    if top <= bottom then
+        self.frame:damage_rows(editor_y + top - 1, editor_y + bottom - 1)
+    end
+end
+
+function State:scroll_to_cursor()
+    local _, _, _, editor_h = self:editor_bounds()
     if self.cursor.line < self.scroll_y + 1 then
         self.scroll_y = self.cursor.line - 1
     elseif self.cursor.line > self.scroll_y + editor_h then
         self.scroll_y = self.cursor.line - editor_h
     end
+end
+
+-- Compares the editor state against the last check and records what has to
+-- be repainted. Buffer edits are reported separately by the buffer listener.
+function State:track_changes()
+    local frame = self.frame
+    local view = self.view
+    -- Wide enough for the highest line number, and at least "999 "
+    self.gutter_width = math.max(4, #tostring(self.buffer:line_count()) + 1)
+    self:scroll_to_cursor()
     
-    -- Render editor lines
-    for i = 1, editor_h do
-        local line_num = self.scroll_y + i
-        local y = editor_y + i - 1
-        
-        -- Gutter (line numbers)
-        if self.show_line_numbers then
-            local num_style = colors.styles.line_number
-            if line_num == self.cursor.line then
-                num_style = colors.styles.line_number_current
-            end
-            
-            local num_str
-            if line_num <= self.buffer:line_count() then
-                num_str = string.format("%3d ", line_num)
-            else
-                num_str = "  ~ "
-            end
-            catvim.render.string(gutter_x, y, num_str, num_style)
-        end
-        
-        -- Line content
-        if line_num <= self.buffer:line_count() then
-            local line = self.buffer:get_line(line_num)
-            local base_style = colors.styles.normal
-            
-            -- Highlight cursor line background
-            if line_num == self.cursor.line then
-                base_style = colors.styles.cursor_line
-            end
-            
-            -- Get syntax highlights for this line
-            local highlights = Syntax.highlight_line(line, self.buffer.filetype)
-            
-            -- Render line character by character with syntax highlighting
-            local display_line = line:sub(1, editor_w)
-            for col = 1, #display_line do
-                local char = display_line:sub(col, col)
-                local char_style = Syntax.get_style(highlights, col)
-                
-                if char_style then
-                    -- Merge syntax style with base style (keep bg from cursor line)
-                    local merged = {
-                        fg = char_style.fg or base_style.fg,
-                        bg = base_style.bg,
-                        bold = char_style.bold,
-                        italic = char_style.italic
-                    }
-                    catvim.render.set(editor_x + col - 1, y, char, merged)
-                else
-                    catvim.render.set(editor_x + col - 1, y, char, base_style)
-                end
-            end
-            
-            -- Fill rest of line
-            local fill = editor_w - #display_line
-            if fill > 0 then
-                catvim.render.string(editor_x + #display_line, y, string.rep(" ", fill), base_style)
-            end
-            
-            -- Render cursor
-            if line_num == self.cursor.line then
-                local cursor_x = editor_x + self.cursor.col - 1
-                local cursor_char = line:sub(self.cursor.col, self.cursor.col)
-                if cursor_char == "" then cursor_char = " " end
-                
-                local cursor_style = { 
-                    fg = colors.colors.bg, 
-                    bg = colors.colors.cursor,
-                    bold = true 
-                }
-                if Modes.current == "insert" then
-                    cursor_style.bg = colors.colors.green
-                end
-                
-                catvim.render.string(cursor_x, y, cursor_char, cursor_style)
-            end
-        else
-            -- Empty line indicator
-            catvim.render.string(editor_x, y, string.rep(" ", editor_w), colors.styles.normal)
-        end
+    local editor_x, _, editor_w, editor_h = self:editor_bounds()
+    if view.width ~= self.width or view.height ~= self.height
+       or view.editor_x ~= editor_x or view.editor_w ~= editor_w
+       or view.scroll_y ~= self.scroll_y then
+        frame:damage_all()
     end
+    view.width, view.height = self.width, self.height
+    view.editor_x, view.editor_w = editor_x, editor_w
+    view.scroll_y = self.scroll_y
     
-    -- Render explorer
-    self.explorer:render()
-    
-    -- Toolbar row (above status line)
-    local toolbar_y = self.height - 1
-    catvim.render.string(1, toolbar_y, string.rep(" ", self.width), { bg = colors.colors.bg_light })
+    -- Cursor: the row it left and the row it is on
+    local cursor = self.cursor
+    if view.cursor_line ~= cursor.line or view.cursor_col ~= cursor.col or view.mode ~= Modes.current then
+        if view.cursor_line then self:damage_lines(view.cursor_line) end
+        self:damage_lines(cursor.line)
+    end
+    view.cursor_line, view.cursor_col, view.mode = cursor.line, cursor.col, Modes.current
     
-    -- Toolbar hint text
-    local hint = " Press <Space>e for explorer | <Space>f for files | :w to save | :q to quit "
-    catvim.render.string(1, toolbar_y, hint, { fg = colors.colors.fg_dim, bg = colors.colors.bg_light })
+    -- A new search pattern changes which matches are highlighted
+    if view.query ~= Modes.search.query then
+        self:damage_lines(1, math.huge)
+    end
+    view.query = Modes.search.query
     
-    -- Render buttons
-    Button.render_all()
+    -- Lines whose highlighting changed because of an edit further up
+    local last_line = math.min(self.scroll_y + editor_h, self.buffer:line_count())
+    if last_line >= 1 then
+        self.highlighter:sync(last_line)
+    end
+    local first, last = self.highlighter:take_restyled()
+    if first then self:damage_lines(first, last) end
     
-    -- Update and render status line
-    self.statusline:update({
+    -- Status line and the command line drawn over it
+    local _, indexed = self.buffer:pending_line()
+    local status_changed = self.statusline:update({
+        indexing = indexed and math.floor(indexed * 100),
         mode = Modes.current,
         filename = self.buffer.name,
         modified = self.buffer.modified,
-        line = self.cursor.line,
-        col = self.cursor.col,
+        line = cursor.line,
+        col = cursor.col,
         total_lines = self.buffer:line_count(),
         filetype = self.buffer.filetype,
     })
-    self.statusline:render()
+    local handler = Modes.handlers[Modes.current]
+    local cmd = (Modes.current == "command" or Modes.current == "search") and handler.input or false
+    if status_changed or view.cmd ~= cmd then
+        frame:damage("statusline")
+    end
+    view.cmd = cmd
+    
+    if Button.take_changes() then
+        frame:damage("toolbar")
+    end
+    
+    local explorer = self.explorer
+    local explorer_key = explorer and explorer.visible and (explorer.selected .. ":" .. explorer.scroll .. ":" .. explorer.version)
+    if view.explorer ~= explorer_key then
+        frame:damage("explorer")
+    end
+    view.explorer = explorer_key
+    
+    -- Autocomplete popup: repaint the rows it covered when it moves or closes
+    local ac = self.autocomplete
+    local popup_key = ac and ac.visible and cursor.line == ac.base_y
+        and (ac.selection .. ":" .. tostring(ac.candidates) .. ":" .. ac.base_x .. ":" .. ac.base_y)
+    if view.popup ~= popup_key then
+        local rect = self.popup_rect
+        if rect then frame:damage_rows(rect.y, rect.y + rect.h - 1) end
+        frame:damage("popup")
+    end
+    view.popup = popup_key
+    
+    -- Profiler overlay: clear the rows it covered once it closes
+    local profiler = self.profiler
+    local profiler_key = profiler and profiler.visible and profiler.version
+    if view.profiler ~= profiler_key then
+        local rect = self.profiler_rect
+        if rect and not profiler_key then
+            frame:damage_rows(rect.y, rect.y + rect.h - 1)
+            frame:damage("explorer")  -- On narrow screens it reaches over it
+        end
+        frame:damage("profiler")
+    end
+    view.profiler = profiler_key
+end
+
+function State:render_row(y, editor_x, editor_y, editor_w)
+    local line_num = self.scroll_y + (y - editor_y + 1)
+    local gutter_x = editor_x - self.gutter_width
+    
+    local pending, indexed = self.buffer:pending_line()
+    
+    -- Gutter (line numbers)
+    if self.show_line_numbers then
+        local num_style = colors.ids.line_number
+        if line_num == self.cursor.line then
+            num_style = colors.ids.line_number_current
+        end
+        
+        local digits = self.gutter_width - 1
+        local num_str
+        if line_num > self.buffer:line_count() then
+            num_str = string.format("%" .. digits .. "s ", "~")
+        elseif pending and line_num >= pending then
+            -- Below the part of a large file not indexed yet: the numbers
+            -- aren't known
+            num_str = string.format("%" .. digits .. "s ", "?")
+        else
+            num_str = string.format("%" .. digits .. "d ", line_num)
+        end
+        catvim.render.string(gutter_x, y, num_str, num_style)
+    end
+    
+    -- Line content
+    if line_num == pending then
+        local text = string.format(" ... indexing, %d%% of the file read ...", math.floor(indexed * 100))
+        local style = line_num == self.cursor.line and colors.ids.cursor_line or colors.ids.line_number
+        local width = catvim.render.string(editor_x, y, text:sub(1, editor_w), style)
+        if width < editor_w then
+            catvim.render.string(editor_x + width, y, string.rep(" ", editor_w - width), style)
+        end
+    elseif line_num <= self.buffer:line_count() then
+        local line = self.buffer:get_line(line_num)
+        local base_name = "normal"
+        
+        -- Highlight cursor line background
+        if line_num == self.cursor.line then
+            base_name = "cursor_line"
+        end
+        local syntax_ids = merged_ids[base_name]
+        
+        -- Get syntax highlights for this line
+        local highlights = self.highlighter:highlights(line_num)
+        
+        -- One span covering the row, then syntax spans on top. The first
+        -- highlight covering a column wins, so paint them in reverse.
+        -- Spans are byte offsets; render.line maps them to columns.
+        local spans = { 1, #line + editor_w, colors.ids[base_name] }
+        for h = #highlights, 1, -1 do
+            local hl = highlights[h]
+            spans[#spans + 1] = hl.start
+            spans[#spans + 1] = hl.finish - hl.start + 1
+            spans[#spans + 1] = syntax_ids[hl.style] or colors.ids[base_name]
+        end
+        
+        -- Search matches
+        local query = Modes.search.query
+        if query then
+            local matches = query:line_matches(line_num)
+            for i = 1, #matches, 2 do
+                if matches[i + 1] > 0 then
+                    spans[#spans + 1] = matches[i]
+                    spans[#spans + 1] = matches[i + 1]
+                    spans[#spans + 1] = colors.ids.search_match
+                end
+            end
+        end
+        
+        -- Render cursor
+        if line_num == self.cursor.line then
+            spans[#spans + 1] = self.cursor.col
+            spans[#spans + 1] = 1
+            spans[#spans + 1] = Modes.current == "insert" and colors.ids.cursor_insert or colors.ids.cursor
+        end
+        
+        catvim.render.line(editor_x, y, line, spans, editor_w)
+    else
+        -- Empty line indicator
+        catvim.render.string(editor_x, y, string.rep(" ", editor_w), colors.ids.normal)
+    end
+end
+
+-- Paints the damaged parts of the screen (see ui/frame.lua)
+function State:render(damage)
+    catvim.profile.render_begin()
+    local full = damage.full
+    local rows = damage.rows
+    local regions = damage.regions
+    if full then
+        catvim.render.clear()
+    end
+    
+    local editor_x, editor_y, editor_w, editor_h = self:editor_bounds()
+    for y = editor_y, editor_y + editor_h - 1 do
+        if full or rows[y] then
+            self:render_row(y, editor_x, editor_y, editor_w)
+        end
+    end
+    
+    if self.explorer and (full or regions.explorer) then
+        self.explorer:render()
+    end
+    
+    -- Toolbar row (above status line)
+    local toolbar_y = self.height - 1
+    if full or regions.toolbar or rows[toolbar_y] then
+        catvim.render.string(1, toolbar_y, string.rep(" ", self.width), colors.ids.toolbar)
+        
+        -- Toolbar hint text
+        local hint = " Press <Space>e for explorer | <Space>f for files | :w to save | :q to quit "
+        catvim.render.string(1, toolbar_y, hint, colors.ids.toolbar_hint)
+        
+        -- Render buttons
+        Button.render_all()
+    end
     
-    -- Command/Search line
-    if Modes.current == "command" then
-        self.cmdline:set_input(Modes.handlers.command.input)
-        self.cmdline:render()
-    elseif Modes.current == "search" then
-        self.cmdline:set_input(Modes.handlers.search.input)
-        self.cmdline:render()
+    -- Status line, with the command/search line drawn over it
+    if full or regions.statusline or rows[self.height] then
+        self.statusline:render()
+        
+        if Modes.current == "command" then
+            self.cmdline:set_input(Modes.handlers.command.input)
+            self.cmdline:render()
+        elseif Modes.current == "search" then
+            self.cmdline:set_input(Modes.handlers.search.input)
+            self.cmdline:render()
+        end
     end
     
-    -- Render autocomplete popup (on top)
+    -- Render autocomplete popup (on top). It is small, so it is simply
+    -- redrawn every frame in case a row under it was repainted.
+    self.popup_rect = nil
     if self.autocomplete then
         self.autocomplete:render(self)
+        if self.autocomplete.visible then
+            self.popup_rect = self.autocomplete.rect
+        end
+    end
+    
+    -- Profiler overlay, over everything else and likewise redrawn each frame
+    self.profiler_rect = nil
+    if self.profiler and self.profiler.visible then
+        self.profiler:render(self)
+        self.profiler_rect = self.profiler.rect
     end
     
     catvim.render.flush()
@@ -298,7 +686,7 @@ function State:handle_event(event)
         end
         
         -- Explorer click
-        if self.explorer:handle_click(event.x, event.y, event.action) then
+        if self.explorer and self.explorer:handle_click(event.x, event.y, event.action) then
             return
         end
         
@@ -312,7 +700,7 @@ function State:handle_event(event)
                 local click_col = event.x - editor_x + 1
                 
                 click_line = math.min(click_line, self.buffer:line_count())
-                self.cursor:move_to(click_line, click_col)
+                self.cursor:move_to_column(click_line, click_col)
             end
         end
         
@@ -329,6 +717,12 @@ function State:handle_event(event)
         return
     end
     
+    -- Bracketed paste: one edit for the whole text
+    if event.type == "paste" then
+        Modes.paste(event.text, self)
+        return
+    end
+    
     -- Handle keyboard events
     if event.type == "key" then
         -- Space-prefixed shortcuts (leader key)
@@ -338,14 +732,13 @@ function State:handle_event(event)
         end
         
         -- Explorer keyboard (if focused)
-        if self.explorer.visible and self.explorer:handle_key(event) then
+        if self.explorer and self.explorer.visible and self.explorer:handle_key(event) then
             return
         end
         
         -- Toggle explorer with Space+e in normal mode
         if Modes.current == "normal" and event.char == "e" and event.ctrl then
-            self.explorer:toggle()
-            self:resize()
+            self:toggle_explorer()
             return
         end
         
@@ -363,7 +756,7 @@ function init()
         State:open_file(arg[1])
     else
         -- Default welcome message
-        State.buffer.lines = {
+        State.buffer:set_lines({
             "",
             "  Welcome to catVIM!",
             "",
@@ -389,18 +782,32 @@ function init()
             "    :e <path>  Open file",
             "    Ctrl+E     Toggle file explorer",
             "",
-        }
+        })
         State.buffer.name = "[Welcome]"
     end
     
-    State:render()
+    State:track_changes()
+    State.frame:schedule()
 end
 
-function update()
-    local event = catvim.term.read()
-    
-    if event then
+-- Everything that arrived since the last wakeup
+function on_input(events)
+    for _, event in ipairs(events) do
         State:handle_event(event)
-        State:render()
     end
 end
+
+-- Terminal resized (SIGWINCH)
+function on_resize(width, height)
+    State:resize()
+end
+
+-- Called after every batch of loop callbacks: collect damage and draw it
+-- (at most once per batch, and no faster than the frame cap)
+function update()
+    State:track_changes()
+    State.frame:schedule()
+end
+
+-- For tools that drive the editor from Lua (bench/bench.lua)
+return State
@@ -28,9 +28,10 @@ function Button:new(opts)
     self.width = opts.width or (#self.text + 2)
     self.height = opts.height or 1
     self.on_click = opts.on_click or function() end
-    self.style = opts.style or colors.styles.button
-    self.style_hover = opts.style_hover or colors.styles.button_hover
-    self.style_active = opts.style_active or colors.styles.button_active
+    -- Styles may be given as ids or tables; both are resolved to ids here
+    self.style = catvim.render.style(opts.style or colors.ids.button)
+    self.style_hover = catvim.render.style(opts.style_hover or colors.ids.button_hover)
+    self.style_active = catvim.render.style(opts.style_active or colors.ids.button_active)
     self.visible = true
     self.hovered = false
     self.pressed = false
@@ -116,6 +117,19 @@ function Button.update_hover(x, y)
     end
 end
 
+-- True if any button's hover/press state changed since the last call
+function Button.take_changes()
+    local changed = false
+    for _, btn in ipairs(buttons) do
+        local look = btn.pressed and "pressed" or (btn.hovered and "hovered" or "normal")
+        if btn.drawn_look ~= look then
+            btn.drawn_look = look
+            changed = true
+        end
+    end
+    return changed
+end
+
 function Button.render_all()
     for _, btn in ipairs(buttons) do
         btn:render()
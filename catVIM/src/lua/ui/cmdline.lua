@@ -37,11 +37,10 @@ end
 function Cmdline:render()
     if not self.visible then return end
     
-    local style = { fg = colors.colors.fg, bg = colors.colors.bg }
     local line = self.prefix .. self.input .. "_"
-    line = line .. string.rep(" ", self.width - #line)
+    line = line .. string.rep(" ", self.width - catvim.utf8.width(line))
     
-    catvim.render.string(1, self.y, line, style)
+    catvim.render.string(1, self.y, line, colors.ids.cmdline)
 end
 
 return Cmdline
@@ -49,6 +49,14 @@ M.styles = {
     -- Status line
     statusline = { fg = M.colors.fg, bg = M.colors.bg_dark },
     statusline_mode = { fg = M.colors.bg, bg = M.colors.blue, bold = true },
+    statusline_modified = { fg = M.colors.yellow, bg = M.colors.bg_dark },
+    mode_normal = { fg = M.colors.bg, bg = M.colors.blue, bold = true },
+    mode_insert = { fg = M.colors.bg, bg = M.colors.green, bold = true },
+    mode_visual = { fg = M.colors.bg, bg = M.colors.purple, bold = true },
+    mode_command = { fg = M.colors.bg, bg = M.colors.orange, bold = true },
+    message_error = { fg = M.colors.error, bg = M.colors.bg_dark, bold = true },
+    message_warning = { fg = M.colors.warning, bg = M.colors.bg_dark },
+    message_info = { fg = M.colors.info, bg = M.colors.bg_dark },
     
     -- Tabs
     tab = { fg = M.colors.fg_dim, bg = M.colors.bg_dark },
@@ -61,15 +69,19 @@ M.styles = {
     button_primary = { fg = M.colors.bg, bg = M.colors.blue, bold = true },
     
     -- Explorer
+    explorer_title = { fg = M.colors.blue, bg = M.colors.bg_dark, bold = true },
     explorer_file = { fg = M.colors.fg },
     explorer_dir = { fg = M.colors.blue, bold = true },
     explorer_selected = { fg = M.colors.fg, bg = M.colors.selection },
     
     -- Editor
+    cursor = { fg = M.colors.bg, bg = M.colors.cursor, bold = true },
+    cursor_insert = { fg = M.colors.bg, bg = M.colors.green, bold = true },
     line_number = { fg = M.colors.fg_dark },
     line_number_current = { fg = M.colors.yellow },
     cursor_line = { bg = M.colors.cursorline },
     selection = { bg = M.colors.selection },
+    search_match = { fg = M.colors.bg, bg = M.colors.yellow },
     
     -- Messages
     error = { fg = M.colors.error, bold = true },
@@ -79,6 +91,18 @@ M.styles = {
     -- Popup / Autocomplete
     popup = { fg = M.colors.fg, bg = M.colors.bg_light },
     popup_selected = { fg = M.colors.bg, bg = M.colors.blue, bold = true },
+    
+    -- Command line / toolbar
+    cmdline = { fg = M.colors.fg, bg = M.colors.bg },
+    toolbar = { bg = M.colors.bg_light },
+    toolbar_hint = { fg = M.colors.fg_dim, bg = M.colors.bg_light },
 }
 
+-- Renderer style ids, registered once so drawing passes an integer instead
+-- of a table. Use these with catvim.render.*; M.styles stays for composing.
+M.ids = {}
+for name, style in pairs(M.styles) do
+    M.ids[name] = catvim.render.style(style)
+end
+
 return M
@@ -13,12 +13,14 @@ function Explorer:new(opts)
     self.width = opts.width or 25
     self.height = 20
     self.visible = opts.visible or false
-    self.entries = {}
+    self.tree = nil     -- catvim.fs.tree, created when first shown
+    self.count = 0      -- Visible entries
+    self.version = 0    -- Bumped when the entries change
     self.selected = 1
+    self.selected_path = nil
     self.scroll = 0
     self.cwd = opts.cwd or "."
     self.on_select = opts.on_select or function() end
-    self.expanded = {}  -- Track expanded directories
     
     return self
 end
@@ -37,52 +39,44 @@ function Explorer:set_bounds(x, y, width, height)
     self.height = height
 end
 
+-- The tree is read and sorted in the background and follows changes on
+-- disk by itself, so this only has to create it
 function Explorer:refresh()
-    self.entries = {}
-    self:load_dir(self.cwd, 0)
+    if self.tree then return end
+    local tree, err = catvim.fs.tree(self.cwd, function() self:entries_changed() end)
+    if not tree then
+        self.error = err
+        return
+    end
+    self.tree = tree
+    self:entries_changed()
 end
 
-function Explorer:load_dir(path, depth)
-    local items = catvim.fs.list(path)
-    if not items then return end
-    
-    -- Sort: directories first, then alphabetically
-    table.sort(items, function(a, b)
-        if a.isdir ~= b.isdir then
-            return a.isdir
-        end
-        return a.name < b.name
-    end)
-    
-    for _, item in ipairs(items) do
-        if item.name ~= ".." then
-            local full_path = path .. "/" .. item.name
-            table.insert(self.entries, {
-                name = item.name,
-                path = full_path,
-                isdir = item.isdir,
-                depth = depth,
-                expanded = self.expanded[full_path] or false
-            })
-            
-            -- Load subdirectory if expanded
-            if item.isdir and self.expanded[full_path] then
-                self:load_dir(full_path, depth + 1)
-            end
-        end
-    end
+-- Keeps the selection on the same path when entries come and go above it
+function Explorer:entries_changed()
+    self.count = self.tree:count()
+    self.version = self.version + 1
+    local idx = self.selected_path and self.tree:find(self.selected_path)
+    self.selected = idx or math.max(1, math.min(self.count, self.selected))
+    self:move_selection(0)
+end
+
+function Explorer:entry(idx)
+    if not self.tree or idx < 1 or idx > self.count then return nil end
+    return self.tree:rows(idx, 1)[1]
 end
 
 function Explorer:select_entry(idx)
-    if idx < 1 or idx > #self.entries then return end
+    local entry = self:entry(idx)
+    if not entry then return end
     
-    local entry = self.entries[idx]
     self.selected = idx
+    self.selected_path = entry.path
     
     if entry.isdir then
         -- Toggle expand
-        self.expanded[entry.path] = not self.expanded[entry.path]
-        self:refresh()
+        self.tree:expand(entry.path, not entry.expanded)
+        self:entries_changed()
     else
         -- Open file
         self.on_select(entry.path)
@@ -90,14 +84,16 @@ function Explorer:select_entry(idx)
 end
 
 function Explorer:move_selection(delta)
-    self.selected = math.max(1, math.min(#self.entries, self.selected + delta))
+    self.selected = math.max(1, math.min(self.count, self.selected + delta))
+    local entry = self:entry(self.selected)
+    self.selected_path = entry and entry.path
     
     -- Scroll if needed
     local visible_start = self.scroll + 1
     local visible_end = self.scroll + self.height - 2
     
     if self.selected < visible_start then
-        self.scroll = self.selected - 1
+        self.scroll = math.max(0, self.selected - 1)
     elseif self.selected > visible_end then
         self.scroll = self.selected - (self.height - 2)
     end
@@ -111,7 +107,7 @@ function Explorer:handle_click(x, y, action)
     if y < self.y + 1 or y >= self.y + self.height - 1 then return false end
     
     local idx = (y - self.y - 1) + self.scroll + 1
-    if idx >= 1 and idx <= #self.entries then
+    if idx >= 1 and idx <= self.count then
         self:select_entry(idx)
         return true
     end
@@ -135,10 +131,10 @@ function Explorer:handle_key(event)
         return true
     elseif char == "h" then
         -- Collapse directory or go to parent
-        local entry = self.entries[self.selected]
-        if entry and entry.isdir and self.expanded[entry.path] then
-            self.expanded[entry.path] = false
-            self:refresh()
+        local entry = self:entry(self.selected)
+        if entry and entry.isdir and entry.expanded then
+            self.tree:expand(entry.path, false)
+            self:entries_changed()
         end
         return true
     elseif char == "q" or key == 27 then  -- q or Escape
@@ -154,7 +150,7 @@ function Explorer:render()
     
     -- Background
     for y = self.y, self.y + self.height - 1 do
-        catvim.render.string(self.x, y, string.rep(" ", self.width), colors.styles.statusline)
+        catvim.render.string(self.x, y, string.rep(" ", self.width), colors.ids.statusline)
     end
     
     -- Border
@@ -162,19 +158,25 @@ function Explorer:render()
     
     -- Title
     local title = " Explorer "
-    catvim.render.string(self.x + 2, self.y, title, { fg = colors.colors.blue, bg = colors.colors.bg_dark, bold = true })
+    catvim.render.string(self.x + 2, self.y, title, colors.ids.explorer_title)
+    
+    if self.error then
+        catvim.render.string(self.x + 1, self.y + 1, self.error:sub(1, self.width - 2), colors.ids.explorer_file)
+    end
+    if not self.tree then return end
     
-    -- Entries
+    -- Entries: only the rows on screen are fetched
     local visible_rows = self.height - 2
+    local rows = self.tree:rows(self.scroll + 1, visible_rows)
     for i = 1, visible_rows do
         local entry_idx = self.scroll + i
-        local entry = self.entries[entry_idx]
+        local entry = rows[i]
         if not entry then break end
         
         local y = self.y + i
         local indent = string.rep("  ", entry.depth)
-        local icon = entry.isdir and (self.expanded[entry.path] and icons.folder_open or icons.folder) or icons.file
-        local name = entry.name
+        local icon = entry.isdir and (entry.expanded and icons.folder_open or icons.folder) or icons.file
+        local name = entry.loading and entry.name .. " ..." or entry.name
         
         local max_name_len = self.width - #indent - 4
         if #name > max_name_len then
@@ -184,9 +186,9 @@ function Explorer:render()
         local text = indent .. icon .. " " .. name
         text = text .. string.rep(" ", self.width - #text - 1)
         
-        local style = entry.isdir and colors.styles.explorer_dir or colors.styles.explorer_file
+        local style = entry.isdir and colors.ids.explorer_dir or colors.ids.explorer_file
         if entry_idx == self.selected then
-            style = colors.styles.explorer_selected
+            style = colors.ids.explorer_selected
         end
         
         catvim.render.string(self.x + 1, y, text, style)
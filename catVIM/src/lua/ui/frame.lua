@@ -0,0 +1,68 @@
+-- catVIM Frame - Damage tracking and frame scheduling
+--
+-- Collects what needs repainting (screen rows and named regions such as
+-- "statusline", "toolbar", "explorer", "popup") and draws it in one frame.
+-- Frames are capped at `fps`: damage that arrives sooner waits on a timer
+-- and is merged into the next frame.
+local Frame = {}
+Frame.__index = Frame
+
+function Frame:new(opts)
+    local self = setmetatable({}, Frame)
+    self.fps = opts.fps or 60
+    self.draw = opts.draw  -- function(damage) that paints the damaged parts
+    self.last_frame = nil
+    self.timer = nil
+    self:reset()
+    self.full = true
+    return self
+end
+
+function Frame:reset()
+    self.full = false
+    self.rows = {}     -- rows[y] = true
+    self.regions = {}  -- regions[name] = true
+end
+
+function Frame:damage_all()
+    self.full = true
+end
+
+function Frame:damage(region)
+    self.regions[region] = true
+end
+
+function Frame:damage_rows(first, last)
+    local rows = self.rows
+    for y = first, last or first do
+        rows[y] = true
+    end
+end
+
+function Frame:is_dirty()
+    return self.full or next(self.rows) ~= nil or next(self.regions) ~= nil
+end
+
+-- Draws now if the cap allows, otherwise makes sure a frame is pending
+function Frame:schedule()
+    if self.timer or not self:is_dirty() then return end
+    local now = catvim.loop.now()
+    local wait = self.last_frame and (self.last_frame + 1000 / self.fps - now) or 0
+    if wait <= 0 then
+        self:present(now)
+    else
+        self.timer = catvim.loop.timer(math.ceil(wait), function()
+            self.timer = nil
+            self:present(catvim.loop.now())
+        end)
+    end
+end
+
+function Frame:present(now)
+    local damage = { full = self.full, rows = self.rows, regions = self.regions }
+    self:reset()
+    self.last_frame = now
+    self.draw(damage)
+end
+
+return Frame
@@ -0,0 +1,82 @@
+-- catVIM Profiler overlay (:profile)
+--
+-- Shows the core's frame timings (catvim.profile.stats) in the top right
+-- corner: p50/p99/max per phase over the last frames, bytes written per
+-- frame and the Lua heap. Refreshed twice a second while it is open.
+local colors = require("ui.colors")
+
+local M = {}
+M.__index = M
+
+local REFRESH_MS = 500
+local WINDOW = 120  -- Frames summarized (about two seconds at the cap)
+local WIDTH = 38
+
+function M:new()
+    local self = setmetatable({}, M)
+    self.visible = false
+    self.version = 0  -- Bumped whenever the overlay changes
+    self.lines = {}
+    self.rect = nil
+    self.timer = nil
+    return self
+end
+
+function M:toggle()
+    if self.visible then
+        self:hide()
+    else
+        self:show()
+    end
+end
+
+function M:show()
+    self.visible = true
+    self:refresh()
+    self.timer = catvim.loop.timer(REFRESH_MS, function() self:refresh() end, REFRESH_MS)
+end
+
+function M:hide()
+    self.visible = false
+    if self.timer then
+        catvim.loop.cancel(self.timer)
+        self.timer = nil
+    end
+    self.version = self.version + 1
+end
+
+local function row(name, p, fmt)
+    return string.format(" %-7s " .. fmt .. " " .. fmt .. " " .. fmt, name, p.p50, p.p99, p.max)
+end
+
+function M:refresh()
+    local s = catvim.profile.stats(WINDOW)
+    local fps = s.seconds > 0 and (s.frames - 1) / s.seconds or 0
+    local lines = {
+        string.format(" profile: %d frames, %.0f fps", s.frames, fps),
+        string.format(" %-7s %8s %8s %8s", "ms", "p50", "p99", "max"),
+    }
+    for _, p in ipairs(s.phases) do
+        lines[#lines + 1] = row(p.name, p, "%8.3f")
+    end
+    lines[#lines + 1] = row("busy", s.busy, "%8.3f")
+    lines[#lines + 1] = row("bytes", s.bytes, "%8d")
+    lines[#lines + 1] = string.format(" lua heap %d KB, %d GC cycles", s.lua_kb, s.gc_cycles)
+    self.lines = lines
+    self.version = self.version + 1
+end
+
+function M:render(state)
+    if not self.visible then return end
+    local x = math.max(1, state.width - WIDTH + 1)
+    local h = math.min(#self.lines, state.height - 2)
+    self.rect = { x = x, y = 1, w = WIDTH, h = h }
+    for i = 1, h do
+        local text = self.lines[i]
+        text = text .. string.rep(" ", WIDTH - #text)
+        local style = i == 1 and colors.ids.popup_selected or colors.ids.popup
+        catvim.render.string(x, i, text:sub(1, WIDTH), style)
+    end
+end
+
+return M
@@ -17,27 +17,29 @@ function StatusLine:new(opts)
     self.col = 1
     self.total_lines = 1
     self.filetype = "text"
+    self.indexing = false  -- Percent of a large file indexed while it is
     self.message = nil
     self.message_type = "info"
-    self.message_time = 0
+    self.message_timer = nil
+    self.dirty = true
     
     -- Create toolbar buttons
     self.btn_save = Button:new({
         text = " Save ",
-        style = colors.styles.button,
+        style = colors.ids.button,
         on_click = function() if self.on_save then self.on_save() end end
     })
     
     self.btn_open = Button:new({
         text = " Open ",
-        style = colors.styles.button,
+        style = colors.ids.button,
         on_click = function() if self.on_open then self.on_open() end end
     })
     
     self.btn_quit = Button:new({
         text = " Quit ",
-        style = { fg = colors.colors.red, bg = colors.colors.btn_normal },
-        style_hover = { fg = colors.colors.red, bg = colors.colors.btn_hover, bold = true },
+        style = catvim.render.style{ fg = colors.colors.red, bg = colors.colors.btn_normal },
+        style_hover = catvim.render.style{ fg = colors.colors.red, bg = colors.colors.btn_hover, bold = true },
         on_click = function() if self.on_quit then self.on_quit() end end
     })
     
@@ -55,39 +57,44 @@ function StatusLine:set_pos(y, width)
     self.btn_save:set_pos(width - 21, btn_y)
 end
 
+local fields = { "mode", "filename", "modified", "line", "col", "total_lines", "filetype", "indexing" }
+local defaults = {
+    mode = "normal", filename = "[No Name]", modified = false,
+    line = 1, col = 1, total_lines = 1, filetype = "text", indexing = false
+}
+
+-- Returns true if anything shown changed since the last render
 function StatusLine:update(state)
-    self.mode = state.mode or "normal"
-    self.filename = state.filename or "[No Name]"
-    self.modified = state.modified or false
-    self.line = state.line or 1
-    self.col = state.col or 1
-    self.total_lines = state.total_lines or 1
-    self.filetype = state.filetype or "text"
+    local changed = self.dirty
+    for _, field in ipairs(fields) do
+        local value = state[field] or defaults[field]
+        if self[field] ~= value then
+            self[field] = value
+            changed = true
+        end
+    end
+    self.dirty = false
+    return changed
 end
 
 function StatusLine:show_message(msg, msg_type)
     self.message = msg
     self.message_type = msg_type or "info"
-    self.message_time = os.time()
+    self.dirty = true
+    
+    -- Messages expire after 3 seconds
+    if self.message_timer then catvim.loop.cancel(self.message_timer) end
+    self.message_timer = catvim.loop.timer(3000, function()
+        self.message_timer = nil
+        self.message = nil
+        self.dirty = true
+    end)
 end
 
 function StatusLine:render()
-    -- Check if message should expire (3 seconds)
-    if self.message and os.time() - self.message_time > 3 then
-        self.message = nil
-    end
-    
     -- Mode indicator
     local mode_text = " " .. self.mode:upper():sub(1, 1) .. " "
-    local mode_colors = {
-        normal = { fg = colors.colors.bg, bg = colors.colors.blue },
-        insert = { fg = colors.colors.bg, bg = colors.colors.green },
-        visual = { fg = colors.colors.bg, bg = colors.colors.purple },
-        command = { fg = colors.colors.bg, bg = colors.colors.orange },
-    }
-    local mode_style = mode_colors[self.mode] or mode_colors.normal
-    mode_style.bold = true
-    
+    local mode_style = colors.ids["mode_" .. self.mode] or colors.ids.mode_normal
     catvim.render.string(1, self.y, mode_text, mode_style)
     
     -- Filename + modified indicator
@@ -97,38 +104,35 @@ function StatusLine:render()
     end
     name_part = name_part .. " "
     
-    local name_style = colors.styles.statusline
-    if self.modified then
-        name_style = { fg = colors.colors.yellow, bg = colors.colors.bg_dark }
-    end
-    catvim.render.string(#mode_text + 1, self.y, name_part, name_style)
+    local name_style = self.modified and colors.ids.statusline_modified or colors.ids.statusline
+    local name_w = catvim.render.string(#mode_text + 1, self.y, name_part, name_style)
     
-    -- Message or spacer
-    local left_len = #mode_text + #name_part
+    -- Message or spacer (render.string returns columns, which differ
+    -- from bytes once the name or message is not ASCII)
+    local left_len = #mode_text + name_w
     
     if self.message then
-        local msg_style = colors.styles[self.message_type] or colors.styles.statusline
-        msg_style.bg = colors.colors.bg_dark
+        local msg_style = colors.ids["message_" .. self.message_type] or colors.ids.statusline
         local space = self.width - left_len - 20
         local msg = self.message:sub(1, space)
-        catvim.render.string(left_len + 1, self.y, " " .. msg, msg_style)
-        left_len = left_len + #msg + 1
+        left_len = left_len + catvim.render.string(left_len + 1, self.y, " " .. msg, msg_style)
     end
     
     -- Fill middle
     local right_part = self.filetype .. " | " .. self.line .. ":" .. self.col .. "/" .. self.total_lines .. " "
+    if self.indexing then
+        -- Line numbers past the indexed part are provisional until it's done
+        right_part = "indexing " .. self.indexing .. "% | " .. right_part
+    end
     local fill_len = self.width - left_len - #right_part
     if fill_len > 0 then
-        catvim.render.string(left_len + 1, self.y, string.rep(" ", fill_len), colors.styles.statusline)
+        catvim.render.string(left_len + 1, self.y, string.rep(" ", fill_len), colors.ids.statusline)
     end
     
     -- Right side info
-    catvim.render.string(self.width - #right_part + 1, self.y, right_part, colors.styles.statusline)
+    catvim.render.string(self.width - #right_part + 1, self.y, right_part, colors.ids.statusline)
     
-    -- Render buttons (they're on line above)
-    self.btn_save:render()
-    self.btn_open:render()
-    self.btn_quit:render()
+    -- Buttons live on the toolbar row above and are drawn with it
 end
 
 return StatusLine
@@ -0,0 +1,112 @@
+// catVIM regression tests (make test)
+//
+// Plain checks against the core classes, no framework: each test prints
+// what failed and main() returns non-zero if anything did.
+#include "undo_journal.hpp"
+#include "text_buffer.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+using namespace catvim;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                    \
+    do {                                                               \
+        if (!(cond)) {                                                 \
+            std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                \
+        }                                                              \
+    } while (0)
+
+// Trimming the group the save point was before must not let undoing
+// everything that is left pass for the saved text
+static void test_trim_past_save_point() {
+    UndoJournal journal;
+    journal.set_budget(1000);
+    std::string text(800, 'x');
+    journal.record_insert(0, text.data(), text.size());
+    journal.mark();
+    journal.record_insert(800, text.data(), text.size());
+    journal.mark();
+    CHECK(journal.undo_depth() == 1);
+
+    UndoGroup group;
+    while (journal.take_undo(group)) journal.push_undone(std::move(group));
+    CHECK(journal.is_modified());
+    while (journal.take_redo(group)) journal.push_redone(std::move(group));
+    CHECK(journal.is_modified());
+
+    journal.mark_saved();
+    CHECK(!journal.is_modified());
+}
+
+// A save point after the trimmed group is still reached by undoing
+static void test_trim_keeps_later_save_point() {
+    UndoJournal journal;
+    journal.set_budget(1000);
+    std::string text(800, 'x');
+    journal.record_insert(0, text.data(), text.size());
+    journal.mark_saved();
+    journal.record_insert(800, text.data(), text.size());
+    journal.mark();
+    CHECK(journal.is_modified());
+
+    UndoGroup group;
+    CHECK(journal.take_undo(group));
+    journal.push_undone(std::move(group));
+    CHECK(!journal.is_modified());
+}
+
+// An idle buffer is only unloaded when its text is the file's; edits
+// whose save point was trimmed away and then undone are not
+static void test_unload_after_trim() {
+    char path[] = "/tmp/catvim-test-XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0) return;
+    CHECK(write(fd, "hello", 5) == 5);
+    close(fd);
+
+    TextBuffer text;
+    std::string error;
+    CHECK(text.load(path, error));
+    text.journal().set_budget(1000);
+    std::string block(800, 'x');
+    text.insert(5, block.data(), block.size());
+    text.journal().mark();
+    text.insert(805, block.data(), block.size());
+    text.journal().mark();
+
+    size_t offset, first;
+    while (text.undo(offset, first)) {}
+    CHECK(text.length() == 805);
+    CHECK(text.journal().is_modified());
+    CHECK(!text.unload());
+    CHECK(text.length() == 805);
+
+    // Once saved it may go, and comes back from the file
+    CHECK(text.save(path, error));
+    text.journal().mark_saved();
+    CHECK(text.unload());
+    CHECK(text.length() == 0);
+    bool changed;
+    CHECK(text.reload(error, changed));
+    CHECK(!changed);
+    CHECK(text.length() == 805);
+    unlink(path);
+}
+
+int main() {
+    test_trim_past_save_point();
+    test_trim_keeps_later_save_point();
+    test_unload_after_trim();
+    if (failures) {
+        std::fprintf(stderr, "%d check%s failed\n", failures, failures == 1 ? "" : "s");
+        return 1;
+    }
+    std::printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,96 @@
+// Build tool: writes the table of embedded Lua modules (see
+// src/core/embedded_lua.hpp) as a C++ source file.
+//
+//   embed_lua <out.cpp> <root> <file>...
+//
+// Each file lies under root and holds a compiled (or plain source) module;
+// its module name is its path below root without the extension, with "/"
+// turned into "." and a trailing ".init" dropped, as require() would find it.
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct Module {
+    std::string name;
+    std::string path;  // Relative to src/lua, for error messages
+    std::string data;
+};
+
+static bool read_file(const std::string& path, std::string& out) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <out.cpp> <root> <file>...\n", argv[0]);
+        return 2;
+    }
+    std::string root = argv[2];
+    if (!root.empty() && root.back() != '/') root += '/';
+
+    std::vector<Module> modules;
+    for (int i = 3; i < argc; i++) {
+        std::string file = argv[i];
+        if (file.compare(0, root.size(), root) != 0) {
+            fprintf(stderr, "embed_lua: %s is not under %s\n", file.c_str(), root.c_str());
+            return 1;
+        }
+        Module m;
+        std::string rel = file.substr(root.size());
+        std::string stem = rel.substr(0, rel.rfind('.'));
+        m.path = stem + ".lua";
+        m.name = stem;
+        std::replace(m.name.begin(), m.name.end(), '/', '.');
+        if (m.name.size() > 5 && m.name.compare(m.name.size() - 5, 5, ".init") == 0) {
+            m.name.resize(m.name.size() - 5);
+        }
+        if (!read_file(file, m.data)) {
+            perror(file.c_str());
+            return 1;
+        }
+        modules.push_back(std::move(m));
+    }
+    // find_embedded_lua() searches by name
+    std::sort(modules.begin(), modules.end(), [](const Module& a, const Module& b) { return a.name < b.name; });
+
+    FILE* out = fopen(argv[1], "w");
+    if (!out) {
+        perror(argv[1]);
+        return 1;
+    }
+    fprintf(out, "// Generated by tools/embed_lua.cpp; do not edit\n");
+    fprintf(out, "#include \"embedded_lua.hpp\"\n\nnamespace catvim {\n\n");
+    for (size_t i = 0; i < modules.size(); i++) {
+        const std::string& data = modules[i].data;
+        fprintf(out, "static const unsigned char module_%zu[] = {", i);
+        for (size_t j = 0; j < data.size(); j++) {
+            if (j % 16 == 0) fprintf(out, "\n   ");
+            fprintf(out, " 0x%02x,", static_cast<unsigned char>(data[j]));
+        }
+        fprintf(out, "\n};\n\n");
+    }
+    fprintf(out, "const EmbeddedLua EMBEDDED_LUA[] = {\n");
+    for (size_t i = 0; i < modules.size(); i++) {
+        fprintf(out, "    {\"%s\", \"%s\", module_%zu, sizeof(module_%zu)},\n", modules[i].name.c_str(),
+                modules[i].path.c_str(), i, i);
+    }
+    // Keeps the array non-empty; not counted
+    fprintf(out, "    {nullptr, nullptr, nullptr, 0},\n};\n\n");
+    fprintf(out, "const size_t EMBEDDED_LUA_COUNT = %zu;\n\n}  // namespace catvim\n", modules.size());
+
+    bool ok = !ferror(out);
+    if (fclose(out) != 0) ok = false;
+    if (!ok) {
+        fprintf(stderr, "embed_lua: failed to write %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
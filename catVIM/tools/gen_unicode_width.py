@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+# Build tool: writes the display width tables used by src/core/unicode.cpp
+# from the Unicode database bundled with Python.
+#
+#   tools/gen_unicode_width.py > src/core/unicode_tables.hpp
+#
+# Code points below U+0300 are all one column and never looked up, so the
+# tables start there. Unassigned code points may join two neighbouring
+# ranges; that keeps the tables small and costs nothing for real text.
+import sys
+import unicodedata
+
+FIRST = 0x300
+
+# Blocks reserved for CJK ideographs are wide even where still unassigned
+# (EastAsianWidth.txt lists them as W; unicodedata reports them as N)
+RESERVED_WIDE = [(0x3400, 0x4DBF), (0x4E00, 0x9FFF), (0xF900, 0xFAFF),
+                 (0x20000, 0x2FFFD), (0x30000, 0x3FFFD)]
+
+
+def unassigned(cp):
+    return unicodedata.category(chr(cp)) == "Cn"
+
+
+def zero_width(cp):
+    # Combining marks, format characters (except the soft hyphen, which
+    # terminals draw) and the Hangul medial and final jamo
+    cat = unicodedata.category(chr(cp))
+    return cat in ("Mn", "Me") or (cat == "Cf" and cp != 0xAD) or 0x1160 <= cp <= 0x11FF
+
+
+def wide(cp):
+    if zero_width(cp):
+        return False
+    if any(a <= cp <= b for a, b in RESERVED_WIDE):
+        return True
+    return not unassigned(cp) and unicodedata.east_asian_width(chr(cp)) in ("W", "F")
+
+
+def ranges(pred):
+    out = []
+    start = last = None
+    for cp in range(FIRST, 0x110000):
+        if not pred(cp):
+            continue
+        if start is not None and all(unassigned(c) for c in range(last + 1, cp)):
+            last = cp
+            continue
+        if start is not None:
+            out.append((start, last))
+        start = last = cp
+    if start is not None:
+        out.append((start, last))
+    return out
+
+
+def emit(name, table):
+    print("static const CodeRange %s[] = {" % name)
+    for i in range(0, len(table), 4):
+        row = ", ".join("{0x%05X, 0x%05X}" % r for r in table[i:i + 4])
+        print("    %s," % row)
+    print("};")
+
+
+def main():
+    print("// Generated by tools/gen_unicode_width.py from Unicode %s; do not edit"
+          % unicodedata.unidata_version)
+    print("#pragma once")
+    print()
+    print("namespace catvim {")
+    print()
+    print("struct CodeRange {")
+    print("    char32_t first, last;")
+    print("};")
+    print()
+    emit("ZERO_WIDTH", ranges(zero_width))
+    print()
+    emit("DOUBLE_WIDTH", ranges(wide))
+    print()
+    print("}  // namespace catvim")
+
+
+if __name__ == "__main__":
+    sys.exit(main())